@@ -0,0 +1,61 @@
+#ifndef ACTIVATION_MEMORY_H
+#define ACTIVATION_MEMORY_H
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <mutex>
+
+/**
+ * @description: process wide activation scratch shared by engines that never run concurrently. Contexts are
+ *               created without device memory and reserve a slot, the slot is allocated for the largest
+ *               reservation on first use. Slot k is shared by context k of every engine, so the contexts of
+ *               one pool still have their own scratch and can overlap. Slots are per device, engines on other
+ *               gpus never see each other's memory.
+ */
+class SharedActivationMemory {
+public:
+    static SharedActivationMemory& Instance();
+
+    ~SharedActivationMemory();
+
+    /**
+     * @description: grow slot of device to at least size byte, call when a context is created.
+     */
+    void Reserve(int device, int slot, size_t size);
+
+    /**
+     * @description: memory of slot on device, reallocated on that device if a larger reservation was made
+     *               since the last call.
+     */
+    void* Get(int device, int slot);
+
+    /**
+     * @description: total device memory held by all slots in byte.
+     */
+    size_t AllocatedSize() const;
+
+protected:
+    SharedActivationMemory() {}
+
+    SharedActivationMemory(const SharedActivationMemory&) = delete;
+
+    SharedActivationMemory& operator=(const SharedActivationMemory&) = delete;
+
+protected:
+    struct Slot {
+        // allocated on the device of its key, freed with that device current
+        void* data = nullptr;
+
+        size_t allocated = 0;
+
+        size_t reserved = 0;
+    };
+
+    // keyed by device and slot
+    std::map<std::pair<int, int>, Slot> mSlots;
+
+    mutable std::mutex mMutex;
+};
+
+#endif
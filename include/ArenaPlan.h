@@ -0,0 +1,45 @@
+#ifndef ARENA_PLAN_H
+#define ARENA_PLAN_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @description: cudaMalloc returns 256 byte aligned memory, keep every binding of an arena on the same boundary.
+ */
+static constexpr size_t kDeviceArenaAlignment = 256;
+
+/**
+ * @description: layout of all bindings of an engine inside one contiguous allocation. Inputs come first, then
+ *               outputs back to back, so [outputBegin, outputEnd) holds every output and one copy fetch them all.
+ *               Host staging buffers use the same layout so the range can be copied as is.
+ */
+struct ArenaPlan {
+    // byte offset of every binding, indexed by binding index
+    std::vector<size_t> offset;
+
+    // byte size of every binding
+    std::vector<size_t> size;
+
+    // total size in byte of the arena
+    size_t arenaSize = 0;
+
+    size_t outputBegin = 0;
+
+    size_t outputEnd = 0;
+};
+
+inline size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @description: plan an arena for bindings, only touch host memory so it can be checked without a gpu.
+ * @sizes: byte size of every binding.
+ * @isInput: true if binding is an input.
+ * @alignment: alignment of every binding offset, power of two.
+ */
+ArenaPlan PlanArena(const std::vector<size_t>& sizes, const std::vector<bool>& isInput,
+                    size_t alignment = kDeviceArenaAlignment);
+
+#endif
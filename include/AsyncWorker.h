@@ -0,0 +1,92 @@
+#ifndef ASYNC_WORKER_H
+#define ASYNC_WORKER_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include <condition_variable>
+#include "ContextPool.h"
+
+/**
+ * @description: cpu worker threads finishing asynchronous detect calls. The submitting thread enqueue the
+ *               inference on a leased context and move on, a worker waits for the context stream, decodes the
+ *               outputs and hands the result out through a future and an optional callback.
+ */
+class AsyncWorker {
+public:
+    explicit AsyncWorker(int nbThreads = 1);
+
+    /**
+     * @description: finish all queued tasks, then join the threads.
+     */
+    ~AsyncWorker();
+
+    AsyncWorker(const AsyncWorker&) = delete;
+
+    AsyncWorker& operator=(const AsyncWorker&) = delete;
+
+    void Post(std::function<void()> task);
+
+    /**
+     * @description: synchronize context on a worker thread and run decode on it, the context stays checked out
+     *               until decode returns.
+     * @callback: called on the worker thread with the result before the future is ready, may be empty.
+     */
+    template <typename Result>
+    std::future<Result> Decode(ContextPool::Lease context,
+                               std::function<Result(InferContext&)> decode,
+                               std::function<void(const Result&)> callback = nullptr) {
+        // std::function need copyable state, share the move only lease and promise
+        auto lease = std::make_shared<ContextPool::Lease>(std::move(context));
+        auto promise = std::make_shared<std::promise<Result>>();
+        std::future<Result> future = promise->get_future();
+        Post([lease, promise, decode, callback]() {
+            try {
+                (*lease)->Synchronize();
+                Result result = decode(**lease);
+                lease->Release();
+                if(callback) {
+                    callback(result);
+                }
+                promise->set_value(std::move(result));
+            } catch(...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+        return future;
+    }
+
+    /**
+     * @description: future of a detect whose inference could not be enqueued, context is given back right away
+     *               and the future throws std::runtime_error(what) instead of decoding stale outputs.
+     */
+    template <typename Result>
+    static std::future<Result> Failed(ContextPool::Lease context, const std::string& what) {
+        context.Release();
+        std::promise<Result> promise;
+        promise.set_exception(std::make_exception_ptr(std::runtime_error(what)));
+        return promise.get_future();
+    }
+
+protected:
+    void Run();
+
+protected:
+    std::vector<std::thread> mThreads;
+
+    std::deque<std::function<void()>> mTasks;
+
+    bool mStop = false;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCondition;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef CONTEXT_POOL_H
+#define CONTEXT_POOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "InferBackend.h"
+
+/**
+ * @description: pool of execution contexts created from one backend. Engine weights are loaded once by the
+ *               backend, every context owns its stream, bindings and host buffers, so concurrent detect()
+ *               calls each check out a context and overlap on the gpu.
+ */
+class ContextPool {
+public:
+    /**
+     * @description: checked out context, returned to the pool when destroyed.
+     */
+    class Lease {
+    public:
+        Lease() {}
+
+        Lease(ContextPool* pool, int index);
+
+        Lease(Lease&& other);
+
+        Lease& operator=(Lease&& other);
+
+        Lease(const Lease&) = delete;
+
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease();
+
+        InferContext* operator->() const;
+
+        InferContext& operator*() const;
+
+        int Index() const {
+            return mIndex;
+        }
+
+        /**
+         * @description: return the context to the pool before the lease is destroyed.
+         */
+        void Release();
+
+    private:
+        ContextPool* mPool = nullptr;
+
+        int mIndex = -1;
+    };
+
+    /**
+     * @description: create poolSize contexts from backend, backend must already CreateEngine.
+     */
+    ContextPool(const std::shared_ptr<InferBackend>& backend, int poolSize);
+
+    ~ContextPool();
+
+    /**
+     * @description: check out a free context, block until one is returned if all are in use.
+     */
+    Lease Acquire();
+
+    int Size() const;
+
+    /**
+     * @description: direct access to context of the pool, only for setup before serving requests.
+     */
+    InferContext* GetContext(int index) const;
+
+    /**
+     * @description: attach a LayerProfiler to every context, runs of context i become track i of the profile.
+     *               Contexts then run synchronously, see InferContext::SetProfiler. Call while no lease is out.
+     * @maxTraceRuns: runs per context kept for the chrome trace.
+     */
+    void EnableLayerProfiling(int maxTraceRuns = 100);
+
+    /**
+     * @description: detach and drop the profilers.
+     */
+    void DisableLayerProfiling();
+
+    /**
+     * @description: layer times of all contexts since enabled or the last reset, empty if profiling is off.
+     */
+    LayerProfile GetLayerProfile() const;
+
+    void ResetLayerProfiling();
+
+protected:
+    void Release(int index);
+
+protected:
+    // keep backend alive as long as its contexts
+    std::shared_ptr<InferBackend> mBackend;
+
+    // one per context while layer profiling is enabled, declared first so it outlives the contexts
+    std::vector<std::unique_ptr<LayerProfiler>> mProfilers;
+
+    std::vector<std::unique_ptr<InferContext>> mContexts;
+
+    std::vector<int> mFreeList;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCondition;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <opencv2/dnn/dnn.hpp>
+#include "InferBackend.h"
+
+class CpuBackend;
+
+/**
+ * @description: execution context of CpuBackend, bindings are host memory so host buffers alias them.
+ */
+class CpuContext : public InferContext {
+public:
+    explicit CpuContext(CpuBackend& backend);
+
+    StreamHandle GetStream() const override;
+
+    void* GetBindingPtr(int bindIndex) const override;
+
+    bool SetBatchSize(int batchSize) override;
+
+    int GetBatchSize() const override;
+
+    Span<float> GetHostBuffer(int bindIndex) override;
+
+    void* GetHostBinding(int bindIndex) override;
+
+    void CopyFromHostToDevice(int bindIndex) override;
+
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) override;
+
+    void CopyFromDeviceToHost(int bindIndex) override;
+
+    void CopyOutputsFromDeviceToHost() override;
+
+    float* GetPreprocessorInput(size_t count) override;
+
+    bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims) override;
+
+    bool ForwardPreprocessor(const TensorDims& inputDims) override;
+
+    void ForwardAsync() override;
+
+    void InferAsync() override;
+
+    void Synchronize() override;
+
+    void SetProfiler(LayerProfiler* profiler) override;
+
+    const InferBackend& GetBackend() const override;
+
+protected:
+    CpuBackend& mBackend;
+
+    int mBatchSize = 0;
+
+    // aligned host memory, binding and staging buffer are the same
+    std::vector<HostBuffer> mBinding;
+
+    std::vector<float*> mBindingPtr;
+
+    // see GetPreprocessorInput
+    HostBuffer mPreprocessorInput;
+
+    LayerProfiler* mProfiler = nullptr;
+};
+
+/**
+ * @description: reference backend, run the onnx model on cpu through OpenCV DNN. Bindings live in host
+ *               memory, so "device" copies are plain memcpy and streams are null. Engine file, run mode
+ *               and int8 calibrator are ignored, inference is always fp32.
+ */
+class CpuBackend : public InferBackend {
+public:
+    CpuBackend();
+
+    ~CpuBackend();
+
+    bool CreateEngine(
+        const std::string& onnxModel,
+        const std::string& engineFile,
+        const std::vector<std::string>& customOutput,
+        int maxBatchSize,
+        int mode) override;
+
+    /**
+     * @description: no engine to build, ForwardPreprocessor resize with cv::resize.
+     */
+    bool buildPreprocessorEngine() override;
+
+    bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims, const StreamHandle& stream) override;
+
+    void Forward() override;
+
+    void ForwardAsync(const StreamHandle& stream) override;
+
+    void SetBindingDimensions(std::vector<int>& inputDims, int bindIndex) override;
+
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) override;
+
+    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex) override;
+
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex, const StreamHandle& stream) override;
+
+    void CopyFromHostToDevice(const float* input, int bindIndex, const StreamHandle& stream) override;
+
+    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex, const StreamHandle& stream) override;
+
+    StreamHandle CreateStream() override;
+
+    void DestroyStream(StreamHandle stream) override;
+
+    void SynchronizeStream(const StreamHandle& stream) override;
+
+    void SetDevice(int device) override;
+
+    int GetDevice() const override;
+
+    void SetInt8Calibrator(const std::string& calibratorType, int input_w,
+        int input_h,
+        const char* img_dir,
+        const char* calib_table_name) override;
+
+    void AddDynamicShapeProfile(int batchSize,
+        const std::string& inputName,
+        const std::vector<int>& minDimVec,
+        const std::vector<int>& optDimVec,
+        const std::vector<int>& maxDimVec) override;
+
+    void SetMaxBatchSize(int max_batch) override;
+
+    /**
+     * @description: contexts share mNet, nothing to prepare.
+     */
+    void SetMaxContexts(int maxContexts) override;
+
+    /**
+     * @description: opencv dnn manage its own activation memory, nothing to share.
+     */
+    void SetShareActivationMemory(bool share) override;
+
+    /**
+     * @description: no cuda graph on cpu, InferAsync just run the net.
+     */
+    void SetCudaGraph(bool enable) override;
+
+    void SetEngineCacheDir(const std::string& dir) override;
+
+    void SetBatchProfiles(const std::vector<int>& maxBatches) override;
+
+    /**
+     * @description: no-op, bindings are always fp32.
+     */
+    void SetHalfIO(bool enable) override;
+
+    /**
+     * @description: the int8 NHWC input is turned into the float NCHW blob by RunInputPrologue before each run,
+     *               the reference for the prologue tensorrt builds into the engine.
+     */
+    void SetInputPrologue(const InputPrologue& prologue) override;
+
+    /**
+     * @description: no-op, opencv dnn has no tactic workspace.
+     */
+    void SetMaxWorkspaceSize(size_t bytes) override;
+
+    /**
+     * @description: no-op, there is a single way to run the net on cpu. Sweeping it still exercises the sweep.
+     */
+    void SetEngineManifest(const std::string& manifest, const std::string& objective, double latencyBudgetMs) override;
+
+    std::string GetBuildTarget() const override;
+
+    int GetMaxBatchSize() const override;
+
+    std::vector<ShapeProfile> GetShapeProfiles() const override;
+
+    bool BindingIsOnDevice() const override;
+
+    void* GetBindingPtr(int bindIndex) const override;
+
+    size_t GetBindingSize(int bindIndex) const override;
+
+    TensorDims GetBindingDims(int bindIndex) const override;
+
+    TensorType GetBindingDataType(int bindIndex) const override;
+
+    std::string GetBindingName(int bindIndex) const override;
+
+    int GetBindingIndex(const std::string& name) const override;
+
+    bool BindingIsInput(int bindIndex) const override;
+
+    /**
+     * @description: every binding of an onnx model with a dynamic batch axis, the net runs the current batch.
+     */
+    bool BindingHasBatchAxis(int bindIndex) const override;
+
+    int GetNbBindings() const override;
+
+    int GetNbInputBindings() const override;
+
+    int GetNbOutputBindings() const override;
+
+    std::unique_ptr<InferContext> CreateContext() override;
+
+protected:
+    friend class CpuContext;
+
+    /**
+     * description: read binding name and shape from onnx graph and run one probe inference to get output shape
+     */
+    bool InitEngine(const std::string& onnxModel, const std::vector<std::string>& customOutput);
+
+    /**
+     * description: wrap host binding memory as NCHW blob with batchSize images
+     */
+    cv::Mat BindingToBlob(float* binding, int bindIndex, int batchSize);
+
+    /**
+     * description: run the net on host bindings, cv::dnn::Net is not thread-safe so contexts take turns
+     */
+    void Run(const std::vector<float*>& binding, int batchSize, LayerProfiler* profiler = nullptr);
+
+    /**
+     * description: bilinear resize of the NCHW input of inputDims to the input binding layout at output
+     */
+    bool Resize(const float* input, const TensorDims& inputDims, float* output);
+
+protected:
+    cv::dnn::Net mNet;
+
+    std::mutex mNetMutex;
+
+    int mBatchSize = 1;
+
+    // device of SetDevice, only recorded
+    int mDevice = -1;
+
+    // onnx input has a dynamic batch axis, otherwise the full batch is always run
+    bool mDynamicBatch = false;
+
+    int mNbInputBindings = 0;
+
+    int mNbOutputBindings = 0;
+
+    std::vector<size_t> mBindingSize;
+
+    std::vector<TensorDims> mBindingDims;
+
+    std::vector<std::string> mBindingName;
+
+    std::vector<bool> mBindingIsInput;
+
+    std::vector<std::vector<float>> mBinding;
+
+    std::vector<std::string> mOutputName;
+
+    // opt dimensions (without batch) of dynamic shape profile, used for symbolic input dimensions
+    std::vector<int> mOptDims;
+
+    InputPrologue mInputPrologue;
+
+    // binding index of the int8 NHWC input, -1 without prologue
+    int mPrologueInput = -1;
+
+    // NCHW dims of the onnx input fed by the prologue and the blob it is written to, guarded by mNetMutex
+    TensorDims mPrologueDims;
+
+    std::vector<float> mPrologueBlob;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DETECT_PIPELINE_H
+#define DETECT_PIPELINE_H
+
+#include <deque>
+#include <future>
+#include <functional>
+#include <opencv2/opencv.hpp>
+
+/**
+ * @description: keep up to depth detectAsync calls in flight and hand the results out in submission order.
+ *               While batch i runs on the gpu the caller preprocesses batch i+1 and a worker decodes batch
+ *               i-1. Every in-flight batch holds one context of the detector pool, so depth should not exceed
+ *               Config::contextPoolSize, a larger depth only blocks in detectAsync until a context returns.
+ */
+template <typename Result>
+class DetectPipeline {
+public:
+    using Submit = std::function<std::future<Result>(const std::vector<cv::Mat>&)>;
+
+    DetectPipeline(Submit submit, int depth) : mSubmit(std::move(submit)), mDepth(depth < 1 ? 1 : depth) {}
+
+    /**
+     * @description: pipeline over detector.detectAsync.
+     */
+    template <typename Detector>
+    DetectPipeline(Detector& detector, int depth)
+        : DetectPipeline([&detector](const std::vector<cv::Mat>& batch) { return detector.detectAsync(batch); }, depth) {}
+
+    /**
+     * @description: submit batch, when depth batches are already in flight wait for the oldest one first.
+     * @return: true if result is filled with the oldest batch.
+     */
+    bool Push(const std::vector<cv::Mat>& batch, Result& result) {
+        bool popped = false;
+        if(static_cast<int>(mInFlight.size()) >= mDepth) {
+            popped = Pop(result);
+        }
+        mInFlight.push_back(mSubmit(batch));
+        return popped;
+    }
+
+    /**
+     * @description: wait for the oldest batch in flight, call until it return false to drain the pipeline.
+     */
+    bool Pop(Result& result) {
+        if(mInFlight.empty()) {
+            return false;
+        }
+        std::future<Result> future = std::move(mInFlight.front());
+        mInFlight.pop_front();
+        result = future.get();
+        return true;
+    }
+
+    int InFlight() const {
+        return static_cast<int>(mInFlight.size());
+    }
+
+    int Depth() const {
+        return mDepth;
+    }
+
+protected:
+    Submit mSubmit;
+
+    int mDepth;
+
+    std::deque<std::future<Result>> mInFlight;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef DETECTOR_WARMUP_H
+#define DETECTOR_WARMUP_H
+
+#include <vector>
+#include <future>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+#include "spdlog/spdlog.h"
+#include "InferBackend.h"
+#include "common.h"
+
+/**
+ * @description: batch size and frame size of one warmup batch.
+ */
+struct WarmupShape {
+    int batchSize;
+
+    cv::Size imageSize;
+};
+
+/**
+ * @description: one shape per batch profile (the largest batch of every profile, plus batch 1) with frames of
+ *               imageSize. Engines with resolution buckets get the opt resolution of every bucket at batch 1
+ *               and at its max batch instead, so every profile the router can pick is run once.
+ */
+std::vector<WarmupShape> WarmupShapes(const InferBackend& backend, const Config& config, const cv::Size& imageSize);
+
+/**
+ * @description: run config.warmupIterations synthetic batches of every WarmupShapes through submit, the
+ *               detectAsync of a detector, so pre- and postprocessing are warmed with the engine. Each round
+ *               keeps config.contextPoolSize batches in flight, every context of the pool initializes its cuda
+ *               state, profiles and graphs before the first real request. Frames are noise, decoders see
+ *               candidates and nms runs.
+ * @return: milliseconds spent, 0 if warmup is disabled.
+ */
+template <typename Submit>
+double WarmupDetector(Submit submit, const InferBackend& backend, const Config& config, const cv::Size& imageSize) {
+    if(config.warmupIterations <= 0) {
+        return 0;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int depth = std::max(config.contextPoolSize, 1);
+    for(const WarmupShape& shape : WarmupShapes(backend, config, imageSize)) {
+        cv::Mat frame(shape.imageSize, CV_8UC3);
+        cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+        std::vector<cv::Mat> batch(shape.batchSize, frame);
+        for(int i = 0; i < config.warmupIterations; i++) {
+            std::vector<decltype(submit(batch))> inFlight;
+            for(int k = 0; k < depth; k++) {
+                inFlight.push_back(submit(batch));
+            }
+            for(auto& result : inFlight) {
+                result.wait();
+            }
+        }
+        spdlog::info("warmup batch {} at {}x{} done", shape.batchSize, shape.imageSize.width, shape.imageSize.height);
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    spdlog::info("warmup took {} ms", elapsed);
+    return elapsed;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef ENGINE_CACHE_H
+#define ENGINE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <iosfwd>
+
+/**
+ * @description: identity of a serialized engine. hash covers the onnx bytes, build options and environment,
+ *               envHash only the environment: tensorrt version, gpu compute capability and registered plugins.
+ *               hash is 0 if the onnx model could not be read, the engine is then checked against envHash only
+ *               and CreateEngine loads config.engineFile instead of a cache path.
+ */
+struct EngineCacheKey {
+    uint64_t hash = 0;
+
+    uint64_t envHash = 0;
+};
+
+/**
+ * @description: 64 bit FNV-1a, chain calls by passing the previous result as seed.
+ */
+static constexpr uint64_t kHashSeed = 14695981039346656037ULL;
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = kHashSeed);
+
+uint64_t HashString(const std::string& value, uint64_t seed = kHashSeed);
+
+/**
+ * @description: <dir>/<hash>.engine, dir is created if it does not exist.
+ */
+std::string EngineCachePath(const std::string& dir, const EngineCacheKey& key);
+
+/**
+ * @description: write fileName through a temporary file next to it that is renamed over fileName, readers
+ *               see the old or the new content but never a partial file.
+ * @write: fill the temporary file, return false to abort.
+ */
+bool WriteFileAtomic(const std::string& fileName, const std::function<bool(std::ostream& file)>& write);
+
+/**
+ * @description: write header and engine to a temporary file next to fileName and rename it over fileName,
+ *               a crash while writing never leaves a truncated engine behind.
+ */
+bool WriteEngineFile(const std::string& fileName, const EngineCacheKey& key, const void* data, size_t size);
+
+/**
+ * @description: map an engine written by WriteEngineFile and pass it to deserialize, fail if the header does
+ *               not match key or the engine checksum is wrong. Files without header are rejected too. Only
+ *               touch host memory, deserialize can be a stub to check the file layer without a gpu.
+ * @deserialize: called with the engine bytes, the mapping is released when it returns.
+ */
+bool ReadEngineFile(const std::string& fileName, const EngineCacheKey& key,
+                    const std::function<bool(const void* engine, size_t size)>& deserialize);
+
+#endif
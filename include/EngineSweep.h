@@ -0,0 +1,200 @@
+#ifndef ENGINE_SWEEP_H
+#define ENGINE_SWEEP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <iosfwd>
+#include "InputPrologue.h"
+
+/**
+ * @description: build options of one engine of a sweep.
+ */
+struct BuildVariant {
+    // run mode 0:fp32 1:fp16 2:int8
+    int mode = 0;
+
+    int maxBatchSize = 1;
+
+    size_t workspaceSize = 10 << 20;
+
+    // see InferBackend::SetBatchProfiles, empty for one profile
+    std::vector<int> batchProfiles;
+
+    /**
+     * @description: short unique name like "fp16_b8_ws256m_p1-4-8", used for engine file names.
+     */
+    std::string Name() const;
+};
+
+/**
+ * @description: values of every build option, the sweep builds their cartesian product.
+ */
+struct SweepGrid {
+    std::vector<int> modes = { 0, 1 };
+
+    std::vector<int> maxBatchSizes = { 1 };
+
+    std::vector<size_t> workspaceSizes = { 10 << 20 };
+
+    std::vector<std::vector<int>> batchProfiles = { {} };
+};
+
+std::vector<BuildVariant> ExpandSweepGrid(const SweepGrid& grid);
+
+/**
+ * @description: measured engine of one variant, ok is false if it could not be built or run.
+ */
+struct SweepResult {
+    BuildVariant variant;
+
+    std::string engineFile;
+
+    bool ok = false;
+
+    // median ms of a batch of 1
+    double latencyMs = 0;
+
+    // images per second at maxBatchSize
+    double throughput = 0;
+};
+
+/**
+ * @description: build and measure one variant, fill result and return false on failure.
+ */
+using SweepMeasure = std::function<bool(const BuildVariant& variant, SweepResult& result)>;
+
+/**
+ * @description: measure every variant in order. Knows nothing about engines, measure does the work, so the
+ *               orchestration runs with any backend or with a stub.
+ */
+std::vector<SweepResult> RunSweep(const std::vector<BuildVariant>& variants, const SweepMeasure& measure);
+
+/**
+ * @description: ok results no other ok result beats on both latency and throughput, by ascending latency.
+ */
+std::vector<SweepResult> ParetoFront(const std::vector<SweepResult>& results);
+
+/**
+ * @description: options outside the sweep grid that are part of an engine as well. A manifest engine only
+ *               stands in for a build with the same ones.
+ */
+struct EngineBuildOptions {
+    int maxContexts = 1;
+
+    bool halfIO = false;
+
+    // hash of the InputPrologue parameters, 0 without prologue
+    uint64_t inputPrologue = 0;
+
+    std::vector<std::string> customOutput;
+
+    bool operator==(const EngineBuildOptions& other) const;
+};
+
+EngineBuildOptions MakeEngineBuildOptions(int maxContexts, bool halfIO, const InputPrologue& prologue,
+                                          const std::vector<std::string>& customOutput);
+
+/**
+ * @description: one line of a sweep manifest, a pareto optimal engine of a target. The target identifies the
+ *               build environment, see InferBackend::GetBuildTarget, an engine is only valid there.
+ */
+struct SweepManifestEntry {
+    std::string target;
+
+    EngineBuildOptions options;
+
+    SweepResult result;
+};
+
+/**
+ * @description: what CreateEngine optimizes when it picks an engine of the manifest. kThroughput picks the
+ *               fastest images per second whose latency fits the budget, if any.
+ */
+enum class SweepObjective {
+    kLatency,
+    kThroughput
+};
+
+/**
+ * @description: "latency" or "throughput", kLatency for anything else.
+ */
+SweepObjective ParseSweepObjective(const std::string& objective);
+
+/**
+ * @description: read the tab separated manifest written by WriteSweepManifest, false if it could not be read.
+ *               Lines without build options, written before they were recorded, are skipped.
+ */
+bool ReadSweepManifest(const std::string& fileName, std::vector<SweepManifestEntry>& entries);
+
+/**
+ * @description: replace the entries of target and options in the manifest by the pareto front of results of
+ *               every max batch size, other entries are kept. Written atomically, see WriteFileAtomic.
+ */
+bool WriteSweepManifest(const std::string& fileName, const std::string& target, const EngineBuildOptions& options,
+                        const std::vector<SweepResult>& results);
+
+/**
+ * @description: entry of target, options and maxBatchSize best for objective, -1 if there is none. Int8 entries
+ *               are only candidates with allowInt8, their engine may need a calibrator to be built again.
+ * @latencyBudgetMs: upper bound of latency for kThroughput, <= 0 for none.
+ */
+int SelectSweepEntry(const std::vector<SweepManifestEntry>& entries, const std::string& target,
+                     const EngineBuildOptions& options, int maxBatchSize, SweepObjective objective,
+                     double latencyBudgetMs, bool allowInt8);
+
+/**
+ * @description: what the sweep tool builds and where it puts the results.
+ */
+struct SweepOptions {
+    std::string backend = "tensorrt";
+
+    std::string onnxModel;
+
+    // engines are written to <engineDir>/<onnx name>_<variant name>.engine, the manifest points to them
+    std::string engineDir;
+
+    std::string manifestFile;
+
+    // contexts the detectors will create, part of the engine
+    int maxContexts = 1;
+
+    // the detector options that change the engine, see EngineBuildOptions. Set them like the detector config
+    // or CreateEngine does not pick the engines of the manifest
+    bool halfIO = false;
+
+    InputPrologue inputPrologue;
+
+    std::vector<std::string> customOutput;
+
+    int iterations = 50;
+
+    // int8 variants are skipped without calibration images
+    std::string calibrationImageDir;
+
+    int calibrationWidth = 640;
+
+    int calibrationHeight = 640;
+};
+
+/**
+ * @description: build variant through an InferBackend of options.backend and time InferAsync at batch 1 and at
+ *               the max batch size.
+ */
+bool MeasureEngine(const SweepOptions& options, const BuildVariant& variant, SweepResult& result);
+
+/**
+ * @description: measure every variant of grid with MeasureEngine, print the results and write the pareto front
+ *               of the current target to options.manifestFile.
+ * @return: all results, the ones that failed included.
+ */
+std::vector<SweepResult> SweepEngines(const SweepOptions& options, const SweepGrid& grid);
+
+/**
+ * @description: results as a text table, the ones written to the manifest marked with *.
+ */
+void PrintSweepResults(std::ostream& out, const std::vector<SweepResult>& results);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef HALF_CONVERT_H
+#define HALF_CONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+#include "TensorView.h"
+
+/**
+ * @description: ieee 754 binary16 as stored in a kHALF binding. Only a bit pattern on the host, convert with
+ *               HalfToFloat before doing math on it.
+ */
+struct Half {
+    uint16_t bits;
+};
+
+template <>
+struct TensorDataType<Half> {
+    static constexpr TensorType value = TensorType::kHALF;
+};
+
+/**
+ * @description: round to nearest even, overflow to inf, nan stays nan.
+ */
+Half FloatToHalf(float value);
+
+float HalfToFloat(Half value);
+
+/**
+ * @description: convert count values, 8 at a time with F16C when the cpu has it, checked once at run time on
+ *               x64 whatever the build targets, scalar otherwise. Both paths give bit exact results.
+ */
+void FloatToHalf(const float* src, Half* dst, size_t count);
+
+void HalfToFloat(const Half* src, float* dst, size_t count);
+
+/**
+ * @description: true if the F16C path is compiled in and the cpu runs it.
+ */
+bool HalfConvertIsVectorized();
+
+#endif
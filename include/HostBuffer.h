@@ -0,0 +1,117 @@
+#ifndef HOST_BUFFER_H
+#define HOST_BUFFER_H
+
+#include <cstddef>
+#include <cassert>
+
+/**
+ * @description: non-owning view of contiguous memory, like std::span.
+ */
+template <typename T>
+class Span {
+public:
+    Span() {}
+
+    Span(T* data, size_t size) : mData(data), mSize(size) {}
+
+    T* data() const {
+        return mData;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+
+    bool empty() const {
+        return mSize == 0;
+    }
+
+    T* begin() const {
+        return mData;
+    }
+
+    T* end() const {
+        return mData + mSize;
+    }
+
+    T& operator[](size_t i) const {
+        assert(i < mSize);
+        return mData[i];
+    }
+
+    Span<T> subspan(size_t offset, size_t count) const {
+        assert(offset + count <= mSize);
+        return Span<T>(mData + offset, count);
+    }
+
+private:
+    T* mData = nullptr;
+
+    size_t mSize = 0;
+};
+
+/**
+ * @description: kPinned is page-locked memory from cudaHostAlloc so cudaMemcpyAsync is truly async and run
+ *               at full PCIe bandwidth, kAligned is ordinary memory aligned to kHostBufferAlignment for
+ *               backends without a device. INFER_CPU_ONLY builds allocate kAligned for both.
+ */
+enum class HostMemoryType {
+    kPinned,
+    kAligned
+};
+
+static constexpr size_t kHostBufferAlignment = 64;
+
+/**
+ * @description: owning host staging buffer, move only.
+ */
+class HostBuffer {
+public:
+    HostBuffer() {}
+
+    HostBuffer(size_t size, HostMemoryType type);
+
+    HostBuffer(HostBuffer&& other);
+
+    HostBuffer& operator=(HostBuffer&& other);
+
+    HostBuffer(const HostBuffer&) = delete;
+
+    HostBuffer& operator=(const HostBuffer&) = delete;
+
+    ~HostBuffer();
+
+    /**
+     * @description: free current memory and allocate size bytes, fall back to aligned memory if pinned
+     *               memory is exhausted.
+     */
+    void Allocate(size_t size, HostMemoryType type);
+
+    void* Data() const {
+        return mData;
+    }
+
+    size_t Size() const {
+        return mSize;
+    }
+
+    HostMemoryType Type() const {
+        return mType;
+    }
+
+    template <typename T>
+    Span<T> AsSpan() const {
+        return Span<T>(static_cast<T*>(mData), mSize / sizeof(T));
+    }
+
+private:
+    void Free();
+
+    void* mData = nullptr;
+
+    size_t mSize = 0;
+
+    HostMemoryType mType = HostMemoryType::kAligned;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef IMAGE_PREPROCESS_H
+#define IMAGE_PREPROCESS_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "PreprocessPool.h"
+
+/**
+ * @description: how the image is resampled to the input size. kArea averages the source pixels every output
+ *               pixel covers, like cv::INTER_AREA, and falls back to kBilinear on an axis that is upscaled.
+ */
+enum class ResizeMode {
+    kBilinear,
+    kArea
+};
+
+/**
+ * @description: what PreprocessImage writes. Every output value is (pixel - mean[c]) * scale[c] of plane c.
+ */
+struct PreprocessParams {
+    // width and height of the planes written
+    cv::Size size;
+
+    // part of the planes the image is resized into, the rest gets padValue. Empty for all of them
+    cv::Rect roi;
+
+    ResizeMode resize = ResizeMode::kBilinear;
+
+    // BGR image, planes in RGB order
+    bool swapRB = false;
+
+    // per plane, after the swap
+    float mean[3] = { 0, 0, 0 };
+
+    float scale[3] = { 1, 1, 1 };
+
+    // pixel value outside roi, before mean and scale
+    float padValue = 0;
+
+    /**
+     * @description: planes of size, values of every channel times scale, e.g. 1 / 255.0 for the detectors
+     *               trained on [0, 1] inputs.
+     */
+    static PreprocessParams Scaled(const cv::Size& size, float scale);
+};
+
+/**
+ * @description: resize, swap, normalize and transpose a CV_8UC3 image to three planar float planes of
+ *               params.size in one pass, written straight to chw, e.g. a batch slot of a staging buffer.
+ *               Source rows are interpolated horizontally once into planar rows, the vertical blend and the
+ *               normalization run 8 floats at a time with AVX2, 4 with SSE2, scalar otherwise. Scratch rows are
+ *               kept per thread, so steady state calls do not allocate. Thread safe.
+ * @chw: 3 * size.area() floats.
+ * @return: false if the image is empty or not CV_8UC3, nothing is written then.
+ */
+bool PreprocessImage(const cv::Mat& image, const PreprocessParams& params, float* chw);
+
+/**
+ * @description: only the output rows [rowBegin, rowEnd) of PreprocessImage. Every row is computed on its own,
+ *               so bands of one image can be filled by different threads and the values do not depend on the
+ *               split.
+ */
+bool PreprocessImageRows(const cv::Mat& image, const PreprocessParams& params, float* chw, int rowBegin, int rowEnd);
+
+// rows below which an image is not split into further bands
+static constexpr int kMinPreprocessBandRows = 32;
+
+/**
+ * @description: PreprocessImage of every image into consecutive slots of batch, image i with paramsOf(i), all
+ *               of the same size. With nbThreads > 1 the images, and bands of rows of each image when the batch
+ *               has fewer images than threads, run on PreprocessPool. Every task writes its own part of the
+ *               batch, the result is the same for any number of threads.
+ * @return: false if any image failed, see PreprocessImage.
+ */
+template <typename ParamsOf>
+bool PreprocessBatch(const std::vector<cv::Mat>& images, ParamsOf paramsOf, float* batch, int nbThreads) {
+    int nbImages = static_cast<int>(images.size());
+    if(nbImages == 0) {
+        return true;
+    }
+    cv::Size size = paramsOf(0).size;
+    size_t stride = static_cast<size_t>(size.area()) * 3;
+    if(nbThreads <= 1) {
+        bool ok = true;
+        for(int i = 0; i < nbImages; i++) {
+            ok = PreprocessImage(images[i], paramsOf(i), batch + stride * i) && ok;
+        }
+        return ok;
+    }
+    PreprocessPool::Instance().Reserve(nbThreads - 1);
+    int bands = std::max(1, std::min((nbThreads + nbImages - 1) / nbImages, size.height / kMinPreprocessBandRows));
+    std::atomic<bool> ok(true);
+    auto task = [&](int index) {
+        int i = index / bands;
+        int band = index % bands;
+        int rowBegin = static_cast<int>(static_cast<int64_t>(size.height) * band / bands);
+        int rowEnd = static_cast<int>(static_cast<int64_t>(size.height) * (band + 1) / bands);
+        if(!PreprocessImageRows(images[i], paramsOf(i), batch + stride * i, rowBegin, rowEnd)) {
+            ok = false;
+        }
+    };
+    PreprocessPool::Instance().ParallelFor(nbImages * bands, task);
+    return ok;
+}
+
+/**
+ * @description: PreprocessBatch with the same params for every image.
+ */
+inline bool PreprocessBatch(const std::vector<cv::Mat>& images, const PreprocessParams& params, float* batch, int nbThreads) {
+    return PreprocessBatch(images, [&params](int) -> const PreprocessParams& { return params; }, batch, nbThreads);
+}
+
+/**
+ * @description: "avx2", "sse2" or "scalar", the path that runs on this cpu. Avx2 is detected at run time on
+ *               x64, sse2 is the x64 baseline.
+ */
+const char* ImagePreprocessIsa();
+
+#endif
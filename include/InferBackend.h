@@ -0,0 +1,438 @@
+#ifndef INFER_BACKEND_H
+#define INFER_BACKEND_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include "TensorTypes.h"
+#include "HostBuffer.h"
+#include "TensorView.h"
+#include "HalfConvert.h"
+#include "InputPrologue.h"
+#include "ProfileRouter.h"
+#include "LayerProfiler.h"
+
+class InferBackend;
+
+/**
+ * @description: per-request execution state of a backend: execution context, stream, bindings and host
+ *               copies of the bindings. Contexts created from one backend share its engine weights, so
+ *               several contexts can run concurrently, one request each. A context is not thread-safe
+ *               itself, see ContextPool for handing them out to concurrent callers.
+ */
+class InferContext {
+public:
+    virtual ~InferContext() {}
+
+    virtual StreamHandle GetStream() const = 0;
+
+    /**
+     * @description: binding memory of this context, device memory if the backend BindingIsOnDevice.
+     */
+    virtual void* GetBindingPtr(int bindIndex) const = 0;
+
+    /**
+     * @description: number of images the following copies and ForwardAsync process, from 1 to max batch size,
+     *               default is max batch size. Only the first batchSize images are transferred, engines with a
+     *               dynamic batch dimension also only compute them.
+     * @return: false if the backend can not run this batch size.
+     */
+    virtual bool SetBatchSize(int batchSize) = 0;
+
+    virtual int GetBatchSize() const = 0;
+
+    /**
+     * @description: host staging buffer of binding, sized from the binding size. Write inputs into it before
+     *               CopyFromHostToDevice(bindIndex), outputs are valid after CopyFromDeviceToHost and Synchronize.
+     *               Page-locked for gpu backends. Always fp32: a kHALF input is converted when it is copied to
+     *               the device, a kHALF output is converted on the first call after Synchronize.
+     */
+    virtual Span<float> GetHostBuffer(int bindIndex) = 0;
+
+    /**
+     * @description: GetHostBuffer of the first input binding, the batch slot detectors preprocess into in place.
+     */
+    Span<float> GetInputBuffer();
+
+    /**
+     * @description: host staging memory of binding in the binding data type, what actually crosses the bus.
+     *               Same as GetHostBuffer for kFLOAT bindings. Read kHALF outputs here to skip the conversion.
+     */
+    virtual void* GetHostBinding(int bindIndex) = 0;
+
+    /**
+     * @description: async copy GetHostBuffer(bindIndex) to binding on the context stream.
+     */
+    virtual void CopyFromHostToDevice(int bindIndex) = 0;
+
+    virtual void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) = 0;
+
+    /**
+     * @description: async copy binding to GetHostBuffer(bindIndex) on the context stream.
+     */
+    virtual void CopyFromDeviceToHost(int bindIndex) = 0;
+
+    /**
+     * @description: async copy all output bindings to their host buffers, a single transfer when the full batch
+     *               is in use since outputs are contiguous in the binding arena.
+     */
+    virtual void CopyOutputsFromDeviceToHost() = 0;
+
+    /**
+     * @description: host staging of the ForwardPreprocessor input with room for count floats. Write the NCHW frames
+     *               in place and call ForwardPreprocessor(inputDims), no host copy is made. Page-locked for gpu
+     *               backends, only reallocated when more than ever before is requested.
+     */
+    virtual float* GetPreprocessorInput(size_t count) = 0;
+
+    /**
+     * @description: resize a NCHW host input of any size to the input binding of this context.
+     */
+    virtual bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims) = 0;
+
+    /**
+     * @description: ForwardPreprocessor of the input written to GetPreprocessorInput. Only enqueued on the context
+     *               stream, the caller does not block until it ran.
+     * @return: false if the resize could not be enqueued.
+     */
+    virtual bool ForwardPreprocessor(const TensorDims& inputDims) = 0;
+
+    virtual void ForwardAsync() = 0;
+
+    /**
+     * @description: async copy every input from its host buffer, ForwardAsync and CopyOutputsFromDeviceToHost on
+     *               the context stream. Replayed from a cuda graph per input shape if the backend SetCudaGraph.
+     */
+    virtual void InferAsync() = 0;
+
+    virtual void Synchronize() = 0;
+
+    /**
+     * @description: report per layer times of every inference of the context to profiler, nullptr to detach.
+     *               While attached inference runs synchronously and without cuda graph, measure with it only.
+     */
+    virtual void SetProfiler(LayerProfiler* profiler) = 0;
+
+    /**
+     * @description: backend the context was created from.
+     */
+    virtual const InferBackend& GetBackend() const = 0;
+
+    /**
+     * @description: host buffer of binding name as a typed view with dims of the current batch size. Empty if
+     *               name is not a binding or T is not its data type, float is also accepted for kHALF bindings
+     *               and views the converted GetHostBuffer. Valid under the same rules as GetHostBuffer.
+     */
+    template <typename T>
+    TensorView<T> HostTensor(const std::string& name);
+
+    /**
+     * @description: binding memory of name, device memory if the backend BindingIsOnDevice.
+     */
+    template <typename T>
+    TensorView<T> BindingTensor(const std::string& name);
+
+    /**
+     * @description: host memory of this context with room for bytes, for intermediates of preprocess such as the
+     *               resized frame of a packed int8 input. Only reallocated when more than ever before is requested,
+     *               the content is not kept.
+     */
+    void* GetScratch(size_t bytes);
+
+private:
+    TensorDims GetTensorDims(int bindIndex) const;
+
+    std::vector<unsigned char> mScratch;
+};
+
+/**
+ * @description: abstract inference backend shared by all detectors. Trt is the TensorRT implementation,
+ *               CpuBackend runs the same onnx model on the host through OpenCV DNN. Detectors must only
+ *               talk to the backend through this interface so the same preprocess -> infer -> decode -> nms
+ *               pipeline runs on hosts without a GPU.
+ */
+class InferBackend {
+public:
+    virtual ~InferBackend() {}
+
+    /**
+     * @description: create engine from onnx model
+     * @onnxModel: path to onnx model
+     * @engineFile: path to saved engine file will be load or save, ignored by backends without engine file
+     * @maxBatchSize: max batch size for inference.
+     * @mode: run mode 0:fp32 1:fp16 2:int8
+     * @return: false if the engine could not be loaded or built, the backend must not be used then.
+     */
+    virtual bool CreateEngine(
+        const std::string& onnxModel,
+        const std::string& engineFile,
+        const std::vector<std::string>& customOutput,
+        int maxBatchSize,
+        int mode) = 0;
+
+    /**
+     * @description: build the resize engine used by dynamic shape detectors, see ForwardPreprocessor.
+     */
+    virtual bool buildPreprocessorEngine() = 0;
+
+    /**
+     * @description: resize a NCHW host input of any size to the input binding.
+     * @inputDims: NCHW dimensions of input.
+     */
+    virtual bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims, const StreamHandle& stream) = 0;
+
+    virtual void Forward() = 0;
+
+    virtual void ForwardAsync(const StreamHandle& stream) = 0;
+
+    virtual void SetBindingDimensions(std::vector<int>& inputDims, int bindIndex) = 0;
+
+    virtual void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) = 0;
+
+    virtual void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex) = 0;
+
+    virtual void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex, const StreamHandle& stream) = 0;
+
+    virtual void CopyFromHostToDevice(const float* input, int bindIndex, const StreamHandle& stream) = 0;
+
+    virtual void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex, const StreamHandle& stream) = 0;
+
+    /**
+     * @description: stream helpers, backends without cuda return a null stream and synchronize is a no-op.
+     */
+    virtual StreamHandle CreateStream() = 0;
+
+    virtual void DestroyStream(StreamHandle stream) = 0;
+
+    virtual void SynchronizeStream(const StreamHandle& stream) = 0;
+
+    /**
+     * @description: load the engine on device, call before CreateEngine. Contexts make it current on the calling
+     *               thread themselves, any thread may use them.
+     */
+    virtual void SetDevice(int device) = 0;
+
+    /**
+     * @description: device of SetDevice, the current device at construction if it was not called.
+     */
+    virtual int GetDevice() const = 0;
+
+    virtual void SetInt8Calibrator(const std::string& calibratorType, int input_w,
+        int input_h,
+        const char* img_dir,
+        const char* calib_table_name) = 0;
+
+    virtual void AddDynamicShapeProfile(int batchSize,
+        const std::string& inputName,
+        const std::vector<int>& minDimVec,
+        const std::vector<int>& optDimVec,
+        const std::vector<int>& maxDimVec) = 0;
+
+    virtual void SetMaxBatchSize(int max_batch) = 0;
+
+    /**
+     * @description: number of contexts that will be created with CreateContext, call before CreateEngine.
+     *               Engines with dynamic shape need one optimization profile per context.
+     */
+    virtual void SetMaxContexts(int maxContexts) = 0;
+
+    /**
+     * @description: contexts use SharedActivationMemory instead of their own activation memory, call before
+     *               CreateEngine. Only for engines that never run concurrently with each other.
+     */
+    virtual void SetShareActivationMemory(bool share) = 0;
+
+    /**
+     * @description: capture InferAsync of every context into a cuda graph once per input shape and replay it,
+     *               backends without cuda run InferAsync as is.
+     */
+    virtual void SetCudaGraph(bool enable) = 0;
+
+    /**
+     * @description: keep engines in dir named by a hash of the onnx model, build options, tensorrt version, gpu
+     *               and plugins instead of engineFile, call before CreateEngine. Empty dir use engineFile.
+     */
+    virtual void SetEngineCacheDir(const std::string& dir) = 0;
+
+    /**
+     * @description: max batch of every optimization profile of a dynamic batch engine, e.g. {1, 4, 8}. Requests
+     *               run on the tightest profile containing their batch, call after SetMaxContexts and before
+     *               CreateEngine. Empty for one profile up to the max batch size.
+     */
+    virtual void SetBatchProfiles(const std::vector<int>& maxBatches) = 0;
+
+    /**
+     * @description: engine inputs and outputs in fp16 instead of fp32, half the bytes over pcie. Only with run
+     *               mode 1, call before CreateEngine. Host buffers stay fp32, see InferContext::GetHostBuffer.
+     */
+    virtual void SetHalfIO(bool enable) = 0;
+
+    /**
+     * @description: take raw BGR bytes as an int8 NHWC input and normalize them inside the engine, 3 bytes per
+     *               pixel over pcie instead of 12. Needs a single 4-D input with fixed C, H and W, otherwise it is
+     *               ignored with a warning. Check the input binding data type to know if it is in effect, call
+     *               before CreateEngine.
+     */
+    virtual void SetInputPrologue(const InputPrologue& prologue) = 0;
+
+    /**
+     * @description: max gpu scratch memory tactics may use, more allows faster tactics for some layers. Call
+     *               before CreateEngine, default 10 MB.
+     */
+    virtual void SetMaxWorkspaceSize(size_t bytes) = 0;
+
+    /**
+     * @description: let CreateEngine pick run mode, workspace, batch profiles and engine file from a manifest of
+     *               SweepEngines instead of its arguments. The entry must match GetBuildTarget and the max batch
+     *               size, the best one for objective ("latency" or "throughput", see SweepObjective) wins. Int8
+     *               entries only for run mode 2. Without a matching entry the arguments are used, call before
+     *               CreateEngine. Empty manifest to disable.
+     */
+    virtual void SetEngineManifest(const std::string& manifest, const std::string& objective, double latencyBudgetMs) = 0;
+
+    /**
+     * @description: identity of the build environment engines are valid for, e.g. tensorrt version, gpu and
+     *               plugins. Sweep manifests keep their entries per target.
+     */
+    virtual std::string GetBuildTarget() const = 0;
+
+    virtual int GetMaxBatchSize() const = 0;
+
+    /**
+     * @description: resolution buckets added with AddDynamicShapeProfile, NCHW. Empty if the engine has a fixed
+     *               input resolution.
+     */
+    virtual std::vector<ShapeProfile> GetShapeProfiles() const = 0;
+
+    /**
+     * @description: true if GetBindingPtr return device memory, false if it is host memory.
+     */
+    virtual bool BindingIsOnDevice() const = 0;
+
+    virtual void* GetBindingPtr(int bindIndex) const = 0;
+
+    virtual size_t GetBindingSize(int bindIndex) const = 0;
+
+    virtual TensorDims GetBindingDims(int bindIndex) const = 0;
+
+    virtual TensorType GetBindingDataType(int bindIndex) const = 0;
+
+    virtual std::string GetBindingName(int bindIndex) const = 0;
+
+    /**
+     * @description: get binding index by name, -1 if not found.
+     */
+    virtual int GetBindingIndex(const std::string& name) const = 0;
+
+    virtual bool BindingIsInput(int bindIndex) const = 0;
+
+    /**
+     * @description: dim 0 of binding is the batch axis, i.e. the engine has an explicit batch that is dynamic and
+     *               set per run within the optimization profiles. GetBindingDims then reports the max batch there
+     *               and views of a context the current one. Static and implicit batch bindings keep their dims.
+     */
+    virtual bool BindingHasBatchAxis(int bindIndex) const = 0;
+
+    virtual int GetNbBindings() const = 0;
+
+    virtual int GetNbInputBindings() const = 0;
+
+    virtual int GetNbOutputBindings() const = 0;
+
+    /**
+     * @description: first input binding, -1 if none. Detectors resolve their input by role, never by position.
+     */
+    int GetInputBindingIndex() const {
+        for(int i = 0; i < GetNbBindings(); i++) {
+            if(BindingIsInput(i)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @description: first output binding whose name contains one of keys, -1 if none. For exports whose output
+     *               order is not fixed, e.g. keys {"hm", "heatmap"}.
+     */
+    int FindOutputBinding(const std::vector<std::string>& keys) const {
+        for(int i = 0; i < GetNbBindings(); i++) {
+            if(BindingIsInput(i)) {
+                continue;
+            }
+            std::string name = GetBindingName(i);
+            for(const std::string& key : keys) {
+                if(name.find(key) != std::string::npos) {
+                    return i;
+                }
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @description: create a new execution context sharing the engine, call after CreateEngine and
+     *               buildPreprocessorEngine.
+     */
+    virtual std::unique_ptr<InferContext> CreateContext() = 0;
+};
+
+/**
+ * @description: create inference backend by name. Built with INFER_CPU_ONLY defined there is no tensorrt
+ *               backend, the build compiles and links without cuda and tensorrt and always creates the cpu one.
+ * @backend: "tensorrt" or "cpu"
+ */
+std::shared_ptr<InferBackend> CreateInferBackend(const std::string& backend);
+
+inline Span<float> InferContext::GetInputBuffer() {
+    return GetHostBuffer(GetBackend().GetInputBindingIndex());
+}
+
+inline void* InferContext::GetScratch(size_t bytes) {
+    if(mScratch.size() < bytes) {
+        mScratch.resize(bytes);
+    }
+    return mScratch.data();
+}
+
+inline TensorDims InferContext::GetTensorDims(int bindIndex) const {
+    // binding dims are sized for the max batch, views only cover the images of the current batch
+    TensorDims dims = GetBackend().GetBindingDims(bindIndex);
+    if(dims.nbDims > 0 && GetBackend().BindingHasBatchAxis(bindIndex)) {
+        dims.d[0] = GetBatchSize();
+    }
+    return dims;
+}
+
+template <typename T>
+TensorView<T> InferContext::HostTensor(const std::string& name) {
+    int bindIndex = GetBackend().GetBindingIndex(name);
+    if(bindIndex < 0) {
+        return TensorView<T>();
+    }
+    TensorType dataType = GetBackend().GetBindingDataType(bindIndex);
+    T* data = nullptr;
+    if(dataType == TensorDataType<T>::value) {
+        data = static_cast<T*>(GetHostBinding(bindIndex));
+    } else if(std::is_same<T, float>::value && dataType == TensorType::kHALF) {
+        data = reinterpret_cast<T*>(GetHostBuffer(bindIndex).data());
+    } else {
+        return TensorView<T>();
+    }
+    return TensorView<T>(data, name, GetTensorDims(bindIndex), TensorLocation::kHost);
+}
+
+template <typename T>
+TensorView<T> InferContext::BindingTensor(const std::string& name) {
+    int bindIndex = GetBackend().GetBindingIndex(name);
+    if(bindIndex < 0 || GetBackend().GetBindingDataType(bindIndex) != TensorDataType<T>::value) {
+        return TensorView<T>();
+    }
+    TensorLocation location = GetBackend().BindingIsOnDevice() ? TensorLocation::kDevice : TensorLocation::kHost;
+    return TensorView<T>(static_cast<T*>(GetBindingPtr(bindIndex)), name, GetTensorDims(bindIndex), location);
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef INPUT_PROLOGUE_H
+#define INPUT_PROLOGUE_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @description: normalization folded into the engine. With enable the model input becomes an int8 NHWC binding
+ *               holding pixel - 128 (tensorrt 7 has no uint8 input, the offset keeps 0..255 exact in int8), the
+ *               engine casts, scales and transposes it to the float NCHW the onnx model expects:
+ *               output[c] = (pixel * scale - mean[c]) / std[c]. Mean and std are per channel of the model input,
+ *               empty means 0 and 1.
+ */
+struct InputPrologue {
+    bool enable = false;
+
+    float scale = 1.f / 255.f;
+
+    std::vector<float> mean;
+
+    std::vector<float> std;
+};
+
+/**
+ * @description: offset subtracted from a pixel before it is stored in the int8 binding.
+ */
+constexpr int kInputPrologueOffset = 128;
+
+/**
+ * @description: per channel coefficients of the prologue on the stored int8 value q, output = q * scale + shift.
+ *               Backends build their prologue from these so they compute the same thing.
+ */
+float InputPrologueScale(const InputPrologue& prologue, int channel);
+
+float InputPrologueShift(const InputPrologue& prologue, int channel);
+
+/**
+ * @description: reference prologue on the host, int8 NHWC pixels to float NCHW output.
+ */
+void RunInputPrologue(const InputPrologue& prologue, const int8_t* pixels, int batch, int height, int width,
+                      int channel, float* output);
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef LAYER_PROFILER_H
+#define LAYER_PROFILER_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+/**
+ * @description: time of one layer over all runs of a profile.
+ */
+struct LayerStats {
+    std::string name;
+
+    int64_t calls = 0;
+
+    double totalMs = 0;
+
+    double minMs = 0;
+
+    double maxMs = 0;
+
+    double AverageMs() const {
+        return calls > 0 ? totalMs / calls : 0;
+    }
+};
+
+/**
+ * @description: layer times of a number of inference runs, aggregated per layer name and kept as a timeline
+ *               for the trace. Plain data without gpu dependency, filled by LayerProfiler or by hand with
+ *               synthetic events.
+ */
+class LayerProfile {
+public:
+    /**
+     * @maxTraceRuns: runs per track kept for the chrome trace, later runs only count in the table.
+     */
+    explicit LayerProfile(int maxTraceRuns = 100);
+
+    /**
+     * @description: ms spent in layer during run, layers of a run are added in execution order. Tracks are
+     *               independent timelines, e.g. one per execution context.
+     */
+    void AddLayerTime(const std::string& name, float ms, int64_t run, int track = 0);
+
+    /**
+     * @description: add every event of other, its tracks are moved to track.
+     */
+    void Merge(const LayerProfile& other, int track);
+
+    void Clear();
+
+    int64_t GetNbRuns() const;
+
+    /**
+     * @description: per layer stats, the most expensive layer first.
+     */
+    std::vector<LayerStats> GetStats() const;
+
+    /**
+     * @description: time of all layers of all runs.
+     */
+    double GetTotalMs() const;
+
+    /**
+     * @description: GetStats as text table with share of total and average per run, top rows only if top > 0.
+     */
+    void PrintTable(std::ostream& out, int top = 0) const;
+
+    /**
+     * @description: chrome trace event json (chrome://tracing, perfetto). Layers of a run are laid end to end
+     *               from their measured durations, one thread per track.
+     */
+    std::string ChromeTrace() const;
+
+    bool WriteChromeTrace(const std::string& path) const;
+
+protected:
+    struct Event {
+        std::string name;
+
+        float ms;
+
+        int64_t run;
+
+        int track;
+    };
+
+    int mMaxTraceRuns;
+
+    std::map<std::string, LayerStats> mStats;
+
+    std::vector<Event> mEvents;
+
+    // last run seen and number of runs per track
+    std::map<int, int64_t> mLastRun;
+
+    std::map<int, int64_t> mTrackRuns;
+
+    int64_t mNbRuns = 0;
+};
+
+/**
+ * @description: layer times of one execution context. The backend reports every layer after a synchronous run,
+ *               tensorrt through its IProfiler, and the context calls EndRun when a run is complete. Engine layer
+ *               names are the names of the network, fused layers are joined with " + ", plugin layers carry the
+ *               label Trt gives them at build.
+ */
+class LayerProfiler {
+public:
+    explicit LayerProfiler(int maxTraceRuns = 100);
+
+    void reportLayerTime(const char* layerName, float ms);
+
+    void EndRun();
+
+    LayerProfile GetProfile() const;
+
+    void Reset();
+
+protected:
+    mutable std::mutex mMutex;
+
+    LayerProfile mProfile;
+
+    int64_t mRun = 0;
+
+    // layers reported since the last EndRun
+    int mRunLayers = 0;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef LETTERBOX_H
+#define LETTERBOX_H
+
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "ImagePreprocess.h"
+#include "common.h"
+
+// gray the yolov5 and yolox letterbox borders are filled with, a pixel value before normalization
+static constexpr float kLetterboxPadValue = 114;
+
+/**
+ * @description: where an image lands in the network input and the inverse for the decoded outputs. The
+ *               placement is a whole pixel rect, PreprocessImage resizes the image into exactly that rect, so
+ *               mapping back with the same rect undoes the resize without the rounding error of the nominal
+ *               ratio. Built from the image and input sizes only, the decoder rebuilds the transform of an
+ *               image instead of keeping it around.
+ */
+class LetterboxTransform {
+public:
+    LetterboxTransform() {}
+
+    /**
+     * @description: keep the aspect ratio, the image fills one side of input and is padded on the other,
+     *               centered or in the top left corner.
+     */
+    static LetterboxTransform Letterbox(const cv::Size& image, const cv::Size& input, bool center = true);
+
+    /**
+     * @description: resize the image to the whole input, no padding.
+     */
+    static LetterboxTransform Stretch(const cv::Size& image, const cv::Size& input);
+
+    /**
+     * @description: Letterbox if letterbox is set, Stretch otherwise, see Config::letterbox.
+     */
+    static LetterboxTransform Fit(const cv::Size& image, const cv::Size& input, bool letterbox, bool center = true);
+
+    /**
+     * @description: params with the size of the input and the roi of the image, the rest of the planes get
+     *               padValue.
+     */
+    PreprocessParams Apply(PreprocessParams params, float padValue = kLetterboxPadValue) const;
+
+    /**
+     * @description: image resized into a CV_8UC3 mat of the input size with cv::resize, for the paths that do
+     *               not run PreprocessImage, e.g. the packed int8 input.
+     */
+    void Resize(const cv::Mat& image, cv::Mat& input, float padValue = kLetterboxPadValue) const;
+
+    /**
+     * @description: image as the packed int8 input, resized into scratch, GetPackedSize bytes, then stored minus
+     *               kInputPrologueOffset at pixels. Nothing is allocated when the same scratch is passed again.
+     * @return: pixels past the input, where the next image of the batch goes.
+     */
+    int8_t* Pack(const cv::Mat& image, int8_t* pixels, void* scratch, float padValue = kLetterboxPadValue) const;
+
+    // bytes of a BGR input, the scratch and the int8 pixels Pack needs
+    size_t GetPackedSize() const { return static_cast<size_t>(mInput.area()) * 3; }
+
+    const cv::Rect& GetRoi() const { return mRoi; }
+
+    const cv::Size& GetImageSize() const { return mImage; }
+
+    const cv::Size& GetInputSize() const { return mInput; }
+
+    // image pixels per input pixel
+    float GetScaleX() const { return mScaleX; }
+
+    float GetScaleY() const { return mScaleY; }
+
+    float ToImageX(float x) const { return (x - mRoi.x) * mScaleX; }
+
+    float ToImageY(float y) const { return (y - mRoi.y) * mScaleY; }
+
+    /**
+     * @description: boxes with x1, y1, x2, y2 members from input to image coordinates, clamped to the image.
+     */
+    template <typename Box>
+    void BoxesToImage(Box* boxes, size_t count) const {
+        float width = static_cast<float>(mImage.width);
+        float height = static_cast<float>(mImage.height);
+        for(size_t i = 0; i < count; i++) {
+            Box& box = boxes[i];
+            box.x1 = std::min(std::max(ToImageX(box.x1), 0.0f), width);
+            box.y1 = std::min(std::max(ToImageY(box.y1), 0.0f), height);
+            box.x2 = std::min(std::max(ToImageX(box.x2), 0.0f), width);
+            box.y2 = std::min(std::max(ToImageY(box.y2), 0.0f), height);
+        }
+    }
+
+    /**
+     * @description: the boxes of decoded detections from input to image coordinates, clamped to the image.
+     */
+    void ToImage(std::vector<BBoxInfo>& detections) const;
+
+    /**
+     * @description: points, e.g. landmarks, from input to image coordinates, not clamped.
+     */
+    void PointsToImage(cv::Point2f* points, size_t count) const;
+
+    void PointsToImage(float* x, float* y, size_t count) const;
+
+protected:
+    LetterboxTransform(const cv::Size& image, const cv::Size& input, const cv::Rect& roi);
+
+protected:
+    cv::Size mImage;
+
+    cv::Size mInput;
+
+    cv::Rect mRoi;
+
+    float mScaleX = 1;
+
+    float mScaleY = 1;
+};
+
+#endif
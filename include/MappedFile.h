@@ -0,0 +1,52 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @description: read only memory mapping of a whole file. Pages are prefetched on open because callers read
+ *               the file front to back right away, deserializing from the mapping avoids a heap copy of the
+ *               engine and the page cache is shared by every process loading the same file.
+ */
+class MappedFile {
+public:
+    MappedFile() {}
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @description: map fileName, close the previous mapping first. Empty files fail to map.
+     */
+    bool Open(const std::string& fileName);
+
+    void Close();
+
+    const char* Data() const {
+        return mData;
+    }
+
+    size_t Size() const {
+        return mSize;
+    }
+
+protected:
+    const char* mData = nullptr;
+
+    size_t mSize = 0;
+
+#ifdef _WIN32
+    // HANDLE of file and file mapping
+    void* mFile = nullptr;
+
+    void* mMapping = nullptr;
+#else
+    int mFd = -1;
+#endif
+};
+
+#endif
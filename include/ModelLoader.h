@@ -0,0 +1,101 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include "AsyncWorker.h"
+#include "common.h"
+
+enum class ModelState {
+    kPending,
+    kLoading,
+    kReady,
+    kFailed
+};
+
+/**
+ * @description: build or deserialize the engines of several detectors at startup on a bounded thread pool.
+ *               Startup takes as long as the slowest model instead of the sum of all, and callers can serve a
+ *               model as soon as Wait or IsReady says so while the others are still loading.
+ */
+class ModelLoader {
+public:
+    using Callback = std::function<void(const std::string& name, ModelState state)>;
+
+    /**
+     * @nbThreads: models loading at the same time, every build hold its own builder workspace on the gpu.
+     * @callback: called on the loading thread when a model is ready or failed, may be empty.
+     */
+    explicit ModelLoader(int nbThreads = 2, Callback callback = nullptr);
+
+    /**
+     * @description: wait for models still loading.
+     */
+    ~ModelLoader();
+
+    ModelLoader(const ModelLoader&) = delete;
+
+    ModelLoader& operator=(const ModelLoader&) = delete;
+
+    /**
+     * @description: queue load for name, a load throwing an exception mark the model failed.
+     */
+    void Add(const std::string& name, std::function<void()> load);
+
+    /**
+     * @description: queue detector.init(config), detector must outlive the load. Detectors throw from init when
+     *               their engine can not be loaded or built, the model is then kFailed and never isReady.
+     */
+    template <typename Detector>
+    void Add(const std::string& name, Detector& detector, const Config& config) {
+        Add(name, [&detector, config]() { detector.init(config); });
+    }
+
+    ModelState GetState(const std::string& name) const;
+
+    bool IsReady(const std::string& name) const {
+        return GetState(name) == ModelState::kReady;
+    }
+
+    /**
+     * @description: block until name is ready or failed.
+     */
+    ModelState Wait(const std::string& name);
+
+    /**
+     * @description: block until every model is ready or failed, true if all are ready.
+     */
+    bool WaitAll();
+
+    /**
+     * @description: milliseconds name took to load, 0 until it is done.
+     */
+    double GetLoadTime(const std::string& name) const;
+
+protected:
+    struct Model {
+        ModelState state = ModelState::kPending;
+
+        double loadTime = 0;
+    };
+
+    void SetState(const std::string& name, ModelState state, double loadTime);
+
+protected:
+    Callback mCallback;
+
+    std::map<std::string, Model> mModels;
+
+    mutable std::mutex mMutex;
+
+    std::condition_variable mCondition;
+
+    // declared last, destroyed first: pending loads still update mModels
+    std::unique_ptr<AsyncWorker> mWorker;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef PLUGIN_DESCRIPTION_H
+#define PLUGIN_DESCRIPTION_H
+
+#include <string>
+
+/**
+ * @description: optional interface of the custom plugins, the attributes of a plugin layer as short text like
+ *               "k3 s1 p1". Trt adds it to the layer name at build so profiles tell plugin layers apart.
+ */
+class PluginDescription {
+public:
+    virtual ~PluginDescription() {}
+
+    virtual std::string Describe() const = 0;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef PREPROCESS_POOL_H
+#define PREPROCESS_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @description: process wide fork join pool the detectors preprocess their batches on. ParallelFor runs the
+ *               indices of a job on the pool threads and on the calling thread, which returns once all of them
+ *               are done. Jobs of concurrent callers queue up and share the threads. A job lives on the stack of
+ *               its caller and the body is called through a pointer, so running one does not allocate.
+ */
+class PreprocessPool {
+public:
+    static PreprocessPool& Instance();
+
+    /**
+     * @description: finish queued jobs, then join the threads.
+     */
+    ~PreprocessPool();
+
+    /**
+     * @description: grow the pool to at least nbThreads threads besides the callers, never shrinks.
+     */
+    void Reserve(int nbThreads);
+
+    int GetNbThreads() const;
+
+    /**
+     * @description: call body(i) for every i in [0, count), in any order and on any thread. Bodies must not
+     *               throw and must only write state of their own index.
+     */
+    template <typename Body>
+    void ParallelFor(int count, Body& body) {
+        Run(count, &Invoke<Body>, &body);
+    }
+
+protected:
+    PreprocessPool() {}
+
+    PreprocessPool(const PreprocessPool&) = delete;
+
+    PreprocessPool& operator=(const PreprocessPool&) = delete;
+
+    struct Job {
+        void (*invoke)(void* body, int index);
+
+        void* body;
+
+        int count;
+
+        // next index to hand out and indices finished, guarded by mMutex
+        int next;
+
+        int done;
+
+        Job* nextJob;
+    };
+
+    template <typename Body>
+    static void Invoke(void* body, int index) {
+        (*static_cast<Body*>(body))(index);
+    }
+
+    void Run(int count, void (*invoke)(void*, int), void* body);
+
+    /**
+     * @description: hand out the next index of job and unlink the job once its last index is out, mMutex held.
+     */
+    int Claim(Job* job);
+
+    void Worker();
+
+protected:
+    std::vector<std::thread> mThreads;
+
+    // jobs with indices left, in submission order
+    Job* mHead = nullptr;
+
+    Job* mTail = nullptr;
+
+    bool mStop = false;
+
+    mutable std::mutex mMutex;
+
+    // signals queued jobs to the workers
+    std::condition_variable mWork;
+
+    // signals finished indices to the callers
+    std::condition_variable mDone;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PROFILE_ROUTER_H
+#define PROFILE_ROUTER_H
+
+#include <vector>
+
+/**
+ * @description: min/opt/max dimensions of one optimization profile for the routed input, one value per axis.
+ */
+struct ShapeProfile {
+    std::vector<int> min;
+
+    std::vector<int> opt;
+
+    std::vector<int> max;
+};
+
+/**
+ * @description: true if min <= dims <= max on every axis.
+ */
+bool ProfileContains(const ShapeProfile& profile, const std::vector<int>& dims);
+
+/**
+ * @description: route a request to the tightest profile containing dims, the one with the smallest max volume.
+ *               Ties go to the profile whose opt is closest to dims, then to the lower index. Kernels of a
+ *               profile are tuned for its opt, so a small input is never sent to a large profile if a smaller
+ *               one fits. Only touch host memory so it can be checked without a gpu.
+ * @return: profile index, -1 if no profile contains dims.
+ */
+int SelectProfile(const std::vector<ShapeProfile>& profiles, const std::vector<int>& dims);
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef REPLICA_MANAGER_H
+#define REPLICA_MANAGER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <exception>
+#include <chrono>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include "common.h"
+
+/**
+ * @description: load of one replica as the router sees it.
+ */
+struct ReplicaStats {
+    // requests routed to the replica and not complete yet
+    int inFlight = 0;
+
+    int64_t completed = 0;
+
+    // moving average of request latency, 0 until the first request completes
+    double averageMs = 0;
+};
+
+/**
+ * @description: picks the replica a request goes to. Knows nothing about devices or detectors, replicas are
+ *               indices, so routing and accounting run the same with mock replicas. A request goes to the
+ *               replica that would finish it first, (inFlight + 1) * averageMs; replicas without a measured
+ *               latency count with the mean of the measured ones. Ties go to the one with fewer requests in
+ *               flight, then round robin.
+ */
+class ReplicaRouter {
+public:
+    /**
+     * @description: routed request, counts as in flight on its replica until completed or destroyed.
+     */
+    class Ticket {
+    public:
+        Ticket() {}
+
+        Ticket(ReplicaRouter* router, int replica);
+
+        Ticket(Ticket&& other);
+
+        Ticket& operator=(Ticket&& other);
+
+        Ticket(const Ticket&) = delete;
+
+        Ticket& operator=(const Ticket&) = delete;
+
+        ~Ticket();
+
+        int Replica() const {
+            return mReplica;
+        }
+
+        /**
+         * @description: request is done, its time since Acquire goes into the latency average of the replica.
+         */
+        void Complete();
+
+        /**
+         * @description: request is done and took latencyMs.
+         */
+        void Complete(double latencyMs);
+
+        /**
+         * @description: request is given up, e.g. it failed, the replica keeps its latency average.
+         */
+        void Release();
+
+    private:
+        ReplicaRouter* mRouter = nullptr;
+
+        int mReplica = -1;
+
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    /**
+     * @smoothing: weight of the latest latency in the moving average, (0, 1].
+     */
+    explicit ReplicaRouter(int nbReplicas, double smoothing = 0.2);
+
+    /**
+     * @description: route a request to the least loaded replica, never blocks.
+     */
+    Ticket Acquire();
+
+    int Size() const;
+
+    ReplicaStats GetStats(int replica) const;
+
+protected:
+    /**
+     * @description: request of replica is done, latencyMs < 0 if it did not complete.
+     */
+    void Release(int replica, double latencyMs);
+
+protected:
+    std::vector<ReplicaStats> mStats;
+
+    double mSmoothing;
+
+    // replica ties are broken from, advanced on every Acquire
+    int mNext = 0;
+
+    mutable std::mutex mMutex;
+};
+
+/**
+ * @description: engineFile of the replica on device, "x.engine" becomes "x_gpu1.engine", so replicas on
+ *               different gpus never load each others engine. Engines of engineCacheDir are keyed by gpu already.
+ */
+std::string DeviceEngineFile(const std::string& engineFile, int device);
+
+/**
+ * @description: one replica of Detector per gpu of config.devices, each detect() runs on the replica
+ *               ReplicaRouter picks. Replicas are independent detectors with their own engine, context pool and
+ *               worker, a replica only waits for its own contexts. Detector is one of the static detectors,
+ *               init(Config), detect(images, results) and detectAsync(images, callback).
+ */
+template <typename Detector>
+class ReplicaManager {
+public:
+    template <typename T>
+    struct FutureValue;
+
+    template <typename T>
+    struct FutureValue<std::future<T>> {
+        using type = T;
+    };
+
+    // std::vector<BatchResult> of Detector
+    using Result = typename FutureValue<decltype(std::declval<Detector&>().detectAsync(
+        std::declval<const std::vector<cv::Mat>&>()))>::type;
+
+    /**
+     * @description: load a replica on every gpu of config.devices, or a single one on config.device if the list
+     *               is empty. Replicas build or load their engines and warm up in parallel. With config.backend
+     *               cpu the devices are only recorded, every replica is a mock device on the cpu. With more than
+     *               one replica shareActivationMemory is turned off, the replicas run concurrently.
+     *               Throws the exception of the first replica whose init failed, e.g. its engine could not be built.
+     */
+    void init(const Config& config) {
+        mDevices = config.devices;
+        if(mDevices.empty()) {
+            mDevices.push_back(config.device);
+        }
+        mReplicas.clear();
+        mRouter.reset(new ReplicaRouter(static_cast<int>(mDevices.size())));
+        std::vector<std::future<void>> loads;
+        for(int device : mDevices) {
+            Config replicaConfig = config;
+            replicaConfig.device = device;
+            if(mDevices.size() > 1) {
+                replicaConfig.engineFile = DeviceEngineFile(config.engineFile, device);
+                // replicas run concurrently, shared activation memory is only safe for engines that never do
+                replicaConfig.shareActivationMemory = false;
+            }
+            mReplicas.emplace_back(new Detector());
+            Detector* replica = mReplicas.back().get();
+            loads.push_back(std::async(std::launch::async, [replica, replicaConfig]() {
+                replica->init(replicaConfig);
+            }));
+        }
+        // every replica finishes loading before the first failure is rethrown
+        std::exception_ptr failure;
+        for(auto& load : loads) {
+            try {
+                load.get();
+            } catch(...) {
+                if(!failure) {
+                    failure = std::current_exception();
+                }
+            }
+        }
+        if(failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    /**
+     * @description: true once every replica is ready.
+     */
+    bool isReady() const {
+        if(mReplicas.empty()) {
+            return false;
+        }
+        for(const auto& replica : mReplicas) {
+            if(!replica->isReady()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void detect(const std::vector<cv::Mat>& vec_image, Result& vec_batch_result) {
+        ReplicaRouter::Ticket ticket = mRouter->Acquire();
+        mReplicas[ticket.Replica()]->detect(vec_image, vec_batch_result);
+        ticket.Complete();
+    }
+
+    /**
+     * @description: detectAsync of the routed replica, the request stays in flight there until callback time.
+     */
+    std::future<Result> detectAsync(const std::vector<cv::Mat>& vec_image,
+                                    std::function<void(const Result&)> callback = nullptr) {
+        auto ticket = std::make_shared<ReplicaRouter::Ticket>(mRouter->Acquire());
+        int replica = ticket->Replica();
+        return mReplicas[replica]->detectAsync(vec_image, [ticket, callback](const Result& result) {
+            ticket->Complete();
+            if(callback) {
+                callback(result);
+            }
+        });
+    }
+
+    int size() const {
+        return static_cast<int>(mReplicas.size());
+    }
+
+    int device(int replica) const {
+        return mDevices[replica];
+    }
+
+    Detector& replica(int index) {
+        return *mReplicas[index];
+    }
+
+    const ReplicaRouter& router() const {
+        return *mRouter;
+    }
+
+protected:
+    std::vector<int> mDevices;
+
+    // outlives the replicas, tickets of their pending requests point to it
+    std::unique_ptr<ReplicaRouter> mRouter;
+
+    std::vector<std::unique_ptr<Detector>> mReplicas;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef TENSOR_TYPES_H
+#define TENSOR_TYPES_H
+
+#include <cstdint>
+#include <numeric>
+#include <functional>
+
+/**
+ * @description: shape of a binding, same fields as nvinfer1::Dims so code indexing d[] reads the same for every
+ *               backend. Dimensions below 0 are dynamic.
+ */
+struct TensorDims {
+    static constexpr int MAX_DIMS = 8;
+
+    int nbDims;
+
+    int d[MAX_DIMS];
+};
+
+// number of elements
+inline int64_t volume(const TensorDims& d) {
+    return std::accumulate(d.d, d.d + d.nbDims, int64_t(1), std::multiplies<int64_t>());
+}
+
+/**
+ * @description: element type of a binding, the subset of nvinfer1::DataType the backends use, in its order.
+ */
+enum class TensorType {
+    kFLOAT,
+    kHALF,
+    kINT8,
+    kINT32,
+    kBOOL
+};
+
+/**
+ * @description: stream the copies and inference of a context run on, a cudaStream_t for the tensorrt backend and
+ *               nullptr for backends without cuda. Declared here so the interface does not need cuda headers.
+ */
+typedef struct CUstream_st* StreamHandle;
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TENSOR_VIEW_H
+#define TENSOR_VIEW_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <type_traits>
+#include "TensorTypes.h"
+#include "HostBuffer.h"
+
+/**
+ * @description: where the memory of a TensorView lives, kDevice memory must not be dereferenced on the host.
+ */
+enum class TensorLocation {
+    kHost,
+    kDevice
+};
+
+/**
+ * @description: binding data type of T, views are only created when it matches the engine binding.
+ */
+template <typename T>
+struct TensorDataType;
+
+template <>
+struct TensorDataType<float> {
+    static constexpr TensorType value = TensorType::kFLOAT;
+};
+
+template <>
+struct TensorDataType<int32_t> {
+    static constexpr TensorType value = TensorType::kINT32;
+};
+
+template <>
+struct TensorDataType<int8_t> {
+    static constexpr TensorType value = TensorType::kINT8;
+};
+
+template <>
+struct TensorDataType<bool> {
+    static constexpr TensorType value = TensorType::kBOOL;
+};
+
+/**
+ * @description: non-owning typed view of one binding of a context, looked up by binding name so decoders do not
+ *               depend on the binding order of the exported model. Carries dims of the current batch size,
+ *               element strides of a dense row-major layout and the residency of the memory. Empty if the name
+ *               is unknown or T does not match the binding data type.
+ */
+template <typename T>
+class TensorView {
+public:
+    TensorView() {}
+
+    TensorView(T* data, const std::string& name, const TensorDims& dims, TensorLocation location)
+        : mData(data), mName(name), mDims(dims), mLocation(location) {
+        mStrides.resize(dims.nbDims);
+        int64_t stride = 1;
+        for(int i = dims.nbDims - 1; i >= 0; i--) {
+            mStrides[i] = stride;
+            stride *= dims.d[i];
+        }
+        mVolume = dims.nbDims > 0 ? stride : 0;
+    }
+
+    T* data() const {
+        return mData;
+    }
+
+    bool empty() const {
+        return mData == nullptr;
+    }
+
+    const std::string& name() const {
+        return mName;
+    }
+
+    const TensorDims& dims() const {
+        return mDims;
+    }
+
+    int dim(int axis) const {
+        assert(axis < mDims.nbDims);
+        return mDims.d[axis];
+    }
+
+    /**
+     * @description: elements between two neighbours along axis.
+     */
+    int64_t stride(int axis) const {
+        assert(axis < mDims.nbDims);
+        return mStrides[axis];
+    }
+
+    int64_t volume() const {
+        return mVolume;
+    }
+
+    TensorType dataType() const {
+        return TensorDataType<typename std::remove_const<T>::type>::value;
+    }
+
+    TensorLocation location() const {
+        return mLocation;
+    }
+
+    bool IsOnDevice() const {
+        return mLocation == TensorLocation::kDevice;
+    }
+
+    T& operator[](int64_t i) const {
+        assert(!IsOnDevice() && i < mVolume);
+        return mData[i];
+    }
+
+    /**
+     * @description: view of image index of the batch, the batch axis is dropped.
+     */
+    TensorView<T> Batch(int index) const {
+        assert(mDims.nbDims > 0 && index < mDims.d[0]);
+        TensorDims dims;
+        dims.nbDims = mDims.nbDims - 1;
+        for(int i = 1; i < mDims.nbDims; i++) {
+            dims.d[i - 1] = mDims.d[i];
+        }
+        return TensorView<T>(mData + index * mStrides[0], mName, dims, mLocation);
+    }
+
+    /**
+     * @description: host elements as a Span, for code that take a flat buffer.
+     */
+    Span<T> AsSpan() const {
+        assert(!IsOnDevice());
+        return Span<T>(mData, static_cast<size_t>(mVolume));
+    }
+
+private:
+    T* mData = nullptr;
+
+    std::string mName;
+
+    TensorDims mDims = {};
+
+    std::vector<int64_t> mStrides;
+
+    int64_t mVolume = 0;
+
+    TensorLocation mLocation = TensorLocation::kHost;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TIMING_CACHE_H
+#define TIMING_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * @description: builder timing cache file shared by every engine built with the same tensorrt version and gpu.
+ *               Update holds an exclusive lock on <file>.lock from read to rename, so build processes finishing
+ *               at the same time merge into the cache one after the other instead of dropping each other's
+ *               tactics. Only touch host memory, merge can be a stub to check the file handling without a gpu.
+ *               Trt only uses it when built against tensorrt 8 or later, tensorrt 7 cannot load or save
+ *               tactic timings and rebuilds there still profile every layer.
+ */
+class TimingCacheFile {
+public:
+    explicit TimingCacheFile(const std::string& fileName);
+
+    const std::string& FileName() const {
+        return mFileName;
+    }
+
+    /**
+     * @description: read the cache without locking, the file is only ever replaced by rename.
+     * @return: false and empty cache if there is no cache yet.
+     */
+    bool Load(std::vector<char>& cache) const;
+
+    /**
+     * @description: lock, read the current cache, let merge build the new content and replace the file.
+     * @merge: called with the current cache, empty if there is none, return false to keep the file as is.
+     */
+    bool Update(const std::function<bool(const std::vector<char>& current, std::vector<char>& merged)>& merge) const;
+
+protected:
+    std::string mFileName;
+};
+
+/**
+ * @description: <dir>/timing_<envHash>.cache, envHash as in EngineCacheKey.
+ */
+std::string TimingCachePath(const std::string& dir, uint64_t envHash);
+
+#endif
@@ -12,10 +12,22 @@
 #include <iostream>
 #include <numeric>
 #include <algorithm>
+#include <mutex>
+#include <map>
+#include "cuda_runtime.h"
 #include "NvInfer.h"
+#include "InferBackend.h"
+#include "ArenaPlan.h"
+#include "EngineCache.h"
+#include "ProfileRouter.h"
+#include "EngineSweep.h"
+
+#ifndef TRT_NOEXCEPT
+#define TRT_NOEXCEPT
+#endif
 
 class TrtLogger : public nvinfer1::ILogger {
-    void log(Severity severity, const char* msg) override
+    void log(Severity severity, const char* msg) TRT_NOEXCEPT override
     {
         // suppress info-level messages
         if (severity != Severity::kVERBOSE)
@@ -23,7 +35,199 @@ class TrtLogger : public nvinfer1::ILogger {
     }
 };
 
-class Trt {
+class Trt;
+
+/**
+ * @description: IProfiler tensorrt reports the layer times of a context to, forwarded to the LayerProfiler
+ *               attached with SetProfiler.
+ */
+class TrtLayerProfiler : public nvinfer1::IProfiler {
+public:
+    void reportLayerTime(const char* layerName, float ms) TRT_NOEXCEPT override {
+        mProfiler->reportLayerTime(layerName, ms);
+    }
+
+    LayerProfiler* mProfiler = nullptr;
+};
+
+/**
+ * @description: execution context of a Trt engine with its own stream, device bindings, host buffers and
+ *               preprocessor contexts. All mutable state of an inference lives here, one per thread and the
+ *               engine is shared without locks.
+ */
+class TrtContext : public InferContext {
+public:
+    /**
+     * @profileIndex: optimization profile of context in profile bucket 0, -1 for engine without dynamic shape.
+     *                Every context has its own copy of each bucket, see Trt::GetProfileIndex.
+     */
+    TrtContext(Trt& trt, int profileIndex);
+
+    ~TrtContext();
+
+    bool IsValid() const;
+
+    cudaStream_t GetStream() const override;
+
+    void* GetBindingPtr(int bindIndex) const override;
+
+    bool SetBatchSize(int batchSize) override;
+
+    int GetBatchSize() const override;
+
+    Span<float> GetHostBuffer(int bindIndex) override;
+
+    void* GetHostBinding(int bindIndex) override;
+
+    void CopyFromHostToDevice(int bindIndex) override;
+
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) override;
+
+    void CopyFromDeviceToHost(int bindIndex) override;
+
+    void CopyOutputsFromDeviceToHost() override;
+
+    float* GetPreprocessorInput(size_t count) override;
+
+    bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims) override;
+
+    bool ForwardPreprocessor(const TensorDims& inputDims) override;
+
+    void ForwardAsync() override;
+
+    void InferAsync() override;
+
+    void Synchronize() override;
+
+    void SetProfiler(LayerProfiler* profiler) override;
+
+    const InferBackend& GetBackend() const override;
+
+protected:
+    /**
+     * @description: size in byte of the first mBatchSize images of binding.
+     */
+    size_t GetBatchBindingSize(int bindIndex) const;
+
+    /**
+     * @description: convert a kHALF input from its fp32 staging buffer into the pinned host arena.
+     */
+    void StageInput(int bindIndex);
+
+    /**
+     * @description: async copy host arena slice of binding to the device, no conversion.
+     */
+    void CopyHostBindingToDevice(int bindIndex);
+
+    /**
+     * @description: kHALF outputs are converted again on the next GetHostBuffer.
+     */
+    void MarkOutputsStale();
+
+    bool Enqueue();
+
+    /**
+     * @description: enqueue input copies, inference and output copies without graph.
+     */
+    bool EnqueueInfer();
+
+    /**
+     * @description: fill key with what a captured graph depends on, the input shapes and the activation memory,
+     *               any change needs a new graph. Reuses the capacity of key.
+     */
+    void GetGraphKey(std::vector<int64_t>& key);
+
+    bool CaptureGraph(const std::vector<int64_t>& key);
+
+    /**
+     * @description: switch to the context's copy of profile bucket, wait for the stream first. The batch size is
+     *               set again on the new profile.
+     */
+    bool UseBucket(int bucket);
+
+    /**
+     * @description: set input binding dimensions of the current profile for batchSize.
+     */
+    bool ApplyBatchSize(int batchSize);
+
+    /**
+     * @description: make the device of the engine current on the calling thread, every entry point issuing cuda
+     *               work calls it first.
+     */
+    void BindDevice() const;
+
+protected:
+    Trt& mTrt;
+
+    nvinfer1::IExecutionContext* mContext = nullptr;
+
+    cudaStream_t mStream = nullptr;
+
+    int mProfileIndex = 0;
+
+    // creation index, selects the context's copy of every profile bucket
+    int mSlot = 0;
+
+    int mBucket = 0;
+
+    int mBatchSize = 0;
+
+    // slot in SharedActivationMemory, -1 if context own its activation memory
+    int mActivationSlot = -1;
+
+    // all bindings in one device allocation, see Trt::mArenaPlan
+    void* mArena = nullptr;
+
+    std::vector<void*> mBinding;
+
+    // bindings of all profiles passed to enqueue, only the slice of mProfileIndex is set
+    std::vector<void*> mEngineBinding;
+
+    // pinned staging buffer of every binding, same layout as mArena
+    HostBuffer mHostArena;
+
+    // fp32 side of kHALF bindings, empty for others
+    std::vector<HostBuffer> mFloatStaging;
+
+    // kHALF output copied from the device but not yet converted to mFloatStaging
+    std::vector<bool> mStale;
+
+    // instantiated graph of InferAsync per graph key
+    std::map<std::vector<int64_t>, cudaGraphExec_t> mGraphs;
+
+    // key of the current InferAsync, a member so replays do not allocate
+    std::vector<int64_t> mGraphKey;
+
+    // capture failed once, e.g. a plugin is not capturable, InferAsync always run eager
+    bool mGraphFailed = false;
+
+    // see SetProfiler
+    LayerProfiler* mProfiler = nullptr;
+
+    TrtLayerProfiler mTrtProfiler;
+
+    // preprocessor context of every shape bucket bound to the profiles of mSlot, see Trt::CreatePreprocessorContexts
+    std::vector<nvinfer1::IExecutionContext*> mPreprocessorContexts;
+
+    // device input of preprocessor and its pinned staging, grow on demand
+    void* mPreprocessorInput = nullptr;
+
+    size_t mPreprocessorInputSize = 0;
+
+    HostBuffer mPreprocessorStaging;
+
+    // bindings of the preprocessor engine, only the two of the current bucket and slot are set
+    std::vector<void*> mPreprocessorBindings;
+};
+
+/**
+ * @description: tensorrt engine and what is derived from it at CreateEngine: binding metadata, arena plan and
+ *               profile layout. Immutable once CreateEngine and buildPreprocessorEngine returned, so the
+ *               metadata getters are read without locks from any thread and CreateContext may be called
+ *               concurrently. Forward, ForwardAsync, ForwardPreprocessor and the copies of the backend itself
+ *               run on a single built-in context and are not thread-safe, threads use a TrtContext each.
+ */
+class Trt : public InferBackend {
 public:
     /**
      * @description: default constructor, will initialize plugin factory with default parameters.
@@ -38,48 +242,60 @@ public:
      * @engineFile: path to saved engien file will be load or save, if it's empty them will not
      *              save engine file
      * @maxBatchSize: max batch size for inference.
-     * @return: 
+     * @return: false if the engine could neither be deserialized nor built.
      */
-    void CreateEngine(
+    bool CreateEngine(
         const std::string& onnxModel,
         const std::string& engineFile,
         const std::vector<std::string>& customOutput,
         int maxBatchSize,
-        int mode);
+        int mode) override;
     
-    bool buildPreprocessorEngine();
+    bool buildPreprocessorEngine() override;
+
+    /**
+     * @description: resize input with preprocessor engine into binding 0, make sure buildPreprocessorEngine
+     *               is called after CreateEngine.
+     */
+    bool ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims, const cudaStream_t& stream) override;
     /**
      * @description: do inference on engine context, make sure you already copy your data to device memory,
      *               see DataTransfer and CopyFromHostToDevice etc.
      */
-    void Forward();
+    void Forward() override;
 
     /**
      * @description: async inference on engine context
      * @stream cuda stream for async inference and data transfer
      */
-    void ForwardAsync(const cudaStream_t& stream);
+    void ForwardAsync(const cudaStream_t& stream) override;
 
-    void SetBindingDimensions(std::vector<int>& inputDims, int bindIndex);
+    void SetBindingDimensions(std::vector<int>& inputDims, int bindIndex) override;
     /**
      * @description: data transfer between host and device, for example befor Forward, you need
      *               copy input data from host to device, and after Forward, you need to transfer
      *               output result from device to host.
      * @bindIndex binding data index, you can see this in CreateEngine log output.
      */
-    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex);
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) override;
+
+    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex) override;
 
-    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex);
+    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex,const cudaStream_t& stream) override;
 
-    void CopyFromHostToDevice(const std::vector<float>& input, int bindIndex,const cudaStream_t& stream);
+    void CopyFromHostToDevice(const float* input, int bindIndex, const cudaStream_t& stream) override;
 
-    void CopyFromHostToDevice(const float* input, int bindIndex, const cudaStream_t& stream);
+    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex,const cudaStream_t& stream) override;
 
-    void CopyFromDeviceToHost(std::vector<float>& output, int bindIndex,const cudaStream_t& stream);
+    cudaStream_t CreateStream() override;
 
-    void SetDevice(int device);
+    void DestroyStream(cudaStream_t stream) override;
 
-    int GetDevice() const;
+    void SynchronizeStream(const cudaStream_t& stream) override;
+
+    void SetDevice(int device) override;
+
+    int GetDevice() const override;
      
     /**
      * @description: setting a int8 calibrator.To run INT8 calibration for a network with dynamic shapes, calibration optimization profile must be set. Calibration is performed using kOPT values of the profile. Calibration input data size must match this profile.
@@ -92,29 +308,54 @@ public:
      *                  EntropyCalibrator:This is the legacy entropy calibrator.This is less complicated than a legacy calibrator and produces better results. Calibration happens after Layer fusion by default. See kCALIBRATION_BEFORE_FUSION for enabling calibration before fusion.
      *                  LegacyCalibrator:This calibrator is for compatibility with TensorRT 2.0 EA. This calibrator requires user parameterization, and is provided as a fallback option if the other calibrators yield poor results. Calibration happens after Layer fusion by default. See kCALIBRATION_BEFORE_FUSION for enabling calibration before fusion. Users can customize this calibrator to implement percentile max, like 99.99% percentile max is proved to have best accuracy for BERT. For more information, refer to the Integer Quantization for Deep Learning Inference: Principles and Empirical Evaluation paper.
      */
-    void Trt::SetInt8Calibrator(const std::string& calibratorType, int input_w,
+    void SetInt8Calibrator(const std::string& calibratorType, int input_w,
         int input_h,
         const char* img_dir,
-        const char* calib_table_name);
+        const char* calib_table_name) override;
 
     /**
-     * @description: async data tranfer between host and device, see above.
-     * @stream cuda stream for async interface and data transfer.
-     * @return: 
+     * @description: add a profile bucket for inputName, call after SetMaxContexts. Every call adds one bucket,
+     *               e.g. small, medium and large resolutions, requests are routed to the tightest bucket that
+     *               contains their shape. The preprocessor engine gets the same buckets.
      */
     void AddDynamicShapeProfile(int batchSize,
                                 const std::string& inputName,
                                 const std::vector<int>& minDimVec,
                                 const std::vector<int>& optDimVec,
-                                const std::vector<int>& maxDimVec);
+                                const std::vector<int>& maxDimVec) override;
+
+    void SetMaxBatchSize(int max_batch) override;
+
+    void SetMaxContexts(int maxContexts) override;
+
+    void SetShareActivationMemory(bool share) override;
+
+    void SetCudaGraph(bool enable) override;
+
+    void SetEngineCacheDir(const std::string& dir) override;
+
+    void SetBatchProfiles(const std::vector<int>& maxBatches) override;
+
+    void SetHalfIO(bool enable) override;
+
+    void SetInputPrologue(const InputPrologue& prologue) override;
+
+    void SetMaxWorkspaceSize(size_t bytes) override;
+
+    void SetEngineManifest(const std::string& manifest, const std::string& objective, double latencyBudgetMs) override;
 
-    void SetMaxBatchSize(int max_batch);
+    /**
+     * @description: hex of the environment hash of the engine cache key.
+     */
+    std::string GetBuildTarget() const override;
 
     /**
      * @description: get max batch size of build engine.
      * @return: max batch size of build engine.
      */
-    int GetMaxBatchSize() const;
+    int GetMaxBatchSize() const override;
+
+    std::vector<ShapeProfile> GetShapeProfiles() const override;
 
     /**
      * @description: get binding data pointer in device. for example if you want to do some post processing
@@ -122,42 +363,122 @@ public:
      *               use this function to avoid extra data io
      * @return: pointer point to device memory.
      */
-    void* GetBindingPtr(int bindIndex) const;
+    void* GetBindingPtr(int bindIndex) const override;
+
+    /**
+     * @description: tensorrt bindings always live in device memory.
+     */
+    bool BindingIsOnDevice() const override;
 
     /**
      * @description: get binding data size in byte, so maybe you need to divide it by sizeof(T) where T is data type
      *               like float.
      * @return: size in byte.
      */
-    size_t GetBindingSize(int bindIndex) const;
+    size_t GetBindingSize(int bindIndex) const override;
 
     /**
      * @description: get binding dimemsions
      * @return: binding dimemsions, see https://docs.nvidia.com/deeplearning/sdk/tensorrt-api/c_api/classnvinfer1_1_1_dims.html
      */
-    nvinfer1::Dims GetBindingDims(int bindIndex) const;
+    TensorDims GetBindingDims(int bindIndex) const override;
 
     /**
      * @description: get binding data type
      * @return: binding data type, see https://docs.nvidia.com/deeplearning/sdk/tensorrt-api/c_api/namespacenvinfer1.html#afec8200293dc7ed40aca48a763592217
      */
-    nvinfer1::DataType GetBindingDataType(int bindIndex) const;
+    TensorType GetBindingDataType(int bindIndex) const override;
 
     /**
      * @description: get binding name
      */
-    std::string GetBindingName(int bindIndex) const;
+    std::string GetBindingName(int bindIndex) const override;
 
-    int GetNbInputBindings() const;
+    int GetBindingIndex(const std::string& name) const override;
 
-    int GetNbOutputBindings() const;
+    bool BindingIsInput(int bindIndex) const override;
+
+    bool BindingHasBatchAxis(int bindIndex) const override;
+
+    int GetNbBindings() const override;
+
+    int GetNbInputBindings() const override;
+
+    int GetNbOutputBindings() const override;
+
+    /**
+     * @description: create execution context sharing mEngine, every context of a dynamic shape engine need
+     *               its own optimization profile, see AddDynamicShapeProfile.
+     */
+    std::unique_ptr<InferContext> CreateContext() override;
 
 protected:
+    friend class TrtContext;
+
 
     bool DeserializeEngine(const std::string& engineFile);
 
+    /**
+     * @description: cache key of the engine CreateEngine would build from onnxModel with the current options.
+     */
+    EngineCacheKey MakeEngineKey(const std::string& onnxModel, const std::vector<std::string>& customOutput) const;
+
     void BuildEngine();
 
+    /**
+     * @description: add profiles with batch dimension from 1 to mBatchSize if the onnx input has a dynamic batch
+     *               axis and no profile was added by AddDynamicShapeProfile, one profile per context.
+     */
+    void AddDynamicBatchProfiles();
+
+    /**
+     * @description: replace the float NCHW network input by an int8 NHWC input of the same name, followed by
+     *               cast, transpose and a per channel scale layer feeding the former consumers. Only that input
+     *               is int8, the other float layers are constrained to the run mode precision. False if the
+     *               network does not qualify, it is then left untouched.
+     */
+    bool AddInputPrologue();
+
+    /**
+     * @description: apply the entry of SetEngineManifest for this target, max batch size and build options to
+     *               run mode, workspace and batch profiles.
+     * @return: engine file of the entry, empty if there is no manifest or no entry fits.
+     */
+    std::string ApplyEngineManifest(const std::vector<std::string>& customOutput);
+
+    /**
+     * @description: name plugin layers "name [type vX attributes] (input dims) -> (output dims)", the engine
+     *               keeps the name so layer profiles show which plugin and shape a row is. Attributes come from
+     *               plugins implementing PluginDescription.
+     */
+    void LabelPluginLayers();
+
+    /**
+     * @description: max batch size of deserialized engine, explicit batch engines take it from the input binding.
+     */
+    int GetEngineBatchSize() const;
+
+    /**
+     * @description: copy count fp32 values to binding, converted to fp16 first for a kHALF binding.
+     */
+    void CopyFromHostToDevice(const float* input, size_t count, int bindIndex, const cudaStream_t& stream);
+
+    /**
+     * @description: engine profile of context slot in bucket, buckets are added one after another and each
+     *               holds one copy per context, mContext included.
+     */
+    int GetProfileIndex(int bucket, int slot) const;
+
+    /**
+     * @description: tightest profile bucket for a dynamic batch request, 0 if the engine has one bucket.
+     */
+    int SelectBatchBucket(int batchSize) const;
+
+    /**
+     * @description: tightest preprocessor profile for input dimensions, -1 if none contains them.
+     */
+    int SelectShapeBucket(const TensorDims& inputDims) const;
+
     bool BuildEngineWithOnnx(const std::string& onnxModel,
                      const std::string& engineFile,
                      const std::vector<std::string>& customOutput);
@@ -172,6 +493,23 @@ protected:
      */
     void SaveEngine(const std::string& fileName);
 
+    /**
+     * description: create execution context, without device memory if activation memory is shared.
+     * @slot: slot in SharedActivationMemory reserved for the context.
+     */
+    nvinfer1::IExecutionContext* CreateExecutionContext(int slot);
+
+    /**
+     * @description: preprocessor context of every shape bucket bound to the profile copy of slot, empty without
+     *               preprocessor engine or if slot exceeds the contexts it was built for.
+     */
+    std::vector<nvinfer1::IExecutionContext*> CreatePreprocessorContexts(int slot) const;
+
+    /**
+     * @description: index of the first preprocessor binding of the profile of bucket and slot.
+     */
+    int GetPreprocessorBindingOffset(int bucket, int slot) const;
+
 protected:
     TrtLogger mLogger;
 
@@ -186,14 +524,88 @@ protected:
 
     nvinfer1::INetworkDefinition* mNetwork = nullptr;
 
-    nvinfer1::IRuntime* mRuntime = nullptr;
-
     std::vector<nvinfer1::DataType> mBindingDataType;
 
+    // dim 0 of the engine binding is -1 in an explicit batch engine, see BindingHasBatchAxis
+    std::vector<bool> mBindingHasBatch;
+
     int mNbInputBindings = 0;
 
     int mNbOutputBindings = 0;
-public:
+
+    // number of contexts created from mEngine, mContext included
+    int mNbContexts = 0;
+
+    // contexts the engine is built for, see SetMaxContexts
+    int mMaxContexts = 1;
+
+    // engine bindings are replicated per profile, binding i of profile k has index i + k * GetNbBindings()
+    int mNbProfiles = 1;
+
+    // input batch dimension is -1, context set it with SetBatchSize
+    bool mDynamicBatch = false;
+
+    // activation memory of contexts come from SharedActivationMemory
+    bool mShareActivationMemory = false;
+
+    // contexts replay InferAsync from cuda graphs
+    bool mCudaGraph = false;
+
+    // network inputs and outputs are kHALF, see SetHalfIO
+    bool mHalfIO = false;
+
+    // see SetInputPrologue
+    InputPrologue mInputPrologue;
+
+    // scale and shift weights of the prologue scale layer, must outlive the build
+    std::vector<float> mPrologueWeights;
+
+    // see SetEngineCacheDir
+    std::string mEngineCacheDir;
+
+    // see SetMaxWorkspaceSize
+    size_t mWorkspaceSize = 10 << 20;
+
+    // see SetEngineManifest
+    std::string mEngineManifest;
+
+    SweepObjective mManifestObjective = SweepObjective::kLatency;
+
+    double mLatencyBudgetMs = 0;
+
+    // engine being loaded or built, written to the engine file header
+    EngineCacheKey mEngineKey;
+
+    // every AddDynamicShapeProfile call, part of the engine cache key
+    std::string mProfileKey;
+
+    // NCHW buckets of AddDynamicShapeProfile, used for the model and the preprocessor engine
+    std::vector<ShapeProfile> mShapeBuckets;
+
+    // max batch of every bucket of a dynamic batch engine, see SetBatchProfiles
+    std::vector<int> mBatchBuckets;
+
+    // profile buckets of the engine, each with mMaxContexts + 1 copies
+    int mNbBuckets = 1;
+
+    // profiles of the preprocessor engine, one context bound to each
+    std::vector<ShapeProfile> mPreprocessorProfiles;
+
+    // builder timing cache next to the engine file, shared by engines built on the same gpu and tensorrt. Only
+    // read and written with tensorrt 8, tensorrt 7 has no timing cache api
+    std::string mTimingCachePath;
+
+    // binding layout of mArena and of every TrtContext arena
+    ArenaPlan mArenaPlan;
+
+    void* mArena = nullptr;
+
+    // device the engine is loaded on, see SetDevice
+    int mDevice = 0;
+
+    // guards mNbContexts while contexts are created
+    std::mutex mContextMutex;
+
     // batch size
     int mBatchSize;
 
@@ -201,6 +613,7 @@ public:
 
     std::vector<nvinfer1::Dims> mBindingDims;
 
+    // device bindings and context of the backend level calls, slot 0 of every profile bucket
     std::vector<void*> mBinding;
 
     nvinfer1::IExecutionContext* mContext = nullptr;
@@ -210,7 +623,10 @@ public:
     std::vector<std::string> mBindingName;
 
     nvinfer1::ICudaEngine* mPreprocessorEngine = nullptr;
-    nvinfer1::IExecutionContext* mPreprocessorContext = nullptr;
+
+    // slot 0 preprocessor contexts of every shape bucket, used by ForwardPreprocessor of the backend
+    std::vector<nvinfer1::IExecutionContext*> mPreprocessorContexts;
+
     nvinfer1::Dims4 m_minDim;
     nvinfer1::Dims4 m_optDim;
     nvinfer1::Dims4 m_maxDim;
@@ -63,6 +63,7 @@ typedef std::map<std::string, ColorPoint> LabelNameColorMap;
 
 #include <iostream>
 #include <vector>
+#include "InputPrologue.h"
 struct Config
 {
     std::string cfgFile = "configs/yolov3.cfg";
@@ -71,6 +72,22 @@ struct Config
 
     std::string engineFile = "configs/yolov3.engine";
 
+    std::string engineCacheDir = ""; //engines cached here by hash of onnx, build options, tensorrt, gpu and plugins, engineFile is ignored if set
+
+    std::vector<int> batchProfiles; //max batch of every optimization profile of dynamic batch engines, e.g. {1, 4, 8}, batches run on the tightest one
+
+    bool halfIO = false; //fp16 engine inputs and outputs, halves the pcie bytes of every copy, needs mode 1
+
+    InputPrologue inputPrologue; //enable to upload raw BGR bytes, /255 and NHWC->NCHW run in the engine, static input models only
+
+    size_t maxWorkspaceSize = 10 << 20; //gpu scratch memory of tensorrt tactics at build, larger may allow faster tactics
+
+    std::string engineManifest = ""; //manifest of SweepEngines, CreateEngine then picks mode, workspace, batch profiles and engine of this gpu and of the same contextPoolSize, halfIO, inputPrologue and outputs from it
+
+    std::string engineObjective = "latency"; //latency or throughput, which pareto optimal engine of engineManifest is picked
+
+    double latencyBudgetMs = 0; //throughput objective only picks engines at most this slow at batch 1, 0 = no budget
+
     std::string calibration_image_list_file = "configs/images/";
 
     std::vector<std::string> customOutput;
@@ -83,6 +100,28 @@ struct Config
 
     int mode; //012
 
+    std::string backend = "tensorrt"; //tensorrt, cpu
+
+    int device = -1; //gpu the detector runs on, -1 = current device
+
+    std::vector<int> devices; //ReplicaManager loads one replica per listed gpu, device is ignored then
+
+    int contextPoolSize = 1; //number of execution context, concurrent detect() calls
+
+    bool shareActivationMemory = false; //share activation memory with other detectors, only if they never run concurrently
+
+    bool useCudaGraph = false; //replay input copy, inference and output copy from a cuda graph, ignored by cpu backend
+
+    int asyncWorkers = 1; //threads decoding detectAsync() results
+
+    int preprocessThreads = 0; //threads preprocessing the images and row bands of a batch on the shared PreprocessPool, 0 or 1 = calling thread only
+
+    bool letterbox = false; //keep the aspect ratio, resize into the input padded with gray and map boxes and landmarks back exactly, false = stretch to the input size
+
+    int warmupIterations = 0; //synthetic batches per batch profile and resolution bucket run by init() before isReady(), 0 = no warmup
+
+    bool layerProfiling = false; //per layer times of every inference after warmup, runs synchronously without cuda graph, read with layerProfile()
+
     float conf_thresh = 0.6;
 
     float m_NMSThresh = 0.2;
@@ -105,8 +144,6 @@ struct TensorInfo
     std::vector<uint32_t> masks;
     std::vector<float> anchors;
     int bindingIndex{ -1 };
-    std::vector<float> hostBuffer;
-    //float* hostBuffer;
 };
 
 struct BBox
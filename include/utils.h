@@ -14,6 +14,7 @@
 #include "cuda_runtime.h"
 #include <NvInfer.h>
 #include <opencv2/opencv.hpp>
+#include "Letterbox.h"
 
 #define UNUSED(unusedVariable) (void)(unusedVariable)
 // suppress compiler warning: unused parameter
@@ -102,26 +103,10 @@ struct alignas(float) Detection{
     float prob;
 };
 
+// centered letterbox of the calibration images, the same placement as LetterboxTransform at inference
 static inline cv::Mat preprocess_img(cv::Mat img, int input_w, int input_h) {
-    int w, h, x, y;
-    float r_w = input_w / (img.cols * 1.0);
-    float r_h = input_h / (img.rows * 1.0);
-    if (r_h > r_w) {
-        w = input_w;
-        h = r_w * img.rows;
-        x = 0;
-        y = (input_h - h) / 2;
-    }
-    else {
-        w = r_h * img.cols;
-        h = input_h;
-        x = (input_w - w) / 2;
-        y = 0;
-    }
-    cv::Mat re(h, w, CV_8UC3);
-    cv::resize(img, re, re.size(), 0, 0, cv::INTER_LINEAR);
-    cv::Mat out(input_h, input_w, CV_8UC3, cv::Scalar(128, 128, 128));
-    re.copyTo(out(cv::Rect(x, y, re.cols, re.rows)));
+    cv::Mat out;
+    LetterboxTransform::Letterbox(img.size(), cv::Size(input_w, input_h)).Resize(img, out, 128);
     return out;
 }
 
@@ -0,0 +1,66 @@
+#include "ActivationMemory.h"
+#include "utils.h"
+#include "spdlog/spdlog.h"
+
+SharedActivationMemory& SharedActivationMemory::Instance() {
+    static SharedActivationMemory instance;
+    return instance;
+}
+
+// runs with device current and restores the previous one
+template <typename Body>
+static void OnDevice(int device, Body body) {
+    int current = 0;
+    cudaGetDevice(&current);
+    if(current != device) {
+        cudaSetDevice(device);
+    }
+    body();
+    if(current != device) {
+        cudaSetDevice(current);
+    }
+}
+
+SharedActivationMemory::~SharedActivationMemory() {
+    for(auto& entry : mSlots) {
+        Slot& slot = entry.second;
+        if(slot.data != nullptr) {
+            OnDevice(entry.first.first, [&slot]() { cudaFree(slot.data); });
+            slot.data = nullptr;
+        }
+    }
+}
+
+void SharedActivationMemory::Reserve(int device, int slot, size_t size) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    Slot& s = mSlots[std::make_pair(device, slot)];
+    s.reserved = std::max(s.reserved, size);
+}
+
+void* SharedActivationMemory::Get(int device, int slot) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto found = mSlots.find(std::make_pair(device, slot));
+    assert(found != mSlots.end());
+    Slot& s = found->second;
+    if(s.allocated < s.reserved) {
+        OnDevice(device, [&]() {
+            if(s.data != nullptr) {
+                // cudaFree wait for the device, engines sharing the slot never run concurrently anyway
+                safeCudaFree(s.data);
+            }
+            spdlog::info("allocate {} byte shared activation memory for slot {} on device {}", s.reserved, slot, device);
+            s.data = safeCudaMalloc(s.reserved);
+        });
+        s.allocated = s.reserved;
+    }
+    return s.data;
+}
+
+size_t SharedActivationMemory::AllocatedSize() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    size_t size = 0;
+    for(const auto& entry : mSlots) {
+        size += entry.second.allocated;
+    }
+    return size;
+}
@@ -0,0 +1,29 @@
+#include "ArenaPlan.h"
+
+#include <cassert>
+
+ArenaPlan PlanArena(const std::vector<size_t>& sizes, const std::vector<bool>& isInput, size_t alignment) {
+    assert(sizes.size() == isInput.size());
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    ArenaPlan plan;
+    plan.offset.resize(sizes.size(), 0);
+    plan.size = sizes;
+    size_t cursor = 0;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        if(isInput[i]) {
+            plan.offset[i] = cursor;
+            cursor = AlignUp(cursor + sizes[i], alignment);
+        }
+    }
+    plan.outputBegin = cursor;
+    plan.outputEnd = cursor;
+    for(size_t i = 0; i < sizes.size(); i++) {
+        if(!isInput[i]) {
+            plan.offset[i] = cursor;
+            plan.outputEnd = cursor + sizes[i];
+            cursor = AlignUp(cursor + sizes[i], alignment);
+        }
+    }
+    plan.arenaSize = cursor;
+    return plan;
+}
@@ -0,0 +1,47 @@
+#include "AsyncWorker.h"
+#include "spdlog/spdlog.h"
+
+AsyncWorker::AsyncWorker(int nbThreads) {
+    if(nbThreads < 1) {
+        spdlog::warn("async worker thread number {} is invalid, use 1", nbThreads);
+        nbThreads = 1;
+    }
+    for(int i = 0; i < nbThreads; i++) {
+        mThreads.emplace_back(&AsyncWorker::Run, this);
+    }
+}
+
+AsyncWorker::~AsyncWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    for(std::thread& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void AsyncWorker::Post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTasks.push_back(std::move(task));
+    }
+    mCondition.notify_one();
+}
+
+void AsyncWorker::Run() {
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this] { return mStop || !mTasks.empty(); });
+            if(mTasks.empty()) {
+                return;
+            }
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+        task();
+    }
+}
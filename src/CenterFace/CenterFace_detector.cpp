@@ -1,8 +1,15 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "class_timer.hpp"
 struct Result
 {
@@ -14,7 +21,7 @@ typedef std::vector<Result> BatchResult;
 class CenterFaceDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -24,9 +31,12 @@ public:
 	float m_NMSThresh = 0.2;
 	float conf_thresh = 0.2;
 	int _n_yolo_ind = 0;
+	std::string m_InputBlobName;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 public:
 	CenterFaceDectector::CenterFaceDectector()
@@ -35,14 +45,11 @@ public:
 	}
 	CenterFaceDectector::~CenterFaceDectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 
 	struct FaceBox {
@@ -99,34 +106,40 @@ public:
 	}
 
 	std::vector<std::vector<FaceRes>> postProcess(const std::vector<cv::Mat>& vec_Mat,
-		float* output_1, float* output_2, float* output_3, float* output_4,
-		const int& outSize_1, const int& outSize_2, const int& outSize_3, const int& outSize_4) {
+		const TensorView<float>& output_1, const TensorView<float>& output_2, const TensorView<float>& output_3, const TensorView<float>& output_4) {
 		std::vector<std::vector<FaceRes>> vec_result;
 		int index = 0;
 		for (const cv::Mat& src_img : vec_Mat)
 		{
 			std::vector<FaceRes> result;
 			int image_size = m_InputW / 4 * m_InputH / 4;
-			float ratio = float(src_img.cols) / float(m_InputW) > float(src_img.rows) / float(m_InputH) ? float(src_img.cols) / float(m_InputW) : float(src_img.rows) / float(m_InputH);
-			float* score = output_1 + index * outSize_1;
-			float* scale0 = output_2 + index * outSize_2;
-			float* scale1 = scale0 + image_size;
-			float* offset0 = output_3 + index * outSize_3;
-			float* offset1 = offset0 + image_size;
-			float* landmark = output_4 + index * outSize_4;
+			LetterboxTransform transform = inputTransform(src_img);
+			const float* score = output_1.Batch(index).data();
+			const float* scale0 = output_2.Batch(index).data();
+			const float* scale1 = scale0 + image_size;
+			const float* offset0 = output_3.Batch(index).data();
+			const float* offset1 = offset0 + image_size;
+			const float* landmark = output_4.Batch(index).data();
 			for (int i = 0; i < m_InputH / 4; i++) {
 				for (int j = 0; j < m_InputW / 4; j++) {
 					int current = i * m_InputW / 4 + j;
 					if (score[current] > conf_thresh) {
 						FaceRes headbox;
 						headbox.confidence = score[current];
-						headbox.face_box.h = std::exp(scale0[current]) * 4 * ratio;
-						headbox.face_box.w = std::exp(scale1[current]) * 4 * ratio;
-						headbox.face_box.x = ((float)j + offset1[current] + 0.5f) * 4 * ratio;
-						headbox.face_box.y = ((float)i + offset0[current] + 0.5f) * 4 * ratio;
+						//input pixels first, landmarks are relative to the box
+						headbox.face_box.h = std::exp(scale0[current]) * 4;
+						headbox.face_box.w = std::exp(scale1[current]) * 4;
+						headbox.face_box.x = ((float)j + offset1[current] + 0.5f) * 4;
+						headbox.face_box.y = ((float)i + offset0[current] + 0.5f) * 4;
 						for (int k = 0; k < 5; k++)
 							headbox.keypoints.emplace_back(cv::Point2f(headbox.face_box.x - headbox.face_box.w / 2 + landmark[(2 * k + 1) * image_size + current] * headbox.face_box.w,
 								headbox.face_box.y - headbox.face_box.h / 2 + landmark[(2 * k) * image_size + current] * headbox.face_box.h));
+						//then the exact inverse of the letterbox to image pixels
+						transform.PointsToImage(headbox.keypoints.data(), headbox.keypoints.size());
+						headbox.face_box.x = transform.ToImageX(headbox.face_box.x);
+						headbox.face_box.y = transform.ToImageY(headbox.face_box.y);
+						headbox.face_box.w *= transform.GetScaleX();
+						headbox.face_box.h *= transform.GetScaleY();
 						result.push_back(headbox);
 					}
 				}
@@ -140,25 +153,32 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputC = onnx_net->mBindingDims[0].d[1];
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[4] - 5;
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_InputC = onnx_net->GetBindingDims(inputIndex).d[1];
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[2];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[3];
+		std::vector<int> outputs;
+		for (int m_face_ind = 0; m_face_ind < onnx_net->GetNbBindings(); m_face_ind++)
 		{
-			TensorInfo outputTensor;
-			if (m_yolo_ind < 4)
+			if (!onnx_net->BindingIsInput(m_face_ind))
+			{
+				outputs.push_back(m_face_ind);
+			}
+		}
+		//heads are picked by name when the export names them. m_OutputTensors is heatmap, scale, offset, landmark
+		const std::vector<std::vector<std::string>> heads = { { "heatmap" }, { "scale" }, { "offset" }, { "landmark" } };
+		for (size_t k = 0; k < heads.size(); k++)
+		{
+			int index = onnx_net->FindOutputBinding(heads[k]);
+			if (index == -1)
 			{
-				outputTensor.masks = std::vector<uint32_t>{ uint32_t(3 * (m_yolo_ind - 1)),uint32_t(3 * (m_yolo_ind - 1) + 1),uint32_t(3 * (m_yolo_ind - 1) + 2) };
-				outputTensor.numBBoxes = onnx_net->mBindingDims[m_yolo_ind].d[1];
-				outputTensor.grid_w = onnx_net->mBindingDims[m_yolo_ind].d[2];
-				outputTensor.grid_h = onnx_net->mBindingDims[m_yolo_ind].d[3];
-				outputTensor.numClasses = onnx_net->mBindingDims[m_yolo_ind].d[4] - 5;
-				outputTensor.stride_h = m_InputH / outputTensor.grid_h;
-				outputTensor.stride_w = m_InputW / outputTensor.grid_w;
+				index = outputs.at(k);
 			}
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float) / onnx_net->mBindingDims[m_yolo_ind].d[0];
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			TensorInfo outputTensor;
+			outputTensor.volume = onnx_net->GetBindingSize(index) / sizeof(float) / onnx_net->GetBindingDims(index).d[0];
+			outputTensor.blobName = onnx_net->GetBindingName(index);
 			m_OutputTensors.push_back(outputTensor);
 		}
 	}
@@ -167,9 +187,8 @@ public:
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -186,8 +205,19 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
@@ -195,69 +225,74 @@ public:
 		m_BatchSize = config.maxBatchSize;
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	void doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
+	}
+
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
-	std::vector<float> prepareImage(std::vector<cv::Mat> vec_img) {
-		std::vector<float> result(m_BatchSize * m_InputW * m_InputH * m_InputC);
-		float* data = result.data();
-		int index = 0;
-		for (const cv::Mat& src_img : vec_img)
-		{
-			if (!src_img.data)
-				continue;
-			float ratio = float(m_InputW) / float(src_img.cols) < float(m_InputH) / float(src_img.rows) ? float(m_InputW) / float(src_img.cols) : float(m_InputH) / float(src_img.rows);
-			cv::Mat flt_img = cv::Mat::zeros(cv::Size(m_InputW, m_InputH), CV_8UC3);
-			cv::Mat rsz_img;
-			cv::resize(src_img, rsz_img, cv::Size(), ratio, ratio);
-			rsz_img.copyTo(flt_img(cv::Rect(0, 0, rsz_img.cols, rsz_img.rows)));
-			flt_img.convertTo(flt_img, CV_32FC3);
+	//centerface is always letterboxed into the top left corner, prepareImage and postProcess build the same
+	//transform so faces and landmarks map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
+	{
+		return LetterboxTransform::Letterbox(img.size(), cv::Size(m_InputW, m_InputH), false);
+	}
 
-			//HWC TO CHW
-			int channelLength = m_InputW * m_InputH;
-			std::vector<cv::Mat> split_img = {
-					cv::Mat(m_InputW, m_InputH, CV_32FC1, data + channelLength * (index + 2)),
-					cv::Mat(m_InputW, m_InputH, CV_32FC1, data + channelLength * (index + 1)),
-					cv::Mat(m_InputW, m_InputH, CV_32FC1, data + channelLength * index)
-			};
-			index += 3;
-			cv::split(flt_img, split_img);
-		}
-		return result;
+	void prepareImage(const std::vector<cv::Mat>& vec_img, Span<float> input) {
+		assert(vec_img.size() * m_InputW * m_InputH * m_InputC <= input.size());
+		//each image into its own slot, an empty one is reported and leaves its slot as is
+		//resized into the top left corner, zero padded, HWC BGR to CHW RGB in one pass
+		PreprocessParams params;
+		params.swapRB = true;
+		PreprocessBatch(vec_img, [&](int i) { return inputTransform(vec_img[i]).Apply(params, 0); }, input.data(), _config.preprocessThreads);
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		//views cover the current batch, size it before writing the input
+		context.SetBatchSize(vec_image.size());
+		prepareImage(vec_image, context.GetInputBuffer());
+	}
+
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
 		vec_batch_result.clear();
 		vec_batch_result.reserve(vec_image.size());
-		std::vector<float> data = prepareImage(vec_image);
-		Timer timer;
-		timer.reset();
-		doInference(data, vec_image.size());
-		double t = timer.elapsed();
-		std::cout << "doInference:" << t << "ms" << std::endl;
-		auto faces = postProcess(vec_image, m_OutputTensors[0].hostBuffer.data(), m_OutputTensors[1].hostBuffer.data(),
-			m_OutputTensors[2].hostBuffer.data(), m_OutputTensors[3].hostBuffer.data(),
-			m_OutputTensors[0].hostBuffer.size(), m_OutputTensors[1].hostBuffer.size(),
-			m_OutputTensors[2].hostBuffer.size(), m_OutputTensors[3].hostBuffer.size());
+		auto faces = postProcess(vec_image, context.HostTensor<float>(m_OutputTensors[0].blobName), context.HostTensor<float>(m_OutputTensors[1].blobName),
+			context.HostTensor<float>(m_OutputTensors[2].blobName), context.HostTensor<float>(m_OutputTensors[3].blobName));
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto remaining = faces[i];
@@ -278,6 +313,50 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		Timer timer;
+		timer.reset();
+		doInference(*context, vec_image.size());
+		double t = timer.elapsed();
+		std::cout << "doInference:" << t << "ms" << std::endl;
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_CenterFaceDectector()
@@ -293,6 +372,7 @@ int main_CenterFaceDectector()
 	m_config.m_NMSThresh = 0.2;
 	m_config.calibration_width = 640;
 	m_config.calibration_height = 640;
+	m_config.warmupIterations = 2;
 	m_CenterFaceDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -318,10 +398,8 @@ int main_CenterFaceDectector()
 		//double t = timer.elapsed();
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 
 		//disp
 		for (int j = 0; j < batch_img.size(); ++j)
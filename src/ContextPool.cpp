@@ -0,0 +1,128 @@
+#include "ContextPool.h"
+#include "spdlog/spdlog.h"
+
+#include <cassert>
+
+ContextPool::Lease::Lease(ContextPool* pool, int index) : mPool(pool), mIndex(index) {
+}
+
+ContextPool::Lease::Lease(Lease&& other) : mPool(other.mPool), mIndex(other.mIndex) {
+    other.mPool = nullptr;
+    other.mIndex = -1;
+}
+
+ContextPool::Lease& ContextPool::Lease::operator=(Lease&& other) {
+    if(this != &other) {
+        Release();
+        mPool = other.mPool;
+        mIndex = other.mIndex;
+        other.mPool = nullptr;
+        other.mIndex = -1;
+    }
+    return *this;
+}
+
+ContextPool::Lease::~Lease() {
+    Release();
+}
+
+InferContext* ContextPool::Lease::operator->() const {
+    assert(mPool != nullptr);
+    return mPool->GetContext(mIndex);
+}
+
+InferContext& ContextPool::Lease::operator*() const {
+    assert(mPool != nullptr);
+    return *mPool->GetContext(mIndex);
+}
+
+void ContextPool::Lease::Release() {
+    if(mPool != nullptr) {
+        mPool->Release(mIndex);
+        mPool = nullptr;
+        mIndex = -1;
+    }
+}
+
+ContextPool::ContextPool(const std::shared_ptr<InferBackend>& backend, int poolSize) : mBackend(backend) {
+    assert(mBackend != nullptr);
+    if(poolSize < 1) {
+        spdlog::warn("context pool size {} is invalid, use 1", poolSize);
+        poolSize = 1;
+    }
+    spdlog::info("create {} execution context...", poolSize);
+    for(int i = 0; i < poolSize; i++) {
+        std::unique_ptr<InferContext> context = mBackend->CreateContext();
+        if(context == nullptr) {
+            spdlog::error("could not create execution context {}, pool size is {}", i, mContexts.size());
+            break;
+        }
+        mContexts.push_back(std::move(context));
+        mFreeList.push_back(i);
+    }
+    assert(!mContexts.empty());
+}
+
+ContextPool::~ContextPool() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if(mFreeList.size() != mContexts.size()) {
+        spdlog::warn("context pool destroyed with {} context in use", mContexts.size() - mFreeList.size());
+    }
+}
+
+ContextPool::Lease ContextPool::Acquire() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this] { return !mFreeList.empty(); });
+    int index = mFreeList.back();
+    mFreeList.pop_back();
+    return Lease(this, index);
+}
+
+void ContextPool::Release(int index) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFreeList.push_back(index);
+    }
+    mCondition.notify_one();
+}
+
+int ContextPool::Size() const {
+    return static_cast<int>(mContexts.size());
+}
+
+InferContext* ContextPool::GetContext(int index) const {
+    return mContexts[index].get();
+}
+
+void ContextPool::EnableLayerProfiling(int maxTraceRuns) {
+    DisableLayerProfiling();
+    for(size_t i = 0; i < mContexts.size(); i++) {
+        mProfilers.push_back(std::unique_ptr<LayerProfiler>(new LayerProfiler(maxTraceRuns)));
+        mContexts[i]->SetProfiler(mProfilers.back().get());
+    }
+    spdlog::info("layer profiling enabled on {} context", mContexts.size());
+}
+
+void ContextPool::DisableLayerProfiling() {
+    if(mProfilers.empty()) {
+        return;
+    }
+    for(auto& context : mContexts) {
+        context->SetProfiler(nullptr);
+    }
+    mProfilers.clear();
+}
+
+LayerProfile ContextPool::GetLayerProfile() const {
+    LayerProfile profile;
+    for(size_t i = 0; i < mProfilers.size(); i++) {
+        profile.Merge(mProfilers[i]->GetProfile(), static_cast<int>(i));
+    }
+    return profile;
+}
+
+void ContextPool::ResetLayerProfiling() {
+    for(auto& profiler : mProfilers) {
+        profiler->Reset();
+    }
+}
@@ -0,0 +1,694 @@
+#include "CpuBackend.h"
+#include "spdlog/spdlog.h"
+
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <iterator>
+
+// utils.h pulls in cuda and tensorrt, the cpu backend builds without them
+#ifndef UNUSED
+#define UNUSED(unusedVariable) (void)(unusedVariable)
+#endif
+
+namespace {
+
+struct OnnxValueInfo {
+    std::string name;
+    // -1 for symbolic dimension
+    std::vector<int64_t> dims;
+};
+
+// minimal protobuf wire format reader, only enough to walk the onnx ModelProto graph inputs and outputs
+// so the cpu backend has no dependency on onnx/protobuf headers.
+class ProtoReader {
+public:
+    ProtoReader(const uint8_t* data, size_t size) : mPtr(data), mEnd(data + size) {}
+
+    bool Next(uint32_t& field, uint32_t& wireType) {
+        if(!mValid || mPtr >= mEnd) {
+            return false;
+        }
+        uint64_t key = Varint();
+        field = static_cast<uint32_t>(key >> 3);
+        wireType = static_cast<uint32_t>(key & 7);
+        return mValid;
+    }
+
+    uint64_t Varint() {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64 && mPtr < mEnd; shift += 7) {
+            uint8_t byte = *mPtr++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        mValid = false;
+        return 0;
+    }
+
+    ProtoReader Message() {
+        uint64_t size = Varint();
+        if(!mValid || size > static_cast<uint64_t>(mEnd - mPtr)) {
+            mValid = false;
+            return ProtoReader(mEnd, 0);
+        }
+        ProtoReader sub(mPtr, static_cast<size_t>(size));
+        mPtr += size;
+        return sub;
+    }
+
+    std::string String() {
+        ProtoReader sub = Message();
+        return std::string(reinterpret_cast<const char*>(sub.mPtr), reinterpret_cast<const char*>(sub.mEnd));
+    }
+
+    void Skip(uint32_t wireType) {
+        switch(wireType) {
+            case 0: Varint(); break;
+            case 1: Advance(8); break;
+            case 2: Message(); break;
+            case 5: Advance(4); break;
+            default: mValid = false; break;
+        }
+    }
+
+    bool Valid() const {
+        return mValid;
+    }
+
+private:
+    void Advance(size_t n) {
+        if(n > static_cast<size_t>(mEnd - mPtr)) {
+            mValid = false;
+            mPtr = mEnd;
+            return;
+        }
+        mPtr += n;
+    }
+
+    const uint8_t* mPtr;
+    const uint8_t* mEnd;
+    bool mValid = true;
+};
+
+// ValueInfoProto{1:name, 2:TypeProto{1:Tensor{2:TensorShapeProto{1:Dimension{1:dim_value, 2:dim_param}}}}}
+OnnxValueInfo ParseValueInfo(ProtoReader reader) {
+    OnnxValueInfo info;
+    uint32_t field, wireType;
+    while(reader.Next(field, wireType)) {
+        if(field == 1 && wireType == 2) {
+            info.name = reader.String();
+        } else if(field == 2 && wireType == 2) {
+            ProtoReader type = reader.Message();
+            while(type.Next(field, wireType)) {
+                if(field != 1 || wireType != 2) {
+                    type.Skip(wireType);
+                    continue;
+                }
+                ProtoReader tensor = type.Message();
+                while(tensor.Next(field, wireType)) {
+                    if(field != 2 || wireType != 2) {
+                        tensor.Skip(wireType);
+                        continue;
+                    }
+                    ProtoReader shape = tensor.Message();
+                    while(shape.Next(field, wireType)) {
+                        if(field != 1 || wireType != 2) {
+                            shape.Skip(wireType);
+                            continue;
+                        }
+                        ProtoReader dim = shape.Message();
+                        int64_t value = -1;
+                        while(dim.Next(field, wireType)) {
+                            if(field == 1 && wireType == 0) {
+                                value = static_cast<int64_t>(dim.Varint());
+                            } else {
+                                dim.Skip(wireType);
+                            }
+                        }
+                        info.dims.push_back(value);
+                    }
+                }
+            }
+        } else {
+            reader.Skip(wireType);
+        }
+    }
+    return info;
+}
+
+// TensorProto{8:name}
+std::string ParseTensorName(ProtoReader reader) {
+    std::string name;
+    uint32_t field, wireType;
+    while(reader.Next(field, wireType)) {
+        if(field == 8 && wireType == 2) {
+            name = reader.String();
+        } else {
+            reader.Skip(wireType);
+        }
+    }
+    return name;
+}
+
+// ModelProto{7:GraphProto{5:initializer, 11:input, 12:output}}, old opsets list initializers as graph input too
+bool ParseOnnxGraph(const std::string& onnxModel,
+                    std::vector<OnnxValueInfo>& inputs,
+                    std::vector<OnnxValueInfo>& outputs) {
+    std::ifstream in(onnxModel.c_str(), std::ifstream::binary);
+    if(!in.is_open()) {
+        return false;
+    }
+    std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ProtoReader model(buffer.data(), buffer.size());
+    std::set<std::string> initializers;
+    std::vector<OnnxValueInfo> graphInputs;
+    uint32_t field, wireType;
+    while(model.Next(field, wireType)) {
+        if(field != 7 || wireType != 2) {
+            model.Skip(wireType);
+            continue;
+        }
+        ProtoReader graph = model.Message();
+        while(graph.Next(field, wireType)) {
+            if(field == 5 && wireType == 2) {
+                initializers.insert(ParseTensorName(graph.Message()));
+            } else if(field == 11 && wireType == 2) {
+                graphInputs.push_back(ParseValueInfo(graph.Message()));
+            } else if(field == 12 && wireType == 2) {
+                outputs.push_back(ParseValueInfo(graph.Message()));
+            } else {
+                graph.Skip(wireType);
+            }
+        }
+        if(!graph.Valid()) {
+            return false;
+        }
+    }
+    for(const auto& input : graphInputs) {
+        if(initializers.find(input.name) == initializers.end()) {
+            inputs.push_back(input);
+        }
+    }
+    return model.Valid();
+}
+
+} // namespace
+
+CpuBackend::CpuBackend() {
+}
+
+CpuBackend::~CpuBackend() {
+}
+
+bool CpuBackend::CreateEngine(
+        const std::string& onnxModel,
+        const std::string& engineFile,
+        const std::vector<std::string>& customOutput,
+        int maxBatchSize,
+        int mode) {
+    UNUSED(engineFile);
+    mBatchSize = maxBatchSize;
+    if(mode != 0) {
+        spdlog::warn("cpu backend only support fp32, run mode {} is ignored", mode);
+    }
+    if(!InitEngine(onnxModel, customOutput)) {
+        spdlog::error("error: could not load onnx model {} with opencv dnn", onnxModel);
+        return false;
+    }
+    return true;
+}
+
+bool CpuBackend::InitEngine(const std::string& onnxModel, const std::vector<std::string>& customOutput) {
+    spdlog::info("load onnx model {} with opencv dnn...", onnxModel);
+    std::vector<OnnxValueInfo> inputs, outputs;
+    if(!ParseOnnxGraph(onnxModel, inputs, outputs) || inputs.empty()) {
+        spdlog::error("could not parse onnx graph of {}", onnxModel);
+        return false;
+    }
+    mNet = cv::dnn::readNetFromONNX(onnxModel);
+    if(mNet.empty()) {
+        return false;
+    }
+    mNet.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+    mNet.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+
+    mOutputName = customOutput;
+    if(mOutputName.empty()) {
+        for(const auto& output : outputs) {
+            mOutputName.push_back(output.name);
+        }
+    }
+    if(mOutputName.empty()) {
+        mOutputName = mNet.getUnconnectedOutLayersNames();
+    }
+
+    // inputs first then outputs, the same order tensorrt give to onnx bindings
+    for(const auto& input : inputs) {
+        TensorDims dims;
+        dims.nbDims = static_cast<int>(input.dims.size());
+        for(int j = 0; j < dims.nbDims; j++) {
+            int64_t d = input.dims[j];
+            if(d <= 0 && j == 0) {
+                mDynamicBatch = true;
+                d = mBatchSize;
+            } else if(d <= 0 && j - 1 < static_cast<int>(mOptDims.size())) {
+                d = mOptDims[j - 1];
+            } else if(d <= 0) {
+                spdlog::error("dynamic dimension {} of input {} is not supported by cpu backend", j, input.name);
+                return false;
+            }
+            dims.d[j] = static_cast<int>(d);
+        }
+        mBindingName.push_back(input.name);
+        mBindingDims.push_back(dims);
+        mBindingIsInput.push_back(true);
+        mNbInputBindings++;
+    }
+
+    // probe inference with zero input to resolve output shapes
+    for(int i = 0; i < mNbInputBindings; i++) {
+        const TensorDims& dims = mBindingDims[i];
+        cv::Mat blob(dims.nbDims, dims.d, CV_32F, cv::Scalar(0));
+        mNet.setInput(blob, mBindingName[i]);
+    }
+    std::vector<cv::Mat> outs;
+    mNet.forward(outs, mOutputName);
+    for(size_t k = 0; k < outs.size(); k++) {
+        TensorDims dims;
+        dims.nbDims = outs[k].dims;
+        for(int j = 0; j < dims.nbDims; j++) {
+            dims.d[j] = outs[k].size[j];
+        }
+        mBindingName.push_back(mOutputName[k]);
+        mBindingDims.push_back(dims);
+        mBindingIsInput.push_back(false);
+        mNbOutputBindings++;
+    }
+
+    if(mInputPrologue.enable && mNbInputBindings == 1 && mBindingDims[0].nbDims == 4) {
+        // same binding as the tensorrt engine, int8 NHWC under the onnx input name
+        mPrologueInput = 0;
+        mPrologueDims = mBindingDims[0];
+        mBindingDims[0] = TensorDims{4, {mPrologueDims.d[0], mPrologueDims.d[2], mPrologueDims.d[3], mPrologueDims.d[1]}};
+        mPrologueBlob.resize(volume(mPrologueDims));
+    } else if(mInputPrologue.enable) {
+        spdlog::warn("input prologue needs a single 4-D input, keep the float input");
+    }
+
+    int nbBindings = GetNbBindings();
+    mBinding.resize(nbBindings);
+    mBindingSize.resize(nbBindings);
+    for(int i = 0; i < nbBindings; i++) {
+        const TensorDims& dims = mBindingDims[i];
+        size_t elementSize = i == mPrologueInput ? sizeof(int8_t) : sizeof(float);
+        int64_t totalSize = volume(dims) * mBatchSize * elementSize / dims.d[0];
+        mBindingSize[i] = totalSize;
+        mBinding[i].resize((totalSize + sizeof(float) - 1) / sizeof(float));
+        spdlog::info("{}: binding bindIndex: {}, name: {}, size in byte: {}",
+                     mBindingIsInput[i] ? "input" : "output", i, mBindingName[i], totalSize);
+    }
+    return true;
+}
+
+cv::Mat CpuBackend::BindingToBlob(float* binding, int bindIndex, int batchSize) {
+    TensorDims dims = mBindingDims[bindIndex];
+    dims.d[0] = batchSize;
+    return cv::Mat(dims.nbDims, dims.d, CV_32F, binding);
+}
+
+void CpuBackend::Run(const std::vector<float*>& binding, int batchSize, LayerProfiler* profiler) {
+    if(!mDynamicBatch) {
+        batchSize = mBatchSize;
+    }
+    std::lock_guard<std::mutex> lock(mNetMutex);
+    for(int i = 0; i < mNbInputBindings; i++) {
+        if(i != mPrologueInput) {
+            mNet.setInput(BindingToBlob(binding[i], i, batchSize), mBindingName[i]);
+            continue;
+        }
+        TensorDims dims = mPrologueDims;
+        dims.d[0] = batchSize;
+        RunInputPrologue(mInputPrologue, reinterpret_cast<const int8_t*>(binding[i]), batchSize, dims.d[2], dims.d[3],
+                         dims.d[1], mPrologueBlob.data());
+        mNet.setInput(cv::Mat(dims.nbDims, dims.d, CV_32F, mPrologueBlob.data()), mBindingName[i]);
+    }
+    std::vector<cv::Mat> outs;
+    mNet.forward(outs, mOutputName);
+    if(profiler != nullptr) {
+        // ticks of every layer of the last forward, layer ids start at 1 after the input layer
+        std::vector<double> ticks;
+        mNet.getPerfProfile(ticks);
+        std::vector<std::string> names = mNet.getLayerNames();
+        double msPerTick = 1000.0 / cv::getTickFrequency();
+        for(size_t k = 0; k < ticks.size() && k < names.size(); k++) {
+            profiler->reportLayerTime(names[k].c_str(), static_cast<float>(ticks[k] * msPerTick));
+        }
+        profiler->EndRun();
+    }
+    for(size_t k = 0; k < outs.size(); k++) {
+        int bindIndex = mNbInputBindings + static_cast<int>(k);
+        cv::Mat out = outs[k].isContinuous() ? outs[k] : outs[k].clone();
+        size_t bytes = std::min(out.total() * out.elemSize(), mBindingSize[bindIndex]);
+        memcpy(binding[bindIndex], out.data, bytes);
+    }
+}
+
+bool CpuBackend::Resize(const float* input, const TensorDims& inputDims, float* output) {
+    const TensorDims& dims = mBindingDims[GetInputBindingIndex()];
+    assert(inputDims.nbDims == 4 && dims.nbDims == 4);
+    int batch = std::min(inputDims.d[0], mBatchSize);
+    int channel = std::min(inputDims.d[1], dims.d[1]);
+    for(int n = 0; n < batch; n++) {
+        for(int c = 0; c < channel; c++) {
+            float* src = const_cast<float*>(input) + (n * inputDims.d[1] + c) * inputDims.d[2] * inputDims.d[3];
+            float* dst = output + (n * dims.d[1] + c) * dims.d[2] * dims.d[3];
+            cv::Mat srcPlane(inputDims.d[2], inputDims.d[3], CV_32FC1, src);
+            cv::Mat dstPlane(dims.d[2], dims.d[3], CV_32FC1, dst);
+            cv::resize(srcPlane, dstPlane, cv::Size(dims.d[3], dims.d[2]), 0, 0, cv::INTER_LINEAR);
+        }
+    }
+    return true;
+}
+
+bool CpuBackend::buildPreprocessorEngine() {
+    return true;
+}
+
+bool CpuBackend::ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims, const StreamHandle& stream) {
+    UNUSED(stream);
+    assert(static_cast<size_t>(volume(inputDims)) <= input.size());
+    return Resize(input.data(), inputDims, mBinding[GetInputBindingIndex()].data());
+}
+
+void CpuBackend::Forward() {
+    std::vector<float*> binding(mBinding.size());
+    for(size_t i = 0; i < mBinding.size(); i++) {
+        binding[i] = mBinding[i].data();
+    }
+    Run(binding, mBatchSize);
+}
+
+void CpuBackend::ForwardAsync(const StreamHandle& stream) {
+    UNUSED(stream);
+    Forward();
+}
+
+void CpuBackend::SetBindingDimensions(std::vector<int>& inputDims, int bindIndex) {
+    TensorDims& dims = mBindingDims[bindIndex];
+    dims.nbDims = static_cast<int>(inputDims.size()) + 1;
+    for(size_t j = 0; j < inputDims.size(); j++) {
+        dims.d[j + 1] = inputDims[j];
+    }
+    mBindingSize[bindIndex] = volume(dims) * mBatchSize * sizeof(float) / dims.d[0];
+    mBinding[bindIndex].resize(mBindingSize[bindIndex] / sizeof(float));
+}
+
+void CpuBackend::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) {
+    assert(input.size()*sizeof(float) <= mBindingSize[bindIndex]);
+    memcpy(mBinding[bindIndex].data(), input.data(), std::min(input.size()*sizeof(float), mBindingSize[bindIndex]));
+}
+
+void CpuBackend::CopyFromDeviceToHost(std::vector<float>& output, int bindIndex) {
+    output.resize(mBindingSize[bindIndex]/sizeof(float));
+    memcpy(output.data(), mBinding[bindIndex].data(), mBindingSize[bindIndex]);
+}
+
+void CpuBackend::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex, const StreamHandle& stream) {
+    UNUSED(stream);
+    CopyFromHostToDevice(input, bindIndex);
+}
+
+void CpuBackend::CopyFromHostToDevice(const float* input, int bindIndex, const StreamHandle& stream) {
+    UNUSED(stream);
+    memcpy(mBinding[bindIndex].data(), input, mBindingSize[bindIndex]);
+}
+
+void CpuBackend::CopyFromDeviceToHost(std::vector<float>& output, int bindIndex, const StreamHandle& stream) {
+    UNUSED(stream);
+    CopyFromDeviceToHost(output, bindIndex);
+}
+
+StreamHandle CpuBackend::CreateStream() {
+    return nullptr;
+}
+
+void CpuBackend::DestroyStream(StreamHandle stream) {
+    UNUSED(stream);
+}
+
+void CpuBackend::SynchronizeStream(const StreamHandle& stream) {
+    UNUSED(stream);
+}
+
+void CpuBackend::SetDevice(int device) {
+    // no cuda device, the id is only kept so replicas on mock devices can be told apart
+    mDevice = device;
+}
+
+int CpuBackend::GetDevice() const {
+    return mDevice;
+}
+
+void CpuBackend::SetInt8Calibrator(const std::string& calibratorType, int input_w,
+                                   int input_h,
+                                   const char* img_dir,
+                                   const char* calib_table_name) {
+    UNUSED(calibratorType);
+    UNUSED(input_w);
+    UNUSED(input_h);
+    UNUSED(img_dir);
+    UNUSED(calib_table_name);
+    spdlog::warn("cpu backend run in fp32, int8 calibrator is ignored");
+}
+
+void CpuBackend::AddDynamicShapeProfile(int batchSize,
+                                        const std::string& inputName,
+                                        const std::vector<int>& minDimVec,
+                                        const std::vector<int>& optDimVec,
+                                        const std::vector<int>& maxDimVec) {
+    UNUSED(batchSize);
+    UNUSED(minDimVec);
+    UNUSED(maxDimVec);
+    spdlog::warn("cpu backend use static input shape, dynamic input {} run at opt shape of profile", inputName);
+    mOptDims = optDimVec;
+}
+
+void CpuBackend::SetMaxBatchSize(int max_batch) {
+    mBatchSize = max_batch;
+}
+
+void CpuBackend::SetMaxContexts(int maxContexts) {
+    UNUSED(maxContexts);
+}
+
+void CpuBackend::SetShareActivationMemory(bool share) {
+    UNUSED(share);
+}
+
+void CpuBackend::SetCudaGraph(bool enable) {
+    UNUSED(enable);
+}
+
+void CpuBackend::SetEngineCacheDir(const std::string& dir) {
+    UNUSED(dir);
+}
+
+void CpuBackend::SetBatchProfiles(const std::vector<int>& maxBatches) {
+    UNUSED(maxBatches);
+}
+
+void CpuBackend::SetHalfIO(bool enable) {
+    UNUSED(enable);
+}
+
+void CpuBackend::SetInputPrologue(const InputPrologue& prologue) {
+    mInputPrologue = prologue;
+}
+
+void CpuBackend::SetMaxWorkspaceSize(size_t bytes) {
+    UNUSED(bytes);
+}
+
+void CpuBackend::SetEngineManifest(const std::string& manifest, const std::string& objective, double latencyBudgetMs) {
+    UNUSED(manifest);
+    UNUSED(objective);
+    UNUSED(latencyBudgetMs);
+}
+
+std::string CpuBackend::GetBuildTarget() const {
+    return "cpu";
+}
+
+int CpuBackend::GetMaxBatchSize() const {
+    return mBatchSize;
+}
+
+std::vector<ShapeProfile> CpuBackend::GetShapeProfiles() const {
+    // every input runs at the opt shape, there is a single resolution
+    return {};
+}
+
+bool CpuBackend::BindingIsOnDevice() const {
+    return false;
+}
+
+void* CpuBackend::GetBindingPtr(int bindIndex) const {
+    return const_cast<float*>(mBinding[bindIndex].data());
+}
+
+size_t CpuBackend::GetBindingSize(int bindIndex) const {
+    return mBindingSize[bindIndex];
+}
+
+TensorDims CpuBackend::GetBindingDims(int bindIndex) const {
+    return mBindingDims[bindIndex];
+}
+
+TensorType CpuBackend::GetBindingDataType(int bindIndex) const {
+    return bindIndex == mPrologueInput ? TensorType::kINT8 : TensorType::kFLOAT;
+}
+
+std::string CpuBackend::GetBindingName(int bindIndex) const {
+    return mBindingName[bindIndex];
+}
+
+int CpuBackend::GetBindingIndex(const std::string& name) const {
+    for(size_t i = 0; i < mBindingName.size(); i++) {
+        if(mBindingName[i] == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+bool CpuBackend::BindingIsInput(int bindIndex) const {
+    return mBindingIsInput[bindIndex];
+}
+
+bool CpuBackend::BindingHasBatchAxis(int bindIndex) const {
+    UNUSED(bindIndex);
+    return mDynamicBatch;
+}
+
+int CpuBackend::GetNbBindings() const {
+    return static_cast<int>(mBindingName.size());
+}
+
+int CpuBackend::GetNbInputBindings() const {
+    return mNbInputBindings;
+}
+
+int CpuBackend::GetNbOutputBindings() const {
+    return mNbOutputBindings;
+}
+
+std::unique_ptr<InferContext> CpuBackend::CreateContext() {
+    if(mBinding.empty()) {
+        spdlog::error("engine is empty, call CreateEngine before CreateContext");
+        return nullptr;
+    }
+    return std::unique_ptr<InferContext>(new CpuContext(*this));
+}
+
+CpuContext::CpuContext(CpuBackend& backend) : mBackend(backend), mBatchSize(backend.mBatchSize) {
+    mBinding.resize(mBackend.mBinding.size());
+    mBindingPtr.resize(mBinding.size());
+    for(size_t i = 0; i < mBinding.size(); i++) {
+        mBinding[i].Allocate(mBackend.mBindingSize[i], HostMemoryType::kAligned);
+        mBindingPtr[i] = static_cast<float*>(mBinding[i].Data());
+    }
+}
+
+StreamHandle CpuContext::GetStream() const {
+    return nullptr;
+}
+
+void* CpuContext::GetBindingPtr(int bindIndex) const {
+    return mBindingPtr[bindIndex];
+}
+
+bool CpuContext::SetBatchSize(int batchSize) {
+    if(batchSize < 1 || batchSize > mBackend.mBatchSize) {
+        spdlog::error("batch size {} out of range [1, {}]", batchSize, mBackend.mBatchSize);
+        return false;
+    }
+    mBatchSize = batchSize;
+    return true;
+}
+
+int CpuContext::GetBatchSize() const {
+    return mBatchSize;
+}
+
+Span<float> CpuContext::GetHostBuffer(int bindIndex) {
+    return mBinding[bindIndex].AsSpan<float>();
+}
+
+void* CpuContext::GetHostBinding(int bindIndex) {
+    return mBinding[bindIndex].Data();
+}
+
+void CpuContext::CopyFromHostToDevice(int bindIndex) {
+    // staging buffer is the binding itself
+    UNUSED(bindIndex);
+}
+
+void CpuContext::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) {
+    assert(input.size()*sizeof(float) <= mBackend.mBindingSize[bindIndex]);
+    memcpy(mBindingPtr[bindIndex], input.data(), std::min(input.size()*sizeof(float), mBackend.mBindingSize[bindIndex]));
+}
+
+void CpuContext::CopyFromDeviceToHost(int bindIndex) {
+    // staging buffer is the binding itself
+    UNUSED(bindIndex);
+}
+
+void CpuContext::CopyOutputsFromDeviceToHost() {
+}
+
+float* CpuContext::GetPreprocessorInput(size_t count) {
+    if(count * sizeof(float) > mPreprocessorInput.Size()) {
+        mPreprocessorInput.Allocate(count * sizeof(float), HostMemoryType::kAligned);
+    }
+    return static_cast<float*>(mPreprocessorInput.Data());
+}
+
+bool CpuContext::ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims) {
+    assert(static_cast<size_t>(volume(inputDims)) <= input.size());
+    return mBackend.Resize(input.data(), inputDims, mBindingPtr[mBackend.GetInputBindingIndex()]);
+}
+
+bool CpuContext::ForwardPreprocessor(const TensorDims& inputDims) {
+    if(static_cast<size_t>(volume(inputDims)) * sizeof(float) > mPreprocessorInput.Size()) {
+        spdlog::error("preprocessor input larger than requested from GetPreprocessorInput");
+        return false;
+    }
+    return mBackend.Resize(static_cast<const float*>(mPreprocessorInput.Data()), inputDims,
+                           mBindingPtr[mBackend.GetInputBindingIndex()]);
+}
+
+void CpuContext::ForwardAsync() {
+    mBackend.Run(mBindingPtr, mBatchSize, mProfiler);
+}
+
+void CpuContext::InferAsync() {
+    // inputs and outputs already live in the host buffers
+    ForwardAsync();
+}
+
+void CpuContext::Synchronize() {
+}
+
+void CpuContext::SetProfiler(LayerProfiler* profiler) {
+    mProfiler = profiler;
+}
+
+const InferBackend& CpuContext::GetBackend() const {
+    return mBackend;
+}
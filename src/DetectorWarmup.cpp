@@ -0,0 +1,43 @@
+#include "DetectorWarmup.h"
+
+#include <set>
+#include <algorithm>
+
+std::vector<WarmupShape> WarmupShapes(const InferBackend& backend, const Config& config, const cv::Size& imageSize) {
+    int maxBatch = std::max(std::min(config.maxBatchSize, backend.GetMaxBatchSize()), 1);
+    std::vector<WarmupShape> shapes;
+    // resolution buckets, the frame size picks the profile. Each one at its smallest and largest batch like the
+    // batch buckets below, a single frame and a full batch take different tactics
+    for(const ShapeProfile& profile : backend.GetShapeProfiles()) {
+        if(profile.opt.size() != 4 || profile.max.size() != 4) {
+            continue;
+        }
+        int minBatch = profile.min.size() == 4 ? profile.min[0] : 1;
+        int largest = std::max(std::min(profile.max[0], maxBatch), 1);
+        std::set<int> profileBatches = {std::min(std::max(minBatch, 1), largest), largest};
+        for(int batch : profileBatches) {
+            WarmupShape shape;
+            shape.batchSize = batch;
+            shape.imageSize = cv::Size(profile.opt[3], profile.opt[2]);
+            shapes.push_back(shape);
+        }
+    }
+    if(!shapes.empty()) {
+        return shapes;
+    }
+    // batch buckets, the batch size picks the profile
+    std::set<int> batchSizes = {1, maxBatch};
+    for(int batch : config.batchProfiles) {
+        if(batch >= 1 && batch <= maxBatch) {
+            batchSizes.insert(batch);
+        }
+    }
+    cv::Size size = imageSize.width > 0 && imageSize.height > 0 ? imageSize : cv::Size(640, 640);
+    for(int batch : batchSizes) {
+        WarmupShape shape;
+        shape.batchSize = batch;
+        shape.imageSize = size;
+        shapes.push_back(shape);
+    }
+    return shapes;
+}
@@ -0,0 +1,172 @@
+#include "EngineCache.h"
+#include "MappedFile.h"
+#include "spdlog/spdlog.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <functional>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define NOMINMAX
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// "TRTCACHE" + format version, bump kEngineFileVersion if the header changes
+const char kEngineFileMagic[8] = {'T', 'R', 'T', 'C', 'A', 'C', 'H', 'E'};
+
+const uint32_t kEngineFileVersion = 1;
+
+struct EngineFileHeader {
+    char magic[8];
+
+    uint32_t version;
+
+    uint32_t headerSize;
+
+    uint64_t keyHash;
+
+    uint64_t envHash;
+
+    uint64_t engineSize;
+
+    uint64_t engineHash;
+};
+
+bool MakeDirectory(const std::string& dir) {
+#ifdef _WIN32
+    int status = _mkdir(dir.c_str());
+#else
+    int status = mkdir(dir.c_str(), 0755);
+#endif
+    return status == 0 || errno == EEXIST;
+}
+
+bool RenameOverFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+} // namespace
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t HashString(const std::string& value, uint64_t seed) {
+    // hash the terminator too so "ab" + "c" and "a" + "bc" differ
+    return HashBytes(value.c_str(), value.size() + 1, seed);
+}
+
+std::string EngineCachePath(const std::string& dir, const EngineCacheKey& key) {
+    if(!MakeDirectory(dir)) {
+        spdlog::warn("create engine cache directory {} failed", dir);
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.engine", static_cast<unsigned long long>(key.hash));
+    char last = dir.empty() ? '/' : dir.back();
+    return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+}
+
+bool WriteFileAtomic(const std::string& fileName, const std::function<bool(std::ostream& file)>& write) {
+    // unique per writer, processes writing the same file race on the rename only
+    std::string tmpName = fileName + "." + std::to_string(getpid()) + "." +
+                          std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(tmpName, std::ios::binary | std::ios::out | std::ios::trunc);
+        if(!file.is_open()) {
+            spdlog::error("create file {} failed", tmpName);
+            return false;
+        }
+        bool written = write(file);
+        file.flush();
+        if(!written || !file) {
+            spdlog::error("write file {} failed", tmpName);
+            file.close();
+            std::remove(tmpName.c_str());
+            return false;
+        }
+    }
+    if(!RenameOverFile(tmpName, fileName)) {
+        spdlog::error("rename {} to {} failed", tmpName, fileName);
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool WriteEngineFile(const std::string& fileName, const EngineCacheKey& key, const void* data, size_t size) {
+    EngineFileHeader header;
+    memcpy(header.magic, kEngineFileMagic, sizeof(header.magic));
+    header.version = kEngineFileVersion;
+    header.headerSize = sizeof(EngineFileHeader);
+    header.keyHash = key.hash;
+    header.envHash = key.envHash;
+    header.engineSize = size;
+    header.engineHash = HashBytes(data, size);
+    return WriteFileAtomic(fileName, [&header, data, size](std::ostream& file) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(static_cast<const char*>(data), size);
+        return static_cast<bool>(file);
+    });
+}
+
+bool ReadEngineFile(const std::string& fileName, const EngineCacheKey& key,
+                    const std::function<bool(const void* engine, size_t size)>& deserialize) {
+    MappedFile file;
+    if(!file.Open(fileName)) {
+        return false;
+    }
+    EngineFileHeader header;
+    if(file.Size() < sizeof(header)) {
+        spdlog::warn("{} has no engine cache header, ignore it", fileName);
+        return false;
+    }
+    memcpy(&header, file.Data(), sizeof(header));
+    if(memcmp(header.magic, kEngineFileMagic, sizeof(header.magic)) != 0) {
+        spdlog::warn("{} has no engine cache header, ignore it", fileName);
+        return false;
+    }
+    if(header.version != kEngineFileVersion || header.headerSize != sizeof(header)) {
+        spdlog::warn("{} has engine cache format {}, expect {}, ignore it", fileName, header.version, kEngineFileVersion);
+        return false;
+    }
+    if(header.envHash != key.envHash) {
+        spdlog::warn("{} was built with another tensorrt version, gpu or plugin set, ignore it", fileName);
+        return false;
+    }
+    if(key.hash != 0 && header.keyHash != key.hash) {
+        spdlog::warn("{} was built from another onnx model or build options, ignore it", fileName);
+        return false;
+    }
+    if(header.engineSize != file.Size() - sizeof(header)) {
+        spdlog::warn("{} is truncated, ignore it", fileName);
+        return false;
+    }
+    const char* engine = file.Data() + sizeof(header);
+    size_t engineSize = static_cast<size_t>(header.engineSize);
+    if(HashBytes(engine, engineSize) != header.engineHash) {
+        spdlog::warn("{} checksum mismatch, ignore it", fileName);
+        return false;
+    }
+    return deserialize(engine, engineSize);
+}
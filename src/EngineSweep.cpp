@@ -0,0 +1,408 @@
+#include "EngineSweep.h"
+#include "EngineCache.h"
+#include "InferBackend.h"
+#include "common.h"
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+const char* ModeName(int mode) {
+    switch(mode) {
+        case 1: return "fp16";
+        case 2: return "int8";
+        default: return "fp32";
+    }
+}
+
+std::string JoinProfiles(const std::vector<int>& profiles, char separator) {
+    std::string text;
+    for(size_t i = 0; i < profiles.size(); i++) {
+        text += (i > 0 ? std::string(1, separator) : "") + std::to_string(profiles[i]);
+    }
+    return text;
+}
+
+std::vector<int> SplitProfiles(const std::string& text) {
+    std::vector<int> profiles;
+    std::stringstream stream(text);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) {
+            profiles.push_back(std::stoi(item));
+        }
+    }
+    return profiles;
+}
+
+std::string JoinNames(const std::vector<std::string>& names) {
+    std::string text;
+    for(size_t i = 0; i < names.size(); i++) {
+        text += (i > 0 ? "," : "") + names[i];
+    }
+    return text;
+}
+
+std::vector<std::string> SplitNames(const std::string& text) {
+    std::vector<std::string> names;
+    std::stringstream stream(text);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        if(!item.empty()) {
+            names.push_back(item);
+        }
+    }
+    return names;
+}
+
+/**
+ * @description: a beats b if it is at least as good on latency and throughput and better on one of them.
+ */
+bool Dominates(const SweepResult& a, const SweepResult& b) {
+    return a.latencyMs <= b.latencyMs && a.throughput >= b.throughput &&
+           (a.latencyMs < b.latencyMs || a.throughput > b.throughput);
+}
+
+/**
+ * @description: median ms of InferAsync at batchSize after two warm runs, negative if the context does not take
+ *               the batch.
+ */
+double MedianBatchMs(InferContext& context, int batchSize, int iterations) {
+    if(!context.SetBatchSize(batchSize)) {
+        return -1;
+    }
+    std::vector<double> times;
+    for(int i = -2; i < std::max(iterations, 1); i++) {
+        auto start = std::chrono::steady_clock::now();
+        context.InferAsync();
+        context.Synchronize();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if(i >= 0) {
+            times.push_back(ms);
+        }
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+/**
+ * @description: pareto front of every max batch size, a deployment is bound to its batch size and needs its own
+ *               best engines even if a larger batch beats them.
+ */
+std::vector<SweepResult> ParetoFrontPerBatch(const std::vector<SweepResult>& results) {
+    std::map<int, std::vector<SweepResult>> groups;
+    for(const SweepResult& result : results) {
+        groups[result.variant.maxBatchSize].push_back(result);
+    }
+    std::vector<SweepResult> front;
+    for(const auto& group : groups) {
+        std::vector<SweepResult> groupFront = ParetoFront(group.second);
+        front.insert(front.end(), groupFront.begin(), groupFront.end());
+    }
+    return front;
+}
+
+std::string StemOf(const std::string& path) {
+    size_t begin = path.find_last_of("/\\");
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    size_t end = path.find_last_of('.');
+    return path.substr(begin, end == std::string::npos || end < begin ? std::string::npos : end - begin);
+}
+
+} // namespace
+
+std::string BuildVariant::Name() const {
+    std::string name = std::string(ModeName(mode)) + "_b" + std::to_string(maxBatchSize) + "_ws" +
+                       std::to_string(workspaceSize >> 20) + "m";
+    if(!batchProfiles.empty()) {
+        name += "_p" + JoinProfiles(batchProfiles, '-');
+    }
+    return name;
+}
+
+std::vector<BuildVariant> ExpandSweepGrid(const SweepGrid& grid) {
+    std::vector<BuildVariant> variants;
+    for(int mode : grid.modes) {
+        for(int maxBatchSize : grid.maxBatchSizes) {
+            for(size_t workspaceSize : grid.workspaceSizes) {
+                for(const std::vector<int>& profiles : grid.batchProfiles) {
+                    // profiles above the max batch would only repeat another variant
+                    if(std::any_of(profiles.begin(), profiles.end(), [&](int batch) { return batch > maxBatchSize; })) {
+                        continue;
+                    }
+                    BuildVariant variant;
+                    variant.mode = mode;
+                    variant.maxBatchSize = maxBatchSize;
+                    variant.workspaceSize = workspaceSize;
+                    variant.batchProfiles = profiles;
+                    variants.push_back(variant);
+                }
+            }
+        }
+    }
+    return variants;
+}
+
+std::vector<SweepResult> RunSweep(const std::vector<BuildVariant>& variants, const SweepMeasure& measure) {
+    std::vector<SweepResult> results;
+    for(size_t i = 0; i < variants.size(); i++) {
+        spdlog::info("sweep {}/{}: {}", i + 1, variants.size(), variants[i].Name());
+        SweepResult result;
+        result.variant = variants[i];
+        result.ok = measure(variants[i], result);
+        // measure may reset result
+        result.variant = variants[i];
+        if(result.ok) {
+            spdlog::info("{}: {} ms at batch 1, {} images/s at batch {}", variants[i].Name(), result.latencyMs,
+                         result.throughput, variants[i].maxBatchSize);
+        } else {
+            spdlog::warn("{} failed", variants[i].Name());
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+std::vector<SweepResult> ParetoFront(const std::vector<SweepResult>& results) {
+    std::vector<SweepResult> front;
+    for(const SweepResult& candidate : results) {
+        if(!candidate.ok) {
+            continue;
+        }
+        bool dominated = std::any_of(results.begin(), results.end(), [&](const SweepResult& other) {
+            return other.ok && Dominates(other, candidate);
+        });
+        if(!dominated) {
+            front.push_back(candidate);
+        }
+    }
+    std::stable_sort(front.begin(), front.end(), [](const SweepResult& a, const SweepResult& b) {
+        return a.latencyMs < b.latencyMs;
+    });
+    return front;
+}
+
+bool EngineBuildOptions::operator==(const EngineBuildOptions& other) const {
+    return maxContexts == other.maxContexts && halfIO == other.halfIO && inputPrologue == other.inputPrologue &&
+           customOutput == other.customOutput;
+}
+
+EngineBuildOptions MakeEngineBuildOptions(int maxContexts, bool halfIO, const InputPrologue& prologue,
+                                          const std::vector<std::string>& customOutput) {
+    EngineBuildOptions options;
+    // SetMaxContexts clamps the same way
+    options.maxContexts = std::max(maxContexts, 1);
+    options.halfIO = halfIO;
+    if(prologue.enable) {
+        uint64_t hash = HashBytes(&prologue.scale, sizeof(prologue.scale));
+        hash = HashBytes(prologue.mean.data(), prologue.mean.size() * sizeof(float), hash);
+        hash = HashBytes(prologue.std.data(), prologue.std.size() * sizeof(float), hash);
+        options.inputPrologue = hash == 0 ? 1 : hash;
+    }
+    options.customOutput = customOutput;
+    return options;
+}
+
+SweepObjective ParseSweepObjective(const std::string& objective) {
+    if(objective == "throughput") {
+        return SweepObjective::kThroughput;
+    }
+    if(objective != "latency") {
+        spdlog::warn("unknown sweep objective {}, use latency", objective);
+    }
+    return SweepObjective::kLatency;
+}
+
+bool ReadSweepManifest(const std::string& fileName, std::vector<SweepManifestEntry>& entries) {
+    entries.clear();
+    std::ifstream file(fileName.c_str());
+    if(!file.is_open()) {
+        return false;
+    }
+    std::string line;
+    while(std::getline(file, line)) {
+        if(line.empty() || line[0] == '#') {
+            continue;
+        }
+        // target engine mode batch workspace profiles contexts halfIO prologue outputs latency throughput
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while(std::getline(stream, field, '\t')) {
+            fields.push_back(field);
+        }
+        if(fields.size() == 8) {
+            spdlog::warn("skip line of sweep manifest {} without build options, sweep again", fileName);
+            continue;
+        }
+        if(fields.size() != 12) {
+            spdlog::warn("skip malformed line of sweep manifest {}", fileName);
+            continue;
+        }
+        SweepManifestEntry entry;
+        try {
+            entry.target = fields[0];
+            entry.result.engineFile = fields[1];
+            entry.result.variant.mode = std::stoi(fields[2]);
+            entry.result.variant.maxBatchSize = std::stoi(fields[3]);
+            entry.result.variant.workspaceSize = static_cast<size_t>(std::stoull(fields[4]));
+            entry.result.variant.batchProfiles = SplitProfiles(fields[5]);
+            entry.options.maxContexts = std::stoi(fields[6]);
+            entry.options.halfIO = std::stoi(fields[7]) != 0;
+            entry.options.inputPrologue = std::stoull(fields[8], nullptr, 16);
+            entry.options.customOutput = SplitNames(fields[9]);
+            entry.result.latencyMs = std::stod(fields[10]);
+            entry.result.throughput = std::stod(fields[11]);
+            entry.result.ok = true;
+        } catch(const std::exception&) {
+            spdlog::warn("skip malformed line of sweep manifest {}", fileName);
+            continue;
+        }
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+bool WriteSweepManifest(const std::string& fileName, const std::string& target, const EngineBuildOptions& options,
+                        const std::vector<SweepResult>& results) {
+    std::vector<SweepManifestEntry> entries;
+    ReadSweepManifest(fileName, entries);
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](const SweepManifestEntry& entry) {
+                                     return entry.target == target && entry.options == options;
+                                 }),
+                  entries.end());
+    for(const SweepResult& result : ParetoFrontPerBatch(results)) {
+        entries.push_back({target, options, result});
+    }
+    return WriteFileAtomic(fileName, [&entries](std::ostream& file) {
+        file << "# target\tengine\tmode\tmaxBatchSize\tworkspaceSize\tbatchProfiles\tmaxContexts\thalfIO"
+                "\tinputPrologue\tcustomOutput\tlatencyMs\tthroughput\n";
+        file << std::setprecision(6);
+        for(const SweepManifestEntry& entry : entries) {
+            const SweepResult& result = entry.result;
+            file << entry.target << '\t' << result.engineFile << '\t' << result.variant.mode << '\t'
+                 << result.variant.maxBatchSize << '\t' << result.variant.workspaceSize << '\t'
+                 << JoinProfiles(result.variant.batchProfiles, ',') << '\t' << entry.options.maxContexts << '\t'
+                 << (entry.options.halfIO ? 1 : 0) << '\t' << std::hex << entry.options.inputPrologue << std::dec
+                 << '\t' << JoinNames(entry.options.customOutput) << '\t' << result.latencyMs << '\t'
+                 << result.throughput << '\n';
+        }
+        return file.good();
+    });
+}
+
+int SelectSweepEntry(const std::vector<SweepManifestEntry>& entries, const std::string& target,
+                     const EngineBuildOptions& options, int maxBatchSize, SweepObjective objective,
+                     double latencyBudgetMs, bool allowInt8) {
+    int best = -1;
+    int fastest = -1;
+    for(int i = 0; i < static_cast<int>(entries.size()); i++) {
+        const SweepResult& result = entries[i].result;
+        // an engine built with other contexts, io types, prologue or outputs has other bindings
+        if(entries[i].target != target || !(entries[i].options == options) || result.variant.maxBatchSize != maxBatchSize ||
+           (result.variant.mode == 2 && !allowInt8)) {
+            continue;
+        }
+        if(fastest < 0 || result.latencyMs < entries[fastest].result.latencyMs) {
+            fastest = i;
+        }
+        if(objective == SweepObjective::kThroughput && (latencyBudgetMs <= 0 || result.latencyMs <= latencyBudgetMs) &&
+           (best < 0 || result.throughput > entries[best].result.throughput)) {
+            best = i;
+        }
+    }
+    // nothing fits the budget, the lowest latency is the closest
+    return best >= 0 ? best : fastest;
+}
+
+bool MeasureEngine(const SweepOptions& options, const BuildVariant& variant, SweepResult& result) {
+    result = SweepResult();
+    result.variant = variant;
+    if(variant.mode == 2 && options.calibrationImageDir.empty()) {
+        spdlog::warn("skip {}, int8 needs calibration images", variant.Name());
+        return false;
+    }
+    std::string engineDir = options.engineDir;
+    if(!engineDir.empty() && engineDir.back() != '/' && engineDir.back() != '\\') {
+        engineDir += "/";
+    }
+    result.engineFile = engineDir + StemOf(options.onnxModel) + "_" + variant.Name() + ".engine";
+    std::shared_ptr<InferBackend> backend = CreateInferBackend(options.backend);
+    backend->SetMaxBatchSize(variant.maxBatchSize);
+    backend->SetMaxContexts(options.maxContexts);
+    backend->SetBatchProfiles(variant.batchProfiles);
+    backend->SetMaxWorkspaceSize(variant.workspaceSize);
+    backend->SetHalfIO(options.halfIO);
+    backend->SetInputPrologue(options.inputPrologue);
+    if(variant.mode == 2) {
+        size_t npos = options.onnxModel.find_last_of('.');
+        std::string calibTable = options.onnxModel.substr(0, npos) + ".table";
+        if(!fileExists(calibTable)) {
+            backend->SetInt8Calibrator("Int8MinMaxCalibrator", options.calibrationWidth, options.calibrationHeight,
+                                       options.calibrationImageDir.c_str(), calibTable.c_str());
+        }
+    }
+    if(!backend->CreateEngine(options.onnxModel, result.engineFile, options.customOutput, variant.maxBatchSize, variant.mode)) {
+        return false;
+    }
+    std::unique_ptr<InferContext> context = backend->CreateContext();
+    if(context == nullptr) {
+        return false;
+    }
+    double latencyMs = MedianBatchMs(*context, 1, options.iterations);
+    double batchMs = variant.maxBatchSize == 1 ? latencyMs : MedianBatchMs(*context, variant.maxBatchSize, options.iterations);
+    if(latencyMs < 0 || batchMs <= 0) {
+        return false;
+    }
+    result.latencyMs = latencyMs;
+    result.throughput = variant.maxBatchSize * 1000.0 / batchMs;
+    result.ok = true;
+    return true;
+}
+
+std::vector<SweepResult> SweepEngines(const SweepOptions& options, const SweepGrid& grid) {
+    std::string target = CreateInferBackend(options.backend)->GetBuildTarget();
+    spdlog::info("sweep {} for target {}", options.onnxModel, target);
+    std::vector<SweepResult> results = RunSweep(ExpandSweepGrid(grid), [&options](const BuildVariant& variant, SweepResult& result) {
+        return MeasureEngine(options, variant, result);
+    });
+    PrintSweepResults(std::cout, results);
+    if(!options.manifestFile.empty()) {
+        EngineBuildOptions buildOptions = MakeEngineBuildOptions(options.maxContexts, options.halfIO,
+                                                                 options.inputPrologue, options.customOutput);
+        if(WriteSweepManifest(options.manifestFile, target, buildOptions, results)) {
+            spdlog::info("write sweep manifest {}", options.manifestFile);
+        } else {
+            spdlog::error("could not write sweep manifest {}", options.manifestFile);
+        }
+    }
+    return results;
+}
+
+void PrintSweepResults(std::ostream& out, const std::vector<SweepResult>& results) {
+    std::vector<SweepResult> front = ParetoFrontPerBatch(results);
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(32) << std::left << "variant" << std::right << std::setw(12) << "latency ms" << std::setw(14)
+        << "images/s" << std::endl;
+    for(const SweepResult& result : results) {
+        bool pareto = std::any_of(front.begin(), front.end(), [&](const SweepResult& other) {
+            return other.variant.Name() == result.variant.Name();
+        });
+        out << (pareto ? "* " : "  ") << std::setw(30) << std::left << result.variant.Name() << std::right;
+        if(result.ok) {
+            out << std::setw(12) << result.latencyMs << std::setw(14) << result.throughput << std::endl;
+        } else {
+            out << std::setw(12) << "failed" << std::endl;
+        }
+    }
+    out.flags(flags);
+}
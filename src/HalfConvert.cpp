@@ -0,0 +1,161 @@
+#include "HalfConvert.h"
+
+#include <cstring>
+
+// F16C is picked at run time, the build does not have to target avx2. gcc and clang compile the vector
+// functions for avx and f16c only, msvc takes the intrinsics without /arch
+#if defined(_M_X64) || defined(__x86_64__)
+#define HALF_CONVERT_F16C 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HALF_CONVERT_TARGET
+#else
+#include <cpuid.h>
+#define HALF_CONVERT_TARGET __attribute__((target("avx,f16c")))
+#endif
+#endif
+
+namespace {
+
+uint32_t FloatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float BitsToFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+#ifdef HALF_CONVERT_F16C
+// cpu has f16c and avx and the os saves the ymm registers
+bool CpuHasF16C() {
+    unsigned int ecx = 0;
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    ecx = static_cast<unsigned int>(regs[2]);
+#else
+    unsigned int eax, ebx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+#endif
+    const unsigned int osxsave = 1u << 27, avx = 1u << 28, f16c = 1u << 29;
+    if((ecx & (osxsave | avx | f16c)) != (osxsave | avx | f16c)) {
+        return false;
+    }
+#if defined(_MSC_VER)
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Low, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = xcr0Low;
+#endif
+    return (xcr0 & 6) == 6;
+}
+
+bool UseF16C() {
+    static const bool use = CpuHasF16C();
+    return use;
+}
+
+// the first count / 8 * 8 values, the caller converts the rest
+HALF_CONVERT_TARGET size_t FloatToHalfF16C(const float* src, Half* dst, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half);
+    }
+    return i;
+}
+
+HALF_CONVERT_TARGET size_t HalfToFloatF16C(const Half* src, float* dst, size_t count) {
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m128i half = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half));
+    }
+    return i;
+}
+#endif
+
+} // namespace
+
+Half FloatToHalf(float value) {
+    uint32_t bits = FloatBits(value);
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    uint32_t abs = bits & 0x7fffffff;
+    Half half;
+    if(abs >= 0x7f800000) {
+        // inf or nan, keep a quiet nan payload bit
+        half.bits = sign | 0x7c00 | (abs > 0x7f800000 ? 0x0200 | ((abs >> 13) & 0x03ff) : 0);
+        return half;
+    }
+    if(abs >= 0x477ff000) {
+        // rounds past the largest finite half
+        half.bits = sign | 0x7c00;
+        return half;
+    }
+    if(abs < 0x38800000) {
+        // subnormal half, let the fpu round by adding 0.5 which shift the mantissa into place
+        float f = BitsToFloat(abs) + 0.5f;
+        half.bits = sign | static_cast<uint16_t>(FloatBits(f) - FloatBits(0.5f));
+        return half;
+    }
+    uint32_t mantissaOdd = (abs >> 13) & 1;
+    abs += 0xc8000fff + mantissaOdd;
+    half.bits = sign | static_cast<uint16_t>(abs >> 13);
+    return half;
+}
+
+float HalfToFloat(Half value) {
+    uint32_t sign = static_cast<uint32_t>(value.bits & 0x8000) << 16;
+    uint32_t exponent = (value.bits >> 10) & 0x1f;
+    uint32_t mantissa = value.bits & 0x03ff;
+    if(exponent == 0x1f) {
+        // nan comes out quiet, like the hardware conversion
+        return BitsToFloat(sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x00400000 : 0));
+    }
+    if(exponent == 0) {
+        // zero or subnormal, mantissa * 2^-24
+        float f = static_cast<float>(mantissa) * BitsToFloat(0x33800000);
+        return BitsToFloat(sign | FloatBits(f));
+    }
+    return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+void FloatToHalf(const float* src, Half* dst, size_t count) {
+    size_t i = 0;
+#ifdef HALF_CONVERT_F16C
+    if(UseF16C()) {
+        i = FloatToHalfF16C(src, dst, count);
+    }
+#endif
+    for(; i < count; i++) {
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+void HalfToFloat(const Half* src, float* dst, size_t count) {
+    size_t i = 0;
+#ifdef HALF_CONVERT_F16C
+    if(UseF16C()) {
+        i = HalfToFloatF16C(src, dst, count);
+    }
+#endif
+    for(; i < count; i++) {
+        dst[i] = HalfToFloat(src[i]);
+    }
+}
+
+bool HalfConvertIsVectorized() {
+#ifdef HALF_CONVERT_F16C
+    return UseF16C();
+#else
+    return false;
+#endif
+}
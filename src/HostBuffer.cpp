@@ -0,0 +1,107 @@
+#include "HostBuffer.h"
+#include "spdlog/spdlog.h"
+
+#include <cstdlib>
+#include <cstring>
+#ifndef INFER_CPU_ONLY
+#include "cuda_runtime.h"
+#endif
+
+namespace {
+
+void* AlignedMalloc(size_t size) {
+    // round up, aligned allocation size must be a multiple of alignment
+    size = (size + kHostBufferAlignment - 1) / kHostBufferAlignment * kHostBufferAlignment;
+#ifdef _WIN32
+    return _aligned_malloc(size, kHostBufferAlignment);
+#else
+    void* data = nullptr;
+    if(posix_memalign(&data, kHostBufferAlignment, size) != 0) {
+        return nullptr;
+    }
+    return data;
+#endif
+}
+
+void AlignedFree(void* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+} // namespace
+
+HostBuffer::HostBuffer(size_t size, HostMemoryType type) {
+    Allocate(size, type);
+}
+
+HostBuffer::HostBuffer(HostBuffer&& other) : mData(other.mData), mSize(other.mSize), mType(other.mType) {
+    other.mData = nullptr;
+    other.mSize = 0;
+}
+
+HostBuffer& HostBuffer::operator=(HostBuffer&& other) {
+    if(this != &other) {
+        Free();
+        mData = other.mData;
+        mSize = other.mSize;
+        mType = other.mType;
+        other.mData = nullptr;
+        other.mSize = 0;
+    }
+    return *this;
+}
+
+HostBuffer::~HostBuffer() {
+    Free();
+}
+
+void HostBuffer::Allocate(size_t size, HostMemoryType type) {
+    Free();
+    if(size == 0) {
+        return;
+    }
+    mType = type;
+#ifdef INFER_CPU_ONLY
+    // no cuda to pin with, nothing copies to a device either
+    mType = HostMemoryType::kAligned;
+#else
+    if(mType == HostMemoryType::kPinned) {
+        if(cudaHostAlloc(&mData, size, cudaHostAllocDefault) != cudaSuccess) {
+            // clear the sticky error so later cuda calls don't report it
+            cudaGetLastError();
+            spdlog::warn("could not allocate {} byte pinned memory, use pageable memory", size);
+            mData = nullptr;
+            mType = HostMemoryType::kAligned;
+        }
+    }
+#endif
+    if(mType == HostMemoryType::kAligned) {
+        mData = AlignedMalloc(size);
+    }
+    if(mData == nullptr) {
+        spdlog::error("out of host memory, allocate {} byte failed", size);
+        return;
+    }
+    memset(mData, 0, size);
+    mSize = size;
+}
+
+void HostBuffer::Free() {
+    if(mData == nullptr) {
+        return;
+    }
+#ifndef INFER_CPU_ONLY
+    if(mType == HostMemoryType::kPinned) {
+        cudaFreeHost(mData);
+    } else {
+        AlignedFree(mData);
+    }
+#else
+    AlignedFree(mData);
+#endif
+    mData = nullptr;
+    mSize = 0;
+}
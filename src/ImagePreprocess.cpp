@@ -0,0 +1,467 @@
+#include "ImagePreprocess.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "spdlog/spdlog.h"
+
+// sse2 is part of x64, avx2 is picked at run time like the f16c path of HalfConvert, the build does not have to
+// target it. gcc and clang compile the avx2 functions for avx2 only, msvc takes the intrinsics without /arch
+#if defined(_M_X64) || defined(__x86_64__)
+#define IMAGE_PREPROCESS_AVX2 1
+#define IMAGE_PREPROCESS_SSE2 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define IMAGE_PREPROCESS_TARGET
+#else
+#include <cpuid.h>
+#define IMAGE_PREPROCESS_TARGET __attribute__((target("avx2")))
+#endif
+#elif defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_PREPROCESS_SSE2 1
+#endif
+
+namespace {
+
+/**
+ * @description: source taps of every output index along one axis. Every output has the same number of taps,
+ *               tap t of output d reads index[t * length + d] with weight[t * length + d], so the taps of
+ *               neighbouring outputs are contiguous for simd loads. Outputs with fewer taps are padded with zero
+ *               weights on their last index.
+ */
+struct AxisMap {
+    std::vector<int> index;
+
+    std::vector<float> weight;
+
+    int taps = 0;
+
+    // leading outputs whose taps all lie before the last source index, 4 byte reads of their pixels stay inside
+    // the row
+    int safe = 0;
+
+    int srcLength = -1;
+
+    int dstLength = -1;
+
+    ResizeMode mode = ResizeMode::kBilinear;
+
+    void Build(int src, int dst, ResizeMode resize) {
+        if(src == srcLength && dst == dstLength && resize == mode) {
+            return;
+        }
+        srcLength = src;
+        dstLength = dst;
+        mode = resize;
+        double scale = static_cast<double>(src) / dst;
+        std::vector<std::vector<std::pair<int, float>>> outputs(dst);
+        for(int d = 0; d < dst; d++) {
+            if(src == dst) {
+                outputs[d].emplace_back(d, 1.0f);
+            } else if(resize == ResizeMode::kBilinear || scale < 1) {
+                // pixel centers aligned like cv::resize, borders replicated. cv::INTER_AREA interpolates upscaling
+                double f = (d + 0.5) * scale - 0.5;
+                int s = static_cast<int>(std::floor(f));
+                float w = static_cast<float>(f - s);
+                if(s < 0) {
+                    s = 0;
+                    w = 0;
+                }
+                if(s >= src - 1) {
+                    s = src - 1;
+                    w = 0;
+                }
+                outputs[d].emplace_back(s, 1 - w);
+                outputs[d].emplace_back(std::min(s + 1, src - 1), w);
+            } else {
+                double begin = d * scale;
+                double end = std::min(begin + scale, static_cast<double>(src));
+                for(int s = static_cast<int>(std::floor(begin)); s < end; s++) {
+                    double overlap = std::min(end, s + 1.0) - std::max(begin, static_cast<double>(s));
+                    if(overlap > 1e-6) {
+                        outputs[d].emplace_back(s, static_cast<float>(overlap / scale));
+                    }
+                }
+            }
+        }
+        taps = 0;
+        for(const auto& output : outputs) {
+            taps = std::max(taps, static_cast<int>(output.size()));
+        }
+        index.assign(static_cast<size_t>(taps) * dst, 0);
+        weight.assign(static_cast<size_t>(taps) * dst, 0.0f);
+        safe = 0;
+        for(int d = 0; d < dst; d++) {
+            for(int t = 0; t < taps; t++) {
+                bool padded = t >= static_cast<int>(outputs[d].size());
+                index[t * dst + d] = padded ? outputs[d].back().first : outputs[d][t].first;
+                weight[t * dst + d] = padded ? 0.0f : outputs[d][t].second;
+            }
+            if(outputs[d].back().first <= src - 2) {
+                safe = d + 1;
+            }
+        }
+    }
+};
+
+/**
+ * @description: tables and horizontally resampled rows, kept per thread between calls.
+ */
+struct Scratch {
+    // tables of the last axes seen, a thread serving detectors of different input sizes keeps all of them
+    static constexpr int kMaxMaps = 8;
+
+    AxisMap maps[kMaxMaps];
+
+    int nextMap = 0;
+
+    // map of the axis, rebuilt in the oldest slot other than keep if it is not cached
+    const AxisMap& Map(int src, int dst, ResizeMode resize, const AxisMap* keep = nullptr) {
+        for(const AxisMap& map : maps) {
+            if(map.srcLength == src && map.dstLength == dst && map.mode == resize) {
+                return map;
+            }
+        }
+        if(&maps[nextMap] == keep) {
+            nextMap = (nextMap + 1) % kMaxMaps;
+        }
+        AxisMap& map = maps[nextMap];
+        nextMap = (nextMap + 1) % kMaxMaps;
+        map.Build(src, dst, resize);
+        return map;
+    }
+
+    // taps of the row map rows of 3 planes each, source row s lives in slot s % taps
+    std::vector<float> rowBuffers;
+
+    std::vector<int> rowOf;
+
+    std::vector<float> acc;
+
+    // non zero taps of the current output row
+    std::vector<const float*> tapRows;
+
+    std::vector<float> tapWeights;
+};
+
+#ifdef IMAGE_PREPROCESS_AVX2
+// cpu has avx2 and the os saves the ymm registers
+bool CpuHasAvx2() {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if(regs[0] < 7) {
+        return false;
+    }
+    __cpuid(regs, 1);
+    unsigned int ecx = static_cast<unsigned int>(regs[2]);
+    __cpuidex(regs, 7, 0);
+    unsigned int ebx = static_cast<unsigned int>(regs[1]);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    unsigned int leaf1Ecx = ecx;
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    ecx = leaf1Ecx;
+#endif
+    const unsigned int osxsave = 1u << 27, avx = 1u << 28, avx2 = 1u << 5;
+    if((ecx & (osxsave | avx)) != (osxsave | avx) || (ebx & avx2) == 0) {
+        return false;
+    }
+#if defined(_MSC_VER)
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Low, xcr0High;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = xcr0Low;
+#endif
+    return (xcr0 & 6) == 6;
+}
+
+bool UseAvx2() {
+    static const bool use = CpuHasAvx2();
+    return use;
+}
+
+// the avx2 kernels do the first n / 8 * 8 values and return how many, the caller finishes the row
+
+IMAGE_PREPROCESS_TARGET int BlendRowsAvx2(const float* a, const float* b, float wa, float wb, float bias, float* out, int n) {
+    __m256 va = _mm256_set1_ps(wa);
+    __m256 vb = _mm256_set1_ps(wb);
+    __m256 vbias = _mm256_set1_ps(bias);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), va), _mm256_mul_ps(_mm256_loadu_ps(b + i), vb));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(v, vbias));
+    }
+    return i;
+}
+
+IMAGE_PREPROCESS_TARGET int ScaleRowAvx2(const float* a, float scale, float bias, float* out, int n) {
+    __m256 vs = _mm256_set1_ps(scale);
+    __m256 vbias = _mm256_set1_ps(bias);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), vs), vbias));
+    }
+    return i;
+}
+
+IMAGE_PREPROCESS_TARGET int AccumulateRowAvx2(const float* a, float w, float* acc, int n) {
+    __m256 vw = _mm256_set1_ps(w);
+    int i = 0;
+    for(; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(_mm256_loadu_ps(a + i), vw)));
+    }
+    return i;
+}
+
+// outputs of ResampleRow up to columns.safe, one 4 byte gather per tap fetches b, g and r of 8 pixels
+IMAGE_PREPROCESS_TARGET int ResampleRowAvx2(const uchar* src, const AxisMap& columns, float* p0, float* p1, float* p2) {
+    int width = columns.dstLength;
+    const int* index = columns.index.data();
+    const float* weight = columns.weight.data();
+    __m256i byteMask = _mm256_set1_epi32(0xff);
+    int x = 0;
+    for(; x + 8 <= columns.safe; x += 8) {
+        __m256 s0 = _mm256_setzero_ps();
+        __m256 s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps();
+        for(int t = 0; t < columns.taps; t++) {
+            __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + t * width + x));
+            __m256i offset = _mm256_add_epi32(_mm256_add_epi32(i, i), i);
+            __m256i bgr = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), offset, 1);
+            __m256 w = _mm256_loadu_ps(weight + t * width + x);
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(bgr, byteMask)), w));
+            s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(bgr, 8), byteMask)), w));
+            s2 = _mm256_add_ps(s2, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(bgr, 16), byteMask)), w));
+        }
+        _mm256_storeu_ps(p0 + x, s0);
+        _mm256_storeu_ps(p1 + x, s1);
+        _mm256_storeu_ps(p2 + x, s2);
+    }
+    return x;
+}
+#endif
+
+// out = (a * wa + b * wb) * scale + bias
+void BlendRows(const float* a, const float* b, float wa, float wb, float scale, float bias, float* out, int n) {
+    wa *= scale;
+    wb *= scale;
+    int i = 0;
+#if defined(IMAGE_PREPROCESS_AVX2)
+    if(UseAvx2()) {
+        i = BlendRowsAvx2(a, b, wa, wb, bias, out, n);
+    }
+#endif
+#if defined(IMAGE_PREPROCESS_SSE2)
+    __m128 va = _mm_set1_ps(wa);
+    __m128 vb = _mm_set1_ps(wb);
+    __m128 vbias = _mm_set1_ps(bias);
+    for(; i + 4 <= n; i += 4) {
+        __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), va), _mm_mul_ps(_mm_loadu_ps(b + i), vb));
+        _mm_storeu_ps(out + i, _mm_add_ps(v, vbias));
+    }
+#endif
+    for(; i < n; i++) {
+        out[i] = (a[i] * wa + b[i] * wb) + bias;
+    }
+}
+
+// out = a * scale + bias
+void ScaleRow(const float* a, float scale, float bias, float* out, int n) {
+    int i = 0;
+#if defined(IMAGE_PREPROCESS_AVX2)
+    if(UseAvx2()) {
+        i = ScaleRowAvx2(a, scale, bias, out, n);
+    }
+#endif
+#if defined(IMAGE_PREPROCESS_SSE2)
+    __m128 vs = _mm_set1_ps(scale);
+    __m128 vbias = _mm_set1_ps(bias);
+    for(; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), vs), vbias));
+    }
+#endif
+    for(; i < n; i++) {
+        out[i] = a[i] * scale + bias;
+    }
+}
+
+// acc += a * w
+void AccumulateRow(const float* a, float w, float* acc, int n) {
+    int i = 0;
+#if defined(IMAGE_PREPROCESS_AVX2)
+    if(UseAvx2()) {
+        i = AccumulateRowAvx2(a, w, acc, n);
+    }
+#endif
+#if defined(IMAGE_PREPROCESS_SSE2)
+    __m128 vw = _mm_set1_ps(w);
+    for(; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(a + i), vw)));
+    }
+#endif
+    for(; i < n; i++) {
+        acc[i] += a[i] * w;
+    }
+}
+
+/**
+ * @description: resample one BGR source row along x into three planes of width floats.
+ */
+void ResampleRow(const uchar* src, const AxisMap& columns, float* planes) {
+    int width = columns.dstLength;
+    float* p0 = planes;
+    float* p1 = planes + width;
+    float* p2 = planes + width * 2;
+    const int* index = columns.index.data();
+    const float* weight = columns.weight.data();
+    int x = 0;
+#if defined(IMAGE_PREPROCESS_AVX2)
+    if(UseAvx2()) {
+        x = ResampleRowAvx2(src, columns, p0, p1, p2);
+    }
+#endif
+    if(columns.taps == 1) {
+        for(; x < width; x++) {
+            const uchar* p = src + index[x] * 3;
+            p0[x] = p[0];
+            p1[x] = p[1];
+            p2[x] = p[2];
+        }
+        return;
+    }
+    for(; x < width; x++) {
+        float s0 = 0, s1 = 0, s2 = 0;
+        for(int t = 0; t < columns.taps; t++) {
+            const uchar* p = src + index[t * width + x] * 3;
+            float w = weight[t * width + x];
+            s0 += p[0] * w;
+            s1 += p[1] * w;
+            s2 += p[2] * w;
+        }
+        p0[x] = s0;
+        p1[x] = s1;
+        p2[x] = s2;
+    }
+}
+
+} // namespace
+
+PreprocessParams PreprocessParams::Scaled(const cv::Size& size, float scale) {
+    PreprocessParams params;
+    params.size = size;
+    params.scale[0] = scale;
+    params.scale[1] = scale;
+    params.scale[2] = scale;
+    return params;
+}
+
+bool PreprocessImage(const cv::Mat& image, const PreprocessParams& params, float* chw) {
+    return PreprocessImageRows(image, params, chw, 0, params.size.height);
+}
+
+bool PreprocessImageRows(const cv::Mat& image, const PreprocessParams& params, float* chw, int rowBegin, int rowEnd) {
+    if(image.empty() || image.type() != CV_8UC3) {
+        spdlog::error("preprocess needs a non empty CV_8UC3 image, got type {}", image.type());
+        return false;
+    }
+    cv::Rect full(cv::Point(), params.size);
+    cv::Rect roi = params.roi.area() > 0 ? (params.roi & full) : full;
+    if(roi.area() <= 0) {
+        spdlog::error("preprocess to {}x{} has no pixels to resize into", params.size.width, params.size.height);
+        return false;
+    }
+    float bias[3];
+    float pad[3];
+    for(int c = 0; c < 3; c++) {
+        bias[c] = -params.mean[c] * params.scale[c];
+        pad[c] = params.padValue * params.scale[c] + bias[c];
+    }
+
+    static thread_local Scratch scratch;
+    const AxisMap& columns = scratch.Map(image.cols, roi.width, params.resize);
+    const AxisMap& rows = scratch.Map(image.rows, roi.height, params.resize, &columns);
+    int slots = rows.taps;
+    size_t rowFloats = static_cast<size_t>(roi.width) * 3;
+    scratch.rowBuffers.resize(slots * rowFloats);
+    scratch.rowOf.assign(slots, -1);
+    scratch.acc.resize(roi.width);
+
+    // horizontally resampled source row s, each computed once while the output rows walk down. The taps of an
+    // output row are consecutive source rows, so they never share a slot
+    auto sourceRow = [&](int s) {
+        int slot = s % slots;
+        float* planes = scratch.rowBuffers.data() + slot * rowFloats;
+        if(scratch.rowOf[slot] != s) {
+            ResampleRow(image.ptr<uchar>(s), columns, planes);
+            scratch.rowOf[slot] = s;
+        }
+        return planes;
+    };
+
+    size_t planeSize = static_cast<size_t>(params.size.area());
+    scratch.tapRows.resize(slots);
+    scratch.tapWeights.resize(slots);
+    const float** tapRows = scratch.tapRows.data();
+    float* tapWeights = scratch.tapWeights.data();
+    for(int y = std::max(rowBegin, 0); y < std::min(rowEnd, params.size.height); y++) {
+        bool inside = y >= roi.y && y < roi.y + roi.height;
+        int dy = y - roi.y;
+        // zero weighted taps, padding or a bilinear tap on an exact source row, are skipped
+        int count = 0;
+        for(int t = 0; inside && t < slots; t++) {
+            float w = rows.weight[t * roi.height + dy];
+            if(w != 0) {
+                tapRows[count] = sourceRow(rows.index[t * roi.height + dy]);
+                tapWeights[count] = w;
+                count++;
+            }
+        }
+        for(int c = 0; c < 3; c++) {
+            float* out = chw + planeSize * c + static_cast<size_t>(y) * params.size.width;
+            if(!inside) {
+                std::fill(out, out + params.size.width, pad[c]);
+                continue;
+            }
+            std::fill(out, out + roi.x, pad[c]);
+            std::fill(out + roi.x + roi.width, out + params.size.width, pad[c]);
+            size_t plane = (params.swapRB ? 2 - c : c) * static_cast<size_t>(roi.width);
+            float* dst = out + roi.x;
+            if(count == 1) {
+                ScaleRow(tapRows[0] + plane, tapWeights[0] * params.scale[c], bias[c], dst, roi.width);
+            } else if(count == 2) {
+                BlendRows(tapRows[0] + plane, tapRows[1] + plane, tapWeights[0], tapWeights[1], params.scale[c],
+                          bias[c], dst, roi.width);
+            } else {
+                float* acc = scratch.acc.data();
+                std::fill(acc, acc + roi.width, 0.0f);
+                for(int t = 0; t < count; t++) {
+                    AccumulateRow(tapRows[t] + plane, tapWeights[t], acc, roi.width);
+                }
+                ScaleRow(acc, params.scale[c], bias[c], dst, roi.width);
+            }
+        }
+    }
+    return true;
+}
+
+const char* ImagePreprocessIsa() {
+#if defined(IMAGE_PREPROCESS_AVX2)
+    if(UseAvx2()) {
+        return "avx2";
+    }
+#endif
+#if defined(IMAGE_PREPROCESS_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,22 @@
+#include "InferBackend.h"
+#ifndef INFER_CPU_ONLY
+#include "Trt.h"
+#endif
+#include "CpuBackend.h"
+#include "spdlog/spdlog.h"
+
+std::shared_ptr<InferBackend> CreateInferBackend(const std::string& backend) {
+    if(backend == "cpu") {
+        spdlog::info("use opencv dnn cpu backend");
+        return std::make_shared<CpuBackend>();
+    }
+#ifdef INFER_CPU_ONLY
+    spdlog::warn("backend {} is not built in, INFER_CPU_ONLY build, use opencv dnn cpu backend", backend);
+    return std::make_shared<CpuBackend>();
+#else
+    if(backend != "tensorrt") {
+        spdlog::warn("unknown backend {}, fall back to tensorrt", backend);
+    }
+    return std::make_shared<Trt>();
+#endif
+}
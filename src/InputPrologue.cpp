@@ -0,0 +1,32 @@
+#include "InputPrologue.h"
+
+#include <cstddef>
+
+float InputPrologueScale(const InputPrologue& prologue, int channel) {
+    float deviation = channel < static_cast<int>(prologue.std.size()) ? prologue.std[channel] : 1.f;
+    return prologue.scale / deviation;
+}
+
+float InputPrologueShift(const InputPrologue& prologue, int channel) {
+    float mean = channel < static_cast<int>(prologue.mean.size()) ? prologue.mean[channel] : 0.f;
+    float deviation = channel < static_cast<int>(prologue.std.size()) ? prologue.std[channel] : 1.f;
+    // (q + offset) * scale / std - mean / std
+    return (kInputPrologueOffset * prologue.scale - mean) / deviation;
+}
+
+void RunInputPrologue(const InputPrologue& prologue, const int8_t* pixels, int batch, int height, int width,
+                      int channel, float* output) {
+    int planeSize = height * width;
+    for(int n = 0; n < batch; n++) {
+        const int8_t* image = pixels + static_cast<size_t>(n) * planeSize * channel;
+        float* planes = output + static_cast<size_t>(n) * planeSize * channel;
+        for(int c = 0; c < channel; c++) {
+            float scale = InputPrologueScale(prologue, c);
+            float shift = InputPrologueShift(prologue, c);
+            float* plane = planes + static_cast<size_t>(c) * planeSize;
+            for(int i = 0; i < planeSize; i++) {
+                plane[i] = image[i * channel + c] * scale + shift;
+            }
+        }
+    }
+}
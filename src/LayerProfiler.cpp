@@ -0,0 +1,198 @@
+#include "LayerProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+std::string JsonEscape(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for(char c : text) {
+        switch(c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                } else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+} // namespace
+
+LayerProfile::LayerProfile(int maxTraceRuns) : mMaxTraceRuns(maxTraceRuns) {
+}
+
+void LayerProfile::AddLayerTime(const std::string& name, float ms, int64_t run, int track) {
+    auto last = mLastRun.find(track);
+    if(last == mLastRun.end() || last->second != run) {
+        mLastRun[track] = run;
+        mTrackRuns[track]++;
+        mNbRuns++;
+    }
+    LayerStats& stats = mStats[name];
+    if(stats.calls == 0) {
+        stats.name = name;
+        stats.minMs = ms;
+        stats.maxMs = ms;
+    }
+    stats.calls++;
+    stats.totalMs += ms;
+    stats.minMs = std::min(stats.minMs, static_cast<double>(ms));
+    stats.maxMs = std::max(stats.maxMs, static_cast<double>(ms));
+    if(mTrackRuns[track] <= mMaxTraceRuns) {
+        mEvents.push_back({name, ms, run, track});
+    }
+}
+
+void LayerProfile::Merge(const LayerProfile& other, int track) {
+    for(const auto& entry : other.mStats) {
+        LayerStats& stats = mStats[entry.first];
+        const LayerStats& add = entry.second;
+        if(stats.calls == 0) {
+            stats = add;
+            continue;
+        }
+        stats.calls += add.calls;
+        stats.totalMs += add.totalMs;
+        stats.minMs = std::min(stats.minMs, add.minMs);
+        stats.maxMs = std::max(stats.maxMs, add.maxMs);
+    }
+    for(const Event& event : other.mEvents) {
+        mEvents.push_back({event.name, event.ms, event.run, track});
+    }
+    mTrackRuns[track] += other.mNbRuns;
+    mNbRuns += other.mNbRuns;
+}
+
+void LayerProfile::Clear() {
+    mStats.clear();
+    mEvents.clear();
+    mLastRun.clear();
+    mTrackRuns.clear();
+    mNbRuns = 0;
+}
+
+int64_t LayerProfile::GetNbRuns() const {
+    return mNbRuns;
+}
+
+std::vector<LayerStats> LayerProfile::GetStats() const {
+    std::vector<LayerStats> stats;
+    stats.reserve(mStats.size());
+    for(const auto& entry : mStats) {
+        stats.push_back(entry.second);
+    }
+    std::stable_sort(stats.begin(), stats.end(), [](const LayerStats& a, const LayerStats& b) {
+        return a.totalMs > b.totalMs;
+    });
+    return stats;
+}
+
+double LayerProfile::GetTotalMs() const {
+    double total = 0;
+    for(const auto& entry : mStats) {
+        total += entry.second.totalMs;
+    }
+    return total;
+}
+
+void LayerProfile::PrintTable(std::ostream& out, int top) const {
+    std::vector<LayerStats> stats = GetStats();
+    double total = GetTotalMs();
+    double runs = static_cast<double>(std::max<int64_t>(mNbRuns, 1));
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << mNbRuns << " runs, " << total / runs << " ms per run in " << stats.size() << " layers" << std::endl;
+    out << std::setw(10) << "ms/run" << std::setw(10) << "avg ms" << std::setw(10) << "min ms" << std::setw(10)
+        << "max ms" << std::setw(8) << "%" << "  layer" << std::endl;
+    int rows = top > 0 ? std::min(top, static_cast<int>(stats.size())) : static_cast<int>(stats.size());
+    for(int i = 0; i < rows; i++) {
+        const LayerStats& layer = stats[i];
+        out << std::setw(10) << layer.totalMs / runs << std::setw(10) << layer.AverageMs() << std::setw(10)
+            << layer.minMs << std::setw(10) << layer.maxMs << std::setw(8) << std::setprecision(1)
+            << (total > 0 ? 100 * layer.totalMs / total : 0) << std::setprecision(3) << "  " << layer.name
+            << std::endl;
+    }
+    out.flags(flags);
+}
+
+std::string LayerProfile::ChromeTrace() const {
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    // time cursor in us and current run of every track, runs follow each other with a small gap
+    std::map<int, double> cursor;
+    std::map<int, int64_t> run;
+    for(const Event& event : mEvents) {
+        auto current = run.find(event.track);
+        if(current == run.end()) {
+            run[event.track] = event.run;
+            cursor[event.track] = 0;
+            json << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << event.track
+                 << ",\"args\":{\"name\":\"context " << event.track << "\"}}";
+            first = false;
+        } else if(current->second != event.run) {
+            current->second = event.run;
+            cursor[event.track] += 10;
+        }
+        double duration = event.ms * 1000.0;
+        json << ",{\"name\":\"" << JsonEscape(event.name) << "\",\"cat\":\"layer\",\"ph\":\"X\",\"ts\":"
+             << cursor[event.track] << ",\"dur\":" << duration << ",\"pid\":0,\"tid\":" << event.track
+             << ",\"args\":{\"run\":" << event.run << "}}";
+        cursor[event.track] += duration;
+    }
+    json << "]}";
+    return json.str();
+}
+
+bool LayerProfile::WriteChromeTrace(const std::string& path) const {
+    std::ofstream out(path.c_str());
+    if(!out.is_open()) {
+        return false;
+    }
+    out << ChromeTrace();
+    return out.good();
+}
+
+LayerProfiler::LayerProfiler(int maxTraceRuns) : mProfile(maxTraceRuns) {
+}
+
+void LayerProfiler::reportLayerTime(const char* layerName, float ms) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mProfile.AddLayerTime(layerName, ms, mRun);
+    mRunLayers++;
+}
+
+void LayerProfiler::EndRun() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mRunLayers > 0) {
+        mRun++;
+        mRunLayers = 0;
+    }
+}
+
+LayerProfile LayerProfiler::GetProfile() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mProfile;
+}
+
+void LayerProfiler::Reset() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mProfile.Clear();
+    mRun = 0;
+    mRunLayers = 0;
+}
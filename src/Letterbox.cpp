@@ -0,0 +1,81 @@
+#include "Letterbox.h"
+#include "InputPrologue.h"
+
+#include <cmath>
+
+LetterboxTransform::LetterboxTransform(const cv::Size& image, const cv::Size& input, const cv::Rect& roi)
+    : mImage(image), mInput(input), mRoi(roi) {
+    // an empty image keeps the identity scale, PreprocessImage rejects it anyway
+    if(image.width > 0 && roi.width > 0) {
+        mScaleX = static_cast<float>(image.width) / roi.width;
+    }
+    if(image.height > 0 && roi.height > 0) {
+        mScaleY = static_cast<float>(image.height) / roi.height;
+    }
+}
+
+LetterboxTransform LetterboxTransform::Letterbox(const cv::Size& image, const cv::Size& input, bool center) {
+    if(image.width <= 0 || image.height <= 0) {
+        return Stretch(image, input);
+    }
+    double ratio = std::min(static_cast<double>(input.width) / image.width,
+                            static_cast<double>(input.height) / image.height);
+    int width = std::min(std::max(static_cast<int>(std::lround(image.width * ratio)), 1), input.width);
+    int height = std::min(std::max(static_cast<int>(std::lround(image.height * ratio)), 1), input.height);
+    cv::Point corner = center ? cv::Point((input.width - width) / 2, (input.height - height) / 2) : cv::Point();
+    return LetterboxTransform(image, input, cv::Rect(corner, cv::Size(width, height)));
+}
+
+LetterboxTransform LetterboxTransform::Stretch(const cv::Size& image, const cv::Size& input) {
+    return LetterboxTransform(image, input, cv::Rect(cv::Point(), input));
+}
+
+LetterboxTransform LetterboxTransform::Fit(const cv::Size& image, const cv::Size& input, bool letterbox, bool center) {
+    return letterbox ? Letterbox(image, input, center) : Stretch(image, input);
+}
+
+PreprocessParams LetterboxTransform::Apply(PreprocessParams params, float padValue) const {
+    params.size = mInput;
+    params.roi = mRoi;
+    params.padValue = padValue;
+    return params;
+}
+
+void LetterboxTransform::Resize(const cv::Mat& image, cv::Mat& input, float padValue) const {
+    input.create(mInput, CV_8UC3);
+    if(mRoi.size() != mInput) {
+        input.setTo(cv::Scalar::all(padValue));
+    }
+    // a view of the right size and type, resize writes into it instead of reallocating
+    cv::Mat view = input(mRoi);
+    cv::resize(image, view, mRoi.size());
+}
+
+int8_t* LetterboxTransform::Pack(const cv::Mat& image, int8_t* pixels, void* scratch, float padValue) const {
+    // headers over memory of the caller, Resize and convertTo find the size and type right and write in place
+    cv::Mat resized(mInput, CV_8UC3, scratch);
+    Resize(image, resized, padValue);
+    cv::Mat packed(mInput, CV_8SC3, pixels);
+    resized.convertTo(packed, CV_8SC3, 1, -kInputPrologueOffset);
+    return pixels + GetPackedSize();
+}
+
+void LetterboxTransform::ToImage(std::vector<BBoxInfo>& detections) const {
+    for(BBoxInfo& detection : detections) {
+        BoxesToImage(&detection.box, 1);
+    }
+}
+
+void LetterboxTransform::PointsToImage(cv::Point2f* points, size_t count) const {
+    for(size_t i = 0; i < count; i++) {
+        points[i].x = ToImageX(points[i].x);
+        points[i].y = ToImageY(points[i].y);
+    }
+}
+
+void LetterboxTransform::PointsToImage(float* x, float* y, size_t count) const {
+    for(size_t i = 0; i < count; i++) {
+        x[i] = ToImageX(x[i]);
+        y[i] = ToImageY(y[i]);
+    }
+}
@@ -0,0 +1,106 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& fileName) {
+    Close();
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    mFile = file;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mMapping == nullptr) {
+        Close();
+        return false;
+    }
+    mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if(mData == nullptr) {
+        Close();
+        return false;
+    }
+    mSize = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::Close() {
+    if(mData != nullptr) {
+        UnmapViewOfFile(mData);
+        mData = nullptr;
+    }
+    if(mMapping != nullptr) {
+        CloseHandle(mMapping);
+        mMapping = nullptr;
+    }
+    if(mFile != nullptr) {
+        CloseHandle(mFile);
+        mFile = nullptr;
+    }
+    mSize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& fileName) {
+    Close();
+    mFd = open(fileName.c_str(), O_RDONLY);
+    if(mFd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(mFd, &st) != 0 || st.st_size == 0) {
+        Close();
+        return false;
+    }
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // fault every page in now instead of one by one while tensorrt walks the engine
+    flags |= MAP_POPULATE;
+#endif
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, flags, mFd, 0);
+    if(data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+#ifndef MAP_POPULATE
+    madvise(data, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+#endif
+    madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    mData = static_cast<const char*>(data);
+    mSize = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::Close() {
+    if(mData != nullptr) {
+        munmap(const_cast<char*>(mData), mSize);
+        mData = nullptr;
+    }
+    if(mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+    mSize = 0;
+}
+
+#endif
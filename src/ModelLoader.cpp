@@ -0,0 +1,92 @@
+#include "ModelLoader.h"
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <exception>
+
+ModelLoader::ModelLoader(int nbThreads, Callback callback)
+    : mCallback(std::move(callback)), mWorker(new AsyncWorker(nbThreads)) {}
+
+ModelLoader::~ModelLoader() {
+    mWorker.reset();
+}
+
+void ModelLoader::Add(const std::string& name, std::function<void()> load) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mModels.count(name) > 0) {
+            spdlog::error("model {} is already added", name);
+            return;
+        }
+        mModels[name] = Model();
+    }
+    mWorker->Post([this, name, load]() {
+        SetState(name, ModelState::kLoading, 0);
+        spdlog::info("load model {}...", name);
+        auto start = std::chrono::steady_clock::now();
+        ModelState state = ModelState::kReady;
+        try {
+            load();
+        } catch(const std::exception& e) {
+            spdlog::error("load model {} failed: {}", name, e.what());
+            state = ModelState::kFailed;
+        } catch(...) {
+            spdlog::error("load model {} failed", name);
+            state = ModelState::kFailed;
+        }
+        double loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if(state == ModelState::kReady) {
+            spdlog::info("model {} ready in {} ms", name, loadTime);
+        }
+        SetState(name, state, loadTime);
+        if(mCallback) {
+            mCallback(name, state);
+        }
+    });
+}
+
+ModelState ModelLoader::GetState(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto model = mModels.find(name);
+    return model == mModels.end() ? ModelState::kFailed : model->second.state;
+}
+
+ModelState ModelLoader::Wait(const std::string& name) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto model = mModels.find(name);
+    if(model == mModels.end()) {
+        spdlog::error("model {} is not added", name);
+        return ModelState::kFailed;
+    }
+    mCondition.wait(lock, [&model] {
+        return model->second.state == ModelState::kReady || model->second.state == ModelState::kFailed;
+    });
+    return model->second.state;
+}
+
+bool ModelLoader::WaitAll() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    bool allReady = true;
+    for(auto& model : mModels) {
+        Model& m = model.second;
+        mCondition.wait(lock, [&m] { return m.state == ModelState::kReady || m.state == ModelState::kFailed; });
+        allReady = allReady && m.state == ModelState::kReady;
+    }
+    return allReady;
+}
+
+double ModelLoader::GetLoadTime(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto model = mModels.find(name);
+    return model == mModels.end() ? 0 : model->second.loadTime;
+}
+
+void ModelLoader::SetState(const std::string& name, ModelState state, double loadTime) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Model& model = mModels[name];
+        model.state = state;
+        model.loadTime = loadTime;
+    }
+    mCondition.notify_all();
+}
@@ -0,0 +1,96 @@
+#include "PreprocessPool.h"
+
+PreprocessPool& PreprocessPool::Instance() {
+    static PreprocessPool instance;
+    return instance;
+}
+
+PreprocessPool::~PreprocessPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWork.notify_all();
+    for(std::thread& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void PreprocessPool::Reserve(int nbThreads) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    while(static_cast<int>(mThreads.size()) < nbThreads) {
+        mThreads.emplace_back(&PreprocessPool::Worker, this);
+    }
+}
+
+int PreprocessPool::GetNbThreads() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return static_cast<int>(mThreads.size());
+}
+
+void PreprocessPool::Run(int count, void (*invoke)(void*, int), void* body) {
+    if(count <= 0) {
+        return;
+    }
+    if(count == 1 || GetNbThreads() == 0) {
+        for(int i = 0; i < count; i++) {
+            invoke(body, i);
+        }
+        return;
+    }
+    Job job = { invoke, body, count, 0, 0, nullptr };
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mTail != nullptr) {
+            mTail->nextJob = &job;
+        } else {
+            mHead = &job;
+        }
+        mTail = &job;
+    }
+    mWork.notify_all();
+    // the caller works on its own job instead of waiting idle
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(job.next < job.count) {
+        int index = Claim(&job);
+        lock.unlock();
+        invoke(body, index);
+        lock.lock();
+        job.done++;
+    }
+    mDone.wait(lock, [&job] { return job.done == job.count; });
+}
+
+int PreprocessPool::Claim(Job* job) {
+    int index = job->next++;
+    if(job->next == job->count) {
+        Job* previous = nullptr;
+        for(Job* current = mHead; current != job; current = current->nextJob) {
+            previous = current;
+        }
+        (previous != nullptr ? previous->nextJob : mHead) = job->nextJob;
+        if(mTail == job) {
+            mTail = previous;
+        }
+    }
+    return index;
+}
+
+void PreprocessPool::Worker() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true) {
+        mWork.wait(lock, [this] { return mStop || mHead != nullptr; });
+        if(mHead == nullptr) {
+            return;
+        }
+        Job* job = mHead;
+        int index = Claim(job);
+        lock.unlock();
+        job->invoke(job->body, index);
+        lock.lock();
+        // the caller may return and drop the job as soon as it sees the last index done
+        if(++job->done == job->count) {
+            mDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#include "ProfileRouter.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+int64_t Volume(const std::vector<int>& dims) {
+    int64_t volume = 1;
+    for(int d : dims) {
+        volume *= d;
+    }
+    return volume;
+}
+
+int64_t Distance(const std::vector<int>& a, const std::vector<int>& b) {
+    int64_t distance = 0;
+    for(size_t i = 0; i < a.size() && i < b.size(); i++) {
+        distance += std::abs(static_cast<int64_t>(a[i]) - b[i]);
+    }
+    return distance;
+}
+
+} // namespace
+
+bool ProfileContains(const ShapeProfile& profile, const std::vector<int>& dims) {
+    if(dims.size() != profile.min.size() || dims.size() != profile.max.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < dims.size(); i++) {
+        if(dims[i] < profile.min[i] || dims[i] > profile.max[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int SelectProfile(const std::vector<ShapeProfile>& profiles, const std::vector<int>& dims) {
+    int best = -1;
+    int64_t bestVolume = 0;
+    int64_t bestDistance = 0;
+    for(size_t i = 0; i < profiles.size(); i++) {
+        if(!ProfileContains(profiles[i], dims)) {
+            continue;
+        }
+        int64_t volume = Volume(profiles[i].max);
+        int64_t distance = Distance(profiles[i].opt, dims);
+        if(best < 0 || volume < bestVolume || (volume == bestVolume && distance < bestDistance)) {
+            best = static_cast<int>(i);
+            bestVolume = volume;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
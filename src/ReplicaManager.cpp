@@ -0,0 +1,111 @@
+#include "ReplicaManager.h"
+
+#include <algorithm>
+#include <cassert>
+
+ReplicaRouter::Ticket::Ticket(ReplicaRouter* router, int replica)
+    : mRouter(router), mReplica(replica), mStart(std::chrono::steady_clock::now()) {
+}
+
+ReplicaRouter::Ticket::Ticket(Ticket&& other)
+    : mRouter(other.mRouter), mReplica(other.mReplica), mStart(other.mStart) {
+    other.mRouter = nullptr;
+    other.mReplica = -1;
+}
+
+ReplicaRouter::Ticket& ReplicaRouter::Ticket::operator=(Ticket&& other) {
+    if(this != &other) {
+        Release();
+        mRouter = other.mRouter;
+        mReplica = other.mReplica;
+        mStart = other.mStart;
+        other.mRouter = nullptr;
+        other.mReplica = -1;
+    }
+    return *this;
+}
+
+ReplicaRouter::Ticket::~Ticket() {
+    Release();
+}
+
+void ReplicaRouter::Ticket::Complete() {
+    Complete(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStart).count());
+}
+
+void ReplicaRouter::Ticket::Complete(double latencyMs) {
+    if(mRouter != nullptr) {
+        mRouter->Release(mReplica, std::max(latencyMs, 0.0));
+        mRouter = nullptr;
+    }
+}
+
+void ReplicaRouter::Ticket::Release() {
+    if(mRouter != nullptr) {
+        mRouter->Release(mReplica, -1);
+        mRouter = nullptr;
+    }
+}
+
+ReplicaRouter::ReplicaRouter(int nbReplicas, double smoothing)
+    : mStats(std::max(nbReplicas, 1)), mSmoothing(std::min(std::max(smoothing, 0.01), 1.0)) {
+}
+
+ReplicaRouter::Ticket ReplicaRouter::Acquire() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    int size = static_cast<int>(mStats.size());
+    double measured = 0;
+    int nbMeasured = 0;
+    for(const ReplicaStats& stats : mStats) {
+        if(stats.completed > 0) {
+            measured += stats.averageMs;
+            nbMeasured++;
+        }
+    }
+    double defaultMs = nbMeasured > 0 ? measured / nbMeasured : 0;
+    int best = -1;
+    double bestScore = 0;
+    for(int k = 0; k < size; k++) {
+        int i = (mNext + k) % size;
+        const ReplicaStats& stats = mStats[i];
+        double score = (stats.inFlight + 1) * (stats.completed > 0 ? stats.averageMs : defaultMs);
+        if(best < 0 || score < bestScore || (score == bestScore && stats.inFlight < mStats[best].inFlight)) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    mNext = (mNext + 1) % size;
+    mStats[best].inFlight++;
+    return Ticket(this, best);
+}
+
+int ReplicaRouter::Size() const {
+    return static_cast<int>(mStats.size());
+}
+
+ReplicaStats ReplicaRouter::GetStats(int replica) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats[replica];
+}
+
+void ReplicaRouter::Release(int replica, double latencyMs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ReplicaStats& stats = mStats[replica];
+    assert(stats.inFlight > 0);
+    stats.inFlight--;
+    if(latencyMs < 0) {
+        return;
+    }
+    stats.averageMs = stats.completed == 0 ? latencyMs : stats.averageMs + mSmoothing * (latencyMs - stats.averageMs);
+    stats.completed++;
+}
+
+std::string DeviceEngineFile(const std::string& engineFile, int device) {
+    std::string suffix = "_gpu" + std::to_string(device);
+    size_t slash = engineFile.find_last_of("/\\");
+    size_t dot = engineFile.find_last_of('.');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return engineFile + suffix;
+    }
+    return engineFile.substr(0, dot) + suffix + engineFile.substr(dot);
+}
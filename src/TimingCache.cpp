@@ -0,0 +1,132 @@
+#include "TimingCache.h"
+#include "EngineCache.h"
+#include "spdlog/spdlog.h"
+
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/**
+ * @description: exclusive advisory lock on a file, held until destroyed. Released by the os if the process dies.
+ */
+class FileLock {
+public:
+    explicit FileLock(const std::string& fileName) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        OVERLAPPED overlapped = {};
+        if(!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+            CloseHandle(file);
+            return;
+        }
+        mFile = file;
+#else
+        int fd = open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fd < 0) {
+            return;
+        }
+        if(flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            return;
+        }
+        mFd = fd;
+#endif
+    }
+
+    ~FileLock() {
+#ifdef _WIN32
+        if(mFile != nullptr) {
+            OVERLAPPED overlapped = {};
+            UnlockFileEx(mFile, 0, MAXDWORD, MAXDWORD, &overlapped);
+            CloseHandle(mFile);
+        }
+#else
+        if(mFd >= 0) {
+            flock(mFd, LOCK_UN);
+            close(mFd);
+        }
+#endif
+    }
+
+    FileLock(const FileLock&) = delete;
+
+    FileLock& operator=(const FileLock&) = delete;
+
+    bool IsLocked() const {
+#ifdef _WIN32
+        return mFile != nullptr;
+#else
+        return mFd >= 0;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE mFile = nullptr;
+#else
+    int mFd = -1;
+#endif
+};
+
+} // namespace
+
+TimingCacheFile::TimingCacheFile(const std::string& fileName) : mFileName(fileName) {}
+
+bool TimingCacheFile::Load(std::vector<char>& cache) const {
+    cache.clear();
+    std::ifstream in(mFileName.c_str(), std::ifstream::binary | std::ifstream::ate);
+    if(!in.is_open()) {
+        return false;
+    }
+    std::streamsize size = in.tellg();
+    in.seekg(0);
+    cache.resize(static_cast<size_t>(size));
+    if(!in.read(cache.data(), size)) {
+        cache.clear();
+        return false;
+    }
+    return !cache.empty();
+}
+
+bool TimingCacheFile::Update(
+    const std::function<bool(const std::vector<char>& current, std::vector<char>& merged)>& merge) const {
+    FileLock lock(mFileName + ".lock");
+    if(!lock.IsLocked()) {
+        spdlog::warn("lock timing cache {} failed, skip update", mFileName);
+        return false;
+    }
+    std::vector<char> current;
+    Load(current);
+    std::vector<char> merged;
+    if(!merge(current, merged) || merged.empty()) {
+        return false;
+    }
+    return WriteFileAtomic(mFileName, [&merged](std::ostream& file) {
+        file.write(merged.data(), merged.size());
+        return static_cast<bool>(file);
+    });
+}
+
+std::string TimingCachePath(const std::string& dir, uint64_t envHash) {
+    char name[48];
+    snprintf(name, sizeof(name), "timing_%016llx.cache", static_cast<unsigned long long>(envHash));
+    if(dir.empty()) {
+        return name;
+    }
+    char last = dir.back();
+    return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+}
@@ -9,6 +9,13 @@
 #include "utils.h"
 #include "spdlog/spdlog.h"
 #include "calibrator.h"
+#include "ActivationMemory.h"
+#include "EngineCache.h"
+#include "MappedFile.h"
+#include "TimingCache.h"
+#include "HalfConvert.h"
+#include "InputPrologue.h"
+#include "PluginDescription.h"
 
 #include <string>
 #include <vector>
@@ -16,18 +23,125 @@
 #include <cassert>
 #include <fstream>
 #include <memory>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
 
 #include "NvInfer.h"
 #include "NvInferRuntime.h"
 #include "NvOnnxParser.h"
 #include "NvInferPlugin.h"
 
+namespace {
+
+TrtLogger& ProcessLogger() {
+    static TrtLogger logger;
+    return logger;
+}
+
+/**
+ * @description: register the tensorrt plugins and create the runtime once, every engine of the process is
+ *               deserialized by it. Never destroyed, engines of static detectors may outlive it otherwise.
+ */
+nvinfer1::IRuntime* ProcessRuntime() {
+    static nvinfer1::IRuntime* runtime = [] {
+        initLibNvInferPlugins(&ProcessLogger(), "");
+        return nvinfer1::createInferRuntime(ProcessLogger());
+    }();
+    return runtime;
+}
+
+/**
+ * @description: hash of tensorrt version, compute capability and name of the current device and name, version
+ *               and namespace of every plugin creator.
+ */
+uint64_t HashBuildEnvironment() {
+    int32_t trtVersion = getInferLibVersion();
+    uint64_t hash = HashBytes(&trtVersion, sizeof(trtVersion));
+    int device = 0;
+    cudaDeviceProp prop;
+    if(cudaGetDevice(&device) == cudaSuccess && cudaGetDeviceProperties(&prop, device) == cudaSuccess) {
+        int capability[2] = {prop.major, prop.minor};
+        hash = HashBytes(capability, sizeof(capability), hash);
+        // gpus of one compute capability still differ in sm count and memory, tactics are timed per model
+        hash = HashString(prop.name, hash);
+    }
+    int nbCreators = 0;
+    nvinfer1::IPluginCreator* const* creators = getPluginRegistry()->getPluginCreatorList(&nbCreators);
+    // registration order depends on static initialization, sort so the hash does not
+    std::vector<std::string> plugins;
+    for(int i = 0; i < nbCreators; i++) {
+        plugins.push_back(std::string(creators[i]->getPluginNamespace()) + "::" + creators[i]->getPluginName() +
+                          "@" + creators[i]->getPluginVersion());
+    }
+    std::sort(plugins.begin(), plugins.end());
+    for(const std::string& plugin : plugins) {
+        hash = HashString(plugin, hash);
+    }
+    return hash;
+}
+
+/**
+ * @description: max batch of every bucket of a dynamic batch engine. The full batch comes first, it is the bucket
+ *               of mContext and of calibration, smaller ones follow in ascending order.
+ */
+std::vector<int> BatchBuckets(const std::vector<int>& maxBatches, int batchSize) {
+    std::vector<int> buckets = { batchSize };
+    for(int batch : maxBatches) {
+        if(batch >= 1 && batch < batchSize) {
+            buckets.push_back(batch);
+        }
+    }
+    std::sort(buckets.begin() + 1, buckets.end());
+    buckets.erase(std::unique(buckets.begin() + 1, buckets.end()), buckets.end());
+    return buckets;
+}
+
+/**
+ * @description: dims as "1x3x640x640", -1 for dynamic dimensions.
+ */
+std::string DimsText(const nvinfer1::Dims& dims) {
+    std::string text;
+    for(int i = 0; i < dims.nbDims; i++) {
+        text += (i > 0 ? "x" : "") + std::to_string(dims.d[i]);
+    }
+    return text;
+}
+
+// the backend-neutral types of the InferBackend interface, TensorType lists nvinfer1::DataType in its order
+static_assert(static_cast<int>(TensorType::kHALF) == static_cast<int>(nvinfer1::DataType::kHALF) &&
+              static_cast<int>(TensorType::kINT8) == static_cast<int>(nvinfer1::DataType::kINT8) &&
+              static_cast<int>(TensorType::kINT32) == static_cast<int>(nvinfer1::DataType::kINT32) &&
+              static_cast<int>(TensorType::kBOOL) == static_cast<int>(nvinfer1::DataType::kBOOL),
+              "TensorType must match nvinfer1::DataType");
+
+TensorType ToTensorType(nvinfer1::DataType type) {
+    return static_cast<TensorType>(type);
+}
+
+TensorDims ToTensorDims(const nvinfer1::Dims& dims) {
+    TensorDims tensorDims = {};
+    tensorDims.nbDims = dims.nbDims;
+    std::copy(dims.d, dims.d + dims.nbDims, tensorDims.d);
+    return tensorDims;
+}
+
+nvinfer1::Dims ToTrtDims(const TensorDims& dims) {
+    nvinfer1::Dims trtDims = {};
+    trtDims.nbDims = dims.nbDims;
+    std::copy(dims.d, dims.d + dims.nbDims, trtDims.d);
+    return trtDims;
+}
+
+} // namespace
 
 Trt::Trt() {
     m_minDim = {};
     m_optDim = {};
     m_maxDim = {};
 
+    CUDA_CHECK(cudaGetDevice(&mDevice));
     mBuilder = nvinfer1::createInferBuilder(mLogger);
     mConfig = mBuilder->createBuilderConfig();
 }
@@ -55,21 +169,22 @@ Trt::~Trt() {
     }
 
     //preprocess DynamicShape
-    if (mPreprocessorContext != nullptr) {
-        mPreprocessorContext->destroy();
-        mPreprocessorContext = nullptr;
+    for (nvinfer1::IExecutionContext* context : mPreprocessorContexts) {
+        context->destroy();
     }
+    mPreprocessorContexts.clear();
     if (mPreprocessorEngine != nullptr) {
         mPreprocessorEngine->destroy();
         mPreprocessorEngine = nullptr;
     }
 
-    for(size_t i=0;i<mBinding.size();i++) {
-        safeCudaFree(mBinding[i]);
+    if(mArena != nullptr) {
+        safeCudaFree(mArena);
+        mArena = nullptr;
     }
 }
 
-void Trt::CreateEngine(
+bool Trt::CreateEngine(
         const std::string& onnxModel,
         const std::string& engineFile,
         const std::vector<std::string>& customOutput,
@@ -77,18 +192,41 @@ void Trt::CreateEngine(
         int mode) {
     mBatchSize = maxBatchSize;
     mRunMode = mode;
-    if(!DeserializeEngine(engineFile)) {
-        if(!BuildEngineWithOnnx(onnxModel,engineFile,customOutput)) {
+    // registered plugins are part of the cache key
+    ProcessRuntime();
+    std::string manifestEngine = ApplyEngineManifest(customOutput);
+    mEngineKey = MakeEngineKey(onnxModel, customOutput);
+    // without the onnx there is no model hash, a cache path would be shared by every engine only model
+    bool useCache = !mEngineCacheDir.empty() && mEngineKey.hash != 0;
+    if(!mEngineCacheDir.empty() && !useCache) {
+        spdlog::warn("no onnx model hash, engine cache {} is not used, loading {}", mEngineCacheDir, engineFile);
+    }
+    std::string enginePath = useCache ? EngineCachePath(mEngineCacheDir, mEngineKey) : engineFile;
+    size_t dirEnd = enginePath.find_last_of("/\\");
+    mTimingCachePath = TimingCachePath(dirEnd == std::string::npos ? "" : enginePath.substr(0, dirEnd + 1), mEngineKey.envHash);
+    // the manifest engine is only read, a rebuild goes to the usual path so the sweep result is never overwritten
+    bool loaded = !manifestEngine.empty() && DeserializeEngine(manifestEngine);
+    if(!manifestEngine.empty() && !loaded) {
+        spdlog::warn("engine {} of the manifest does not fit, use {}", manifestEngine, enginePath);
+    }
+    if(!loaded && !DeserializeEngine(enginePath)) {
+        if(!BuildEngineWithOnnx(onnxModel,enginePath,customOutput)) {
             spdlog::error("error: could not deserialize or build engine");
-            return;
+            return false;
         }
     }
     spdlog::info("create execute context and malloc device memory...");
     InitEngine();
+    return true;
 }
 
 bool Trt::buildPreprocessorEngine()
 {
+    if (mBindingDataType[GetInputBindingIndex()] == nvinfer1::DataType::kINT8)
+    {
+        spdlog::error("preprocessor engine resize float images, the model input is int8 with SetInputPrologue");
+        return false;
+    }
     // Create the preprocessor engine using a network that supports full dimensions (createNetworkV2).
     auto mFlags = 1U << static_cast<uint32_t>(nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH);
     auto preprocessorNetwork = mBuilder->createNetworkV2(mFlags);
@@ -100,9 +238,11 @@ bool Trt::buildPreprocessorEngine()
     // Reshape a dynamically shaped input to the size expected by the model
     auto input = preprocessorNetwork->addInput("input", nvinfer1::DataType::kFLOAT, nvinfer1::Dims4{ -1, 3, -1, -1 });
     auto resizeLayer = preprocessorNetwork->addResize(*input);
-    auto mPredictionInputDims = mBindingDims[0];
+    auto mPredictionInputDims = mBindingDims[GetInputBindingIndex()];
     resizeLayer->setOutputDimensions(mPredictionInputDims);
     preprocessorNetwork->markOutput(*resizeLayer->getOutput(0));
+    // write the model input in its own precision, fp16 with SetHalfIO
+    resizeLayer->getOutput(0)->setType(mBindingDataType[GetInputBindingIndex()]);
 
     // Finally, configure and build the preprocessor engine.
     auto preprocessorConfig = mBuilder->createBuilderConfig();
@@ -111,38 +251,120 @@ bool Trt::buildPreprocessorEngine()
         return false;
     }
 
-    auto profile = mBuilder->createOptimizationProfile();
-    profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMIN, m_minDim);
-    profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kOPT, m_optDim);
-    profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMAX, m_maxDim);
-    preprocessorConfig->addOptimizationProfile(profile);
+    // one profile per shape bucket, so a small frame is resized by kernels tuned for small frames. Every bucket
+    // has a copy per context slot like the model engine, a TrtContext binds its own copies and never shares them
+    mPreprocessorProfiles = mShapeBuckets;
+    if (mPreprocessorProfiles.empty())
+    {
+        ShapeProfile shape;
+        shape.min.assign(m_minDim.d, m_minDim.d + 4);
+        shape.opt.assign(m_optDim.d, m_optDim.d + 4);
+        shape.max.assign(m_maxDim.d, m_maxDim.d + 4);
+        mPreprocessorProfiles.push_back(shape);
+    }
+    for (const ShapeProfile& shape : mPreprocessorProfiles)
+    {
+        for (int slot = 0; slot <= mMaxContexts; slot++)
+        {
+            auto profile = mBuilder->createOptimizationProfile();
+            profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMIN, nvinfer1::Dims4{ shape.min[0], shape.min[1], shape.min[2], shape.min[3] });
+            profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kOPT, nvinfer1::Dims4{ shape.opt[0], shape.opt[1], shape.opt[2], shape.opt[3] });
+            profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMAX, nvinfer1::Dims4{ shape.max[0], shape.max[1], shape.max[2], shape.max[3] });
+            preprocessorConfig->addOptimizationProfile(profile);
+        }
+    }
 
     mPreprocessorEngine = mBuilder->buildEngineWithConfig(*preprocessorNetwork, *preprocessorConfig);
     if (!mPreprocessorEngine)
     {
         return false;
     }
-    mPreprocessorContext = mPreprocessorEngine->createExecutionContext();
-    if (!mPreprocessorContext)
+    // slot 0 of every bucket serves the ForwardPreprocessor of the backend, contexts create theirs
+    mPreprocessorContexts = CreatePreprocessorContexts(0);
+    return !mPreprocessorContexts.empty();
+}
+
+std::vector<nvinfer1::IExecutionContext*> Trt::CreatePreprocessorContexts(int slot) const {
+    std::vector<nvinfer1::IExecutionContext*> contexts;
+    if (mPreprocessorEngine == nullptr || slot > mMaxContexts)
     {
+        return contexts;
+    }
+    for (size_t bucket = 0; bucket < mPreprocessorProfiles.size(); bucket++)
+    {
+        nvinfer1::IExecutionContext* context = mPreprocessorEngine->createExecutionContext();
+        if (context == nullptr || !context->setOptimizationProfile(GetProfileIndex(static_cast<int>(bucket), slot)))
+        {
+            spdlog::error("create preprocessor context of bucket {} slot {} failed", bucket, slot);
+            if (context != nullptr)
+            {
+                context->destroy();
+            }
+            for (nvinfer1::IExecutionContext* created : contexts)
+            {
+                created->destroy();
+            }
+            return {};
+        }
+        contexts.push_back(context);
+    }
+    return contexts;
+}
+
+int Trt::GetPreprocessorBindingOffset(int bucket, int slot) const {
+    // binding i of profile k has index i + k * bindings per profile
+    int nbProfiles = mPreprocessorEngine->getNbOptimizationProfiles();
+    return GetProfileIndex(bucket, slot) * (mPreprocessorEngine->getNbBindings() / nbProfiles);
+}
+
+bool Trt::ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims, const cudaStream_t& stream) {
+    if(mPreprocessorContexts.empty()) {
+        spdlog::error("preprocessor engine is empty, call buildPreprocessorEngine first");
         return false;
     }
-    return true;
+    int bucket = SelectShapeBucket(inputDims);
+    if(bucket < 0) {
+        return false;
+    }
+    nvinfer1::IExecutionContext* preprocessor = mPreprocessorContexts[bucket];
+    void* deviceInput = safeCudaMalloc(input.size() * sizeof(float));
+    CUDA_CHECK(cudaMemcpyAsync(deviceInput, input.data(), input.size() * sizeof(float), cudaMemcpyHostToDevice, stream));
+    int offset = GetPreprocessorBindingOffset(bucket, 0);
+    preprocessor->setBindingDimensions(offset, ToTrtDims(inputDims));
+    // We can only run inference once all dynamic input shapes have been specified.
+    if(!preprocessor->allInputDimensionsSpecified()) {
+        safeCudaFree(deviceInput);
+        return false;
+    }
+    std::vector<void*> preprocessorBindings(mPreprocessorEngine->getNbBindings(), nullptr);
+    preprocessorBindings[offset] = deviceInput;
+    preprocessorBindings[offset + 1] = mBinding[GetInputBindingIndex()];
+    bool status = preprocessor->enqueueV2(preprocessorBindings.data(), stream, nullptr);
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    safeCudaFree(deviceInput);
+    return status;
 }
 
 void Trt::Forward() {
-    if(mFlags == 1U << static_cast<uint32_t>(nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH)) {
-        mContext->executeV2(&mBinding[0]);
-    } else {
+    if(mShareActivationMemory) {
+        mContext->setDeviceMemory(SharedActivationMemory::Instance().Get(mDevice, 0));
+    }
+    // mFlags is only set when building, deserialized engines tell it themselves
+    if(mEngine->hasImplicitBatchDimension()) {
         mContext->execute(mBatchSize, &mBinding[0]);
+    } else {
+        mContext->executeV2(&mBinding[0]);
     }
 }
 
 void Trt::ForwardAsync(const cudaStream_t& stream) {
-    if(mFlags == 1U << static_cast<uint32_t>(nvinfer1::NetworkDefinitionCreationFlag::kEXPLICIT_BATCH)) {
-        mContext->enqueueV2(&mBinding[0], stream, nullptr);
-    } else {
+    if(mShareActivationMemory) {
+        mContext->setDeviceMemory(SharedActivationMemory::Instance().Get(mDevice, 0));
+    }
+    if(mEngine->hasImplicitBatchDimension()) {
         mContext->enqueue(mBatchSize, &mBinding[0], stream, nullptr);
+    } else {
+        mContext->enqueueV2(&mBinding[0], stream, nullptr);
     }
 }
 
@@ -152,44 +374,77 @@ void Trt::SetBindingDimensions(std::vector<int>& inputDims, int bindIndex) {
 }
 
 void Trt::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) {
-    assert(input.size()*sizeof(float) <= mBindingSize[bindIndex]);
-    CUDA_CHECK(cudaMemcpy(mBinding[bindIndex], input.data(), mBindingSize[bindIndex], cudaMemcpyHostToDevice));
+    CopyFromHostToDevice(input, bindIndex, nullptr);
+    CUDA_CHECK(cudaStreamSynchronize(nullptr));
 }
 
 void Trt::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex, const cudaStream_t& stream) {
-    assert(input.size()*sizeof(float) <= mBindingSize[bindIndex]);
-    CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], input.data(), mBindingSize[bindIndex], cudaMemcpyHostToDevice, stream));
+    size_t elementSize = getElementSize(mBindingDataType[bindIndex]);
+    assert(input.size()*elementSize <= mBindingSize[bindIndex]);
+    size_t count = std::min(input.size(), mBindingSize[bindIndex] / elementSize);
+    CopyFromHostToDevice(input.data(), count, bindIndex, stream);
 }
 
 void Trt::CopyFromHostToDevice(const float* input, int bindIndex, const cudaStream_t& stream) {
-    //assert(input.size() * sizeof(float) <= mBindingSize[bindIndex]);
-    CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], input, mBindingSize[bindIndex], cudaMemcpyHostToDevice, stream));
+    CopyFromHostToDevice(input, mBindingSize[bindIndex] / getElementSize(mBindingDataType[bindIndex]), bindIndex, stream);
+}
+
+void Trt::CopyFromHostToDevice(const float* input, size_t count, int bindIndex, const cudaStream_t& stream) {
+    if(mBindingDataType[bindIndex] != nvinfer1::DataType::kHALF) {
+        CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], input, count * sizeof(float), cudaMemcpyHostToDevice, stream));
+        return;
+    }
+    // converted copy only live in this call, wait for the transfer
+    std::vector<Half> half(count);
+    FloatToHalf(input, half.data(), count);
+    CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], half.data(), count * sizeof(Half), cudaMemcpyHostToDevice, stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
 void Trt::CopyFromDeviceToHost(std::vector<float>& output, int bindIndex) {
-    output.resize(mBindingSize[bindIndex]/sizeof(float));
-    CUDA_CHECK(cudaMemcpy(output.data(), mBinding[bindIndex], mBindingSize[bindIndex], cudaMemcpyDeviceToHost));
+    CopyFromDeviceToHost(output, bindIndex, nullptr);
+    CUDA_CHECK(cudaStreamSynchronize(nullptr));
 }
 
 void Trt::CopyFromDeviceToHost(std::vector<float>& output, int bindIndex, const cudaStream_t& stream) {
-    output.resize(mBindingSize[bindIndex]/sizeof(float));
-    CUDA_CHECK(cudaMemcpyAsync(output.data(), mBinding[bindIndex], mBindingSize[bindIndex], cudaMemcpyDeviceToHost, stream));
+    size_t count = mBindingSize[bindIndex] / getElementSize(mBindingDataType[bindIndex]);
+    output.resize(count);
+    if(mBindingDataType[bindIndex] != nvinfer1::DataType::kHALF) {
+        CUDA_CHECK(cudaMemcpyAsync(output.data(), mBinding[bindIndex], mBindingSize[bindIndex], cudaMemcpyDeviceToHost, stream));
+        return;
+    }
+    // fp32 result only exist after the transfer, so a kHALF binding is copied synchronously
+    std::vector<Half> half(count);
+    CUDA_CHECK(cudaMemcpyAsync(half.data(), mBinding[bindIndex], mBindingSize[bindIndex], cudaMemcpyDeviceToHost, stream));
+    CUDA_CHECK(cudaStreamSynchronize(stream));
+    HalfToFloat(half.data(), output.data(), count);
+}
+
+cudaStream_t Trt::CreateStream() {
+    cudaStream_t stream;
+    CUDA_CHECK(cudaStreamCreate(&stream));
+    return stream;
+}
+
+void Trt::DestroyStream(cudaStream_t stream) {
+    CUDA_CHECK(cudaStreamDestroy(stream));
+}
+
+void Trt::SynchronizeStream(const cudaStream_t& stream) {
+    CUDA_CHECK(cudaStreamSynchronize(stream));
 }
 
 void Trt::SetDevice(int device) {
-    spdlog::warn("warning: make sure save engine file match choosed device");
+    if(mEngine != nullptr) {
+        spdlog::warn("set device {} after CreateEngine, the engine stays on device {}", device, mDevice);
+        return;
+    }
     CUDA_CHECK(cudaSetDevice(device));
+    mDevice = device;
 }
 
-int Trt::GetDevice() const { 
-    int device = -1;
-    CUDA_CHECK(cudaGetDevice(&device));
-    if(device != -1) {
-        return device;
-    } else {
-        spdlog::error("Get Device Error");
-        return -1;
-    }
+int Trt::GetDevice() const {
+    return mDevice;
 }
 
 void Trt::SetInt8Calibrator(const std::string& calibratorType, int input_w,
@@ -218,42 +473,181 @@ void Trt::AddDynamicShapeProfile(int batchSize,
     m_minDim = minDim;
     m_optDim = optDim;
     m_maxDim = maxDim;
-    nvinfer1::IOptimizationProfile* profile = mBuilder->createOptimizationProfile();
-    profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kMIN, minDim);
-    profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kOPT, optDim);
-    profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kMAX, maxDim);
-    assert(profile->isValid());
-    mConfig->addOptimizationProfile(profile);
+    mProfileKey += inputName + ":" + std::to_string(batchSize);
+    for(const std::vector<int>* dims : {&minDimVec, &optDimVec, &maxDimVec}) {
+        for(int d : *dims) {
+            mProfileKey += "," + std::to_string(d);
+        }
+    }
+    mProfileKey += ";";
+    ShapeProfile shape;
+    shape.min.assign(minDim.d, minDim.d + 4);
+    shape.opt.assign(optDim.d, optDim.d + 4);
+    shape.max.assign(maxDim.d, maxDim.d + 4);
+    mShapeBuckets.push_back(shape);
+    // mContext use profile 0, every context from CreateContext need its own copy
+    for(int k = 0; k < mMaxContexts + 1; k++) {
+        nvinfer1::IOptimizationProfile* profile = mBuilder->createOptimizationProfile();
+        profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kMIN, minDim);
+        profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kOPT, optDim);
+        profile->setDimensions(inputName.c_str(), nvinfer1::OptProfileSelector::kMAX, maxDim);
+        assert(profile->isValid());
+        mConfig->addOptimizationProfile(profile);
+    }
 }
 
 void Trt::SetMaxBatchSize(int max_batch) {
     mBatchSize = max_batch;
 }
 
+void Trt::SetMaxContexts(int maxContexts) {
+    mMaxContexts = std::max(maxContexts, 1);
+}
+
+void Trt::SetShareActivationMemory(bool share) {
+    mShareActivationMemory = share;
+}
+
+void Trt::SetCudaGraph(bool enable) {
+    mCudaGraph = enable;
+}
+
+void Trt::SetHalfIO(bool enable) {
+    mHalfIO = enable;
+}
+
+void Trt::SetInputPrologue(const InputPrologue& prologue) {
+    mInputPrologue = prologue;
+}
+
+void Trt::SetEngineCacheDir(const std::string& dir) {
+    mEngineCacheDir = dir;
+}
+
+void Trt::SetBatchProfiles(const std::vector<int>& maxBatches) {
+    mBatchBuckets = maxBatches;
+}
+
+void Trt::SetMaxWorkspaceSize(size_t bytes) {
+    mWorkspaceSize = bytes;
+}
+
+void Trt::SetEngineManifest(const std::string& manifest, const std::string& objective, double latencyBudgetMs) {
+    mEngineManifest = manifest;
+    mManifestObjective = ParseSweepObjective(objective);
+    mLatencyBudgetMs = latencyBudgetMs;
+}
+
+std::string Trt::GetBuildTarget() const {
+    // plugins registered by the runtime are part of the target
+    ProcessRuntime();
+    char target[32];
+    snprintf(target, sizeof(target), "%016llx", static_cast<unsigned long long>(HashBuildEnvironment()));
+    return target;
+}
+
+std::string Trt::ApplyEngineManifest(const std::vector<std::string>& customOutput) {
+    if(mEngineManifest.empty()) {
+        return "";
+    }
+    std::vector<SweepManifestEntry> entries;
+    if(!ReadSweepManifest(mEngineManifest, entries)) {
+        spdlog::warn("could not read engine manifest {}, build options are kept", mEngineManifest);
+        return "";
+    }
+    EngineBuildOptions options = MakeEngineBuildOptions(mMaxContexts, mHalfIO, mInputPrologue, customOutput);
+    int index = SelectSweepEntry(entries, GetBuildTarget(), options, mBatchSize, mManifestObjective, mLatencyBudgetMs,
+                                 mRunMode == 2);
+    if(index < 0) {
+        spdlog::warn("engine manifest {} has no engine of max batch {} and these build options for this target, "
+                     "build options are kept", mEngineManifest, mBatchSize);
+        return "";
+    }
+    const SweepResult& result = entries[index].result;
+    mRunMode = result.variant.mode;
+    mWorkspaceSize = result.variant.workspaceSize;
+    mBatchBuckets = result.variant.batchProfiles;
+    spdlog::info("engine manifest pick {}: {} ms at batch 1, {} images/s", result.variant.Name(), result.latencyMs,
+                 result.throughput);
+    return result.engineFile;
+}
+
+int Trt::GetProfileIndex(int bucket, int slot) const {
+    return bucket * (mMaxContexts + 1) + slot;
+}
+
+int Trt::SelectBatchBucket(int batchSize) const {
+    if(mNbBuckets <= 1 || !mShapeBuckets.empty()) {
+        return 0;
+    }
+    std::vector<ShapeProfile> profiles;
+    for(int batch : mBatchBuckets) {
+        ShapeProfile profile;
+        profile.min = {1};
+        profile.opt = {batch};
+        profile.max = {batch};
+        profiles.push_back(profile);
+    }
+    return SelectProfile(profiles, {batchSize});
+}
+
+int Trt::SelectShapeBucket(const TensorDims& inputDims) const {
+    std::vector<int> dims(inputDims.d, inputDims.d + inputDims.nbDims);
+    int bucket = SelectProfile(mPreprocessorProfiles, dims);
+    if(bucket < 0) {
+        spdlog::error("input shape {}x{}x{}x{} is outside every optimization profile", dims[0], dims[1], dims[2], dims[3]);
+    }
+    return bucket;
+}
+
 int Trt::GetMaxBatchSize() const{
     return mBatchSize;
 }
 
+std::vector<ShapeProfile> Trt::GetShapeProfiles() const {
+    return mShapeBuckets;
+}
+
 void* Trt::GetBindingPtr(int bindIndex) const {
     return mBinding[bindIndex];
 }
 
+bool Trt::BindingIsOnDevice() const {
+    return true;
+}
+
 size_t Trt::GetBindingSize(int bindIndex) const {
     return mBindingSize[bindIndex];
 }
 
-nvinfer1::Dims Trt::GetBindingDims(int bindIndex) const {
-    return mBindingDims[bindIndex];
+TensorDims Trt::GetBindingDims(int bindIndex) const {
+    return ToTensorDims(mBindingDims[bindIndex]);
 }
 
-nvinfer1::DataType Trt::GetBindingDataType(int bindIndex) const {
-    return mBindingDataType[bindIndex];
+TensorType Trt::GetBindingDataType(int bindIndex) const {
+    return ToTensorType(mBindingDataType[bindIndex]);
 }
 
 std::string Trt::GetBindingName(int bindIndex) const{
     return mBindingName[bindIndex];
 }
 
+int Trt::GetBindingIndex(const std::string& name) const {
+    return mEngine->getBindingIndex(name.c_str());
+}
+
+bool Trt::BindingIsInput(int bindIndex) const {
+    return mEngine->bindingIsInput(bindIndex);
+}
+
+bool Trt::BindingHasBatchAxis(int bindIndex) const {
+    return mBindingHasBatch[bindIndex];
+}
+
+int Trt::GetNbBindings() const {
+    return static_cast<int>(mBinding.size());
+}
+
 int Trt::GetNbInputBindings() const {
     return mNbInputBindings;
 }
@@ -262,6 +656,36 @@ int Trt::GetNbOutputBindings() const {
     return mNbOutputBindings;
 }
 
+std::unique_ptr<InferContext> Trt::CreateContext() {
+    if(mEngine == nullptr) {
+        spdlog::error("engine is empty, call CreateEngine before CreateContext");
+        return nullptr;
+    }
+    // slots are handed out in creation order, threads may create their contexts concurrently
+    std::lock_guard<std::mutex> lock(mContextMutex);
+    bool dynamicShape = false;
+    for(int i = 0; i < mEngine->getNbBindings(); i++) {
+        nvinfer1::Dims dims = mEngine->getBindingDimensions(i);
+        dynamicShape |= std::any_of(dims.d, dims.d + dims.nbDims, [](int d) { return d < 0; });
+    }
+    int profileIndex = -1;
+    if(dynamicShape) {
+        // a profile can only be used by one context at a time, mContext own slot 0 of every bucket
+        profileIndex = GetProfileIndex(0, mNbContexts);
+        if(mNbContexts >= mNbProfiles / mNbBuckets) {
+            spdlog::error("dynamic shape engine has {} optimization profile per bucket, could not create context {}",
+                          mNbProfiles / mNbBuckets, mNbContexts);
+            return nullptr;
+        }
+    }
+    std::unique_ptr<TrtContext> context(new TrtContext(*this, profileIndex));
+    if(!context->IsValid()) {
+        return nullptr;
+    }
+    mNbContexts++;
+    return std::move(context);
+}
+
 void Trt::SaveEngine(const std::string& fileName) {
     if(fileName == "") {
         spdlog::warn("empty engine file name, skip save");
@@ -270,14 +694,9 @@ void Trt::SaveEngine(const std::string& fileName) {
     if(mEngine != nullptr) {
         spdlog::info("save engine to {}...",fileName);
         nvinfer1::IHostMemory* data = mEngine->serialize();
-        std::ofstream file;
-        file.open(fileName,std::ios::binary | std::ios::out);
-        if(!file.is_open()) {
-            spdlog::error("read create engine file {} failed",fileName);
-            return;
+        if(!WriteEngineFile(fileName, mEngineKey, data->data(), data->size())) {
+            spdlog::error("save engine to {} failed",fileName);
         }
-        file.write((const char*)data->data(), data->size());
-        file.close();
         data->destroy();
     } else {
         spdlog::error("engine is empty, save engine failed");
@@ -285,25 +704,45 @@ void Trt::SaveEngine(const std::string& fileName) {
 }
 
 bool Trt::DeserializeEngine(const std::string& engineFile) {
-    std::ifstream in(engineFile.c_str(), std::ifstream::binary);
-    if(in.is_open()) {
+    // tensorrt read the engine straight from the mapped file, no heap copy
+    bool loaded = ReadEngineFile(engineFile, mEngineKey, [this, &engineFile](const void* engine, size_t size) {
         spdlog::info("deserialize engine from {}",engineFile);
-        auto const start_pos = in.tellg();
-        in.ignore(std::numeric_limits<std::streamsize>::max());
-        size_t bufCount = in.gcount();
-        in.seekg(start_pos);
-        std::unique_ptr<char[]> engineBuf(new char[bufCount]);
-        in.read(engineBuf.get(), bufCount);
-        initLibNvInferPlugins(&mLogger, "");
-        mRuntime = nvinfer1::createInferRuntime(mLogger);
-        mEngine = mRuntime->deserializeCudaEngine((void*)engineBuf.get(), bufCount, nullptr);
-        assert(mEngine != nullptr);
-        mBatchSize = mEngine->getMaxBatchSize();
-        spdlog::info("max batch size of deserialized engine: {}",mEngine->getMaxBatchSize());
-        mRuntime->destroy();
-        return true;
+        mEngine = ProcessRuntime()->deserializeCudaEngine(engine, size, nullptr);
+        return mEngine != nullptr;
+    });
+    if(!loaded) {
+        return false;
+    }
+    mBatchSize = GetEngineBatchSize();
+    spdlog::info("max batch size of deserialized engine: {}",mBatchSize);
+    return true;
+}
+
+EngineCacheKey Trt::MakeEngineKey(const std::string& onnxModel, const std::vector<std::string>& customOutput) const {
+    EngineCacheKey key;
+    key.envHash = HashBuildEnvironment();
+    MappedFile onnx;
+    if(!onnx.Open(onnxModel)) {
+        spdlog::warn("read onnx model {} failed, engine file is only checked against tensorrt, gpu and plugins", onnxModel);
+        return key;
+    }
+    uint64_t hash = HashBytes(onnx.Data(), onnx.Size(), key.envHash);
+    int options[] = {mRunMode, mBatchSize, mMaxContexts, mHalfIO ? 1 : 0, mInputPrologue.enable ? 1 : 0};
+    hash = HashBytes(options, sizeof(options), hash);
+    if(mInputPrologue.enable) {
+        hash = HashBytes(&mInputPrologue.scale, sizeof(mInputPrologue.scale), hash);
+        hash = HashBytes(mInputPrologue.mean.data(), mInputPrologue.mean.size() * sizeof(float), hash);
+        hash = HashBytes(mInputPrologue.std.data(), mInputPrologue.std.size() * sizeof(float), hash);
     }
-    return false;
+    hash = HashString(mProfileKey, hash);
+    hash = HashBytes(mBatchBuckets.data(), mBatchBuckets.size() * sizeof(int), hash);
+    hash = HashBytes(&mWorkspaceSize, sizeof(mWorkspaceSize), hash);
+    for(const std::string& output : customOutput) {
+        hash = HashString(output, hash);
+    }
+    // 0 means no onnx hash in ReadEngineFile
+    key.hash = hash == 0 ? 1 : hash;
+    return key;
 }
 
 void Trt::BuildEngine() {
@@ -313,12 +752,15 @@ void Trt::BuildEngine() {
         if (!mBuilder->platformHasFastFp16()) {
             spdlog::warn("the platform do not has fast for fp16");
         }
+#if NV_TENSORRT_MAJOR < 8
+        // removed in tensorrt 8, the config flag alone selects fp16 there
         mBuilder->setFp16Mode(true);
+#endif
         mConfig->setFlag(nvinfer1::BuilderFlag::kFP16);
     }
     mBuilder->setMaxBatchSize(mBatchSize);
     // set the maximum GPU temporary memory which the engine can use at execution time.
-    mConfig->setMaxWorkspaceSize(10 << 20);
+    mConfig->setMaxWorkspaceSize(mWorkspaceSize);
     
     spdlog::info("fp16 support: {}",mBuilder->platformHasFastFp16 ());
     spdlog::info("int8 support: {}",mBuilder->platformHasFastInt8 ());
@@ -327,9 +769,212 @@ void Trt::BuildEngine() {
     spdlog::info("Number of DLA core: {}",mBuilder->getNbDLACores());
     spdlog::info("Max DLA batchsize: {}",mBuilder->getMaxDLABatchSize());
     spdlog::info("Current use DLA core: {}",mConfig->getDLACore()); // TODO: set DLA core
+#if NV_TENSORRT_MAJOR >= 8
+    // timing cache api exist since tensorrt 8: tactic timings of earlier builds on this gpu are reused, layers
+    // seen before are not profiled again. Objects are released with delete there.
+    TimingCacheFile timingCacheFile(mTimingCachePath);
+    std::vector<char> timingCacheData;
+    if(timingCacheFile.Load(timingCacheData)) {
+        spdlog::info("load timing cache from {}", mTimingCachePath);
+    }
+    nvinfer1::ITimingCache* timingCache = mConfig->createTimingCache(timingCacheData.data(), timingCacheData.size());
+    mConfig->setTimingCache(*timingCache, false);
+#else
+    // deferred on tensorrt 7: no api to load or save tactic timings, the algorithm selector of 7.x only restricts
+    // the choices and still times them. Every layer is profiled again
+    spdlog::info("timing cache needs tensorrt 8, build profiles every tactic");
+#endif
     spdlog::info("build engine...");
     mEngine = mBuilder -> buildEngineWithConfig(*mNetwork, *mConfig);
     assert(mEngine != nullptr);
+#if NV_TENSORRT_MAJOR >= 8
+    // another build may have saved its timings meanwhile, merge with the file content under its lock
+    bool saved = timingCacheFile.Update([this, timingCache](const std::vector<char>& current, std::vector<char>& merged) {
+        if(!current.empty()) {
+            nvinfer1::ITimingCache* onDisk = mConfig->createTimingCache(current.data(), current.size());
+            timingCache->combine(*onDisk, true);
+            delete onDisk;
+        }
+        nvinfer1::IHostMemory* data = timingCache->serialize();
+        merged.assign(static_cast<const char*>(data->data()), static_cast<const char*>(data->data()) + data->size());
+        delete data;
+        return true;
+    });
+    if(saved) {
+        spdlog::info("save timing cache to {}", mTimingCachePath);
+    }
+    delete timingCache;
+#endif
+}
+
+void Trt::AddDynamicBatchProfiles() {
+    if(mConfig->getNbOptimizationProfiles() > 0) {
+        return;
+    }
+    std::vector<nvinfer1::ITensor*> inputs;
+    for(int i = 0; i < mNetwork->getNbInputs(); i++) {
+        nvinfer1::ITensor* input = mNetwork->getInput(i);
+        nvinfer1::Dims dims = input->getDimensions();
+        if(dims.d[0] >= 0) {
+            continue;
+        }
+        if(std::any_of(dims.d + 1, dims.d + dims.nbDims, [](int d) { return d < 0; })) {
+            spdlog::warn("input {} has dynamic dimension besides batch, use AddDynamicShapeProfile", input->getName());
+            return;
+        }
+        inputs.push_back(input);
+    }
+    if(inputs.empty()) {
+        return;
+    }
+    std::vector<int> buckets = BatchBuckets(mBatchBuckets, mBatchSize);
+    // mContext use profile 0, every context from CreateContext need its own copy of each bucket
+    int nbProfiles = mMaxContexts + 1;
+    for(int batch : buckets) {
+        spdlog::info("dynamic batch input, add {} optimization profile with batch 1 to {}", nbProfiles, batch);
+        for(int k = 0; k < nbProfiles; k++) {
+            nvinfer1::IOptimizationProfile* profile = mBuilder->createOptimizationProfile();
+            for(nvinfer1::ITensor* input : inputs) {
+                nvinfer1::Dims minDim = input->getDimensions();
+                nvinfer1::Dims maxDim = minDim;
+                minDim.d[0] = 1;
+                maxDim.d[0] = batch;
+                profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMIN, minDim);
+                profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kOPT, maxDim);
+                profile->setDimensions(input->getName(), nvinfer1::OptProfileSelector::kMAX, maxDim);
+            }
+            assert(profile->isValid());
+            mConfig->addOptimizationProfile(profile);
+            if(k == 0 && batch == buckets[0] && mRunMode == 2) {
+                mConfig->setCalibrationProfile(profile);
+            }
+        }
+    }
+}
+
+bool Trt::AddInputPrologue() {
+    if(mNetwork->getNbInputs() != 1) {
+        spdlog::warn("input prologue needs a single network input, got {}", mNetwork->getNbInputs());
+        return false;
+    }
+    nvinfer1::ITensor* input = mNetwork->getInput(0);
+    nvinfer1::Dims dims = input->getDimensions();
+    if(dims.nbDims != 4 || input->getType() != nvinfer1::DataType::kFLOAT ||
+       std::any_of(dims.d + 1, dims.d + dims.nbDims, [](int d) { return d < 0; })) {
+        spdlog::warn("input prologue needs a float NCHW input with fixed C, H and W, {} keeps its float input", input->getName());
+        return false;
+    }
+    if(mRunMode == 2) {
+        spdlog::warn("int8 calibrator feeds float batches, input prologue is ignored in run mode 2");
+        return false;
+    }
+    int channel = dims.d[1];
+    // the whole int8 range is stored, pixel 0 is -128. Tensorrt quantizes symmetric with a step of
+    // max(|min|, |max|) / 127, the scale layer divides that step out again so the pixels stay exact
+    const float rangeMin = -128.f;
+    const float rangeMax = 127.f;
+    const float step = std::max(std::abs(rangeMin), std::abs(rangeMax)) / 127.f;
+    mPrologueWeights.resize(channel * 2);
+    for(int c = 0; c < channel; c++) {
+        mPrologueWeights[c] = InputPrologueScale(mInputPrologue, c) / step;
+        mPrologueWeights[channel + c] = InputPrologueShift(mInputPrologue, c);
+    }
+    // the new input take over the name so bindings, profiles and detectors still find it
+    std::string name = input->getName();
+    input->setName((name + "_float").c_str());
+    nvinfer1::ITensor* pixels = mNetwork->addInput(name.c_str(), nvinfer1::DataType::kINT8,
+                                                   nvinfer1::Dims4{dims.d[0], dims.d[2], dims.d[3], dims.d[1]});
+    // the stored value is pixel - kInputPrologueOffset
+    pixels->setDynamicRange(rangeMin, rangeMax);
+    pixels->setAllowedFormats(1U << static_cast<int>(nvinfer1::TensorFormat::kLINEAR));
+    nvinfer1::IIdentityLayer* cast = mNetwork->addIdentity(*pixels);
+    cast->setOutputType(0, nvinfer1::DataType::kFLOAT);
+    nvinfer1::IShuffleLayer* transpose = mNetwork->addShuffle(*cast->getOutput(0));
+    transpose->setFirstTranspose(nvinfer1::Permutation{{0, 3, 1, 2}});
+    nvinfer1::Weights scale{nvinfer1::DataType::kFLOAT, mPrologueWeights.data(), channel};
+    nvinfer1::Weights shift{nvinfer1::DataType::kFLOAT, mPrologueWeights.data() + channel, channel};
+    nvinfer1::Weights power{nvinfer1::DataType::kFLOAT, nullptr, 0};
+    nvinfer1::IScaleLayer* normalize = mNetwork->addScaleNd(*transpose->getOutput(0), nvinfer1::ScaleMode::kCHANNEL,
+                                                            shift, scale, power, 1);
+    nvinfer1::ITensor* normalized = normalize->getOutput(0);
+    for(int i = 0; i < mNetwork->getNbLayers(); i++) {
+        nvinfer1::ILayer* layer = mNetwork->getLayer(i);
+        for(int j = 0; j < layer->getNbInputs(); j++) {
+            if(layer->getInput(j) == input) {
+                layer->setInput(j, *normalized);
+            }
+        }
+    }
+    mNetwork->removeTensor(*input);
+    // int8 is enabled for the input only. Without a calibrator no other tensor has a range, so every float layer
+    // after the cast is held to the precision of the run mode instead of being considered for int8. Plugins
+    // choose their formats themselves and are left alone
+    mConfig->setFlag(nvinfer1::BuilderFlag::kINT8);
+    nvinfer1::DataType precision = mRunMode == 1 ? nvinfer1::DataType::kHALF : nvinfer1::DataType::kFLOAT;
+    for(int i = 0; i < mNetwork->getNbLayers(); i++) {
+        nvinfer1::ILayer* layer = mNetwork->getLayer(i);
+        if(layer == cast || layer->getType() == nvinfer1::LayerType::kPLUGIN_V2) {
+            continue;
+        }
+        bool floatOutputs = true;
+        for(int j = 0; j < layer->getNbOutputs(); j++) {
+            floatOutputs = floatOutputs && layer->getOutput(j)->getType() == nvinfer1::DataType::kFLOAT;
+        }
+        if(floatOutputs) {
+            layer->setPrecision(precision);
+        }
+    }
+#if NV_TENSORRT_MAJOR > 8 || (NV_TENSORRT_MAJOR == 8 && NV_TENSORRT_MINOR >= 2)
+    mConfig->setFlag(nvinfer1::BuilderFlag::kPREFER_PRECISION_CONSTRAINTS);
+#else
+    mConfig->setFlag(nvinfer1::BuilderFlag::kSTRICT_TYPES);
+#endif
+    spdlog::info("input prologue: {} is int8 {}x{}x{} NHWC, normalized in the engine", name, dims.d[2], dims.d[3], channel);
+    return true;
+}
+
+int Trt::GetEngineBatchSize() const {
+    if(mEngine->hasImplicitBatchDimension()) {
+        return mEngine->getMaxBatchSize();
+    }
+    for(int i = 0; i < mEngine->getNbBindings(); i++) {
+        if(!mEngine->bindingIsInput(i)) {
+            continue;
+        }
+        nvinfer1::Dims dims = mEngine->getBindingDimensions(i);
+        if(dims.d[0] < 0) {
+            return mEngine->getProfileDimensions(i, 0, nvinfer1::OptProfileSelector::kMAX).d[0];
+        }
+        return dims.d[0];
+    }
+    return mBatchSize;
+}
+
+void Trt::LabelPluginLayers() {
+    for(int i = 0; i < mNetwork->getNbLayers(); i++) {
+        nvinfer1::ILayer* layer = mNetwork->getLayer(i);
+        if(layer->getType() != nvinfer1::LayerType::kPLUGIN_V2) {
+            continue;
+        }
+        nvinfer1::IPluginV2& plugin = static_cast<nvinfer1::IPluginV2Layer*>(layer)->getPlugin();
+        std::string label = std::string(layer->getName()) + " [" + plugin.getPluginType() + " v" +
+                            plugin.getPluginVersion();
+        const PluginDescription* description = dynamic_cast<const PluginDescription*>(&plugin);
+        if(description != nullptr) {
+            label += " " + description->Describe();
+        }
+        label += "] (";
+        for(int j = 0; j < layer->getNbInputs(); j++) {
+            label += (j > 0 ? ", " : "") + DimsText(layer->getInput(j)->getDimensions());
+        }
+        label += ") -> (";
+        for(int j = 0; j < layer->getNbOutputs(); j++) {
+            label += (j > 0 ? ", " : "") + DimsText(layer->getOutput(j)->getDimensions());
+        }
+        label += ")";
+        layer->setName(label.c_str());
+        spdlog::info("plugin layer {}", label);
+    }
 }
 
 bool Trt::BuildEngineWithOnnx(const std::string& onnxModel,
@@ -383,6 +1028,34 @@ bool Trt::BuildEngineWithOnnx(const std::string& onnxModel,
         }    
     }
 
+    LabelPluginLayers();
+
+    if(mInputPrologue.enable) {
+        AddInputPrologue();
+    }
+
+    if(mHalfIO && mRunMode != 1) {
+        spdlog::warn("fp16 inputs and outputs need run mode 1, keep them fp32");
+    } else if(mHalfIO) {
+        // linear fp16 io, so the bytes crossing pcie are half and the host convert them with HalfConvert
+        std::vector<nvinfer1::ITensor*> tensors;
+        for(int i = 0; i < mNetwork->getNbInputs(); i++) {
+            tensors.push_back(mNetwork->getInput(i));
+        }
+        for(int i = 0; i < mNetwork->getNbOutputs(); i++) {
+            tensors.push_back(mNetwork->getOutput(i));
+        }
+        for(nvinfer1::ITensor* tensor : tensors) {
+            if(tensor->getType() != nvinfer1::DataType::kFLOAT) {
+                continue;
+            }
+            tensor->setType(nvinfer1::DataType::kHALF);
+            tensor->setAllowedFormats(1U << static_cast<int>(nvinfer1::TensorFormat::kLINEAR));
+        }
+    }
+
+    AddDynamicBatchProfiles();
+
     BuildEngine();
 
     spdlog::info("serialize engine to {}", engineFile);
@@ -392,23 +1065,52 @@ bool Trt::BuildEngineWithOnnx(const std::string& onnxModel,
     return true;
 }
 
+nvinfer1::IExecutionContext* Trt::CreateExecutionContext(int slot) {
+    if(!mShareActivationMemory) {
+        return mEngine->createExecutionContext();
+    }
+    SharedActivationMemory::Instance().Reserve(mDevice, slot, mEngine->getDeviceMemorySize());
+    return mEngine->createExecutionContextWithoutDeviceMemory();
+}
+
 void Trt::InitEngine() {
     spdlog::info("init engine...");
-    mContext = mEngine->createExecutionContext();
+    // mContext use slot 0, TrtContext use their creation index
+    mContext = CreateExecutionContext(0);
     assert(mContext != nullptr);
+    mNbContexts = 1;
 
     spdlog::info("malloc device memory");
-    int nbBindings = mEngine->getNbBindings();
+    mNbProfiles = std::max(mEngine->getNbOptimizationProfiles(), 1);
+    mNbBuckets = 1;
+    if(mEngine->getNbOptimizationProfiles() > 0) {
+        mBatchBuckets = BatchBuckets(mBatchBuckets, mBatchSize);
+        int expectBuckets = static_cast<int>(!mShapeBuckets.empty() ? mShapeBuckets.size() : mBatchBuckets.size());
+        mNbBuckets = mNbProfiles / (mMaxContexts + 1);
+        if(mNbBuckets != expectBuckets || mNbProfiles % (mMaxContexts + 1) != 0) {
+            spdlog::warn("engine has {} optimization profile, expect {} bucket with {} copy, use profile bucket 0 only",
+                         mNbProfiles, expectBuckets, mMaxContexts + 1);
+            mNbBuckets = 1;
+        }
+    }
+    int nbBindings = mEngine->getNbBindings() / mNbProfiles;
     std::cout << "nbBingdings: " << nbBindings << std::endl;
     mBinding.resize(nbBindings);
     mBindingSize.resize(nbBindings);
     mBindingName.resize(nbBindings);
     mBindingDims.resize(nbBindings);
     mBindingDataType.resize(nbBindings);
+    mBindingHasBatch.assign(nbBindings, false);
     for(int i=0; i< nbBindings; i++) {
         nvinfer1::Dims dims = mEngine->getBindingDimensions(i);
         nvinfer1::DataType dtype = mEngine->getBindingDataType(i);
         const char* name = mEngine->getBindingName(i);
+        if(!mEngine->hasImplicitBatchDimension() && dims.d[0] < 0) {
+            // size buffers for the max batch, contexts run a smaller one with SetBatchSize
+            mDynamicBatch = true;
+            mBindingHasBatch[i] = true;
+            dims.d[0] = mBatchSize;
+        }
         int64_t totalSize = volume(dims) * mBatchSize * getElementSize(dtype) / dims.d[0];
         //int64_t totalSize = volume(dims) * mBatchSize * getElementSize(dtype);
         mBindingSize[i] = totalSize;
@@ -426,11 +1128,444 @@ void Trt::InitEngine() {
             std::cout << dims.d[j] << " x ";
         }
         std::cout << "\b\b  "<< std::endl;
-        mBinding[i] = safeCudaMalloc(totalSize);
         if(mEngine->bindingIsInput(i)) {
             mNbInputBindings++;
         } else {
             mNbOutputBindings++;
         }
     }
+    std::vector<bool> isInput(nbBindings);
+    for(int i = 0; i < nbBindings; i++) {
+        isInput[i] = mEngine->bindingIsInput(i);
+    }
+    // one allocation for all bindings, outputs back to back so they are fetched with one copy
+    mArenaPlan = PlanArena(mBindingSize, isInput);
+    spdlog::info("binding arena size in byte: {}, activation memory size in byte: {}",
+                 mArenaPlan.arenaSize, mEngine->getDeviceMemorySize());
+    mArena = safeCudaMalloc(mArenaPlan.arenaSize);
+    for(int i = 0; i < nbBindings; i++) {
+        mBinding[i] = static_cast<char*>(mArena) + mArenaPlan.offset[i];
+    }
+    if(mDynamicBatch) {
+        for(int i = 0; i < nbBindings; i++) {
+            if(mEngine->bindingIsInput(i)) {
+                mContext->setBindingDimensions(i, mBindingDims[i]);
+            }
+        }
+    }
+}
+
+TrtContext::TrtContext(Trt& trt, int profileIndex) : mTrt(trt), mProfileIndex(std::max(profileIndex, 0)) {
+    BindDevice();
+    mSlot = mTrt.mNbContexts;
+    if(mTrt.mShareActivationMemory) {
+        mActivationSlot = mTrt.mNbContexts;
+    }
+    mContext = mTrt.CreateExecutionContext(mTrt.mNbContexts);
+    if(mContext == nullptr) {
+        spdlog::error("create execution context failed");
+        return;
+    }
+    if(profileIndex >= 0 && !mContext->setOptimizationProfile(profileIndex)) {
+        spdlog::error("set optimization profile {} failed", profileIndex);
+        mContext->destroy();
+        mContext = nullptr;
+        return;
+    }
+    CUDA_CHECK(cudaStreamCreate(&mStream));
+    int nbBindings = mTrt.GetNbBindings();
+    mBinding.resize(nbBindings);
+    mEngineBinding.resize(nbBindings * mTrt.mNbProfiles, nullptr);
+    mArena = safeCudaMalloc(mTrt.mArenaPlan.arenaSize);
+    mHostArena.Allocate(mTrt.mArenaPlan.arenaSize, HostMemoryType::kPinned);
+    mFloatStaging.resize(nbBindings);
+    mStale.assign(nbBindings, false);
+    for(int i = 0; i < nbBindings; i++) {
+        mBinding[i] = static_cast<char*>(mArena) + mTrt.mArenaPlan.offset[i];
+        mEngineBinding[i + mProfileIndex * nbBindings] = mBinding[i];
+        if(mTrt.mBindingDataType[i] == nvinfer1::DataType::kHALF) {
+            mFloatStaging[i].Allocate(mTrt.mBindingSize[i] / sizeof(Half) * sizeof(float), HostMemoryType::kAligned);
+        }
+    }
+    mPreprocessorContexts = mTrt.CreatePreprocessorContexts(mSlot);
+    if(mTrt.mPreprocessorEngine != nullptr) {
+        mPreprocessorBindings.assign(mTrt.mPreprocessorEngine->getNbBindings(), nullptr);
+    }
+    SetBatchSize(mTrt.mBatchSize);
+}
+
+TrtContext::~TrtContext() {
+    BindDevice();
+    if(mStream != nullptr) {
+        CUDA_CHECK(cudaStreamSynchronize(mStream));
+        CUDA_CHECK(cudaStreamDestroy(mStream));
+        mStream = nullptr;
+    }
+    for(auto& graph : mGraphs) {
+        CUDA_CHECK(cudaGraphExecDestroy(graph.second));
+    }
+    mGraphs.clear();
+    if(mArena != nullptr) {
+        safeCudaFree(mArena);
+        mArena = nullptr;
+    }
+    if(mPreprocessorInput != nullptr) {
+        safeCudaFree(mPreprocessorInput);
+        mPreprocessorInput = nullptr;
+    }
+    for(nvinfer1::IExecutionContext* preprocessor : mPreprocessorContexts) {
+        preprocessor->destroy();
+    }
+    mPreprocessorContexts.clear();
+    if(mContext != nullptr) {
+        mContext->destroy();
+        mContext = nullptr;
+    }
+}
+
+bool TrtContext::IsValid() const {
+    return mContext != nullptr;
+}
+
+cudaStream_t TrtContext::GetStream() const {
+    return mStream;
+}
+
+void* TrtContext::GetBindingPtr(int bindIndex) const {
+    return mBinding[bindIndex];
+}
+
+bool TrtContext::SetBatchSize(int batchSize) {
+    if(batchSize < 1 || batchSize > mTrt.mBatchSize) {
+        spdlog::error("batch size {} out of range [1, {}]", batchSize, mTrt.mBatchSize);
+        return false;
+    }
+    if(batchSize == mBatchSize) {
+        return true;
+    }
+    if(mTrt.mDynamicBatch && mTrt.mNbBuckets > 1 && mTrt.mShapeBuckets.empty()) {
+        int bucket = mTrt.SelectBatchBucket(batchSize);
+        if(bucket >= 0 && bucket != mBucket) {
+            mBatchSize = batchSize;
+            return UseBucket(bucket);
+        }
+    }
+    return ApplyBatchSize(batchSize);
+}
+
+bool TrtContext::ApplyBatchSize(int batchSize) {
+    mBatchSize = batchSize;
+    if(!mTrt.mDynamicBatch) {
+        // static batch engine still compute the full batch, only the transfers shrink
+        return true;
+    }
+    int offset = mProfileIndex * mTrt.GetNbBindings();
+    for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+        if(!mTrt.BindingIsInput(i)) {
+            continue;
+        }
+        nvinfer1::Dims dims = mTrt.mBindingDims[i];
+        dims.d[0] = batchSize;
+        if(!mContext->setBindingDimensions(i + offset, dims)) {
+            spdlog::error("set batch size {} of binding {} failed", batchSize, i);
+            return false;
+        }
+    }
+    return mContext->allInputDimensionsSpecified();
+}
+
+bool TrtContext::UseBucket(int bucket) {
+    if(bucket == mBucket) {
+        return true;
+    }
+    int profileIndex = mTrt.GetProfileIndex(bucket, mSlot);
+    // the previous profile may still be in use by work queued on the stream
+    CUDA_CHECK(cudaStreamSynchronize(mStream));
+    if(!mContext->setOptimizationProfile(profileIndex)) {
+        spdlog::error("set optimization profile {} failed", profileIndex);
+        return false;
+    }
+    int nbBindings = mTrt.GetNbBindings();
+    for(int i = 0; i < nbBindings; i++) {
+        mEngineBinding[i + mProfileIndex * nbBindings] = nullptr;
+        mEngineBinding[i + profileIndex * nbBindings] = mBinding[i];
+    }
+    mProfileIndex = profileIndex;
+    mBucket = bucket;
+    return ApplyBatchSize(mBatchSize);
+}
+
+int TrtContext::GetBatchSize() const {
+    return mBatchSize;
+}
+
+size_t TrtContext::GetBatchBindingSize(int bindIndex) const {
+    return mTrt.mBindingSize[bindIndex] / mTrt.mBatchSize * mBatchSize;
+}
+
+Span<float> TrtContext::GetHostBuffer(int bindIndex) {
+    if(mFloatStaging[bindIndex].Data() == nullptr) {
+        return Span<float>(static_cast<float*>(GetHostBinding(bindIndex)), mTrt.mBindingSize[bindIndex] / sizeof(float));
+    }
+    Span<float> staging = mFloatStaging[bindIndex].AsSpan<float>();
+    if(mStale[bindIndex]) {
+        // only the images of the batch came back
+        HalfToFloat(static_cast<const Half*>(GetHostBinding(bindIndex)), staging.data(), GetBatchBindingSize(bindIndex) / sizeof(Half));
+        mStale[bindIndex] = false;
+    }
+    return staging;
+}
+
+void* TrtContext::GetHostBinding(int bindIndex) {
+    return static_cast<char*>(mHostArena.Data()) + mTrt.mArenaPlan.offset[bindIndex];
+}
+
+void TrtContext::StageInput(int bindIndex) {
+    if(mFloatStaging[bindIndex].Data() != nullptr) {
+        FloatToHalf(mFloatStaging[bindIndex].AsSpan<float>().data(), static_cast<Half*>(GetHostBinding(bindIndex)),
+                    GetBatchBindingSize(bindIndex) / sizeof(Half));
+    }
+}
+
+void TrtContext::CopyHostBindingToDevice(int bindIndex) {
+    CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], GetHostBinding(bindIndex), GetBatchBindingSize(bindIndex), cudaMemcpyHostToDevice, mStream));
+}
+
+void TrtContext::MarkOutputsStale() {
+    for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+        mStale[i] = !mTrt.BindingIsInput(i) && mFloatStaging[i].Data() != nullptr;
+    }
+}
+
+void TrtContext::CopyFromHostToDevice(int bindIndex) {
+    BindDevice();
+    StageInput(bindIndex);
+    CopyHostBindingToDevice(bindIndex);
+}
+
+void TrtContext::CopyFromHostToDevice(const std::vector<float>& input, int bindIndex) {
+    BindDevice();
+    size_t elementSize = getElementSize(mTrt.mBindingDataType[bindIndex]);
+    assert(input.size()*elementSize <= mTrt.mBindingSize[bindIndex]);
+    size_t count = std::min(input.size(), GetBatchBindingSize(bindIndex) / elementSize);
+    if(mFloatStaging[bindIndex].Data() == nullptr) {
+        CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], input.data(), count * sizeof(float), cudaMemcpyHostToDevice, mStream));
+        return;
+    }
+    // convert into the pinned arena, the copy is async from there
+    FloatToHalf(input.data(), static_cast<Half*>(GetHostBinding(bindIndex)), count);
+    CUDA_CHECK(cudaMemcpyAsync(mBinding[bindIndex], GetHostBinding(bindIndex), count * sizeof(Half), cudaMemcpyHostToDevice, mStream));
+}
+
+void TrtContext::CopyFromDeviceToHost(int bindIndex) {
+    BindDevice();
+    CUDA_CHECK(cudaMemcpyAsync(GetHostBinding(bindIndex), mBinding[bindIndex], GetBatchBindingSize(bindIndex), cudaMemcpyDeviceToHost, mStream));
+    mStale[bindIndex] = mFloatStaging[bindIndex].Data() != nullptr;
+}
+
+void TrtContext::CopyOutputsFromDeviceToHost() {
+    BindDevice();
+    MarkOutputsStale();
+    if(mBatchSize != mTrt.mBatchSize) {
+        // tail images of every output are not computed, skip them instead of copying the whole range
+        for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+            if(!mTrt.BindingIsInput(i)) {
+                CopyFromDeviceToHost(i);
+            }
+        }
+        return;
+    }
+    const ArenaPlan& plan = mTrt.mArenaPlan;
+    size_t size = plan.outputEnd - plan.outputBegin;
+    CUDA_CHECK(cudaMemcpyAsync(static_cast<char*>(mHostArena.Data()) + plan.outputBegin, static_cast<char*>(mArena) + plan.outputBegin,
+                               size, cudaMemcpyDeviceToHost, mStream));
+}
+
+float* TrtContext::GetPreprocessorInput(size_t count) {
+    size_t inputSize = count * sizeof(float);
+    if(inputSize > mPreprocessorInputSize) {
+        BindDevice();
+        if(mPreprocessorInput != nullptr) {
+            CUDA_CHECK(cudaStreamSynchronize(mStream));
+            safeCudaFree(mPreprocessorInput);
+        }
+        mPreprocessorInput = safeCudaMalloc(inputSize);
+        mPreprocessorInputSize = inputSize;
+        mPreprocessorStaging.Allocate(inputSize, HostMemoryType::kPinned);
+    }
+    return static_cast<float*>(mPreprocessorStaging.Data());
+}
+
+bool TrtContext::ForwardPreprocessor(const std::vector<float>& input, const TensorDims& inputDims) {
+    assert(static_cast<size_t>(volume(inputDims)) <= input.size());
+    // frame size vary per call, stage through pinned memory so the upload is a single dma
+    memcpy(GetPreprocessorInput(input.size()), input.data(), input.size() * sizeof(float));
+    return ForwardPreprocessor(inputDims);
+}
+
+bool TrtContext::ForwardPreprocessor(const TensorDims& inputDims) {
+    BindDevice();
+    if(mPreprocessorContexts.empty()) {
+        spdlog::error("context has no preprocessor, call buildPreprocessorEngine before CreateContext");
+        return false;
+    }
+    int bucket = mTrt.SelectShapeBucket(inputDims);
+    if(bucket < 0) {
+        return false;
+    }
+    if(mTrt.mNbBuckets > 1 && mTrt.mNbBuckets == static_cast<int>(mTrt.mShapeBuckets.size()) && !UseBucket(bucket)) {
+        return false;
+    }
+    size_t inputSize = static_cast<size_t>(volume(inputDims)) * sizeof(float);
+    if(inputSize > mPreprocessorInputSize) {
+        spdlog::error("preprocessor input of {} bytes, only {} bytes requested from GetPreprocessorInput", inputSize, mPreprocessorInputSize);
+        return false;
+    }
+    CUDA_CHECK(cudaMemcpyAsync(mPreprocessorInput, mPreprocessorStaging.Data(), inputSize, cudaMemcpyHostToDevice, mStream));
+    // own preprocessor context of the bucket, its binding dimensions are only touched by this context
+    nvinfer1::IExecutionContext* preprocessor = mPreprocessorContexts[bucket];
+    int offset = mTrt.GetPreprocessorBindingOffset(bucket, mSlot);
+    preprocessor->setBindingDimensions(offset, ToTrtDims(inputDims));
+    if(!preprocessor->allInputDimensionsSpecified()) {
+        return false;
+    }
+    std::fill(mPreprocessorBindings.begin(), mPreprocessorBindings.end(), nullptr);
+    mPreprocessorBindings[offset] = mPreprocessorInput;
+    mPreprocessorBindings[offset + 1] = mBinding[mTrt.GetInputBindingIndex()];
+    // no sync, the inference enqueued after it on mStream orders after the preprocessor
+    return preprocessor->enqueueV2(mPreprocessorBindings.data(), mStream, nullptr);
+}
+
+void TrtContext::ForwardAsync() {
+    BindDevice();
+    if(!Enqueue()) {
+        spdlog::error("enqueue inference failed");
+    }
+}
+
+void TrtContext::InferAsync() {
+    BindDevice();
+    // fp16 inputs are converted on the host, graphs only replay the copies
+    for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+        if(mTrt.BindingIsInput(i)) {
+            StageInput(i);
+        }
+    }
+    // a replayed graph bypass the profiler
+    if(!mTrt.mCudaGraph || mGraphFailed || mProfiler != nullptr) {
+        EnqueueInfer();
+        return;
+    }
+    GetGraphKey(mGraphKey);
+    auto graph = mGraphs.find(mGraphKey);
+    if(graph != mGraphs.end()) {
+        CUDA_CHECK(cudaGraphLaunch(graph->second, mStream));
+        MarkOutputsStale();
+        return;
+    }
+    // tensorrt initialize lazily on the first enqueue of a shape, run it eager once and capture for the next call
+    EnqueueInfer();
+    CaptureGraph(mGraphKey);
+}
+
+bool TrtContext::Enqueue() {
+    if(mActivationSlot >= 0) {
+        mContext->setDeviceMemory(SharedActivationMemory::Instance().Get(mTrt.mDevice, mActivationSlot));
+    }
+    if(mProfiler != nullptr) {
+        // layer times are reported by synchronous runs, wait for the input copies queued on mStream
+        CUDA_CHECK(cudaStreamSynchronize(mStream));
+        bool status = mTrt.mEngine->hasImplicitBatchDimension() ? mContext->execute(mBatchSize, mEngineBinding.data())
+                                                                : mContext->executeV2(mEngineBinding.data());
+        mProfiler->EndRun();
+        return status;
+    }
+    if(mTrt.mEngine->hasImplicitBatchDimension()) {
+        return mContext->enqueue(mBatchSize, mEngineBinding.data(), mStream, nullptr);
+    } else {
+        return mContext->enqueueV2(mEngineBinding.data(), mStream, nullptr);
+    }
+}
+
+bool TrtContext::EnqueueInfer() {
+    for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+        if(mTrt.BindingIsInput(i)) {
+            CopyHostBindingToDevice(i);
+        }
+    }
+    bool status = Enqueue();
+    CopyOutputsFromDeviceToHost();
+    return status;
+}
+
+void TrtContext::GetGraphKey(std::vector<int64_t>& key) {
+    key.clear();
+    key.push_back(mBatchSize);
+    // a graph is recorded against the bindings of one profile
+    key.push_back(mProfileIndex);
+    if(!mTrt.mEngine->hasImplicitBatchDimension()) {
+        int offset = mProfileIndex * mTrt.GetNbBindings();
+        for(int i = 0; i < mTrt.GetNbBindings(); i++) {
+            if(!mTrt.BindingIsInput(i)) {
+                continue;
+            }
+            nvinfer1::Dims dims = mContext->getBindingDimensions(i + offset);
+            key.insert(key.end(), dims.d, dims.d + dims.nbDims);
+        }
+    }
+    if(mActivationSlot >= 0) {
+        // shared slot is reallocated when a larger engine reserve it, graph hold the old address
+        key.push_back(reinterpret_cast<int64_t>(SharedActivationMemory::Instance().Get(mTrt.mDevice, mActivationSlot)));
+    }
+}
+
+bool TrtContext::CaptureGraph(const std::vector<int64_t>& key) {
+    // thread local capture, other contexts keep running on their own stream meanwhile
+    if(cudaStreamBeginCapture(mStream, cudaStreamCaptureModeThreadLocal) != cudaSuccess) {
+        cudaGetLastError();
+        spdlog::warn("could not begin cuda graph capture, run inference without graph");
+        mGraphFailed = true;
+        return false;
+    }
+    bool status = EnqueueInfer();
+    cudaGraph_t graph = nullptr;
+    cudaError_t error = cudaStreamEndCapture(mStream, &graph);
+    cudaGraphExec_t graphExec = nullptr;
+    if(status && error == cudaSuccess) {
+        error = cudaGraphInstantiate(&graphExec, graph, nullptr, nullptr, 0);
+    }
+    if(graph != nullptr) {
+        cudaGraphDestroy(graph);
+    }
+    if(!status || error != cudaSuccess) {
+        cudaGetLastError();
+        spdlog::warn("could not capture cuda graph for batch size {}, run inference without graph", mBatchSize);
+        mGraphFailed = true;
+        return false;
+    }
+    spdlog::info("captured cuda graph for batch size {}", mBatchSize);
+    mGraphs[key] = graphExec;
+    return true;
+}
+
+void TrtContext::Synchronize() {
+    BindDevice();
+    CUDA_CHECK(cudaStreamSynchronize(mStream));
+}
+
+void TrtContext::SetProfiler(LayerProfiler* profiler) {
+    // wait for inference still using the old profiler
+    CUDA_CHECK(cudaStreamSynchronize(mStream));
+    mProfiler = profiler;
+    mTrtProfiler.mProfiler = profiler;
+    mContext->setProfiler(profiler != nullptr ? &mTrtProfiler : nullptr);
+}
+
+void TrtContext::BindDevice() const {
+    // the calling thread may have any device current, e.g. a worker serving replicas on several gpus
+    CUDA_CHECK(cudaSetDevice(mTrt.mDevice));
+}
+
+const InferBackend& TrtContext::GetBackend() const {
+    return mTrt;
 }
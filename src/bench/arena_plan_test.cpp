@@ -0,0 +1,98 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "ArenaPlan.h"
+
+struct ArenaCase
+{
+	const char* name;
+	std::vector<size_t> sizes;
+	std::vector<bool> isInput;
+	size_t alignment;
+};
+
+//problems of plan for one case, empty if there are none
+static std::vector<std::string> checkPlan(const ArenaCase& c, const ArenaPlan& plan)
+{
+	std::vector<std::string> problems;
+	size_t count = c.sizes.size();
+	if (plan.offset.size() != count || plan.size != c.sizes)
+	{
+		problems.push_back("offset or size not per binding");
+		return problems;
+	}
+	size_t inputEnd = 0;
+	size_t outputBytes = 0;
+	size_t lastOutput = 0;
+	bool hasOutput = false;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t begin = plan.offset[i];
+		size_t end = begin + c.sizes[i];
+		if (begin % c.alignment != 0)
+			problems.push_back("binding " + std::to_string(i) + " at " + std::to_string(begin) + " is not aligned");
+		if (end > plan.arenaSize)
+			problems.push_back("binding " + std::to_string(i) + " ends after the arena");
+		for (size_t j = 0; j < i; j++)
+		{
+			size_t otherBegin = plan.offset[j];
+			size_t otherEnd = otherBegin + c.sizes[j];
+			if (c.sizes[i] > 0 && c.sizes[j] > 0 && begin < otherEnd && otherBegin < end)
+				problems.push_back("bindings " + std::to_string(j) + " and " + std::to_string(i) + " overlap");
+		}
+		if (c.isInput[i])
+		{
+			inputEnd = std::max(inputEnd, end);
+			continue;
+		}
+		if (begin < plan.outputBegin || end > plan.outputEnd)
+			problems.push_back("output " + std::to_string(i) + " outside [outputBegin, outputEnd)");
+		//outputs in binding order, each right after the previous one plus its alignment padding
+		if (hasOutput && begin != AlignUp(plan.offset[lastOutput] + c.sizes[lastOutput], c.alignment))
+			problems.push_back("output " + std::to_string(i) + " does not follow output " + std::to_string(lastOutput));
+		outputBytes += c.sizes[i];
+		lastOutput = i;
+		hasOutput = true;
+	}
+	if (inputEnd > plan.outputBegin)
+		problems.push_back("inputs reach into the outputs");
+	if (!hasOutput && plan.outputBegin != plan.outputEnd)
+		problems.push_back("output range of a plan without outputs is not empty");
+	if (hasOutput && plan.outputEnd != plan.offset[lastOutput] + c.sizes[lastOutput])
+		problems.push_back("outputEnd is not the end of the last output");
+	if (plan.outputEnd - plan.outputBegin < outputBytes)
+		problems.push_back("output range smaller than the outputs");
+	if (plan.arenaSize % c.alignment != 0 || plan.arenaSize < plan.outputEnd)
+		problems.push_back("arena size " + std::to_string(plan.arenaSize) + " not aligned or too small");
+	return problems;
+}
+
+//PlanArena on binding layouts of the detectors and odd ones: every binding aligned and apart from the others,
+//inputs first and the outputs back to back in [outputBegin, outputEnd), so one copy fetches them all
+int main_arena_plan_test()
+{
+	std::vector<ArenaCase> cases;
+	cases.push_back({ "yolov5 fp32 batch 4", { 4 * 3 * 640 * 640 * 4, 4 * 3 * 80 * 80 * 85 * 4, 4 * 3 * 40 * 40 * 85 * 4, 4 * 3 * 20 * 20 * 85 * 4 },
+		{ true, false, false, false }, kDeviceArenaAlignment });
+	cases.push_back({ "input between outputs", { 1000, 3 * 640 * 640, 7, 13 }, { false, true, false, false }, kDeviceArenaAlignment });
+	cases.push_back({ "two inputs, odd sizes", { 1, 255, 257, 3, 511 }, { true, false, true, false, false }, kDeviceArenaAlignment });
+	cases.push_back({ "half outputs, 64 byte alignment", { 3 * 320 * 320 * 2, 6 * 2, 10 * 2, 85 * 2 }, { true, false, false, false }, 64 });
+	cases.push_back({ "empty output", { 4096, 0, 100 }, { true, false, false }, kDeviceArenaAlignment });
+	cases.push_back({ "no outputs", { 300, 500 }, { true, true }, kDeviceArenaAlignment });
+	cases.push_back({ "alignment 1", { 3, 5, 7 }, { true, false, false }, 1 });
+
+	int failures = 0;
+	for (const ArenaCase& c : cases)
+	{
+		ArenaPlan plan = PlanArena(c.sizes, c.isInput, c.alignment);
+		std::vector<std::string> problems = checkPlan(c, plan);
+		std::cout << c.name << ": arena " << plan.arenaSize << " bytes, outputs [" << plan.outputBegin << ", "
+			<< plan.outputEnd << ")" << (problems.empty() ? "" : "  FAILED") << std::endl;
+		for (const std::string& problem : problems)
+			std::cout << "  " << problem << std::endl;
+		if (!problems.empty())
+			failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
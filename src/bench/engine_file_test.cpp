@@ -0,0 +1,106 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include "EngineCache.h"
+
+static std::vector<char> readBytes(const std::string& fileName)
+{
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void writeBytes(const std::string& fileName, const std::vector<char>& bytes)
+{
+	std::ofstream file(fileName.c_str(), std::ios::binary | std::ios::trunc);
+	file.write(bytes.data(), bytes.size());
+}
+
+//ReadEngineFile with a stub deserializer instead of tensorrt: a written engine comes back byte for byte, files
+//of another key, environment or format, truncated, padded or corrupted ones are rejected before the
+//deserializer sees them
+int main_engine_file_test()
+{
+	std::string fileName = "engine_file_test.engine";
+	std::vector<char> engine(100000);
+	for (size_t i = 0; i < engine.size(); i++)
+		engine[i] = static_cast<char>(i * 131 + i / 7);
+	EngineCacheKey key;
+	key.hash = HashString("model.onnx fp16 batch 4");
+	key.envHash = HashString("tensorrt 7.2.2.3 sm_75");
+
+	std::remove(fileName.c_str());
+	if (!WriteEngineFile(fileName, key, engine.data(), engine.size()))
+	{
+		std::cout << "WriteEngineFile " << fileName << "  FAILED" << std::endl;
+		return 1;
+	}
+	std::vector<char> written = readBytes(fileName);
+	size_t headerSize = written.size() - engine.size();
+
+	struct Case
+	{
+		const char* name;
+		//file content, the written one if empty
+		std::vector<char> content;
+		EngineCacheKey key;
+		bool deserializerAccepts;
+		bool expectLoaded;
+	};
+	EngineCacheKey otherModel = key;
+	otherModel.hash ^= 1;
+	EngineCacheKey otherEnvironment = key;
+	otherEnvironment.envHash ^= 1;
+	EngineCacheKey noOnnxHash = key;
+	noOnnxHash.hash = 0;
+	std::vector<char> truncated(written.begin(), written.end() - 1);
+	std::vector<char> padded = written;
+	padded.push_back(0);
+	std::vector<char> corrupted = written;
+	corrupted[headerSize + engine.size() / 2] ^= 0x10;
+	std::vector<char> headerOnly(written.begin(), written.begin() + headerSize - 1);
+	std::vector<char> newerFormat = written;
+	newerFormat[8] += 1;
+
+	std::vector<Case> cases;
+	cases.push_back({ "same key", {}, key, true, true });
+	cases.push_back({ "no onnx hash, same environment", {}, noOnnxHash, true, true });
+	cases.push_back({ "deserializer fails", {}, key, false, false });
+	cases.push_back({ "wrong key", {}, otherModel, true, false });
+	cases.push_back({ "wrong environment", {}, otherEnvironment, true, false });
+	cases.push_back({ "truncated by one byte", truncated, key, true, false });
+	cases.push_back({ "one byte appended", padded, key, true, false });
+	cases.push_back({ "bad checksum", corrupted, key, true, false });
+	cases.push_back({ "shorter than the header", headerOnly, key, true, false });
+	cases.push_back({ "other format version", newerFormat, key, true, false });
+	cases.push_back({ "engine without header", engine, key, true, false });
+
+	int failures = 0;
+	for (const Case& c : cases)
+	{
+		writeBytes(fileName, c.content.empty() ? written : c.content);
+		bool called = false;
+		bool same = false;
+		bool loaded = ReadEngineFile(fileName, c.key, [&](const void* data, size_t size) {
+			called = true;
+			same = size == engine.size() && memcmp(data, engine.data(), size) == 0;
+			return c.deserializerAccepts;
+		});
+		//the deserializer only ever sees an intact engine, and only rejected files never reach it
+		bool expectCalled = c.expectLoaded || !c.deserializerAccepts;
+		bool ok = loaded == c.expectLoaded && called == expectCalled && (!called || same);
+		std::cout << c.name << ": " << (loaded ? "loaded" : "rejected") << (ok ? "" : "  FAILED") << std::endl;
+		if (!ok)
+			failures++;
+	}
+	std::remove(fileName.c_str());
+	bool missing = ReadEngineFile(fileName, key, [](const void*, size_t) { return true; });
+	std::cout << "missing file: " << (missing ? "loaded  FAILED" : "rejected") << std::endl;
+	if (missing)
+		failures++;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "EngineSweep.h"
+
+static int g_failures = 0;
+
+static void expect(bool ok, const std::string& what)
+{
+	std::cout << what << (ok ? "" : "  FAILED") << std::endl;
+	if (!ok)
+		g_failures++;
+}
+
+static SweepResult result(const std::string& label, double latencyMs, double throughput, bool ok = true)
+{
+	SweepResult r;
+	r.engineFile = label;
+	r.latencyMs = latencyMs;
+	r.throughput = throughput;
+	r.ok = ok;
+	return r;
+}
+
+//stand in for MeasureEngine: fp16 is twice as fast as fp32, a larger workspace helps a little, batch profiles
+//cut latency and cost throughput. Int8 only builds at batch 1 with the large workspace
+static bool stubMeasure(const BuildVariant& variant, SweepResult& r)
+{
+	r = SweepResult();
+	if (variant.mode == 2 && (variant.maxBatchSize != 1 || variant.workspaceSize < (size_t(256) << 20)))
+		return false;
+	double base = (variant.mode == 0 ? 4.0 : variant.mode == 1 ? 2.0 : 1.0) + (variant.workspaceSize < (size_t(256) << 20) ? 0.5 : 0.0);
+	r.latencyMs = base + (variant.batchProfiles.empty() ? 0.3 : 0.0);
+	r.throughput = 1000.0 / base * (variant.maxBatchSize == 4 ? 2.5 : 1.0) * (variant.batchProfiles.empty() ? 1.0 : 0.9);
+	r.engineFile = "sweep/" + variant.Name() + ".engine";
+	return true;
+}
+
+static std::string nameOf(const std::vector<SweepManifestEntry>& entries, int index)
+{
+	return index < 0 ? "none" : entries[index].result.variant.Name();
+}
+
+//the sweep orchestration with a stub measure instead of engines: grid expansion, RunSweep, ParetoFront, the
+//manifest round trip with build options and what SelectSweepEntry picks from it
+int main_engine_sweep_test()
+{
+	SweepGrid grid;
+	grid.modes = { 0, 1, 2 };
+	grid.maxBatchSizes = { 1, 4 };
+	grid.workspaceSizes = { size_t(10) << 20, size_t(256) << 20 };
+	grid.batchProfiles = { {}, { 1, 4 } };
+	std::vector<BuildVariant> variants = ExpandSweepGrid(grid);
+	//profiles up to 4 are skipped at max batch 1
+	expect(variants.size() == 18, "grid of 18 variants: " + std::to_string(variants.size()));
+
+	std::vector<SweepResult> results = RunSweep(variants, stubMeasure);
+	bool inOrder = results.size() == variants.size();
+	int failed = 0;
+	for (size_t i = 0; inOrder && i < results.size(); i++)
+	{
+		inOrder = results[i].variant.Name() == variants[i].Name();
+		failed += results[i].ok ? 0 : 1;
+	}
+	expect(inOrder, "RunSweep keeps variant order and the variant of a measure that resets the result");
+	expect(failed == 5, "int8 variants that do not build are failed results: " + std::to_string(failed));
+
+	std::vector<SweepResult> hand = {
+		result("a", 1, 100), result("b", 2, 300), result("c", 2, 200), result("d", 3, 300),
+		result("failed", 0.5, 1000, false), result("f", 4, 400), result("g", 1, 100),
+	};
+	std::vector<SweepResult> front = ParetoFront(hand);
+	std::string labels;
+	for (const SweepResult& r : front)
+		labels += r.engineFile + " ";
+	expect(labels == "a g b f ", "pareto front without dominated or failed results, by latency: " + labels);
+
+	std::string manifest = "engine_sweep_test.sweep";
+	std::remove(manifest.c_str());
+	EngineBuildOptions plain = MakeEngineBuildOptions(3, false, InputPrologue(), {});
+	InputPrologue prologue;
+	prologue.enable = true;
+	prologue.mean = { 0.485f, 0.456f, 0.406f };
+	prologue.std = { 0.229f, 0.224f, 0.225f };
+	EngineBuildOptions custom = MakeEngineBuildOptions(3, true, prologue, { "boxes", "scores" });
+	expect(!(plain == custom) && custom.inputPrologue != 0, "prologue and outputs change the build options");
+	expect(WriteSweepManifest(manifest, "gpuA", plain, results) && WriteSweepManifest(manifest, "gpuA", custom, results)
+		&& WriteSweepManifest(manifest, "gpuB", plain, results), "write manifest of two targets and two option sets");
+	//the same target and options again replaces its entries only
+	expect(WriteSweepManifest(manifest, "gpuA", plain, results), "rewrite one target and option set");
+	{
+		std::ofstream old(manifest.c_str(), std::ios::app);
+		old << "gpuA\told.engine\t1\t4\t10485760\t\t0.1\t99999\n";
+	}
+	std::vector<SweepManifestEntry> entries;
+	expect(ReadSweepManifest(manifest, entries), "read manifest");
+	//batch 1 front is int8 alone, batch 4 has two fp16 engines, per target and option set
+	expect(entries.size() == 9, "3 entries per target and option set, old line skipped: " + std::to_string(entries.size()));
+	bool roundTrip = false;
+	for (const SweepManifestEntry& entry : entries)
+	{
+		if (entry.target == "gpuA" && entry.options.halfIO)
+			roundTrip = entry.options == custom;
+	}
+	expect(roundTrip, "build options read back as written");
+
+	int latency = SelectSweepEntry(entries, "gpuA", plain, 4, SweepObjective::kLatency, 0, false);
+	expect(nameOf(entries, latency) == "fp16_b4_ws256m_p1-4", "latency at batch 4: " + nameOf(entries, latency));
+	int throughput = SelectSweepEntry(entries, "gpuA", plain, 4, SweepObjective::kThroughput, 0, false);
+	expect(nameOf(entries, throughput) == "fp16_b4_ws256m", "throughput at batch 4: " + nameOf(entries, throughput));
+	int budget = SelectSweepEntry(entries, "gpuA", plain, 4, SweepObjective::kThroughput, 2.1, false);
+	expect(nameOf(entries, budget) == "fp16_b4_ws256m_p1-4", "throughput within 2.1 ms: " + nameOf(entries, budget));
+	int overBudget = SelectSweepEntry(entries, "gpuA", plain, 4, SweepObjective::kThroughput, 1.0, false);
+	expect(nameOf(entries, overBudget) == "fp16_b4_ws256m_p1-4", "nothing within 1 ms, fastest: " + nameOf(entries, overBudget));
+	int int8 = SelectSweepEntry(entries, "gpuA", plain, 1, SweepObjective::kLatency, 0, true);
+	expect(nameOf(entries, int8) == "int8_b1_ws256m", "int8 allowed at batch 1: " + nameOf(entries, int8));
+	int noInt8 = SelectSweepEntry(entries, "gpuA", plain, 1, SweepObjective::kLatency, 0, false);
+	expect(noInt8 < 0, "int8 only front without int8: " + nameOf(entries, noInt8));
+	int withCustom = SelectSweepEntry(entries, "gpuA", custom, 4, SweepObjective::kLatency, 0, false);
+	expect(withCustom >= 0 && entries[withCustom].options == custom, "entry of the custom build options");
+	EngineBuildOptions otherContexts = plain;
+	otherContexts.maxContexts = 2;
+	expect(SelectSweepEntry(entries, "gpuA", otherContexts, 4, SweepObjective::kLatency, 0, false) < 0, "no entry for other contexts");
+	EngineBuildOptions halfIO = plain;
+	halfIO.halfIO = true;
+	expect(SelectSweepEntry(entries, "gpuA", halfIO, 4, SweepObjective::kLatency, 0, false) < 0, "no entry for half io alone");
+	expect(SelectSweepEntry(entries, "gpuC", plain, 4, SweepObjective::kLatency, 0, false) < 0, "no entry for another target");
+	expect(SelectSweepEntry(entries, "gpuA", plain, 8, SweepObjective::kLatency, 0, false) < 0, "no entry for another max batch");
+	std::remove(manifest.c_str());
+	return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "HalfConvert.h"
+
+template <typename Run>
+static double medianMs(Run run, int iterations)
+{
+	std::vector<double> times;
+	run();
+	for (int i = 0; i < iterations; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		run();
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+static float bitsToFloat(uint32_t bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static uint32_t floatToBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+//the bulk converters, F16C when the cpu has it, against the scalar ones value by value: every half to float
+//and back, and one float in every 256 over all bit patterns, its low mantissa bits varied so the rounding
+//cases come up. Odd counts leave a tail for the scalar loop of the bulk converters too
+static int checkRoundTrip()
+{
+	int failures = 0;
+	std::vector<Half> halves(65536 + 3);
+	for (size_t i = 0; i < halves.size(); i++)
+		halves[i].bits = static_cast<uint16_t>(i);
+	std::vector<float> floats(halves.size());
+	HalfToFloat(halves.data(), floats.data(), halves.size());
+	std::vector<Half> back(halves.size());
+	FloatToHalf(floats.data(), back.data(), floats.size());
+	for (size_t i = 0; i < halves.size(); i++)
+	{
+		float expected = HalfToFloat(halves[i]);
+		bool nan = expected != expected;
+		if (floatToBits(floats[i]) != floatToBits(expected))
+			failures++;
+		//nan payloads keep their quiet bit, everything else comes back unchanged
+		if (!nan && back[i].bits != halves[i].bits)
+			failures++;
+		if (nan && (back[i].bits & 0x7e00) != 0x7e00)
+			failures++;
+	}
+	std::cout << "half -> float -> half, " << halves.size() << " values: " << failures << " mismatches" << std::endl;
+
+	int floatFailures = 0;
+	size_t checked = 0;
+	std::vector<float> source(4096 + 5);
+	std::vector<Half> bulk(source.size());
+	for (uint64_t high = 0; high < (1ull << 32); high += 256 * source.size())
+	{
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			uint64_t bits = high + i * 256 + (i * 37) % 256;
+			source[i] = bitsToFloat(static_cast<uint32_t>(bits));
+		}
+		FloatToHalf(source.data(), bulk.data(), source.size());
+		for (size_t i = 0; i < source.size(); i++)
+		{
+			Half expected = FloatToHalf(source[i]);
+			bool nan = source[i] != source[i];
+			if (nan ? (bulk[i].bits & 0x7e00) != 0x7e00 : bulk[i].bits != expected.bits)
+				floatFailures++;
+		}
+		checked += source.size();
+	}
+	std::cout << "float -> half, " << checked << " values: " << floatFailures << " mismatches" << std::endl;
+	return failures + floatFailures;
+}
+
+//bit exact check of the bulk converters against the scalar ones, then throughput of both directions on a
+//640x640x3 tensor, the size of a detector input or a large head
+int main_half_convert_bench()
+{
+	std::cout << "HalfConvert path: " << (HalfConvertIsVectorized() ? "f16c" : "scalar") << std::endl;
+	int failures = checkRoundTrip();
+
+	size_t count = 640 * 640 * 3;
+	std::vector<float> floats(count);
+	for (size_t i = 0; i < count; i++)
+		floats[i] = static_cast<float>(i % 4093) / 97.0f - 20.0f;
+	std::vector<Half> halves(count);
+	std::vector<float> restored(count);
+	int iterations = 100;
+	double toHalfMs = medianMs([&]() { FloatToHalf(floats.data(), halves.data(), count); }, iterations);
+	double toFloatMs = medianMs([&]() { HalfToFloat(halves.data(), restored.data(), count); }, iterations);
+	double scalarToHalfMs = medianMs([&]() { for (size_t i = 0; i < count; i++) halves[i] = FloatToHalf(floats[i]); }, iterations);
+	double scalarToFloatMs = medianMs([&]() { for (size_t i = 0; i < count; i++) restored[i] = HalfToFloat(halves[i]); }, iterations);
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << count << " values  float->half " << toHalfMs << " ms (scalar " << scalarToHalfMs << " ms, x"
+		<< scalarToHalfMs / toHalfMs << ")  half->float " << toFloatMs << " ms (scalar " << scalarToFloatMs << " ms, x"
+		<< scalarToFloatMs / toFloatMs << ")" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
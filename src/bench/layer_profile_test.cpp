@@ -0,0 +1,247 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include "LayerProfiler.h"
+
+//minimal json reader, enough to tell whether ChromeTrace is valid json. Every string is decoded into strings
+class JsonChecker
+{
+public:
+	explicit JsonChecker(const std::string& text) : m_Text(text) {}
+
+	bool Check()
+	{
+		m_Pos = 0;
+		if (!value())
+			return false;
+		skipSpace();
+		return m_Pos == m_Text.size();
+	}
+
+	std::vector<std::string> strings;
+
+private:
+	void skipSpace()
+	{
+		while (m_Pos < m_Text.size() && (m_Text[m_Pos] == ' ' || m_Text[m_Pos] == '\n' || m_Text[m_Pos] == '\r' || m_Text[m_Pos] == '\t'))
+			m_Pos++;
+	}
+
+	bool eat(char c)
+	{
+		skipSpace();
+		if (m_Pos < m_Text.size() && m_Text[m_Pos] == c)
+		{
+			m_Pos++;
+			return true;
+		}
+		return false;
+	}
+
+	bool value()
+	{
+		skipSpace();
+		if (m_Pos >= m_Text.size())
+			return false;
+		char c = m_Text[m_Pos];
+		if (c == '{')
+			return object();
+		if (c == '[')
+			return array();
+		if (c == '"')
+			return string();
+		return number();
+	}
+
+	bool object()
+	{
+		eat('{');
+		if (eat('}'))
+			return true;
+		do
+		{
+			skipSpace();
+			if (!string() || !eat(':') || !value())
+				return false;
+		} while (eat(','));
+		return eat('}');
+	}
+
+	bool array()
+	{
+		eat('[');
+		if (eat(']'))
+			return true;
+		do
+		{
+			if (!value())
+				return false;
+		} while (eat(','));
+		return eat(']');
+	}
+
+	bool string()
+	{
+		if (m_Pos >= m_Text.size() || m_Text[m_Pos] != '"')
+			return false;
+		m_Pos++;
+		std::string decoded;
+		while (m_Pos < m_Text.size())
+		{
+			char c = m_Text[m_Pos++];
+			if (c == '"')
+			{
+				strings.push_back(decoded);
+				return true;
+			}
+			//raw control characters are not allowed inside a json string
+			if (static_cast<unsigned char>(c) < 0x20 || m_Pos >= m_Text.size())
+				return false;
+			if (c != '\\')
+			{
+				decoded += c;
+				continue;
+			}
+			char escape = m_Text[m_Pos++];
+			switch (escape)
+			{
+			case '"': decoded += '"'; break;
+			case '\\': decoded += '\\'; break;
+			case '/': decoded += '/'; break;
+			case 'n': decoded += '\n'; break;
+			case 't': decoded += '\t'; break;
+			case 'r': decoded += '\r'; break;
+			case 'b': decoded += '\b'; break;
+			case 'f': decoded += '\f'; break;
+			case 'u':
+			{
+				if (m_Pos + 4 > m_Text.size())
+					return false;
+				std::string hex = m_Text.substr(m_Pos, 4);
+				if (hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+					return false;
+				decoded += static_cast<char>(std::strtol(hex.c_str(), nullptr, 16));
+				m_Pos += 4;
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return false;
+	}
+
+	bool number()
+	{
+		size_t begin = m_Pos;
+		while (m_Pos < m_Text.size() && std::string("+-0123456789.eE").find(m_Text[m_Pos]) != std::string::npos)
+			m_Pos++;
+		return m_Pos > begin;
+	}
+
+	std::string m_Text;
+
+	size_t m_Pos = 0;
+};
+
+static int g_failures = 0;
+
+static void expect(bool ok, const std::string& what)
+{
+	std::cout << what << (ok ? "" : "  FAILED") << std::endl;
+	if (!ok)
+		g_failures++;
+}
+
+static bool near(double a, double b)
+{
+	return std::fabs(a - b) < 1e-4;
+}
+
+static size_t countOf(const std::string& text, const std::string& part)
+{
+	size_t count = 0;
+	for (size_t pos = text.find(part); pos != std::string::npos; pos = text.find(part, pos + part.size()))
+		count++;
+	return count;
+}
+
+//LayerProfile with synthetic events: per layer aggregation over runs and tracks, Merge, the run counting of
+//LayerProfiler, and a ChromeTrace that is valid json even for layer names with quotes, backslashes and
+//control characters, decoding back to the original names
+int main_layer_profile_test()
+{
+	LayerProfile profile(2);
+	for (int run = 0; run < 3; run++)
+	{
+		profile.AddLayerTime("conv1", 1.0f + run, run);
+		profile.AddLayerTime("relu1", 0.5f, run);
+	}
+	//run 0 of another context is a run of its own
+	profile.AddLayerTime("conv1", 4.0f, 0, 1);
+	std::vector<LayerStats> stats = profile.GetStats();
+	expect(profile.GetNbRuns() == 4, "runs of two tracks: " + std::to_string(profile.GetNbRuns()));
+	expect(stats.size() == 2 && stats[0].name == "conv1" && stats[1].name == "relu1", "most expensive layer first");
+	if (stats.size() == 2)
+	{
+		expect(stats[0].calls == 4 && near(stats[0].totalMs, 10) && near(stats[0].minMs, 1) && near(stats[0].maxMs, 4)
+			&& near(stats[0].AverageMs(), 2.5), "conv1 calls, total, min, max and average");
+		expect(stats[1].calls == 3 && near(stats[1].totalMs, 1.5) && near(stats[1].minMs, 0.5) && near(stats[1].maxMs, 0.5),
+			"relu1 calls, total, min and max");
+	}
+	expect(near(profile.GetTotalMs(), 11.5), "total ms of all layers");
+	//only the first two runs of track 0 are traced, the third one counts in the table only
+	std::string trace = profile.ChromeTrace();
+	expect(countOf(trace, "\"ph\":\"X\"") == 5, "trace keeps maxTraceRuns runs per track");
+	expect(trace.find("\"ts\":1000.000,\"dur\":500.000") != std::string::npos, "layers of a run laid end to end");
+
+	LayerProfile other;
+	other.AddLayerTime("conv1", 0.25f, 0);
+	other.AddLayerTime("head", 2.0f, 0);
+	profile.Merge(other, 7);
+	stats = profile.GetStats();
+	expect(profile.GetNbRuns() == 5 && stats.size() == 3, "merge adds runs and layers");
+	expect(!stats.empty() && stats[0].calls == 5 && near(stats[0].minMs, 0.25), "merge combines stats of a layer");
+	expect(profile.ChromeTrace().find("\"tid\":7") != std::string::npos, "merged events on their track");
+
+	LayerProfiler profiler;
+	profiler.EndRun();
+	profiler.reportLayerTime("a", 1.0f);
+	profiler.reportLayerTime("b", 1.0f);
+	profiler.EndRun();
+	profiler.EndRun();
+	profiler.reportLayerTime("a", 3.0f);
+	profiler.EndRun();
+	LayerProfile reported = profiler.GetProfile();
+	expect(reported.GetNbRuns() == 2 && near(reported.GetTotalMs(), 5), "LayerProfiler counts runs with layers only");
+	profiler.Reset();
+	expect(profiler.GetProfile().GetNbRuns() == 0, "LayerProfiler reset");
+
+	std::vector<std::string> names = {
+		"Conv_0 + Relu_1",
+		"SiLU_2 [SiLU v1 beta=1.0] (1x3x640x640) -> (1x3x640x640)",
+		"quote \"in\" name",
+		"back\\slash\\",
+		"new\nline and\ttab",
+		std::string("control \x01\x1f bytes"),
+		"",
+	};
+	LayerProfile escaping;
+	for (size_t i = 0; i < names.size(); i++)
+		escaping.AddLayerTime(names[i], 0.1f * (i + 1), 0);
+	std::string json = escaping.ChromeTrace();
+	JsonChecker checker(json);
+	expect(checker.Check(), "ChromeTrace is valid json");
+	int lost = 0;
+	for (const std::string& name : names)
+	{
+		if (std::find(checker.strings.begin(), checker.strings.end(), name) == checker.strings.end())
+			lost++;
+	}
+	expect(lost == 0, "layer names decode to the original, " + std::to_string(lost) + " lost");
+	expect(JsonChecker(LayerProfile().ChromeTrace()).Check(), "empty profile is valid json");
+	return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <opencv2/opencv.hpp>
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
+
+//global operator new of the program, counts while g_countAllocations is set. The other forms of new and delete
+//end up here or in free. Buffers opencv allocates itself come from cv::fastMalloc and are not counted
+static std::atomic<bool> g_countAllocations(false);
+static std::atomic<long> g_allocations(0);
+
+void* operator new(size_t size)
+{
+	if (g_countAllocations.load(std::memory_order_relaxed))
+		g_allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size != 0 ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+//allocations of iterations calls of run after warming it up, so first call growth of scratch rows, pool threads
+//and scratch buffers is left out
+template <typename Run>
+static long countAllocations(Run run, int iterations)
+{
+	for (int i = 0; i < 20; i++)
+		run();
+	g_allocations = 0;
+	g_countAllocations = true;
+	for (int i = 0; i < iterations; i++)
+		run();
+	g_countAllocations = false;
+	return g_allocations;
+}
+
+//the preprocess paths of the detectors in steady state, 1080p and 720p frames alternating into a 640x640 batch:
+//PreprocessImage stretched, letterboxed and with kArea, PreprocessBatch on one and on four threads, and the
+//packed int8 input through LetterboxTransform::Pack into a kept scratch like InferContext::GetScratch. None of
+//them may allocate
+int main_preprocess_alloc_test()
+{
+	int batchSize = 4;
+	cv::Size input(640, 640);
+	std::vector<cv::Mat> frames;
+	for (int i = 0; i < batchSize; i++)
+	{
+		cv::Mat frame(i % 2 == 0 ? cv::Size(1920, 1080) : cv::Size(1280, 720), CV_8UC3);
+		cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+		frames.push_back(frame);
+	}
+	size_t imageFloats = static_cast<size_t>(input.area()) * 3;
+	std::vector<float> batch(imageFloats * batchSize);
+	std::vector<int8_t> packed(static_cast<size_t>(input.area()) * 3 * batchSize);
+	std::vector<unsigned char> scratch(static_cast<size_t>(input.area()) * 3);
+	PreprocessParams params = PreprocessParams::Scaled(input, 1 / 255.0);
+	PreprocessParams area = params;
+	area.resize = ResizeMode::kArea;
+	auto letterbox = [&](int i) { return LetterboxTransform::Letterbox(frames[i].size(), input).Apply(params); };
+
+	struct Case
+	{
+		const char* name;
+		long allocations;
+	};
+	int iterations = 100;
+	std::vector<Case> cases;
+	cases.push_back({ "PreprocessImage stretch", countAllocations([&]() {
+		for (int i = 0; i < batchSize; i++)
+			PreprocessImage(frames[i], params, batch.data() + imageFloats * i);
+	}, iterations) });
+	cases.push_back({ "PreprocessImage letterbox", countAllocations([&]() {
+		for (int i = 0; i < batchSize; i++)
+			PreprocessImage(frames[i], letterbox(i), batch.data() + imageFloats * i);
+	}, iterations) });
+	cases.push_back({ "PreprocessImage area", countAllocations([&]() {
+		for (int i = 0; i < batchSize; i++)
+			PreprocessImage(frames[i], area, batch.data() + imageFloats * i);
+	}, iterations) });
+	cases.push_back({ "PreprocessBatch 1 thread", countAllocations([&]() {
+		PreprocessBatch(frames, letterbox, batch.data(), 1);
+	}, iterations) });
+	cases.push_back({ "PreprocessBatch 4 threads", countAllocations([&]() {
+		PreprocessBatch(frames, letterbox, batch.data(), 4);
+	}, iterations) });
+	cases.push_back({ "LetterboxTransform::Pack", countAllocations([&]() {
+		int8_t* pixels = packed.data();
+		for (int i = 0; i < batchSize; i++)
+			pixels = LetterboxTransform::Letterbox(frames[i].size(), input).Pack(frames[i], pixels, scratch.data());
+	}, iterations) });
+
+	int failures = 0;
+	for (const Case& c : cases)
+	{
+		std::cout << c.name << ": " << c.allocations << " allocations in " << iterations << " batches"
+			<< (c.allocations == 0 ? "" : "  FAILED") << std::endl;
+		if (c.allocations != 0)
+			failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
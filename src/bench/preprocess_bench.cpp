@@ -0,0 +1,120 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <opencv2/opencv.hpp>
+#include "ImagePreprocess.h"
+
+//the chain every detector ran before PreprocessImage: resize, convertTo, split into the planes
+static void preprocessOpenCV(const cv::Mat& img, const cv::Size& size, int interpolation, float* data)
+{
+	cv::Mat resized, imgf;
+	cv::resize(img, resized, size, 0, 0, interpolation);
+	resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
+	int channelLength = imgf.rows * imgf.cols;
+	std::vector<cv::Mat> channles = {
+		cv::Mat(imgf.rows, imgf.cols, CV_32FC1, data),
+		cv::Mat(imgf.rows, imgf.cols, CV_32FC1, data + channelLength),
+		cv::Mat(imgf.rows, imgf.cols, CV_32FC1, data + channelLength * 2) };
+	cv::split(imgf, channles);
+}
+
+template <typename Run>
+static double medianMs(Run run, int iterations)
+{
+	std::vector<double> times;
+	run();
+	for (int i = 0; i < iterations; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		run();
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+//cpu time of the old opencv chain against the fused pass for common camera frames and detector inputs, the
+//max difference of the values shows both feed the network the same input
+int main_preprocess_bench()
+{
+	struct Case
+	{
+		cv::Size frame;
+		cv::Size input;
+	};
+	std::vector<Case> cases = {
+		{ cv::Size(1920, 1080), cv::Size(640, 640) },
+		{ cv::Size(1280, 720), cv::Size(512, 512) },
+		{ cv::Size(640, 480), cv::Size(416, 416) },
+		{ cv::Size(640, 640), cv::Size(640, 640) },
+		{ cv::Size(320, 240), cv::Size(640, 640) } };
+	int iterations = 200;
+	std::cout << "PreprocessImage path: " << ImagePreprocessIsa() << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	for (const Case& c : cases)
+	{
+		cv::Mat frame(c.frame, CV_8UC3);
+		cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+		std::vector<float> reference(c.input.area() * 3);
+		std::vector<float> fused(c.input.area() * 3);
+		const int interpolations[] = { cv::INTER_LINEAR, cv::INTER_AREA };
+		for (int interpolation : interpolations)
+		{
+			PreprocessParams params = PreprocessParams::Scaled(c.input, 1 / 255.0);
+			params.resize = interpolation == cv::INTER_AREA ? ResizeMode::kArea : ResizeMode::kBilinear;
+			double opencvMs = medianMs([&]() { preprocessOpenCV(frame, c.input, interpolation, reference.data()); }, iterations);
+			double fusedMs = medianMs([&]() { PreprocessImage(frame, params, fused.data()); }, iterations);
+			float maxDiff = 0;
+			for (size_t i = 0; i < fused.size(); i++)
+			{
+				maxDiff = std::max(maxDiff, std::abs(fused[i] - reference[i]));
+			}
+			std::cout << c.frame.width << "x" << c.frame.height << " -> " << c.input.width << "x" << c.input.height
+				<< (interpolation == cv::INTER_AREA ? " area    " : " bilinear") << "  opencv " << opencvMs << " ms  fused "
+				<< fusedMs << " ms  x" << opencvMs / fusedMs << "  max diff " << maxDiff << std::endl;
+		}
+	}
+	return 0;
+}
+
+//batch of 1080p frames to a 640x640 input with 1 to all hardware threads on PreprocessPool, the output is
+//compared byte for byte with the single thread one
+int main_preprocess_scaling_bench()
+{
+	int batchSize = 8;
+	cv::Size input(640, 640);
+	std::vector<cv::Mat> frames;
+	for (int i = 0; i < batchSize; i++)
+	{
+		cv::Mat frame(cv::Size(1920, 1080), CV_8UC3);
+		cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+		frames.push_back(frame);
+	}
+	PreprocessParams params = PreprocessParams::Scaled(input, 1 / 255.0);
+	size_t batchFloats = static_cast<size_t>(input.area()) * 3 * batchSize;
+	std::vector<float> reference(batchFloats);
+	std::vector<float> batch(batchFloats);
+	int iterations = 50;
+	int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "PreprocessImage path: " << ImagePreprocessIsa() << ", batch " << batchSize << " 1920x1080 -> "
+		<< input.width << "x" << input.height << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	double serialMs = medianMs([&]() { PreprocessBatch(frames, params, reference.data(), 1); }, iterations);
+	std::vector<int> threadCounts;
+	for (int threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+	for (int threads : threadCounts)
+	{
+		double ms = medianMs([&]() { PreprocessBatch(frames, params, batch.data(), threads); }, iterations);
+		bool same = std::memcmp(batch.data(), reference.data(), batchFloats * sizeof(float)) == 0;
+		std::cout << std::setw(3) << threads << " threads  " << ms << " ms  x" << serialMs / ms
+			<< (same ? "  identical" : "  DIFFERENT") << std::endl;
+	}
+	return 0;
+}
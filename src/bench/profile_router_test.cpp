@@ -0,0 +1,82 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ProfileRouter.h"
+
+static ShapeProfile profile(std::vector<int> min, std::vector<int> opt, std::vector<int> max)
+{
+	ShapeProfile shape;
+	shape.min = min;
+	shape.opt = opt;
+	shape.max = max;
+	return shape;
+}
+
+static std::string dimsText(const std::vector<int>& dims)
+{
+	std::string text;
+	for (size_t i = 0; i < dims.size(); i++)
+		text += (i > 0 ? "x" : "") + std::to_string(dims[i]);
+	return text;
+}
+
+//SelectProfile on batch buckets like m_config.batchProfiles and on resolution buckets of the dyn detectors:
+//the containing profile of smallest max volume wins, equal volumes go to the closest opt, then to the lower index
+int main_profile_router_test()
+{
+	//batch buckets {1, 4, 8}, listed largest first so the index order does not decide
+	std::vector<ShapeProfile> batches = {
+		profile({ 5 }, { 8 }, { 8 }),
+		profile({ 1 }, { 1 }, { 1 }),
+		profile({ 2 }, { 4 }, { 4 }),
+	};
+	//NCHW resolution buckets, the last two have the same max volume with different opt
+	std::vector<ShapeProfile> resolutions = {
+		profile({ 1, 3, 320, 320 }, { 1, 3, 1280, 1280 }, { 1, 3, 1280, 1280 }),
+		profile({ 1, 3, 320, 320 }, { 1, 3, 640, 640 }, { 1, 3, 640, 640 }),
+		profile({ 1, 3, 320, 320 }, { 1, 3, 384, 640 }, { 1, 3, 640, 640 }),
+		profile({ 1, 3, 320, 320 }, { 1, 3, 640, 384 }, { 1, 3, 640, 640 }),
+	};
+	std::vector<ShapeProfile> none;
+	//overlapping profiles of equal volume and equal opt distance
+	std::vector<ShapeProfile> same = {
+		profile({ 1 }, { 2 }, { 4 }),
+		profile({ 1 }, { 2 }, { 4 }),
+	};
+
+	struct Case
+	{
+		const char* name;
+		const std::vector<ShapeProfile>& profiles;
+		std::vector<int> dims;
+		int expected;
+	};
+	std::vector<Case> cases = {
+		{ "batch 1 to the batch 1 bucket", batches, { 1 }, 1 },
+		{ "batch 3 to the batch 4 bucket", batches, { 3 }, 2 },
+		{ "batch 4 to the batch 4 bucket", batches, { 4 }, 2 },
+		{ "batch 6 to the batch 8 bucket", batches, { 6 }, 0 },
+		{ "batch 9 fits no bucket", batches, { 9 }, -1 },
+		{ "batch 0 fits no bucket", batches, { 0 }, -1 },
+		{ "wrong rank fits no bucket", batches, { 1, 1 }, -1 },
+		{ "no profiles", none, { 1 }, -1 },
+		{ "960x960 only fits the large bucket", resolutions, { 1, 3, 960, 960 }, 0 },
+		{ "640x640 tie, closest opt", resolutions, { 1, 3, 640, 640 }, 1 },
+		{ "384x640 tie, closest opt", resolutions, { 1, 3, 384, 640 }, 2 },
+		{ "640x384 tie, closest opt", resolutions, { 1, 3, 640, 384 }, 3 },
+		{ "400x600 tie, closest opt", resolutions, { 1, 3, 400, 600 }, 2 },
+		{ "200x200 below every min", resolutions, { 1, 3, 200, 200 }, -1 },
+		{ "full tie, lower index", same, { 3 }, 0 },
+	};
+
+	int failures = 0;
+	for (const Case& c : cases)
+	{
+		int selected = SelectProfile(c.profiles, c.dims);
+		bool ok = selected == c.expected;
+		std::cout << c.name << ": " << dimsText(c.dims) << " -> " << selected << (ok ? "" : "  FAILED, expect " + std::to_string(c.expected)) << std::endl;
+		if (!ok)
+			failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
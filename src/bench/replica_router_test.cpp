@@ -0,0 +1,116 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include "ReplicaManager.h"
+
+static int g_failures = 0;
+
+static void expect(bool ok, const std::string& what)
+{
+	std::cout << what << (ok ? "" : "  FAILED") << std::endl;
+	if (!ok)
+		g_failures++;
+}
+
+//in flight requests of every replica, "2 2 1"
+static std::string inFlightText(const ReplicaRouter& router)
+{
+	std::string text;
+	for (int i = 0; i < router.Size(); i++)
+		text += (i > 0 ? " " : "") + std::to_string(router.GetStats(i).inFlight);
+	return text;
+}
+
+//routes of requests held in flight, "0 0 1"
+static std::string routeText(const std::vector<ReplicaRouter::Ticket>& tickets)
+{
+	std::string text;
+	for (size_t i = 0; i < tickets.size(); i++)
+		text += (i > 0 ? " " : "") + std::to_string(tickets[i].Replica());
+	return text;
+}
+
+//ReplicaRouter with mock replicas, indices only: unmeasured replicas share the load evenly, tickets account
+//in flight requests however they end, measured latencies route more requests to the faster replica, and the
+//counts stay exact under concurrent callers
+int main_replica_router_test()
+{
+	{
+		ReplicaRouter router(4);
+		std::vector<ReplicaRouter::Ticket> tickets;
+		for (int i = 0; i < 10; i++)
+			tickets.push_back(router.Acquire());
+		expect(inFlightText(router) == "3 3 2 2", "10 requests on 4 unmeasured replicas: " + inFlightText(router));
+		tickets[0].Release();
+		tickets[1].Complete(5.0);
+		ReplicaStats given = router.GetStats(tickets[0].Replica());
+		ReplicaStats done = router.GetStats(tickets[1].Replica());
+		expect(given.completed == 0 && given.averageMs == 0, "given up request keeps the average");
+		expect(done.completed == 1 && done.averageMs == 5.0, "completed request sets the average");
+		ReplicaRouter::Ticket moved = std::move(tickets[2]);
+		tickets[2] = std::move(moved);
+		tickets[2].Complete(5.0);
+		tickets[2].Release();
+		expect(inFlightText(router) == "2 2 1 2", "moved ticket counted once: " + inFlightText(router));
+		tickets.clear();
+		expect(inFlightText(router) == "0 0 0 0", "destroyed tickets leave flight: " + inFlightText(router));
+	}
+	{
+		ReplicaRouter router(2, 1.0);
+		router.Acquire().Complete(1.0);
+		router.Acquire().Complete(4.0);
+		std::vector<ReplicaRouter::Ticket> tickets;
+		for (int i = 0; i < 5; i++)
+			tickets.push_back(router.Acquire());
+		//(inFlight + 1) * averageMs: 1 < 4, 2 < 4, 3 < 4, 4 = 4 goes to fewer in flight, then 4 < 8
+		expect(routeText(tickets) == "0 0 0 1 0", "1 ms and 4 ms replicas: " + routeText(tickets));
+	}
+	{
+		ReplicaRouter router(3, 1.0);
+		router.Acquire().Complete(2.0);
+		router.Acquire().Complete(4.0);
+		std::vector<ReplicaRouter::Ticket> tickets;
+		for (int i = 0; i < 3; i++)
+			tickets.push_back(router.Acquire());
+		//the unmeasured replica counts with the mean 3 ms: 2 < 3 < 4, then 3 < 4 = 4, then 4 < 6 = 6
+		expect(routeText(tickets) == "0 2 1", "unmeasured replica at the mean latency: " + routeText(tickets));
+	}
+	{
+		ReplicaRouter router(1, 0.5);
+		router.Acquire().Complete(10.0);
+		router.Acquire().Complete(20.0);
+		expect(router.GetStats(0).averageMs == 15.0 && router.GetStats(0).completed == 2, "moving average with smoothing 0.5");
+	}
+	{
+		int replicas = 4;
+		int threads = 8;
+		int requests = 2000;
+		ReplicaRouter router(replicas);
+		std::vector<std::thread> callers;
+		for (int t = 0; t < threads; t++)
+		{
+			callers.emplace_back([&router, requests, t]() {
+				for (int i = 0; i < requests; i++)
+				{
+					ReplicaRouter::Ticket ticket = router.Acquire();
+					if (i % 3 == 0)
+						ticket.Release();
+					else
+						ticket.Complete(1.0 + ticket.Replica() + t % 2);
+				}
+			});
+		}
+		for (std::thread& caller : callers)
+			caller.join();
+		int64_t completed = 0;
+		for (int i = 0; i < replicas; i++)
+			completed += router.GetStats(i).completed;
+		int64_t expected = static_cast<int64_t>(threads) * (requests - (requests + 2) / 3);
+		expect(inFlightText(router) == "0 0 0 0" && completed == expected, std::to_string(threads) + " callers, in flight "
+			+ inFlightText(router) + ", " + std::to_string(completed) + " of " + std::to_string(expected) + " completed");
+	}
+	expect(DeviceEngineFile("model/yolov5.engine", 1) == "model/yolov5_gpu1.engine", "engine file of device 1");
+	expect(DeviceEngineFile("model.v2/yolov5", 2) == "model.v2/yolov5_gpu2", "engine file without extension");
+	return g_failures == 0 ? 0 : 1;
+}
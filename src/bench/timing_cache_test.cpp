@@ -0,0 +1,92 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include "TimingCache.h"
+
+//lines of a cache, the stub tactic timings each writer adds
+static std::set<std::string> cacheLines(const std::vector<char>& cache)
+{
+	std::set<std::string> lines;
+	std::stringstream stream(std::string(cache.begin(), cache.end()));
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		if (!line.empty())
+			lines.insert(line);
+	}
+	return lines;
+}
+
+//TimingCacheFile without tensorrt: the merge is a union of text lines standing in for ITimingCache::combine.
+//writers threads update the same file updates times each, a merge sleeping between read and write loses lines
+//unless Update holds the lock from read to rename. Every line of every writer must be in the file afterwards
+int main_timing_cache_test()
+{
+	std::string fileName = TimingCachePath("", 0x0123456789abcdefull);
+	std::remove(fileName.c_str());
+	int failures = 0;
+	if (fileName != "timing_0123456789abcdef.cache")
+	{
+		std::cout << "TimingCachePath " << fileName << "  FAILED" << std::endl;
+		failures++;
+	}
+	TimingCacheFile cacheFile(fileName);
+	std::vector<char> cache;
+	if (cacheFile.Load(cache) || !cache.empty())
+	{
+		std::cout << "Load of a missing cache  FAILED" << std::endl;
+		failures++;
+	}
+	//a merge returning false keeps the file as is, here it does not create one
+	cacheFile.Update([](const std::vector<char>&, std::vector<char>&) { return false; });
+	if (cacheFile.Load(cache))
+	{
+		std::cout << "rejected merge wrote the cache  FAILED" << std::endl;
+		failures++;
+	}
+
+	int writers = 8;
+	int updates = 5;
+	std::vector<std::thread> threads;
+	for (int w = 0; w < writers; w++)
+	{
+		threads.emplace_back([&cacheFile, w, updates]() {
+			for (int u = 0; u < updates; u++)
+			{
+				std::string line = "layer_" + std::to_string(w) + "_" + std::to_string(u) + " tactic " + std::to_string(w * 100 + u) + "\n";
+				cacheFile.Update([&line](const std::vector<char>& current, std::vector<char>& merged) {
+					merged = current;
+					std::this_thread::sleep_for(std::chrono::milliseconds(2));
+					merged.insert(merged.end(), line.begin(), line.end());
+					return true;
+				});
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+
+	cacheFile.Load(cache);
+	std::set<std::string> lines = cacheLines(cache);
+	int missing = 0;
+	for (int w = 0; w < writers; w++)
+	{
+		for (int u = 0; u < updates; u++)
+		{
+			if (lines.count("layer_" + std::to_string(w) + "_" + std::to_string(u) + " tactic " + std::to_string(w * 100 + u)) == 0)
+				missing++;
+		}
+	}
+	std::cout << writers << " writers x " << updates << " updates: " << lines.size() << " lines merged, " << missing
+		<< " missing" << (missing == 0 ? "" : "  FAILED") << std::endl;
+	failures += missing;
+
+	std::remove(fileName.c_str());
+	std::remove((fileName + ".lock").c_str());
+	return failures == 0 ? 0 : 1;
+}
@@ -1,8 +1,15 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "ctdetLayer.h"
 #include "class_timer.hpp"
 struct CenterNetResult
@@ -15,7 +22,7 @@ typedef std::vector<CenterNetResult> BatchResult;
 class CenterNetDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -26,8 +33,12 @@ public:
 	int m_Classes;
 	int m_kernelSize = 3;
 	std::vector<std::string> m_ClassNames;
+	std::string m_InputBlobName;
+	bool m_PackedInput = false;
 	std::vector<TensorInfo> m_OutputTensors;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 public:
 	CenterNetDectector::CenterNetDectector()
@@ -36,14 +47,11 @@ public:
 	}
 	CenterNetDectector::~CenterNetDectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//释放内存
 		m_ClassNames.clear();
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 
 	std::vector<BBoxInfo> nonMaximumSuppression(const float nmsThresh, std::vector<BBoxInfo> binfo)
@@ -116,25 +124,46 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[1];
-		for (int m_centernet_ind = 1; m_centernet_ind < onnx_net->mBindingName.size(); m_centernet_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_PackedInput = onnx_net->GetBindingDataType(inputIndex) == TensorType::kINT8;
+		//int8 input of SetInputPrologue is NHWC
+		int spatialAxis = m_PackedInput ? 1 : 2;
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[spatialAxis];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[spatialAxis + 1];
+		std::vector<int> outputs;
+		for (int m_centernet_ind = 0; m_centernet_ind < onnx_net->GetNbBindings(); m_centernet_ind++)
+		{
+			if (!onnx_net->BindingIsInput(m_centernet_ind))
+			{
+				outputs.push_back(m_centernet_ind);
+			}
+		}
+		//heads are picked by name, exporters do not agree on their order. m_OutputTensors is hm, reg, wh
+		const std::vector<std::vector<std::string>> heads = { { "hm", "heatmap" }, { "reg", "offset" }, { "wh" } };
+		for (size_t k = 0; k < heads.size(); k++)
 		{
+			int index = onnx_net->FindOutputBinding(heads[k]);
+			if (index == -1)
+			{
+				std::cout << "no output named " << heads[k][0] << ", use output " << k << std::endl;
+				index = outputs.at(k);
+			}
 			TensorInfo outputTensor;
-			outputTensor.volume = onnx_net->mBindingSize[m_centernet_ind] / sizeof(float);
-			outputTensor.blobName = onnx_net->mBindingName[m_centernet_ind];
+			outputTensor.volume = onnx_net->GetBindingSize(index) / sizeof(float);
+			outputTensor.blobName = onnx_net->GetBindingName(index);
 			m_OutputTensors.push_back(outputTensor);
 		}
+		m_Classes = onnx_net->GetBindingDims(onnx_net->GetBindingIndex(m_OutputTensors[0].blobName)).d[1];
 	}
 
 	void allocateBuffers()
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -151,8 +180,20 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetInputPrologue(config.inputPrologue);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
 		if (config.mode == 2)
@@ -160,108 +201,129 @@ public:
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//更新m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	void doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
+	}
+
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
-	std::vector<std::vector<BBoxInfo>> reprocessing()
+	std::vector<std::vector<BBoxInfo>> reprocessing(InferContext& context)
 	{
 		Timer timer;
 		std::vector<std::vector<BBoxInfo>> m_batch_box;
-		m_batch_box.reserve(m_BatchSize);
-		for (uint32_t i_BatchSize = 0; i_BatchSize < m_BatchSize; i_BatchSize++)
+		const uint32_t batchSize = context.GetBatchSize();
+		m_batch_box.reserve(batchSize);
+		//heads stay where inference left them, on the device for gpu backends
+		TensorView<float> hm = context.BindingTensor<float>(m_OutputTensors[0].blobName);
+		TensorView<float> reg = context.BindingTensor<float>(m_OutputTensors[1].blobName);
+		TensorView<float> wh = context.BindingTensor<float>(m_OutputTensors[2].blobName);
+		assert(!hm.empty() && !reg.empty() && !wh.empty() && "Invalid output binding");
+		for (uint32_t i_BatchSize = 0; i_BatchSize < batchSize; i_BatchSize++)
 		{
-			void* cudaOutputBuffer;
-			int outputBufferSize = onnx_net->mBindingSize[1] * 6 / m_BatchSize;
+			int outputBufferSize = onnx_net->GetBindingSize(m_OutputTensors[0].bindingIndex) * 6 / m_BatchSize;
 			std::unique_ptr<float[]> outputData(new float[outputBufferSize]);
-			cudaMalloc(&cudaOutputBuffer, outputBufferSize);
-			CUDA_CHECK(cudaMemset(cudaOutputBuffer, 0, sizeof(float)));
-			const float* m_hm_hostBuffer = static_cast<const float*>(onnx_net->mBinding[1]) + i_BatchSize * m_OutputTensors[0].volume / m_BatchSize;
-			const float* m_reg_hostBuffer = static_cast<const float*>(onnx_net->mBinding[2]) + i_BatchSize * m_OutputTensors[1].volume / m_BatchSize;
-			const float* m_wh_hostBuffer = static_cast<const float*>(onnx_net->mBinding[3]) + i_BatchSize * m_OutputTensors[2].volume / m_BatchSize;
-			CTdetforward_gpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, static_cast<float*>(cudaOutputBuffer),
-				m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, conf_thresh);
-			//CUDA_CHECK(cudaMemcpyAsync(outputData.get(), cudaOutputBuffer, outputBufferSize, cudaMemcpyDeviceToHost, mCudaStream));
-			cudaMemcpyAsync(outputData.get(), cudaOutputBuffer, outputBufferSize, cudaMemcpyDeviceToHost, mCudaStream);
+			const float* m_hm_hostBuffer = hm.Batch(i_BatchSize).data();
+			const float* m_reg_hostBuffer = reg.Batch(i_BatchSize).data();
+			const float* m_wh_hostBuffer = wh.Batch(i_BatchSize).data();
+			if (onnx_net->BindingIsOnDevice())
+			{
+				void* cudaOutputBuffer;
+				cudaMalloc(&cudaOutputBuffer, outputBufferSize);
+				CUDA_CHECK(cudaMemsetAsync(cudaOutputBuffer, 0, sizeof(float), context.GetStream()));
+				CTdetforward_gpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, static_cast<float*>(cudaOutputBuffer),
+					m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, conf_thresh, context.GetStream());
+				CUDA_CHECK(cudaMemcpyAsync(outputData.get(), cudaOutputBuffer, outputBufferSize, cudaMemcpyDeviceToHost, context.GetStream()));
+				context.Synchronize();
+				cudaFree(cudaOutputBuffer);
+			}
+			else
+			{
+				outputData[0] = 0;
+				CTdetforward_cpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, outputData.get(),
+					m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, conf_thresh);
+			}
 			std::vector<BBoxInfo> result;
 			int num_det = static_cast<int>(outputData[0]);
 			result.resize(num_det);
 			memcpy(result.data(), &outputData[1], num_det * sizeof(BBoxInfo));
 			m_batch_box.push_back(result);
-			cudaFree(cudaOutputBuffer);
 		}
 		return m_batch_box;
 	}
 
+	//where an image sits in the input, preprocess and postProcess build the same one so boxes map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
+	{
+		return LetterboxTransform::Fit(img.size(), cv::Size(m_InputW, m_InputH), _config.letterbox);
+	}
+
+	//input pixels to image pixels, the exact inverse of the preprocessing
 	void postProcess(std::vector<BBoxInfo>& result, const cv::Mat& img)
 	{
-		using namespace cv;
-		int input_w = m_InputW;
-		int input_h = m_InputH;
-		float scale_w = float(input_w) / img.cols;
-		float scale_h = float(input_h) / img.rows;
-		float dx = (input_w - scale_w * img.cols) / 2;
-		float dy = (input_h - scale_h * img.rows) / 2;
-		for (auto& item : result)
+		inputTransform(img).ToImage(result);
+	}
+
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		if (m_PackedInput)
 		{
-			float x1 = (item.box.x1 - dx) / scale_w;
-			float y1 = (item.box.y1 - dy) / scale_h;
-			float x2 = (item.box.x2 - dx) / scale_w;
-			float y2 = (item.box.y2 - dy) / scale_h;
-			x1 = (x1 > 0) ? x1 : 0;
-			y1 = (y1 > 0) ? y1 : 0;
-			x2 = (x2 < img.cols) ? x2 : img.cols - 1;
-			y2 = (y2 < img.rows) ? y2 : img.rows - 1;
-			item.box.x1 = x1;
-			item.box.y1 = y1;
-			item.box.x2 = x2;
-			item.box.y2 = y2;
+			//raw BGR bytes minus 128, the engine normalizes them and transposes to NCHW
+			int8_t* pixels = context.HostTensor<int8_t>(m_InputBlobName).data();
+			//resized into the scratch of the context, allocated on the first call only
+			void* scratch = context.GetScratch(static_cast<size_t>(m_InputW) * m_InputH * 3);
+			for (const auto& img : vec_image)
+			{
+				pixels = inputTransform(img).Pack(img, pixels, scratch);
+			}
+			return;
 		}
+		float* data = context.GetInputBuffer().data();
+		PreprocessParams params = PreprocessParams::Scaled(cv::Size(m_InputW, m_InputH), 1 / 255.0);
+		//resize or letterbox, /255 and BGRBGRBGR->BBBGGGRRR in one pass, straight into the staging buffer, every
+		//image into its own slot, split over the preprocess pool threads
+		PreprocessBatch(vec_image, [&](int i) { return inputTransform(vec_image[i]).Apply(params); }, data, _config.preprocessThreads);
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
 		vec_batch_result.clear();
 		vec_batch_result.reserve(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
-		{
-			cv::Mat resized, imgf;
-			cv::resize(img, resized, cv::Size(m_InputH, m_InputW));
-			resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr2, ptr2 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr3, ptr3 + m_InputH * m_InputW);
-		}
 		Timer timer;
 		timer.reset();
-		doInference(data, vec_image.size());
-		double t_doInference = timer.elapsed();
-		std::cout << "doInference:"  << t_doInference << "ms" << std::endl;
-		timer.reset();
-		std::vector < std::vector<BBoxInfo>> m_batch_box = reprocessing();
+		std::vector < std::vector<BBoxInfo>> m_batch_box = reprocessing(context);
 		double reprocessing_t = timer.elapsed();
 		std::cout << "reprocessing:" << reprocessing_t << "ms" << std::endl;
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
@@ -295,6 +357,52 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		Timer timer;
+		timer.reset();
+		doInference(*context, vec_image.size());
+		double t_doInference = timer.elapsed();
+		std::cout << "doInference:"  << t_doInference << "ms" << std::endl;
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_CenterNetDectector()
@@ -310,6 +418,9 @@ int main_CenterNetDectector()
 	m_config.calibration_height = 512;
 	m_config.conf_thresh = 0.5;
 	m_config.m_NMSThresh = 0.2;
+	m_config.warmupIterations = 2;
+	//synchronous inference while profiling, the fps below include it
+	m_config.layerProfiling = true;
 	m_CenterNetDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -332,14 +443,16 @@ int main_CenterNetDectector()
 		m_CenterNetDectector.detect(batch_img, batch_res);
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << "次 time:" << all_time << " ms" << std::endl;
 	std::cout << "1次 time:" << all_time / m << " ms" << std::endl;
 	std::cout << "FPS::" << 1000 / (all_time / m) << std::endl;
+	//top layers of the loop above, open the trace in chrome://tracing
+	LayerProfile profile = m_CenterNetDectector.layerProfile();
+	profile.PrintTable(std::cout, 20);
+	profile.WriteChromeTrace("centernet_layers.json");
 	
 	//disp
 	for (int i = 0; i < batch_img.size(); ++i)
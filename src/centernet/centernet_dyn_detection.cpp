@@ -1,8 +1,14 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
 #include "ctdetLayer.h"
 #include "cuda_runtime.h"
 #include <NvInfer.h>
@@ -16,7 +22,7 @@ typedef std::vector<Result> BatchResult;
 class CenterNetDynDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -27,12 +33,13 @@ public:
 	int m_kernelSize = 3;
 	const float m_Threshold = 0.3;
 	std::vector<std::string> m_ClassNames;
+	std::string m_InputBlobName;
 	std::vector<TensorInfo> m_OutputTensors;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 
-	uint32_t m_Ori_InputH;
-	uint32_t m_Ori_InputW;
 public:
 	CenterNetDynDectector::CenterNetDynDectector()
 	{
@@ -40,14 +47,11 @@ public:
 	}
 	CenterNetDynDectector::~CenterNetDynDectector()
 	{
+		//finish pending detectAsync_dyn calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
 		m_ClassNames.clear();
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 
 	std::vector<BBoxInfo> nonMaximumSuppression(const float nmsThresh, std::vector<BBoxInfo> binfo)
@@ -120,25 +124,44 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[1];
-		for (int m_centernet_ind = 1; m_centernet_ind < onnx_net->mBindingName.size(); m_centernet_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_InputC = onnx_net->GetBindingDims(inputIndex).d[1];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[2];
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[3];
+		std::vector<int> outputs;
+		for (int m_centernet_ind = 0; m_centernet_ind < onnx_net->GetNbBindings(); m_centernet_ind++)
 		{
+			if (!onnx_net->BindingIsInput(m_centernet_ind))
+			{
+				outputs.push_back(m_centernet_ind);
+			}
+		}
+		//heads are picked by name, exporters do not agree on their order. m_OutputTensors is hm, reg, wh
+		const std::vector<std::vector<std::string>> heads = { { "hm", "heatmap" }, { "reg", "offset" }, { "wh" } };
+		for (size_t k = 0; k < heads.size(); k++)
+		{
+			int index = onnx_net->FindOutputBinding(heads[k]);
+			if (index == -1)
+			{
+				std::cout << "no output named " << heads[k][0] << ", use output " << k << std::endl;
+				index = outputs.at(k);
+			}
 			TensorInfo outputTensor;
-			outputTensor.volume = onnx_net->mBindingSize[m_centernet_ind] / sizeof(float);
-			outputTensor.blobName = onnx_net->mBindingName[m_centernet_ind];
+			outputTensor.volume = onnx_net->GetBindingSize(index) / sizeof(float);
+			outputTensor.blobName = onnx_net->GetBindingName(index);
 			m_OutputTensors.push_back(outputTensor);
 		}
+		m_Classes = onnx_net->GetBindingDims(onnx_net->GetBindingIndex(m_OutputTensors[0].blobName)).d[1];
 	}
 
 	void allocateBuffers()
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -155,8 +178,18 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
@@ -164,79 +197,105 @@ public:
 		bool m_dyn_flag = true;
 		if (m_dyn_flag)
 		{
-			onnx_net->AddDynamicShapeProfile(1, "input", { 3,512,512 }, { 3,512,512 }, {3,1500,1500});
+			//one profile per resolution bucket, frames run on the smallest one that fits
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,512,512 }, { 3,512,512 }, { 3,768,768 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,512,512 }, { 3,1024,1024 }, { 3,1100,1100 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,512,512 }, { 3,1500,1500 }, { 3,1500,1500 });
 		}
 
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		onnx_net->buildPreprocessorEngine();
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync_dyn(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference_dyn(std::vector<float> input, const uint32_t batchSize)
+	void doInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
 	{
-		nvinfer1::Dims inputdim = onnx_net->mEngine->getBindingDimensions(0); // C*H*W
-		void* hostBuffer;
-		cudaMalloc(&hostBuffer,input.size() * sizeof(float));
-		CUDA_CHECK(cudaMemcpy(hostBuffer, input.data(), input.size() * sizeof(float), cudaMemcpyHostToDevice));
-		
-		// Set the input size for the preprocessor
-		nvinfer1::Dims inputDims_1;
-		inputDims_1.nbDims = 4;
-		inputDims_1.d[0] = batchSize;
-		inputDims_1.d[1] = m_InputC;
-		inputDims_1.d[2] = m_Ori_InputH;
-		inputDims_1.d[3] = m_Ori_InputW;
-		//CHECK_RETURN_W_MSG(onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims), false, "Invalid binding dimensions.");
-		onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims_1);
-		// We can only run inference once all dynamic input shapes have been specified.
-		if (!onnx_net->mPreprocessorContext->allInputDimensionsSpecified())
+		if (enqueueInference_dyn(context, batchSize, imageSize))
 		{
-			return;
+			context.Synchronize();
 		}
+	}
 
-		std::vector<void*> preprocessorBindings = { hostBuffer, onnx_net->GetBindingPtr(0) };
-		bool status = onnx_net->mPreprocessorContext->executeV2(preprocessorBindings.data());
-		if (!status)
+	// resize, inference and output copy are queued on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
+	{
+		if (!context.SetBatchSize(batchSize))
 		{
-			return;
+			return false;
 		}
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+
+		// Set the input size for the preprocessor
+		TensorDims inputDims_1;
+		inputDims_1.nbDims = 4;
+		inputDims_1.d[0] = batchSize;
+		inputDims_1.d[1] = m_InputC;
+		inputDims_1.d[2] = imageSize.height;
+		inputDims_1.d[3] = imageSize.width;
+		if (!context.ForwardPreprocessor(inputDims_1))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.ForwardAsync();
+		context.CopyOutputsFromDeviceToHost();
+		return true;
 	}
 
-	std::vector<std::vector<BBoxInfo>> reprocessing()
+	std::vector<std::vector<BBoxInfo>> reprocessing(InferContext& context)
 	{
 		std::vector<std::vector<BBoxInfo>> m_batch_box;
-		m_batch_box.resize(m_BatchSize);
-		for (int i_BatchSize = 0; i_BatchSize < m_BatchSize; i_BatchSize++)
+		const uint32_t batchSize = context.GetBatchSize();
+		m_batch_box.resize(batchSize);
+		//heads stay where inference left them, on the device for gpu backends
+		TensorView<float> hm = context.BindingTensor<float>(m_OutputTensors[0].blobName);
+		TensorView<float> reg = context.BindingTensor<float>(m_OutputTensors[1].blobName);
+		TensorView<float> wh = context.BindingTensor<float>(m_OutputTensors[2].blobName);
+		assert(!hm.empty() && !reg.empty() && !wh.empty() && "Invalid output binding");
+		for (uint32_t i_BatchSize = 0; i_BatchSize < batchSize; i_BatchSize++)
 		{
-			void* cudaOutputBuffer;
 			std::vector<float> outputData;
-			int outputBufferSize = onnx_net->mBindingSize[1] * 6 / m_BatchSize;
+			int outputBufferSize = onnx_net->GetBindingSize(m_OutputTensors[0].bindingIndex) * 6 / m_BatchSize;
 			outputData.resize(outputBufferSize);
-			cudaMalloc(&cudaOutputBuffer, outputBufferSize);
-			CUDA_CHECK(cudaMemset(cudaOutputBuffer, 0, sizeof(float)));
-			const float* m_hm_hostBuffer = static_cast<const float*>(onnx_net->mBinding[1]) + i_BatchSize * m_OutputTensors[0].volume / m_BatchSize;
-			const float* m_reg_hostBuffer = static_cast<const float*>(onnx_net->mBinding[2]) + i_BatchSize * m_OutputTensors[1].volume / m_BatchSize;
-			const float* m_wh_hostBuffer = static_cast<const float*>(onnx_net->mBinding[3]) + i_BatchSize * m_OutputTensors[2].volume / m_BatchSize;
-			CTdetforward_gpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, static_cast<float*>(cudaOutputBuffer),
-				m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, m_Threshold);
-			CUDA_CHECK(cudaMemcpyAsync(outputData.data(), cudaOutputBuffer, outputBufferSize, cudaMemcpyDeviceToHost, mCudaStream));
+			const float* m_hm_hostBuffer = hm.Batch(i_BatchSize).data();
+			const float* m_reg_hostBuffer = reg.Batch(i_BatchSize).data();
+			const float* m_wh_hostBuffer = wh.Batch(i_BatchSize).data();
+			if (onnx_net->BindingIsOnDevice())
+			{
+				void* cudaOutputBuffer;
+				cudaMalloc(&cudaOutputBuffer, outputBufferSize);
+				CUDA_CHECK(cudaMemsetAsync(cudaOutputBuffer, 0, sizeof(float), context.GetStream()));
+				CTdetforward_gpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, static_cast<float*>(cudaOutputBuffer),
+					m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, m_Threshold, context.GetStream());
+				CUDA_CHECK(cudaMemcpyAsync(outputData.data(), cudaOutputBuffer, outputBufferSize, cudaMemcpyDeviceToHost, context.GetStream()));
+				context.Synchronize();
+				cudaFree(cudaOutputBuffer);
+			}
+			else
+			{
+				outputData[0] = 0;
+				CTdetforward_cpu(m_hm_hostBuffer, m_reg_hostBuffer, m_wh_hostBuffer, outputData.data(),
+					m_InputW / 4, m_InputH / 4, m_Classes, m_kernelSize, m_Threshold);
+			}
 			std::vector<BBoxInfo> result;
 			int num_det = static_cast<int>(outputData[0]);
 			result.resize(num_det);
 			memcpy(result.data(), &outputData[1], num_det * sizeof(BBoxInfo));
 			m_batch_box[i_BatchSize] = result;
 			outputData.clear();
-			cudaFree(cudaOutputBuffer);
 		}
 
 		return m_batch_box;
@@ -268,31 +327,20 @@ public:
 		}
 	}
 
-	void detect_dyn(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	//frames of a batch share one size, written in place into the pinned preprocessor staging of the context
+	void prepareInput_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		size_t imageSize = vec_image[0].total() * 3;
+		float* data = context.GetPreprocessorInput(imageSize * vec_image.size());
+		//the preprocessor engine resizes on the gpu, /255 and BGRBGRBGR->BBBGGGRRR in one pass here
+		PreprocessBatch(vec_image, PreprocessParams::Scaled(vec_image[0].size(), 1 / 255.0), data, _config.preprocessThreads);
+	}
+
+	void decodeOutputs_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
-		m_Ori_InputW = vec_image[0].cols;
-		m_Ori_InputH = vec_image[0].rows;
-		m_InputC = vec_image[0].channels();
 		vec_batch_result.clear();
 		vec_batch_result.resize(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
-		{
-			cv::Mat imgf;
-			//cv::resize(img, resized, cv::Size(m_InputW, m_InputH));
-			img.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + img.rows * img.cols);
-			data.insert(data.end(), ptr2, ptr2 + img.rows * img.cols);
-			data.insert(data.end(), ptr3, ptr3 + img.rows * img.cols);
-		}
-		doInference_dyn(data, vec_image.size());
-		std::vector < std::vector<BBoxInfo>> m_batch_box = reprocessing();
+		std::vector < std::vector<BBoxInfo>> m_batch_box = reprocessing(context);
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
@@ -322,6 +370,45 @@ public:
 			vec_batch_result[i] = vec_result;
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect_dyn(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		doInference_dyn(*context, vec_image.size(), vec_image[0].size());
+		decodeOutputs_dyn(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect_dyn, decode and nms run on m_Worker, the result is handed out through the future and callback
+	std::future<std::vector<BatchResult>> detectAsync_dyn(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		if (!enqueueInference_dyn(*context, vec_image.size(), vec_image[0].size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs_dyn(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_CenterNetDynDectector()
@@ -335,6 +422,7 @@ int main_CenterNetDynDectector()
 	m_config.mode = 0;
 	m_config.calibration_width = 512;
 	m_config.calibration_height = 512;
+	m_config.warmupIterations = 2;
 	m_CenterNetDynDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
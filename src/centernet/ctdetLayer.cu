@@ -1,5 +1,6 @@
 #include "ctdetLayer.h"
 #include "common.h"
+#include <cmath>
 dim3 cudaGridSize(uint32_t n)
 {
     uint32_t k = (n - 1) /BLOCK + 1;
@@ -62,7 +63,48 @@ __global__ void CTdetforward_kernel(const float *hm, const float *reg,const floa
 }
 
 void CTdetforward_gpu(const float *hm, const float *reg,const float *wh ,float *output,
-                      const int w,const int h,const int classes,const int kernerl_size, const float visthresh ){
+                      const int w,const int h,const int classes,const int kernerl_size, const float visthresh,
+                      cudaStream_t stream){
     uint32_t num = w * h * classes;
-    CTdetforward_kernel<<<cudaGridSize(num),BLOCK>>>(hm,reg,wh,output,w,h,classes,kernerl_size,visthresh);
+    CTdetforward_kernel<<<cudaGridSize(num),BLOCK,0,stream>>>(hm,reg,wh,output,w,h,classes,kernerl_size,visthresh);
+}
+
+void CTdetforward_cpu(const float *hm, const float *reg,const float *wh ,float *output,
+                      const int w,const int h,const int classes,const int kernel_size, const float visthresh ){
+    auto logist = [](float data) { return 1.f / (1.f + std::exp(-data)); };
+    int padding = (kernel_size - 1) / 2;
+    int stride = w * h;
+    for (int idx = 0; idx < w * h * classes; ++idx) {
+        float objProb = logist(hm[idx]);
+        if (objProb <= visthresh) continue;
+        int grid_x = idx % w;
+        int grid_y = (idx / w) % h;
+        int cls = idx / w / h;
+        // keep only the local maximum of the kernel window, same as the gpu kernel
+        float max = -1;
+        int max_index = 0;
+        for (int l = 0; l < kernel_size; ++l)
+            for (int m = 0; m < kernel_size; ++m) {
+                int cur_x = l - padding + grid_x;
+                int cur_y = m - padding + grid_y;
+                int cur_index = cur_y * w + cur_x + stride * cls;
+                bool valid = (cur_x >= 0 && cur_x < w && cur_y >= 0 && cur_y < h);
+                float val = valid ? logist(hm[cur_index]) : -1;
+                max_index = (val > max) ? cur_index : max_index;
+                max = (val > max) ? val : max;
+            }
+        if (idx != max_index) continue;
+        int resCount = static_cast<int>(output[0]);
+        output[0] += 1;
+        BBoxInfo* det = (BBoxInfo*)((char*)output + sizeof(float) + resCount * sizeof(BBoxInfo));
+        int reg_index = idx - cls * stride;
+        float c_x = grid_x + reg[reg_index];
+        float c_y = grid_y + reg[reg_index + stride];
+        det->box.x1 = (c_x - wh[reg_index] / 2) * 4;
+        det->box.y1 = (c_y - wh[reg_index + stride] / 2) * 4;
+        det->box.x2 = (c_x + wh[reg_index] / 2) * 4;
+        det->box.y2 = (c_y + wh[reg_index + stride] / 2) * 4;
+        det->label = cls;
+        det->prob = objProb;
+    }
 }
@@ -5,6 +5,13 @@
 #ifndef CTDET_TRT_CTDETLAYER_H
 #define CTDET_TRT_CTDETLAYER_H
 
+#include <cuda_runtime.h>
+
 void CTdetforward_gpu(const float *hm, const float *reg,const float *wh ,float *output,
+                      const int w,const int h,const int classes,const int kernerl_size,const float visthresh,
+                      cudaStream_t stream = 0);
+
+// host version of CTdetforward_gpu for backends whose bindings live in host memory, output[0] must be zeroed
+void CTdetforward_cpu(const float *hm, const float *reg,const float *wh ,float *output,
                       const int w,const int h,const int classes,const int kernerl_size,const float visthresh  );
 #endif //CTDET_TRT_CTDETLAYER_H
@@ -7,6 +7,7 @@
 
 #include "NvInfer.h"
 #include "common.h"
+#include "PluginDescription.h"
 #include <thread>
 #include <cassert>
 #include <iostream>
@@ -36,7 +37,7 @@ namespace
 } // namespace
 
 /// inherited from IPluginV2DynamicExt 
-class DCNDynamicPlugin final: public nvinfer1::IPluginV2DynamicExt {
+class DCNDynamicPlugin final: public nvinfer1::IPluginV2DynamicExt, public PluginDescription {
 private:
     std::string _nameSpace;
     nvinfer1::Dims _inputDims;
@@ -174,6 +175,10 @@ public:
     }
     const char* getPluginType() const override {return DCN_PLUGIN_NAME;}
     const char* getPluginVersion() const override {return DCN_PLUGIN_VERSION;}
+    std::string Describe() const override {
+        return "k" + std::to_string(_kernel_size) + " s" + std::to_string(_stride) + " p" + std::to_string(_padding)
+               + " d" + std::to_string(_dilation) + " g" + std::to_string(_deformable_groups);
+    }
     void setPluginNamespace(const char* libNamespace) override {_nameSpace = libNamespace;}
     //const char* getPluginNamespace() const {return _nameSpace.c_str();}
     const char* getPluginNamespace() const {return "";}
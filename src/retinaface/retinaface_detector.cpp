@@ -1,8 +1,15 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "class_timer.hpp"
 struct FacePts
 {
@@ -63,7 +70,7 @@ struct FaceDetectInfo
 class RetinaFaceDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -73,9 +80,12 @@ public:
 	float m_NMSThresh = 0.2;
 	float conf_thresh = 0.6;
 	int _n_yolo_ind = 0;
+	std::string m_InputBlobName;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 	std::vector<int> _feat_stride_fpn = { 32, 16, 8 };
 	std::vector<anchor_cfg> cfg;
@@ -90,14 +100,11 @@ public:
 	}
 	RetinaFaceDectector::~RetinaFaceDectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 
 	std::vector<anchor_box> anchors_plane(int height, int width, int stride, std::vector<anchor_box> base_anchors)
@@ -377,10 +384,8 @@ public:
 		return bboxes_nms;
 	}
 
-	std::vector<FaceDetectInfo> decodeTensor(const int imageIdx,
-		const int imageH,
-		const int imageW,
-		const int _feat_stride_fpn_i)
+	//faces and landmarks in input pixels, decodeDetections maps them to the image
+	std::vector<FaceDetectInfo> decodeTensor(InferContext& context, const int imageIdx, const int _feat_stride_fpn_i)
 	{
 		std::string name_bbox = "face_rpn_bbox_pred_stride";
 		std::string name_score = "face_rpn_cls_prob_reshape_stride";
@@ -389,9 +394,13 @@ public:
 		std::string str_name_bbox = name_bbox + std::to_string(_feat_stride_fpn_i);
 		std::string str_name_score = name_score + std::to_string(_feat_stride_fpn_i);
 		std::string str_name_landmark = name_landmark + std::to_string(_feat_stride_fpn_i);
-		auto tensor_bbox = getOutputTensors(str_name_bbox);
 		auto tensor_score = getOutputTensors(str_name_score);
-		auto tensor_landmark = getOutputTensors(str_name_landmark);
+		TensorView<float> view_score = context.HostTensor<float>(str_name_score).Batch(imageIdx);
+		TensorView<float> view_bbox = context.HostTensor<float>(str_name_bbox).Batch(imageIdx);
+		TensorView<float> view_landmark = context.HostTensor<float>(str_name_landmark).Batch(imageIdx);
+		const float* score = view_score.data();
+		const float* bbox = view_bbox.data();
+		const float* landmark = view_landmark.data();
 
 		size_t num_anchor = _num_anchors[key];
 		size_t count = tensor_score.grid_w * tensor_score.grid_h;
@@ -402,17 +411,17 @@ public:
 		for (size_t num = 0; num < num_anchor; num++) {
 			for (size_t j = 0; j < count; j++) {
 				//ŶСֵ
-				int half_num = tensor_score.hostBuffer.size() / 2;
-				float conf = tensor_score.hostBuffer[j + count * num + half_num];
+				int half_num = view_score.volume() / 2;
+				float conf = score[j + count * num + half_num];
 				if (conf <= conf_thresh) {
 					continue;
 				}
 
 				cv::Vec4f regress;
-				float dx = tensor_bbox.hostBuffer[j + count * (0 + num * 4)];
-				float dy = tensor_bbox.hostBuffer[j + count * (1 + num * 4)];
-				float dw = tensor_bbox.hostBuffer[j + count * (2 + num * 4)];
-				float dh = tensor_bbox.hostBuffer[j + count * (3 + num * 4)];
+				float dx = bbox[j + count * (0 + num * 4)];
+				float dy = bbox[j + count * (1 + num * 4)];
+				float dw = bbox[j + count * (2 + num * 4)];
+				float dh = bbox[j + count * (3 + num * 4)];
 				regress = cv::Vec4f(dx, dy, dw, dh);
 
 				//ع
@@ -420,22 +429,13 @@ public:
 				//Խ紦
 				clip_boxes(rect, m_InputW, m_InputH);
 
-				rect.x1 = rect.x1 / m_InputW * imageW;
-				rect.x2 = rect.x2 / m_InputW * imageW;
-				rect.y1 = rect.y1 / m_InputH * imageH;
-				rect.y2 = rect.y2 / m_InputH * imageH;
 				FacePts pts;
 				for (size_t k = 0; k < 5; k++) {
-					pts.x[k] = tensor_landmark.hostBuffer[j + count * (num * 10 + k * 2)];
-					pts.y[k] = tensor_landmark.hostBuffer[j + count * (num * 10 + k * 2 + 1)];
+					pts.x[k] = landmark[j + count * (num * 10 + k * 2)];
+					pts.y[k] = landmark[j + count * (num * 10 + k * 2 + 1)];
 				}
 				//عؼ
 				FacePts landmarks = landmark_pred(anchors[j + count * num], pts);
-				for (int i = 0; i < 5; i++)
-				{
-					landmarks.x[i] = landmarks.x[i] / m_InputW * imageW;
-					landmarks.y[i] = landmarks.y[i] / m_InputH * imageH;
-				}
 
 				FaceDetectInfo tmp;
 				tmp.score = conf;
@@ -446,16 +446,20 @@ public:
 		}
 		return faceInfo;
 	}
-	std::vector<FaceDetectInfo> decodeDetections(const int& imageIdx,
-		const int& imageH,
-		const int& imageW)
+	std::vector<FaceDetectInfo> decodeDetections(InferContext& context, const int& imageIdx, const LetterboxTransform& transform)
 	{
 		std::vector<FaceDetectInfo> faceInfo;
 		for (int m_tensor_i = 0; m_tensor_i < _feat_stride_fpn.size(); m_tensor_i++)
 		{
-			std::vector<FaceDetectInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, _feat_stride_fpn[m_tensor_i]);
+			std::vector<FaceDetectInfo> curBInfo = decodeTensor(context, imageIdx, _feat_stride_fpn[m_tensor_i]);
 			faceInfo.insert(faceInfo.end(), curBInfo.begin(), curBInfo.end());
 		}
+		//input pixels to image pixels, the exact inverse of the preprocessing
+		for (FaceDetectInfo& face : faceInfo)
+		{
+			transform.BoxesToImage(&face.rect, 1);
+			transform.PointsToImage(face.pts.x, face.pts.y, 5);
+		}
 		//nms
 		faceInfo = nms(faceInfo, m_NMSThresh);
 		return faceInfo;
@@ -463,17 +467,24 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputC = onnx_net->mBindingDims[0].d[1];
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[2] - 5;
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_InputC = onnx_net->GetBindingDims(inputIndex).d[1];
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[2];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[3];
+		m_Classes = 1;
+		for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
 		{
+			if (onnx_net->BindingIsInput(m_yolo_ind))
+			{
+				continue;
+			}
 			TensorInfo outputTensor;
-			outputTensor.grid_w = onnx_net->mBindingDims[m_yolo_ind].d[2];
-			outputTensor.grid_h = onnx_net->mBindingDims[m_yolo_ind].d[3];
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float) / onnx_net->mBindingDims[m_yolo_ind].d[0];
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			outputTensor.grid_w = onnx_net->GetBindingDims(m_yolo_ind).d[2];
+			outputTensor.grid_h = onnx_net->GetBindingDims(m_yolo_ind).d[3];
+			outputTensor.volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / onnx_net->GetBindingDims(m_yolo_ind).d[0];
+			outputTensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
 			m_OutputTensors.push_back(outputTensor);
 		}
 	}
@@ -482,9 +493,8 @@ public:
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -545,8 +555,19 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
@@ -554,69 +575,77 @@ public:
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		init_anchor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	void doInference(InferContext& context, const uint32_t batchSize)
 	{
-		//	Timer timer;
-		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (enqueueInference(context, batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			context.Synchronize();
 		}
-		cudaStreamSynchronize(mCudaStream);
 	}
 
-	std::vector<float> prepareImage(std::vector<cv::Mat> vec_img) {
-		std::vector<float> result(m_BatchSize * m_InputW * m_InputH * m_InputC);
-		float* data = result.data();
-		int index = 0;
-		for (const cv::Mat& src_img : vec_img)
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
+	{
+		//	Timer timer;
+		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		if (!context.SetBatchSize(batchSize))
 		{
-			if (!src_img.data)
-				continue;
-			//float ratio = float(m_InputW) / float(src_img.cols) < float(m_InputH) / float(src_img.rows) ? float(m_InputW) / float(src_img.cols) : float(m_InputH) / float(src_img.rows);
-			float ratio_w = float(m_InputW) / float(src_img.cols);
-			float ratio_h = float(m_InputH) / float(src_img.rows);
-			cv::Mat flt_img = cv::Mat::zeros(cv::Size(m_InputW, m_InputH), CV_8UC3);
-			cv::Mat rsz_img;
-			cv::resize(src_img, rsz_img, cv::Size(), ratio_w, ratio_h);
-			rsz_img.copyTo(flt_img(cv::Rect(0, 0, rsz_img.cols, rsz_img.rows)));
-			flt_img.convertTo(flt_img, CV_32FC3);
-
-			//HWC TO CHW
-			int channelLength = m_InputW * m_InputH;
-			std::vector<cv::Mat> split_img = {
-					cv::Mat(m_InputW, m_InputW, CV_32FC1, data + channelLength * (index + 2)),
-					cv::Mat(m_InputW, m_InputW, CV_32FC1, data + channelLength * (index + 1)),
-					cv::Mat(m_InputW, m_InputW, CV_32FC1, data + channelLength * index)
-			};
-			index += 3;
-			cv::split(flt_img, split_img);
+			return false;
 		}
-		return result;
+		context.InferAsync();
+		return true;
+	}
+
+	//where an image sits in the input, prepareImage and decodeOutputs build the same one so faces and landmarks
+	//map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
+	{
+		return LetterboxTransform::Fit(img.size(), cv::Size(m_InputW, m_InputH), _config.letterbox);
+	}
+
+	void prepareImage(const std::vector<cv::Mat>& vec_img, Span<float> input) {
+		assert(vec_img.size() * m_InputW * m_InputH * m_InputC <= input.size());
+		//stretched or letterboxed to the input size, HWC BGR to CHW RGB in one pass, each image into its own
+		//slot, an empty one is reported and leaves its slot as is
+		PreprocessParams params;
+		params.swapRB = true;
+		PreprocessBatch(vec_img, [&](int i) { return inputTransform(vec_img[i]).Apply(params); }, input.data(), _config.preprocessThreads);
+	}
+
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		//views cover the current batch, size it before writing the input
+		context.SetBatchSize(vec_image.size());
+		prepareImage(vec_image, context.GetInputBuffer());
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
 		vec_batch_result.clear();
 		vec_batch_result.reserve(vec_image.size());
-		std::vector<float>data;
-		data = prepareImage(vec_image);
-		doInference(data, vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, inputTransform(curImage));
 			if (binfo.empty())
 			{
 				continue;
@@ -637,6 +666,46 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		doInference(*context, vec_image.size());
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_RetinaFaceDectector()
@@ -652,6 +721,7 @@ int main_RetinaFaceDectector()
 	m_config.calibration_height = 512;
 	m_config.conf_thresh = 0.2;
 	m_config.m_NMSThresh = 0.2;
+	m_config.warmupIterations = 2;
 	m_RetinaFaceDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -673,10 +743,8 @@ int main_RetinaFaceDectector()
 		//double t = timer.elapsed();
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << " time:" << all_time << " ms" << std::endl;
 	std::cout << "1 time:" << all_time / m << " ms" << std::endl;
@@ -0,0 +1,27 @@
+#include "EngineSweep.h"
+#include "common.h"
+
+//build yolov5 across precision, max batch, workspace and batch profiles, keep the pareto front in a manifest.
+//detectors with config.engineManifest set to it then load the best engine of this gpu without further options.
+int main_engine_sweep()
+{
+	SweepOptions options;
+	options.backend = "tensorrt";
+	options.onnxModel = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\pytorch_onnx_tensorrt_yolov5\\yolov5x.sim.onnx";
+	options.engineDir = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\pytorch_onnx_tensorrt_yolov5\\sweep";
+	options.manifestFile = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\pytorch_onnx_tensorrt_yolov5\\yolov5x.sweep";
+	options.calibrationImageDir = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\darknet_onnx_tensorrt_yolo\\image\\";
+	options.calibrationWidth = 640;
+	options.calibrationHeight = 640;
+	//contextPoolSize, halfIO, inputPrologue and customOutput of the detector config, entries of other values are not picked
+	options.maxContexts = 3;
+	options.halfIO = false;
+	options.iterations = 50;
+	SweepGrid grid;
+	grid.modes = { 0, 1, 2 };
+	grid.maxBatchSizes = { 1, 4 };
+	grid.workspaceSizes = { size_t(10) << 20, size_t(256) << 20, size_t(1) << 30 };
+	grid.batchProfiles = { {}, { 1, 4 } };
+	std::vector<SweepResult> results = SweepEngines(options, grid);
+	return ParetoFront(results).empty() ? 1 : 0;
+}
@@ -1,8 +1,15 @@
 #include <iostream>
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <cuda_runtime.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "common.h"
 #include "class_timer.hpp"
 using BatchResult = std::vector<cv::Mat>;
@@ -21,9 +28,13 @@ public:
 	uint32_t m_InputC;
 	uint32_t m_InputSize;
 	uint32_t m_BatchSize = 1;
-	cudaStream_t mCudaStream;
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
+	std::shared_ptr<InferBackend> onnx_net;
 	std::vector<std::string> m_ClassNames;
+	std::string m_InputBlobName;
+	bool m_PackedInput = false;
 	std::vector<TensorInfo> m_OutputTensors;
 	float CONF_THRESH = 0.6;
 	LabelNameColorMap ncp;
@@ -36,25 +47,32 @@ public:
 
 	UnetParser::~UnetParser()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
 		m_ClassNames.clear();
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 
 	void UnetParser::UpdateOutputTensor()
 	{
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_PackedInput = onnx_net->GetBindingDataType(inputIndex) == TensorType::kINT8;
+		//int8 input of SetInputPrologue is NHWC
+		int spatialAxis = m_PackedInput ? 1 : 2;
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[spatialAxis];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[spatialAxis + 1];
+		for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
 		{
+			if (onnx_net->BindingIsInput(m_yolo_ind))
+			{
+				continue;
+			}
 			TensorInfo outputTensor;
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float);
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			outputTensor.volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float);
+			outputTensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
 			m_OutputTensors.push_back(outputTensor);
 		}
 	}
@@ -63,23 +81,30 @@ public:
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize /** sizeof(float)*/);
 		}
 	}
 
-	void UnetParser::doInference(std::vector<float> input, const uint32_t batchSize)
+	void UnetParser::doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
+	}
+
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool UnetParser::enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
 	std::vector<float> UnetParser::postprocess(std::vector<float> buffer)
@@ -133,8 +158,20 @@ public:
 	void UnetParser::init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetInputPrologue(config.inputPrologue);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
@@ -143,38 +180,49 @@ public:
 		//todo:
 		this->ncp = config.ncp;
 		this->CONF_THRESH = config.conf_thresh;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void UnetParser::detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	void UnetParser::preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
 	{
-		vec_batch_result.clear();
-		vec_batch_result.resize(vec_image.size());
-		std::vector<float> data;
-		for (const auto& img : vec_image)
+		if (m_PackedInput)
 		{
-			cv::Mat resized, imgf;
-			cv::resize(img, resized, cv::Size(m_InputH, m_InputW));
-			resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-
-			//BGRBGRBGR->BBBGGGRRR
-			data.insert(data.end(), ptr1, ptr1 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr2, ptr2 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr3, ptr3 + m_InputH * m_InputW);
+			//raw BGR bytes minus 128, the engine normalizes them and transposes to NCHW
+			int8_t* pixels = context.HostTensor<int8_t>(m_InputBlobName).data();
+			//resized into the scratch of the context, allocated on the first call only
+			void* scratch = context.GetScratch(static_cast<size_t>(m_InputW) * m_InputH * 3);
+			for (const auto& img : vec_image)
+			{
+				pixels = LetterboxTransform::Stretch(img.size(), cv::Size(m_InputW, m_InputH)).Pack(img, pixels, scratch);
+			}
+			return;
 		}
-		doInference(data, vec_image.size());
-
-
+		float* data = context.GetInputBuffer().data();
+		PreprocessParams params = PreprocessParams::Scaled(cv::Size(m_InputW, m_InputH), 1 / 255.0);
+		//resize, /255 and BGRBGRBGR->BBBGGGRRR in one pass, straight into the staging buffer, every image into
+		//its own slot, split over the preprocess pool threads
+		PreprocessBatch(vec_image, params, data, _config.preprocessThreads);
+	}
 
+	void UnetParser::decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		vec_batch_result.clear();
+		vec_batch_result.resize(vec_image.size());
 		for (int i = 0; i < vec_image.size(); i++)
 		{
 			float max_conf = 0.0;
@@ -184,7 +232,9 @@ public:
 			for (auto& tensor : m_OutputTensors)
 			{
 				//ͨ趨ֵн
-				int m_classes = tensor.hostBuffer.size() / (m_InputW * m_InputH);
+				TensorView<float> view = context.HostTensor<float>(tensor.blobName).Batch(i);
+				const float* output = view.data();
+				int m_classes = view.volume() / (m_InputW * m_InputH);
 				m_Detection.mask.resize(m_InputW * m_InputH * 1);   //ǩͼ
 				for (int i = 0; i < m_InputW * m_InputH; i++)
 				{
@@ -192,10 +242,10 @@ public:
 					m_Detection.mask[i] = 0;
 					for (int c = 1; c < m_classes; ++c)
 					{
-						float pixel = sigmoid(*(tensor.hostBuffer.data() + i + m_InputW * m_InputH * c));
-						if ((*(tensor.hostBuffer.data() + i + m_InputW * m_InputH * c) >= max_pixel_value) && pixel >= CONF_THRESH)
+						float pixel = sigmoid(*(output + i + m_InputW * m_InputH * c));
+						if ((*(output + i + m_InputW * m_InputH * c) >= max_pixel_value) && pixel >= CONF_THRESH)
 						{
-							max_pixel_value = *(tensor.hostBuffer.data() + i + m_InputW * m_InputH * c);
+							max_pixel_value = *(output + i + m_InputW * m_InputH * c);
 							m_Detection.mask[i] = c;
 						}
 					}
@@ -225,6 +275,48 @@ public:
 			vec_batch_result[i].push_back(mask_mat_rgb);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool UnetParser::isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile UnetParser::layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void UnetParser::detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		doInference(*context, vec_image.size());
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decoding runs on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> UnetParser::detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_unet()
@@ -262,6 +354,7 @@ int main_unet()
 	m_config.ncp["train"] = ColorPoint{ 128, 192, 0 };
 	//ncp["tvmonitor"] = ColorPoint{ 0, 64, 128 };
 
+	m_config.warmupIterations = 2;
 	m_Unet.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -281,10 +374,8 @@ int main_unet()
 		m_Unet.detect(batch_img, batch_res);
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << " time:" << all_time << " ms" << std::endl;
 	std::cout << "1 time:" << all_time / m << " ms" << std::endl;
@@ -4,10 +4,11 @@
 #include <vector>
 #include <iostream>
 #include "NvInfer.h"
+#include "PluginDescription.h"
 
 namespace nvinfer1
 {
-    class Yolo : public IPluginV2IOExt
+    class Yolo : public IPluginV2IOExt, public PluginDescription
     {
     public:
         explicit Yolo();
@@ -44,6 +45,11 @@ namespace nvinfer1
 
         const char* getPluginVersion() const override;
 
+        std::string Describe() const override {
+            return "classes" + std::to_string(numclass_) + " anchors" + std::to_string(numanchors_) + " grid "
+                   + std::to_string(_n_grid_w) + "x" + std::to_string(_n_grid_h);
+        }
+
         void destroy() override;
 
         IPluginV2IOExt* clone() const override;
@@ -1,8 +1,15 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "class_timer.hpp"
 struct YoloResult
 {
@@ -14,7 +21,7 @@ typedef std::vector<YoloResult> BatchResult;
 class YoloDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -24,9 +31,13 @@ public:
 	float m_NMSThresh = 0.2;
 	int _n_yolo_ind = 0;
 	std::vector<std::string> m_ClassNames;
+	std::string m_InputBlobName;
+	bool m_PackedInput = false;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 public:
 	YoloDectector::YoloDectector()
@@ -35,15 +46,12 @@ public:
 	}
 	YoloDectector::~YoloDectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
 		m_ClassNames.clear();
-		for (int i = 0; i < m_OutputTensors.size();i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 	const std::vector<int> m_ClassIds{
 		1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17, 18, 19, 20, 21,
@@ -81,9 +89,9 @@ public:
 		return b;
 	}
 
+	//box in input pixels, decodeDetections maps it to the image
 	inline void add_bbox_proposal(const float bx, const float by, const float bw, const float bh,
-		const uint32_t stride_h_, const uint32_t stride_w_, const float scaleH, const float scaleW, const float xoffset_, const float yoffset, const int maxIndex, const float maxProb,
-		const uint32_t 	image_w, const uint32_t image_h,
+		const uint32_t stride_h_, const uint32_t stride_w_, const int maxIndex, const float maxProb,
 		std::vector<BBoxInfo>& binfo)
 	{
 		BBoxInfo bbi;
@@ -92,13 +100,6 @@ public:
 		{
 			return;
 		}
-		else
-		{
-			bbi.box.x1 = ((float)bbi.box.x1 / (float)m_InputW) * (float)image_w;
-			bbi.box.y1 = ((float)bbi.box.y1 / (float)m_InputH) * (float)image_h;
-			bbi.box.x2 = ((float)bbi.box.x2 / (float)m_InputW) * (float)image_w;
-			bbi.box.y2 = ((float)bbi.box.y2 / (float)m_InputH) * (float)image_h;
-		}
 
 		bbi.label = maxIndex;
 		bbi.prob = maxProb;
@@ -106,17 +107,11 @@ public:
 		binfo.push_back(bbi);
 	};
 
-	std::vector<BBoxInfo> decodeTensor(const int imageIdx,
-		const int imageH,
-		const int imageW,
-		const TensorInfo& tensor)
+	std::vector<BBoxInfo> decodeTensor(InferContext& context, const int imageIdx, const TensorInfo& tensor)
 	{
-		float	scale_h = 1.f;
-		float	scale_w = 1.f;
-		int	xOffset = 0;
-		int yOffset = 0;
-
-		const float* detections = &tensor.hostBuffer[imageIdx * tensor.volume];
+		TensorView<float> output = context.HostTensor<float>(tensor.blobName);
+		assert(!output.empty() && "Invalid output binding");
+		const float* detections = output.Batch(imageIdx).data();
 
 		std::vector<BBoxInfo> binfo;
 		for (uint32_t y = 0; y < tensor.grid_h; ++y)
@@ -162,7 +157,7 @@ public:
 
 					if (maxProb > conf_thresh)//m_ProbThresh
 					{
-						add_bbox_proposal(bx, by, bw, bh, tensor.stride_h, tensor.stride_w, scale_h, scale_w, xOffset, yOffset, maxIndex, maxProb, imageW, imageH, binfo);
+						add_bbox_proposal(bx, by, bw, bh, tensor.stride_h, tensor.stride_w, maxIndex, maxProb, binfo);
 					}
 				}
 			}
@@ -170,17 +165,17 @@ public:
 		return binfo;
 	}
 
-	std::vector<BBoxInfo> decodeDetections(const int& imageIdx,
-		const int& imageH,
-		const int& imageW)
+	std::vector<BBoxInfo> decodeDetections(InferContext& context, const int& imageIdx, const LetterboxTransform& transform)
 	{
 		//	Timer timer;
 		std::vector<BBoxInfo> binfo;
 		for (auto& tensor : m_OutputTensors)
 		{
-			std::vector<BBoxInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, tensor);
+			std::vector<BBoxInfo> curBInfo = decodeTensor(context, imageIdx, tensor);
 			binfo.insert(binfo.end(), curBInfo.begin(), curBInfo.end());
 		}
+		//input pixels to image pixels, the exact inverse of the preprocessing
+		transform.ToImage(binfo);
 		//	timer.out("decodeDetections");
 		return binfo;
 	}
@@ -460,7 +455,7 @@ public:
 					}
 				}
 
-				//outputTensor.blobName = onnx_net->mBindingName[_n_yolo_ind + 1];
+				//outputTensor.blobName = onnx_net->GetBindingName(_n_yolo_ind + 1);
 				outputTensor.gridSize = (m_InputH / 32) * pow(2, _n_yolo_ind);
 				outputTensor.grid_h = (m_InputH / 32) * pow(2, _n_yolo_ind);
 				outputTensor.grid_w = (m_InputW / 32) * pow(2, _n_yolo_ind);
@@ -483,11 +478,27 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		int m_yolo_ind = 1;
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_PackedInput = onnx_net->GetBindingDataType(inputIndex) == TensorType::kINT8;
+		//bind every yolo layer of the cfg to the output with its volume, the export may order heads differently
+		std::vector<bool> bound(onnx_net->GetNbBindings(), false);
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.blobName = onnx_net->mBindingName[m_yolo_ind];
-			m_yolo_ind++;
+			for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
+			{
+				TensorDims dims = onnx_net->GetBindingDims(m_yolo_ind);
+				uint64_t volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / dims.d[0];
+				if (bound[m_yolo_ind] || onnx_net->BindingIsInput(m_yolo_ind) || volume != tensor.volume)
+				{
+					continue;
+				}
+				tensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
+				bound[m_yolo_ind] = true;
+				break;
+			}
+			assert(!tensor.blobName.empty() && "No output binding matches yolo layer");
 		}
 	}
 
@@ -495,9 +506,8 @@ public:
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -514,11 +524,23 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		//cfgʼ
 		m_configBlocks = parseConfigFile(config.cfgFile);
 		parseConfigBlocks();
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetInputPrologue(config.inputPrologue);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
 		if (config.mode == 2)
@@ -526,51 +548,80 @@ public:
 			isInt8(config.calibration_image_list_file);
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
+	}
+
+	void doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	//where an image sits in the input, preprocess and decodeOutputs build the same one so boxes map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
 	{
-		vec_batch_result.clear();
-		vec_batch_result.reserve(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
+		return LetterboxTransform::Fit(img.size(), cv::Size(m_InputW, m_InputH), _config.letterbox);
+	}
+
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		if (m_PackedInput)
 		{
-			cv::Mat resized, imgf;
-			cv::resize(img, resized, cv::Size(m_InputH, m_InputW));
-			resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr2, ptr2 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr3, ptr3 + m_InputH * m_InputW);
+			//raw BGR bytes minus 128, the engine normalizes them and transposes to NCHW
+			int8_t* pixels = context.HostTensor<int8_t>(m_InputBlobName).data();
+			//resized into the scratch of the context, allocated on the first call only
+			void* scratch = context.GetScratch(static_cast<size_t>(m_InputW) * m_InputH * 3);
+			for (const auto& img : vec_image)
+			{
+				pixels = inputTransform(img).Pack(img, pixels, scratch);
+			}
+			return;
 		}
-		doInference(data, vec_image.size());
+		float* data = context.GetInputBuffer().data();
+		PreprocessParams params = PreprocessParams::Scaled(cv::Size(m_InputW, m_InputH), 1 / 255.0);
+		//resize or letterbox, /255 and BGRBGRBGR->BBBGGGRRR in one pass, straight into the staging buffer, every
+		//image into its own slot, split over the preprocess pool threads
+		PreprocessBatch(vec_image, [&](int i) { return inputTransform(vec_image[i]).Apply(params); }, data, _config.preprocessThreads);
+	}
+
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		vec_batch_result.clear();
+		vec_batch_result.reserve(vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, inputTransform(curImage));
 			auto remaining = nmsAllClasses(getNMSThresh(),
 				binfo,
 				getNumClasses(),
@@ -596,6 +647,48 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		doInference(*context, vec_image.size());
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main()
@@ -610,6 +703,7 @@ int main()
 	m_config.mode = 0;
 	m_config.conf_thresh = 0.4;
 	m_config.m_NMSThresh = 0.2;
+	m_config.warmupIterations = 2;
 	m_YoloDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -634,10 +728,8 @@ int main()
 		//double t = timer.elapsed();
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << " time:" << all_time << " ms" << std::endl;
 	std::cout << "1 time:" << (all_time / m / batch_img.size()) << " ms" << std::endl;
@@ -4,10 +4,11 @@
 #include <vector>
 #include <iostream>
 #include "NvInfer.h"
+#include "PluginDescription.h"
 
 namespace nvinfer1
 {
-    class YoloDynamic : public IPluginV2DynamicExt
+    class YoloDynamic : public IPluginV2DynamicExt, public PluginDescription
     {
     public:
         explicit YoloDynamic();
@@ -38,6 +39,11 @@ namespace nvinfer1
 
         const char* getPluginVersion() const override;
 
+        std::string Describe() const override {
+            return "classes" + std::to_string(numclass_) + " anchors" + std::to_string(numanchors_) + " grid "
+                   + std::to_string(_n_grid_w) + "x" + std::to_string(_n_grid_h);
+        }
+
         void destroy() override;
 
         IPluginV2DynamicExt* clone() const override;
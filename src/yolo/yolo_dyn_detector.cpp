@@ -1,8 +1,14 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
 struct Result
 {
 	int		 id = -1;
@@ -13,7 +19,7 @@ typedef std::vector<Result> BatchResult;
 class YoloDynamicDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -22,13 +28,14 @@ public:
 	float m_NMSThresh = 0.2;
 	int _n_yolo_ind = 0;
 	std::vector<std::string> m_ClassNames;
+	std::string m_InputBlobName;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 
-	uint32_t m_Ori_InputH;
-	uint32_t m_Ori_InputW;
 public:
 	YoloDynamicDectector::YoloDynamicDectector()
 	{
@@ -36,15 +43,12 @@ public:
 	}
 	YoloDynamicDectector::~YoloDynamicDectector()
 	{
+		//finish pending detectAsync_dyn calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
 		m_ClassNames.clear();
-		for (int i = 0; i < m_OutputTensors.size();i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 	const std::vector<int> m_ClassIds{
 		1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17, 18, 19, 20, 21,
@@ -107,7 +111,7 @@ public:
 		binfo.push_back(bbi);
 	};
 
-	std::vector<BBoxInfo> decodeTensor(const int imageIdx,
+	std::vector<BBoxInfo> decodeTensor(InferContext& context, const int imageIdx,
 		const int imageH,
 		const int imageW,
 		const TensorInfo& tensor)
@@ -117,7 +121,9 @@ public:
 		int	xOffset = 0;
 		int yOffset = 0;
 
-		const float* detections = &tensor.hostBuffer[imageIdx * tensor.volume];
+		TensorView<float> output = context.HostTensor<float>(tensor.blobName);
+		assert(!output.empty() && "Invalid output binding");
+		const float* detections = output.Batch(imageIdx).data();
 
 		std::vector<BBoxInfo> binfo;
 		for (uint32_t y = 0; y < tensor.grid_h; ++y)
@@ -171,7 +177,7 @@ public:
 		return binfo;
 	}
 
-	std::vector<BBoxInfo> decodeDetections(const int& imageIdx,
+	std::vector<BBoxInfo> decodeDetections(InferContext& context, const int& imageIdx,
 		const int& imageH,
 		const int& imageW)
 	{
@@ -179,7 +185,7 @@ public:
 		std::vector<BBoxInfo> binfo;
 		for (auto& tensor : m_OutputTensors)
 		{
-			std::vector<BBoxInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, tensor);
+			std::vector<BBoxInfo> curBInfo = decodeTensor(context, imageIdx, imageH, imageW, tensor);
 			binfo.insert(binfo.end(), curBInfo.begin(), curBInfo.end());
 		}
 		//	timer.out("decodeDetections");
@@ -461,7 +467,7 @@ public:
 					}
 				}
 
-				//outputTensor.blobName = onnx_net->mBindingName[_n_yolo_ind + 1];
+				//outputTensor.blobName = onnx_net->GetBindingName(_n_yolo_ind + 1);
 				outputTensor.gridSize = (m_InputH / 32) * pow(2, _n_yolo_ind);
 				outputTensor.grid_h = (m_InputH / 32) * pow(2, _n_yolo_ind);
 				outputTensor.grid_w = (m_InputW / 32) * pow(2, _n_yolo_ind);
@@ -484,11 +490,26 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		int m_yolo_ind = 1;
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		//bind every yolo layer of the cfg to the output with its volume, the export may order heads differently
+		std::vector<bool> bound(onnx_net->GetNbBindings(), false);
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.blobName = onnx_net->mBindingName[m_yolo_ind];
-			m_yolo_ind++;
+			for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
+			{
+				TensorDims dims = onnx_net->GetBindingDims(m_yolo_ind);
+				uint64_t volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / dims.d[0];
+				if (bound[m_yolo_ind] || onnx_net->BindingIsInput(m_yolo_ind) || volume != tensor.volume)
+				{
+					continue;
+				}
+				tensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
+				bound[m_yolo_ind] = true;
+				break;
+			}
+			assert(!tensor.blobName.empty() && "No output binding matches yolo layer");
 		}
 	}
 
@@ -496,9 +517,8 @@ public:
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -515,11 +535,21 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		//cfgʼ
 		m_configBlocks = parseConfigFile(config.cfgFile);
 		parseConfigBlocks();
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file);
@@ -527,80 +557,80 @@ public:
 		bool m_dyn_flag = true;
 		if (m_dyn_flag)
 		{
-			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,512,512 }, { 3,800,800 });
+			//one profile per resolution bucket, frames run on the smallest one that fits
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,416,416 }, { 3,512,512 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,608,608 }, { 3,640,640 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,800,800 }, { 3,800,800 });
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		onnx_net->buildPreprocessorEngine();
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync_dyn(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference_dyn(std::vector<float> input, const uint32_t batchSize)
+	void doInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
 	{
-		nvinfer1::Dims inputdim = onnx_net->mEngine->getBindingDimensions(0); // C*H*W
-		void* hostBuffer;
-		cudaMalloc(&hostBuffer, input.size() * sizeof(float));
-		CUDA_CHECK(cudaMemcpy(hostBuffer, input.data(), input.size() * sizeof(float), cudaMemcpyHostToDevice));
+		if (enqueueInference_dyn(context, batchSize, imageSize))
+		{
+			context.Synchronize();
+		}
+	}
+
+	// resize, inference and output copy are queued on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
+	{
+		if (!context.SetBatchSize(batchSize))
+		{
+			return false;
+		}
 
 		// Set the input size for the preprocessor
-		nvinfer1::Dims inputDims_1;
+		TensorDims inputDims_1;
 		inputDims_1.nbDims = 4;
 		inputDims_1.d[0] = batchSize;
 		inputDims_1.d[1] = m_InputC;
-		inputDims_1.d[2] = m_Ori_InputH;
-		inputDims_1.d[3] = m_Ori_InputW;
-		//CHECK_RETURN_W_MSG(onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims), false, "Invalid binding dimensions.");
-		onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims_1);
-		// We can only run inference once all dynamic input shapes have been specified.
-		if (!onnx_net->mPreprocessorContext->allInputDimensionsSpecified())
+		inputDims_1.d[2] = imageSize.height;
+		inputDims_1.d[3] = imageSize.width;
+		if (!context.ForwardPreprocessor(inputDims_1))
 		{
-			return;
+			return false;
 		}
+		context.ForwardAsync();
+		context.CopyOutputsFromDeviceToHost();
+		return true;
+	}
 
-		std::vector<void*> preprocessorBindings = { hostBuffer, onnx_net->GetBindingPtr(0) };
-		bool status = onnx_net->mPreprocessorContext->executeV2(preprocessorBindings.data());
-		if (!status)
-		{
-			return;
-		}
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
-		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
-		}
-		cudaStreamSynchronize(mCudaStream);
+	//frames of a batch share one size, written in place into the pinned preprocessor staging of the context
+	void prepareInput_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		size_t imageSize = vec_image[0].total() * 3;
+		float* data = context.GetPreprocessorInput(imageSize * vec_image.size());
+		//the preprocessor engine resizes on the gpu, /255 and BGRBGRBGR->BBBGGGRRR in one pass here
+		PreprocessBatch(vec_image, PreprocessParams::Scaled(vec_image[0].size(), 1 / 255.0), data, _config.preprocessThreads);
 	}
 
-	void detect_dyn(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	void decodeOutputs_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
-		m_Ori_InputW = vec_image[0].cols;
-		m_Ori_InputH = vec_image[0].rows;
-		m_InputC = vec_image[0].channels();
 		vec_batch_result.clear();
 		vec_batch_result.resize(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
-		{
-			cv::Mat imgf;
-			img.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + img.rows * img.cols);
-			data.insert(data.end(), ptr2, ptr2 + img.rows * img.cols);
-			data.insert(data.end(), ptr3, ptr3 + img.rows * img.cols);
-		}
-		doInference_dyn(data, vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, curImage.rows, curImage.cols);
 			auto remaining = nmsAllClasses(getNMSThresh(),
 				binfo,
 				getNumClasses(),
@@ -625,6 +655,45 @@ public:
 			vec_batch_result[i] = vec_result;
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect_dyn(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		doInference_dyn(*context, vec_image.size(), vec_image[0].size());
+		decodeOutputs_dyn(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect_dyn, decode and nms run on m_Worker, the result is handed out through the future and callback
+	std::future<std::vector<BatchResult>> detectAsync_dyn(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		if (!enqueueInference_dyn(*context, vec_image.size(), vec_image[0].size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs_dyn(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_YoloDynamicDectector()
@@ -637,6 +706,7 @@ int main_YoloDynamicDectector()
 	m_config.calibration_image_list_file = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\darknet_onnx_tensorrt_yolo\\image\\";
 	m_config.maxBatchSize = 1;
 	m_config.mode = 0;
+	m_config.warmupIterations = 2;
 	m_YoloDynamicDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
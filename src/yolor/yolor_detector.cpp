@@ -1,8 +1,15 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
 #include "class_timer.hpp"
 struct YolorResult
 {
@@ -14,7 +21,7 @@ typedef std::vector<YolorResult> BatchResult;
 class YolorDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -24,9 +31,13 @@ public:
 	float conf_thresh = 0.4;
 	float m_NMSThresh = 0.2;
 	int _n_yolo_ind = 0;
+	std::string m_InputBlobName;
+	bool m_PackedInput = false;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 	std::vector<float> vec_anchors = { 12, 16, 19, 36, 40, 28, 36, 75, 76, 55, 72, 146, 142, 110, 192, 243, 459, 401 };
 	std::vector<float> vec_stride = { 8,16,32 };
@@ -37,14 +48,11 @@ public:
 	}
 	YolorDectector::~YolorDectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
-		for (int i = 0; i < m_OutputTensors.size(); i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 	const std::vector<int> m_ClassIds{
 		1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17, 18, 19, 20, 21,
@@ -107,34 +115,15 @@ public:
 		binfo.push_back(bbi);
 	};
 
-	void calcuate_letterbox_message(const int m_InputH, const int m_InputW,
-		const int imageH, const int imageW,
-		float& sh, float& sw,
-		int& xOffset, int& yOffset)
-	{
-		float dim = std::max(imageW, imageH);
-		int resizeH = ((imageH / dim) * m_InputH);
-		int resizeW = ((imageW / dim) * m_InputW);
-		sh = static_cast<float>(resizeH) / static_cast<float>(imageH);
-		sw = static_cast<float>(resizeW) / static_cast<float>(imageW);
-		if ((m_InputW - resizeW) % 2) resizeW--;
-		if ((m_InputH - resizeH) % 2) resizeH--;
-		assert((m_InputW - resizeW) % 2 == 0);
-		assert((m_InputH - resizeH) % 2 == 0);
-		xOffset = (m_InputW - resizeW) / 2;
-		yOffset = (m_InputH - resizeH) / 2;
-	}
-
-	std::vector<BBoxInfo> decodeTensor(const int imageIdx,
-		const int imageH,
-		const int imageW,
-		const int m_tensor_i)
+	std::vector<BBoxInfo> decodeTensor(InferContext& context, const int imageIdx, const int m_tensor_i)
 	{
-		auto tensor = m_OutputTensors[m_tensor_i];
-		float* detections = tensor.hostBuffer.data() + imageIdx * tensor.volume;
+		const TensorInfo& tensor = m_OutputTensors[m_tensor_i];
+		TensorView<float> output = context.HostTensor<float>(tensor.blobName);
+		assert(!output.empty() && "Invalid output binding");
+		const float* detections = output.Batch(imageIdx).data();
 		std::vector<BBoxInfo> binfo;
 		int position = 0;
-		for (int i = 0; i < tensor.hostBuffer.size() / (m_Classes + 5); i++)
+		for (int i = 0; i < tensor.volume / (m_Classes + 5); i++)
 		{
 			float* row = detections + position * (m_Classes + 5);
 			position++;
@@ -145,29 +134,30 @@ public:
 				continue;
 			box.classId = max_pos - row - 5;
 			box.label = max_pos - row - 5;
-			int center_x = row[0];
-			int center_y = row[1];
-			int center_w = row[2];
-			int center_h = row[3];
-			box.box.x1 = double(center_x - center_w / 2) / m_InputW * imageW;
-			box.box.x2 = double(center_x + center_w / 2) / m_InputW * imageW;
-			box.box.y1 = double(center_y - center_h / 2) / m_InputH * imageH;
-			box.box.y2 = double(center_y + center_h / 2) / m_InputH * imageH;
+			//input pixels, kept fractional so the mapping back to the image does not scale a rounding error
+			float center_x = row[0];
+			float center_y = row[1];
+			float center_w = row[2];
+			float center_h = row[3];
+			box.box.x1 = center_x - center_w / 2;
+			box.box.x2 = center_x + center_w / 2;
+			box.box.y1 = center_y - center_h / 2;
+			box.box.y2 = center_y + center_h / 2;
 			binfo.push_back(box);
 		}
 		return binfo;
 	}
-	std::vector<BBoxInfo> decodeDetections(const int& imageIdx,
-		const int& imageH,
-		const int& imageW)
+	std::vector<BBoxInfo> decodeDetections(InferContext& context, const int& imageIdx, const LetterboxTransform& transform)
 	{
 		//	Timer timer;
 		std::vector<BBoxInfo> binfo;
 		for (int m_tensor_i = 0; m_tensor_i < m_OutputTensors.size(); m_tensor_i++)
 		{
-			std::vector<BBoxInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, m_tensor_i);
+			std::vector<BBoxInfo> curBInfo = decodeTensor(context, imageIdx, m_tensor_i);
 			binfo.insert(binfo.end(), curBInfo.begin(), curBInfo.end());
 		}
+		//input pixels to image pixels, the exact inverse of the preprocessing
+		transform.ToImage(binfo);
 		//	timer.out("decodeDetections");
 		return binfo;
 	}
@@ -316,27 +306,37 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputC = onnx_net->mBindingDims[0].d[1];
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[2] - 5;
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_PackedInput = onnx_net->GetBindingDataType(inputIndex) == TensorType::kINT8;
+		m_InputC = onnx_net->GetBindingDims(inputIndex).d[m_PackedInput ? 3 : 1];
+		//int8 input of SetInputPrologue is NHWC
+		int spatialAxis = m_PackedInput ? 1 : 2;
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[spatialAxis];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[spatialAxis + 1];
+		for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
 		{
+			if (onnx_net->BindingIsInput(m_yolo_ind))
+			{
+				continue;
+			}
 			TensorInfo outputTensor;
 			outputTensor.anchors = vec_anchors;
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float) / onnx_net->mBindingDims[m_yolo_ind].d[0];
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			outputTensor.volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / onnx_net->GetBindingDims(m_yolo_ind).d[0];
+			outputTensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
 			m_OutputTensors.push_back(outputTensor);
 		}
+		assert(!m_OutputTensors.empty() && "No output binding");
+		m_Classes = onnx_net->GetBindingDims(onnx_net->GetBindingIndex(m_OutputTensors[0].blobName)).d[2] - 5;
 	}
 
 	void allocateBuffers()
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -353,8 +353,20 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetInputPrologue(config.inputPrologue);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
 		if (config.mode == 2)
@@ -362,52 +374,80 @@ public:
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
+	}
+
+	void doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	//where an image sits in the input, preprocess and decodeOutputs build the same one so boxes map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
 	{
-		vec_batch_result.clear();
-		vec_batch_result.reserve(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
+		return LetterboxTransform::Fit(img.size(), cv::Size(m_InputW, m_InputH), _config.letterbox);
+	}
+
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		if (m_PackedInput)
 		{
-			cv::Mat resized, imgf;
-			cv::resize(img, resized, cv::Size(m_InputH, m_InputW));
-			resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr2, ptr2 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr3, ptr3 + m_InputH * m_InputW);
+			//raw BGR bytes minus 128, the engine normalizes them and transposes to NCHW
+			int8_t* pixels = context.HostTensor<int8_t>(m_InputBlobName).data();
+			//resized into the scratch of the context, allocated on the first call only
+			void* scratch = context.GetScratch(static_cast<size_t>(m_InputW) * m_InputH * 3);
+			for (const auto& img : vec_image)
+			{
+				pixels = inputTransform(img).Pack(img, pixels, scratch);
+			}
+			return;
 		}
+		float* data = context.GetInputBuffer().data();
+		PreprocessParams params = PreprocessParams::Scaled(cv::Size(m_InputW, m_InputH), 1 / 255.0);
+		//resize or letterbox, /255 and BGRBGRBGR->BBBGGGRRR in one pass, straight into the staging buffer, every
+		//image into its own slot, split over the preprocess pool threads
+		PreprocessBatch(vec_image, [&](int i) { return inputTransform(vec_image[i]).Apply(params); }, data, _config.preprocessThreads);
+	}
 
-		doInference(data, vec_image.size());
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		vec_batch_result.clear();
+		vec_batch_result.reserve(vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, inputTransform(curImage));
 			auto remaining = nmsAllClasses(getNMSThresh(),
 				binfo,
 				m_Classes,
@@ -432,6 +472,48 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		doInference(*context, vec_image.size());
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_yolor()
@@ -447,6 +529,7 @@ int main_yolor()
 	m_config.calibration_height = 512;
 	m_config.conf_thresh = 0.5;
 	m_config.m_NMSThresh = 0.2;
+	m_config.warmupIterations = 2;
 	m_YolorDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -471,10 +554,8 @@ int main_yolor()
 		//double t = timer.elapsed();
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << " time:" << all_time << " ms" << std::endl;
 	std::cout << "1 time:" << all_time / m << " ms" << std::endl;
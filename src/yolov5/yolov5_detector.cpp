@@ -1,8 +1,16 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
+#include "Letterbox.h"
+#include "DetectPipeline.h"
 #include "class_timer.hpp"
 struct Yolov5Result
 {
@@ -14,7 +22,7 @@ typedef std::vector<Yolov5Result> BatchResult;
 class Yolov5Dectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -24,9 +32,13 @@ public:
 	float m_NMSThresh = 0.2;
 	float conf_thresh = 0.5;
 	int _n_yolo_ind = 0;
+	std::string m_InputBlobName;
+	bool m_PackedInput = false;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 	std::vector<float> vec_anchors = { 10, 13, 16, 30, 33, 23, 30, 61, 62, 45, 59, 119, 116, 90, 156, 198, 373, 326 };
 public:
@@ -36,14 +48,11 @@ public:
 	}
 	Yolov5Dectector::~Yolov5Dectector()
 	{
+		//finish pending detectAsync calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
-		for (int i = 0; i < m_OutputTensors.size();i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 	const std::vector<int> m_ClassIds{
 		1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17, 18, 19, 20, 21,
@@ -106,31 +115,27 @@ public:
 		binfo.push_back(bbi);
 	};
 
-	void calcuate_letterbox_message(const int m_InputH, const int m_InputW,
-		const int imageH, const int imageW,
-		float& sh, float& sw,
-		int& xOffset, int& yOffset)
+	static float ToFloat(float value) { return value; }
+
+	static float ToFloat(Half value) { return HalfToFloat(value); }
+
+	std::vector<BBoxInfo> decodeTensor(InferContext& context, const int imageIdx, const int m_tensor_i)
 	{
-		float dim = std::max(imageW, imageH);
-		int resizeH = ((imageH / dim) * m_InputH);
-		int resizeW = ((imageW / dim) * m_InputW);
-		sh = static_cast<float>(resizeH) / static_cast<float>(imageH);
-		sw = static_cast<float>(resizeW) / static_cast<float>(imageW);
-		if ((m_InputW - resizeW) % 2) resizeW--;
-		if ((m_InputH - resizeH) % 2) resizeH--;
-		assert((m_InputW - resizeW) % 2 == 0);
-		assert((m_InputH - resizeH) % 2 == 0);
-		xOffset = (m_InputW - resizeW) / 2;
-		yOffset = (m_InputH - resizeH) / 2;
+		const TensorInfo& tensor = m_OutputTensors[m_tensor_i];
+		//fp16 heads are read in place, only rows that pass the objectness test are converted
+		TensorView<Half> half = context.HostTensor<Half>(tensor.blobName);
+		if (!half.empty())
+		{
+			return decodeRows(half.Batch(imageIdx).data(), tensor);
+		}
+		TensorView<float> output = context.HostTensor<float>(tensor.blobName);
+		assert(!output.empty() && "Invalid output binding");
+		return decodeRows(output.Batch(imageIdx).data(), tensor);
 	}
 
-	std::vector<BBoxInfo> decodeTensor(const int imageIdx,
-		const int imageH,
-		const int imageW,
-		const int m_tensor_i)
+	template <typename T>
+	std::vector<BBoxInfo> decodeRows(const T* detections, const TensorInfo& tensor)
 	{
-		auto tensor = m_OutputTensors[m_tensor_i];
-		float* detections = tensor.hostBuffer.data() + imageIdx * tensor.volume;
 		std::vector<BBoxInfo> binfo;
 		int position = 0;
 		for (int c = 0; c < tensor.numBBoxes; c++)
@@ -141,23 +146,28 @@ public:
 			{
 				for (int w = 0; w < tensor.grid_w; w++)
 				{
-					float* row = detections + position * (m_Classes + 5);
+					const T* row = detections + position * (m_Classes + 5);
 					position++;
+					//class score is at most 1, a low objectness can not pass whatever the class
+					float objectness = Logist(ToFloat(row[4]));
+					if (objectness < conf_thresh)
+						continue;
 					BBoxInfo box;
-					auto max_pos = std::max_element(row + 5, row + m_Classes + 5);
-					box.prob = Logist(row[4]) * Logist(row[max_pos - row]);
+					auto max_pos = std::max_element(row + 5, row + m_Classes + 5, [](const T& a, const T& b) { return ToFloat(a) < ToFloat(b); });
+					box.prob = objectness * Logist(ToFloat(*max_pos));
 					if (box.prob < conf_thresh)
 						continue;
 					box.classId = max_pos - row - 5;
 					box.label = max_pos - row - 5;
-					int center_x = (Logist(row[0]) * 2 - 0.5 + w) * tensor.stride_w;
-					int center_y = (Logist(row[1]) * 2 - 0.5 + h) * tensor.stride_h;
-					int center_w = pow(Logist(row[2]) * 2.f, 2) * pw;
-					int center_h = pow(Logist(row[3]) * 2.f, 2) * ph;
-					box.box.x1 = double(center_x - center_w / 2) / m_InputW * imageW;
-					box.box.x2 = double(center_x + center_w / 2) / m_InputW * imageW;
-					box.box.y1 = double(center_y - center_h / 2) / m_InputH * imageH;
-					box.box.y2 = double(center_y + center_h / 2) / m_InputH * imageH;
+					//input pixels, kept fractional so the mapping back to the image does not scale a rounding error
+					float center_x = (Logist(ToFloat(row[0])) * 2 - 0.5f + w) * tensor.stride_w;
+					float center_y = (Logist(ToFloat(row[1])) * 2 - 0.5f + h) * tensor.stride_h;
+					float center_w = pow(Logist(ToFloat(row[2])) * 2.f, 2) * pw;
+					float center_h = pow(Logist(ToFloat(row[3])) * 2.f, 2) * ph;
+					box.box.x1 = center_x - center_w / 2;
+					box.box.x2 = center_x + center_w / 2;
+					box.box.y1 = center_y - center_h / 2;
+					box.box.y2 = center_y + center_h / 2;
 					binfo.push_back(box);
 				}
 			}
@@ -165,17 +175,17 @@ public:
 		return binfo;
 	}
 
-	std::vector<BBoxInfo> decodeDetections(const int& imageIdx,
-		const int& imageH,
-		const int& imageW)
+	std::vector<BBoxInfo> decodeDetections(InferContext& context, const int& imageIdx, const LetterboxTransform& transform)
 	{
 		//	Timer timer;
 		std::vector<BBoxInfo> binfo;
 		for (int m_tensor_i = 0; m_tensor_i< m_OutputTensors.size(); m_tensor_i++)
 		{
-			std::vector<BBoxInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, m_tensor_i);
+			std::vector<BBoxInfo> curBInfo = decodeTensor(context, imageIdx, m_tensor_i);
 			binfo.insert(binfo.end(), curBInfo.begin(), curBInfo.end());
 		}
+		//input pixels to image pixels, the exact inverse of the preprocessing
+		transform.ToImage(binfo);
 		//	timer.out("decodeDetections");
 		return binfo;
 	}
@@ -324,36 +334,52 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[4] - 5;
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_PackedInput = onnx_net->GetBindingDataType(inputIndex) == TensorType::kINT8;
+		//int8 input of SetInputPrologue is NHWC
+		int spatialAxis = m_PackedInput ? 1 : 2;
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[spatialAxis];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[spatialAxis + 1];
+		//yolo heads are the 5-D outputs, other outputs of the export are not decoded
+		for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
 		{
-			TensorInfo outputTensor;
-			if (m_yolo_ind < 4)
+			TensorDims dims = onnx_net->GetBindingDims(m_yolo_ind);
+			if (onnx_net->BindingIsInput(m_yolo_ind) || dims.nbDims != 5)
 			{
-				outputTensor.anchors = vec_anchors;
-				outputTensor.masks = std::vector<uint32_t>{ uint32_t(3 * (m_yolo_ind - 1)),uint32_t(3 * (m_yolo_ind - 1) + 1),uint32_t(3 * (m_yolo_ind - 1) + 2) };
-				outputTensor.numBBoxes = onnx_net->mBindingDims[m_yolo_ind].d[1];
-				outputTensor.grid_w = onnx_net->mBindingDims[m_yolo_ind].d[2];
-				outputTensor.grid_h = onnx_net->mBindingDims[m_yolo_ind].d[3];
-				outputTensor.numClasses = onnx_net->mBindingDims[m_yolo_ind].d[4] - 5;
-				outputTensor.stride_h = m_InputH / outputTensor.grid_h;
-				outputTensor.stride_w = m_InputW / outputTensor.grid_w;
+				continue;
 			}
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float) / onnx_net->mBindingDims[m_yolo_ind].d[0];
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			TensorInfo outputTensor;
+			outputTensor.anchors = vec_anchors;
+			outputTensor.numBBoxes = dims.d[1];
+			outputTensor.grid_h = dims.d[2];
+			outputTensor.grid_w = dims.d[3];
+			outputTensor.numClasses = dims.d[4] - 5;
+			outputTensor.stride_h = m_InputH / outputTensor.grid_h;
+			outputTensor.stride_w = m_InputW / outputTensor.grid_w;
+			outputTensor.volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / dims.d[0];
+			outputTensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
 			m_OutputTensors.push_back(outputTensor);
 		}
+		assert(!m_OutputTensors.empty() && "No yolo output binding");
+		//anchors go from the finest grid to the coarsest, whatever order the heads were exported in
+		std::sort(m_OutputTensors.begin(), m_OutputTensors.end(), [](const TensorInfo& a, const TensorInfo& b) {
+			return a.grid_h * a.grid_w > b.grid_h * b.grid_w;
+		});
+		for (uint32_t i = 0; i < m_OutputTensors.size(); i++)
+		{
+			m_OutputTensors[i].masks = std::vector<uint32_t>{ 3 * i, 3 * i + 1, 3 * i + 2 };
+		}
+		m_Classes = m_OutputTensors[0].numClasses;
 	}
 
 	void allocateBuffers()
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -370,8 +396,20 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
+		onnx_net->SetInputPrologue(config.inputPrologue);
+		onnx_net->SetCudaGraph(config.useCudaGraph);
 		conf_thresh = config.conf_thresh;
 		m_NMSThresh = config.m_NMSThresh;
 		if (config.mode == 2)
@@ -379,52 +417,80 @@ public:
 			isInt8(config.calibration_image_list_file, config.calibration_width, config.calibration_height);
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
+	}
+
+	void doInference(InferContext& context, const uint32_t batchSize)
+	{
+		if (enqueueInference(context, batchSize))
+		{
+			context.Synchronize();
+		}
 	}
 
-	void doInference(std::vector<float> input, const uint32_t batchSize)
+	// enqueue copies and inference on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference(InferContext& context, const uint32_t batchSize)
 	{
 		//	Timer timer;
 		assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
+		if (!context.SetBatchSize(batchSize))
 		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
+			return false;
 		}
-		cudaStreamSynchronize(mCudaStream);
+		context.InferAsync();
+		return true;
 	}
 
-	void detect(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	//where an image sits in the input, preprocess and decodeOutputs build the same one so boxes map back exactly
+	LetterboxTransform inputTransform(const cv::Mat& img) const
 	{
-		vec_batch_result.clear();
-		vec_batch_result.reserve(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
+		return LetterboxTransform::Fit(img.size(), cv::Size(m_InputW, m_InputH), _config.letterbox);
+	}
+
+	void preprocess(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		if (m_PackedInput)
 		{
-			cv::Mat resized, imgf;
-			cv::resize(img, resized, cv::Size(m_InputH, m_InputW));
-			resized.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr2, ptr2 + m_InputH * m_InputW);
-			data.insert(data.end(), ptr3, ptr3 + m_InputH * m_InputW);
+			//raw BGR bytes minus 128, the engine normalizes them and transposes to NCHW
+			int8_t* pixels = context.HostTensor<int8_t>(m_InputBlobName).data();
+			//resized into the scratch of the context, allocated on the first call only
+			void* scratch = context.GetScratch(static_cast<size_t>(m_InputW) * m_InputH * 3);
+			for (const auto& img : vec_image)
+			{
+				pixels = inputTransform(img).Pack(img, pixels, scratch);
+			}
+			return;
 		}
+		float* data = context.GetInputBuffer().data();
+		PreprocessParams params = PreprocessParams::Scaled(cv::Size(m_InputW, m_InputH), 1 / 255.0);
+		//resize or letterbox, /255 and BGRBGRBGR->BBBGGGRRR in one pass, straight into the staging buffer, every
+		//image into its own slot, split over the preprocess pool threads
+		PreprocessBatch(vec_image, [&](int i) { return inputTransform(vec_image[i]).Apply(params); }, data, _config.preprocessThreads);
+	}
 
-		doInference(data, vec_image.size());
+	void decodeOutputs(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		vec_batch_result.clear();
+		vec_batch_result.reserve(vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, inputTransform(curImage));
 			auto remaining = nmsAllClasses(getNMSThresh(),
 				binfo,
 				m_Classes,
@@ -450,6 +516,48 @@ public:
 			vec_batch_result.push_back(vec_result);
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		doInference(*context, vec_image.size());
+		decodeOutputs(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect, decode and nms run on m_Worker. callback is called on the worker thread before the
+	// future is ready, the caller only waits for a free context when all of them are in flight
+	std::future<std::vector<BatchResult>> detectAsync(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		assert(vec_image.size() <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		preprocess(*context, vec_image);
+		if (!enqueueInference(*context, vec_image.size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main_yolov5()
@@ -465,6 +573,8 @@ int main_yolov5()
 	m_config.calibration_height = 640;
 	m_config.conf_thresh = 0.5;
 	m_config.m_NMSThresh = 0.2;
+	m_config.contextPoolSize = 3;
+	m_config.warmupIterations = 2;
 	m_Yolov5Dectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;
@@ -489,14 +599,25 @@ int main_yolov5()
 		//double t = timer.elapsed();
 		double t = timer.elapsed();
 		std::cout << i << ":" << t << "ms" << std::endl;
-		if (i > 0)
-		{
-			all_time += t;
-		}
+		//warmup in init, the first iteration already runs at steady state
+		all_time += t;
 	}
 	std::cout << m << " time:" << all_time << " ms" << std::endl;
 	std::cout << "1 time:" << all_time / m << " ms" << std::endl;
 	std::cout << "FPS::" << 1000 / (all_time / m) << std::endl;
+	//pipelined, preprocess of the next batch and decode of the previous one overlap with inference
+	DetectPipeline<std::vector<BatchResult>> pipeline(m_Yolov5Dectector, m_config.contextPoolSize);
+	timer.reset();
+	for (int i = 0; i < m; i++)
+	{
+		pipeline.Push(batch_img, batch_res);
+	}
+	while (pipeline.Pop(batch_res))
+	{
+	}
+	double pipeline_time = timer.elapsed();
+	std::cout << "pipeline " << m << " time:" << pipeline_time << " ms" << std::endl;
+	std::cout << "pipeline FPS::" << 1000 / (pipeline_time / m) << std::endl;
 	//disp
 	for (int i = 0; i < batch_img.size(); ++i)
 	{
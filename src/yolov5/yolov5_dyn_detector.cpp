@@ -1,8 +1,14 @@
 #include "assert.h"
 #include <cuda_runtime.h>
 #include <opencv2/opencv.hpp>
+#include <stdexcept>
+#include <atomic>
 #include <common.h>
-#include "Trt.h"
+#include "InferBackend.h"
+#include "ContextPool.h"
+#include "AsyncWorker.h"
+#include "DetectorWarmup.h"
+#include "ImagePreprocess.h"
 struct Result
 {
 	int		 id = -1;
@@ -13,7 +19,7 @@ typedef std::vector<Result> BatchResult;
 class Yolov5DynDectector
 {
 public:
-	std::shared_ptr<Trt> onnx_net;
+	std::shared_ptr<InferBackend> onnx_net;
 	uint32_t m_InputH;
 	uint32_t m_InputW;
 	uint32_t m_InputC;
@@ -22,14 +28,15 @@ public:
 	uint32_t m_BatchSize = 1;
 	float m_NMSThresh = 0.2;
 	int _n_yolo_ind = 0;
+	std::string m_InputBlobName;
 	std::vector<TensorInfo> m_OutputTensors;
 	std::vector<std::map<std::string, std::string>> m_configBlocks;
-	cudaStream_t mCudaStream;
+	std::shared_ptr<ContextPool> m_ContextPool;
+	std::shared_ptr<AsyncWorker> m_Worker;
+	std::atomic<bool> m_Ready{ false };
 	Config _config;
 	std::vector<float> vec_anchors = { 10, 13, 16, 30, 33, 23, 30, 61, 62, 45, 59, 119, 116, 90, 156, 198, 373, 326 };
 
-	uint32_t m_Ori_InputH;
-	uint32_t m_Ori_InputW;
 public:
 	Yolov5DynDectector::Yolov5DynDectector()
 	{
@@ -37,14 +44,11 @@ public:
 	}
 	Yolov5DynDectector::~Yolov5DynDectector()
 	{
+		//finish pending detectAsync_dyn calls before the members they decode with go away
+		m_Worker.reset();
 		//ͷڴ
-		for (int i = 0; i < m_OutputTensors.size();i++)
-		{
-			m_OutputTensors[i].hostBuffer.clear();
-		}
 		m_OutputTensors.clear();
 		m_configBlocks.clear();
-		cudaStreamDestroy(mCudaStream);
 	}
 	const std::vector<int> m_ClassIds{
 		1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 13, 14, 15, 16, 17, 18, 19, 20, 21,
@@ -107,31 +111,30 @@ public:
 		binfo.push_back(bbi);
 	};
 
-	void calcuate_letterbox_message(const int m_InputH, const int m_InputW,
-		const int imageH, const int imageW,
-		float& sh, float& sw,
-		int& xOffset, int& yOffset)
-	{
-		float dim = std::max(imageW, imageH);
-		int resizeH = ((imageH / dim) * m_InputH);
-		int resizeW = ((imageW / dim) * m_InputW);
-		sh = static_cast<float>(resizeH) / static_cast<float>(imageH);
-		sw = static_cast<float>(resizeW) / static_cast<float>(imageW);
-		if ((m_InputW - resizeW) % 2) resizeW--;
-		if ((m_InputH - resizeH) % 2) resizeH--;
-		assert((m_InputW - resizeW) % 2 == 0);
-		assert((m_InputH - resizeH) % 2 == 0);
-		xOffset = (m_InputW - resizeW) / 2;
-		yOffset = (m_InputH - resizeH) / 2;
-	}
+	static float ToFloat(float value) { return value; }
 
-	std::vector<BBoxInfo> decodeTensor(const int imageIdx,
+	static float ToFloat(Half value) { return HalfToFloat(value); }
+
+	std::vector<BBoxInfo> decodeTensor(InferContext& context, const int imageIdx,
 		const int imageH,
 		const int imageW,
 		const int m_tensor_i)
 	{
-		auto tensor = m_OutputTensors[m_tensor_i];
-		float* detections = tensor.hostBuffer.data() + imageIdx * tensor.volume;
+		const TensorInfo& tensor = m_OutputTensors[m_tensor_i];
+		//fp16 heads are read in place, only rows that pass the objectness test are converted
+		TensorView<Half> half = context.HostTensor<Half>(tensor.blobName);
+		if (!half.empty())
+		{
+			return decodeRows(half.Batch(imageIdx).data(), tensor, imageH, imageW);
+		}
+		TensorView<float> output = context.HostTensor<float>(tensor.blobName);
+		assert(!output.empty() && "Invalid output binding");
+		return decodeRows(output.Batch(imageIdx).data(), tensor, imageH, imageW);
+	}
+
+	template <typename T>
+	std::vector<BBoxInfo> decodeRows(const T* detections, const TensorInfo& tensor, const int imageH, const int imageW)
+	{
 		std::vector<BBoxInfo> binfo;
 		int position = 0;
 		for (int c = 0; c < tensor.numBBoxes; c++)
@@ -142,19 +145,23 @@ public:
 			{
 				for (int w = 0; w < tensor.grid_w; w++)
 				{
-					float* row = detections + position * (m_Classes + 5);
+					const T* row = detections + position * (m_Classes + 5);
 					position++;
+					//class score is at most 1, a low objectness can not pass whatever the class
+					float objectness = Logist(ToFloat(row[4]));
+					if (objectness < 0.5)
+						continue;
 					BBoxInfo box;
-					auto max_pos = std::max_element(row + 5, row + m_Classes + 5);
-					box.prob = Logist(row[4]) * Logist(row[max_pos - row]);
+					auto max_pos = std::max_element(row + 5, row + m_Classes + 5, [](const T& a, const T& b) { return ToFloat(a) < ToFloat(b); });
+					box.prob = objectness * Logist(ToFloat(*max_pos));
 					if (box.prob < 0.5)
 						continue;
 					box.classId = max_pos - row - 5;
 					box.label = max_pos - row - 5;
-					int center_x = (Logist(row[0]) * 2 - 0.5 + w) * tensor.stride_w;
-					int center_y = (Logist(row[1]) * 2 - 0.5 + h) * tensor.stride_h;
-					int center_w = pow(Logist(row[2]) * 2.f, 2) * pw;
-					int center_h = pow(Logist(row[3]) * 2.f, 2) * ph;
+					int center_x = (Logist(ToFloat(row[0])) * 2 - 0.5 + w) * tensor.stride_w;
+					int center_y = (Logist(ToFloat(row[1])) * 2 - 0.5 + h) * tensor.stride_h;
+					int center_w = pow(Logist(ToFloat(row[2])) * 2.f, 2) * pw;
+					int center_h = pow(Logist(ToFloat(row[3])) * 2.f, 2) * ph;
 					box.box.x1 = double(center_x - center_w / 2) / m_InputW * imageW;
 					box.box.x2 = double(center_x + center_w / 2) / m_InputW * imageW;
 					box.box.y1 = double(center_y - center_h / 2) / m_InputH * imageH;
@@ -166,7 +173,7 @@ public:
 		return binfo;
 	}
 
-	std::vector<BBoxInfo> decodeDetections(const int& imageIdx,
+	std::vector<BBoxInfo> decodeDetections(InferContext& context, const int& imageIdx,
 		const int& imageH,
 		const int& imageW)
 	{
@@ -174,7 +181,7 @@ public:
 		std::vector<BBoxInfo> binfo;
 		for (int m_tensor_i = 0; m_tensor_i< m_OutputTensors.size(); m_tensor_i++)
 		{
-			std::vector<BBoxInfo> curBInfo = decodeTensor(imageIdx, imageH, imageW, m_tensor_i);
+			std::vector<BBoxInfo> curBInfo = decodeTensor(context, imageIdx, imageH, imageW, m_tensor_i);
 			binfo.insert(binfo.end(), curBInfo.begin(), curBInfo.end());
 		}
 		//	timer.out("decodeDetections");
@@ -325,36 +332,50 @@ public:
 
 	void UpdateOutputTensor()
 	{
-		m_InputW = onnx_net->mBindingDims[0].d[2];
-		m_InputH = onnx_net->mBindingDims[0].d[3];
-		m_Classes = onnx_net->mBindingDims[1].d[4] - 5;
-		for (int m_yolo_ind = 1; m_yolo_ind < onnx_net->mBindingName.size(); m_yolo_ind++)
+		int inputIndex = onnx_net->GetInputBindingIndex();
+		assert((inputIndex != -1) && "No input binding");
+		m_InputBlobName = onnx_net->GetBindingName(inputIndex);
+		m_InputC = onnx_net->GetBindingDims(inputIndex).d[1];
+		m_InputW = onnx_net->GetBindingDims(inputIndex).d[2];
+		m_InputH = onnx_net->GetBindingDims(inputIndex).d[3];
+		//yolo heads are the 5-D outputs, other outputs of the export are not decoded
+		for (int m_yolo_ind = 0; m_yolo_ind < onnx_net->GetNbBindings(); m_yolo_ind++)
 		{
-			TensorInfo outputTensor;
-			if (m_yolo_ind < 4)
+			TensorDims dims = onnx_net->GetBindingDims(m_yolo_ind);
+			if (onnx_net->BindingIsInput(m_yolo_ind) || dims.nbDims != 5)
 			{
-				outputTensor.anchors = vec_anchors;
-				outputTensor.masks = std::vector<uint32_t>{ uint32_t(3 * (m_yolo_ind - 1)),uint32_t(3 * (m_yolo_ind - 1) + 1),uint32_t(3 * (m_yolo_ind - 1) + 2) };
-				outputTensor.numBBoxes = onnx_net->mBindingDims[m_yolo_ind].d[1];
-				outputTensor.grid_w = onnx_net->mBindingDims[m_yolo_ind].d[2];
-				outputTensor.grid_h = onnx_net->mBindingDims[m_yolo_ind].d[3];
-				outputTensor.numClasses = onnx_net->mBindingDims[m_yolo_ind].d[4] - 5;
-				outputTensor.stride_h = m_InputH / outputTensor.grid_h;
-				outputTensor.stride_w = m_InputW / outputTensor.grid_w;
+				continue;
 			}
-			outputTensor.volume = onnx_net->mBindingSize[m_yolo_ind] / sizeof(float) / onnx_net->mBindingDims[m_yolo_ind].d[0];
-			outputTensor.blobName = onnx_net->mBindingName[m_yolo_ind];
+			TensorInfo outputTensor;
+			outputTensor.anchors = vec_anchors;
+			outputTensor.numBBoxes = dims.d[1];
+			outputTensor.grid_w = dims.d[2];
+			outputTensor.grid_h = dims.d[3];
+			outputTensor.numClasses = dims.d[4] - 5;
+			outputTensor.stride_h = m_InputH / outputTensor.grid_h;
+			outputTensor.stride_w = m_InputW / outputTensor.grid_w;
+			outputTensor.volume = onnx_net->GetBindingSize(m_yolo_ind) / sizeof(float) / dims.d[0];
+			outputTensor.blobName = onnx_net->GetBindingName(m_yolo_ind);
 			m_OutputTensors.push_back(outputTensor);
 		}
+		assert(!m_OutputTensors.empty() && "No yolo output binding");
+		//anchors go from the finest grid to the coarsest, whatever order the heads were exported in
+		std::sort(m_OutputTensors.begin(), m_OutputTensors.end(), [](const TensorInfo& a, const TensorInfo& b) {
+			return a.grid_h * a.grid_w > b.grid_h * b.grid_w;
+		});
+		for (uint32_t i = 0; i < m_OutputTensors.size(); i++)
+		{
+			m_OutputTensors[i].masks = std::vector<uint32_t>{ 3 * i, 3 * i + 1, 3 * i + 2 };
+		}
+		m_Classes = m_OutputTensors[0].numClasses;
 	}
 
 	void allocateBuffers()
 	{
 		for (auto& tensor : m_OutputTensors)
 		{
-			tensor.bindingIndex = onnx_net->mEngine->getBindingIndex(tensor.blobName.c_str());
+			tensor.bindingIndex = onnx_net->GetBindingIndex(tensor.blobName);
 			assert((tensor.bindingIndex != -1) && "Invalid output binding index");
-			tensor.hostBuffer.resize(tensor.volume * m_BatchSize * sizeof(float));
 		}
 	}
 
@@ -371,8 +392,18 @@ public:
 	void init(Config config)
 	{
 		_config = config;
-		onnx_net = std::make_shared<Trt>();
+		onnx_net = CreateInferBackend(config.backend);
+		if (config.device >= 0) {
+			onnx_net->SetDevice(config.device);
+		}
 		onnx_net->SetMaxBatchSize(config.maxBatchSize);
+		onnx_net->SetMaxContexts(config.contextPoolSize);
+		onnx_net->SetShareActivationMemory(config.shareActivationMemory);
+		onnx_net->SetEngineCacheDir(config.engineCacheDir);
+		onnx_net->SetBatchProfiles(config.batchProfiles);
+		onnx_net->SetHalfIO(config.halfIO);
+		onnx_net->SetMaxWorkspaceSize(config.maxWorkspaceSize);
+		onnx_net->SetEngineManifest(config.engineManifest, config.engineObjective, config.latencyBudgetMs);
 		if (config.mode == 2)
 		{
 			isInt8(config.calibration_image_list_file);
@@ -380,86 +411,85 @@ public:
 		bool m_dyn_flag = true;
 		if (m_dyn_flag)
 		{
-			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,512,512 }, { 3,800,800 });
+			//one profile per resolution bucket, frames run on the smallest one that fits
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,416,416 }, { 3,512,512 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,608,608 }, { 3,640,640 });
+			onnx_net->AddDynamicShapeProfile(1, "input", { 3,320,320 }, { 3,800,800 }, { 3,800,800 });
 		}
 		m_BatchSize = config.maxBatchSize;
-		onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode);
+		if (!onnx_net->CreateEngine(config.onnxModelpath, config.engineFile, config.customOutput, config.maxBatchSize, config.mode))
+		{
+			//fail before any binding is looked up, ModelLoader reports the model failed and the others keep loading
+			throw std::runtime_error("could not load or build the engine of " + config.onnxModelpath);
+		}
 		onnx_net->buildPreprocessorEngine();
 		//m_OutputTensors
 		UpdateOutputTensor();
 		allocateBuffers();
-		cudaStreamCreate(&mCudaStream);
+		m_ContextPool = std::make_shared<ContextPool>(onnx_net, config.contextPoolSize);
+		m_Worker = std::make_shared<AsyncWorker>(config.asyncWorkers);
+		WarmupDetector([this](const std::vector<cv::Mat>& batch) { return detectAsync_dyn(batch); }, *onnx_net, config, cv::Size(m_InputW, m_InputH));
+		if (config.layerProfiling)
+		{
+			m_ContextPool->EnableLayerProfiling();
+		}
+		m_Ready = true;
 	}
 
-	void doInference_dyn(std::vector<float> input, const uint32_t batchSize)
+	void doInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
+	{
+		if (enqueueInference_dyn(context, batchSize, imageSize))
+		{
+			context.Synchronize();
+		}
+	}
+
+	// resize, inference and output copy are queued on the context stream, outputs are ready after context.Synchronize()
+	bool enqueueInference_dyn(InferContext& context, const uint32_t batchSize, const cv::Size& imageSize)
 	{
 		//	Timer timer;
 		//assert(batchSize <= m_BatchSize && "Image batch size exceeds TRT engines batch size");
-		//onnx_net->CopyFromHostToDevice(input, 0, mCudaStream);
+		//context.CopyFromHostToDevice(0);
 
-		nvinfer1::Dims inputdim = onnx_net->mEngine->getBindingDimensions(0); // C*H*W
-		void* hostBuffer;
-		cudaMalloc(&hostBuffer, input.size() * sizeof(float));
-		CUDA_CHECK(cudaMemcpy(hostBuffer, input.data(), input.size() * sizeof(float), cudaMemcpyHostToDevice));
+		if (!context.SetBatchSize(batchSize))
+		{
+			return false;
+		}
 
 		// Set the input size for the preprocessor
-		nvinfer1::Dims inputDims_1;
+		TensorDims inputDims_1;
 		inputDims_1.nbDims = 4;
 		inputDims_1.d[0] = batchSize;
 		inputDims_1.d[1] = m_InputC;
-		inputDims_1.d[2] = m_Ori_InputH;
-		inputDims_1.d[3] = m_Ori_InputW;
-		//CHECK_RETURN_W_MSG(onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims), false, "Invalid binding dimensions.");
-		onnx_net->mPreprocessorContext->setBindingDimensions(0, inputDims_1);
-		// We can only run inference once all dynamic input shapes have been specified.
-		if (!onnx_net->mPreprocessorContext->allInputDimensionsSpecified())
+		inputDims_1.d[2] = imageSize.height;
+		inputDims_1.d[3] = imageSize.width;
+		if (!context.ForwardPreprocessor(inputDims_1))
 		{
-			return;
+			return false;
 		}
 
-		std::vector<void*> preprocessorBindings = { hostBuffer, onnx_net->GetBindingPtr(0) };
-		bool status = onnx_net->mPreprocessorContext->executeV2(preprocessorBindings.data());
-		if (!status)
-		{
-			return;
-		}
+		context.ForwardAsync();
+		context.CopyOutputsFromDeviceToHost();
+		return true;
+	}
 
-		onnx_net->ForwardAsync(mCudaStream);
-		for (auto& tensor : m_OutputTensors)
-		{
-			onnx_net->CopyFromDeviceToHost(tensor.hostBuffer, tensor.bindingIndex, mCudaStream);
-		}
-		cudaStreamSynchronize(mCudaStream);
+	//frames of a batch share one size, written in place into the pinned preprocessor staging of the context
+	void prepareInput_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image)
+	{
+		size_t imageSize = vec_image[0].total() * 3;
+		float* data = context.GetPreprocessorInput(imageSize * vec_image.size());
+		//the preprocessor engine resizes on the gpu, /255 and BGRBGRBGR->BBBGGGRRR in one pass here
+		PreprocessBatch(vec_image, PreprocessParams::Scaled(vec_image[0].size(), 1 / 255.0), data, _config.preprocessThreads);
 	}
 
-	void detect_dyn(const std::vector<cv::Mat>& vec_image,
-		std::vector<BatchResult>& vec_batch_result)
+	void decodeOutputs_dyn(InferContext& context, const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
 	{
-		m_Ori_InputW = vec_image[0].cols;
-		m_Ori_InputH = vec_image[0].rows;
-		m_InputC = vec_image[0].channels();
 		vec_batch_result.clear();
 		vec_batch_result.resize(vec_image.size());
-		std::vector<float>data;
-		for (const auto& img : vec_image)
-		{
-			cv::Mat imgf;
-			img.convertTo(imgf, CV_32FC3, 1 / 255.0);
-			std::vector<cv::Mat>channles(3);
-			cv::split(imgf, channles);
-			float* ptr1 = (float*)(channles[0].data);
-			float* ptr2 = (float*)(channles[1].data);
-			float* ptr3 = (float*)(channles[2].data);
-			data.insert(data.end(), ptr1, ptr1 + img.rows * img.cols);
-			data.insert(data.end(), ptr2, ptr2 + img.rows * img.cols);
-			data.insert(data.end(), ptr3, ptr3 + img.rows * img.cols);
-		}
-
-		doInference_dyn(data, vec_image.size());
 		for (uint32_t i = 0; i < vec_image.size(); ++i)
 		{
 			auto curImage = vec_image.at(i);
-			auto binfo = decodeDetections(i, curImage.rows, curImage.cols);
+			auto binfo = decodeDetections(context, i, curImage.rows, curImage.cols);
 			auto remaining = nmsAllClasses(getNMSThresh(),
 				binfo,
 				m_Classes,
@@ -484,6 +514,45 @@ public:
 			vec_batch_result[i] = vec_result;
 		}
 	}
+
+	//true once init() has created the engine and run the warmup, for health checks to poll
+	bool isReady() const
+	{
+		return m_Ready;
+	}
+
+	//per layer times of every context since init, empty unless config.layerProfiling
+	LayerProfile layerProfile() const
+	{
+		return m_ContextPool->GetLayerProfile();
+	}
+
+	void detect_dyn(const std::vector<cv::Mat>& vec_image, std::vector<BatchResult>& vec_batch_result)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		doInference_dyn(*context, vec_image.size(), vec_image[0].size());
+		decodeOutputs_dyn(*context, vec_image, vec_batch_result);
+	}
+
+	// non-blocking detect_dyn, decode and nms run on m_Worker, the result is handed out through the future and callback
+	std::future<std::vector<BatchResult>> detectAsync_dyn(const std::vector<cv::Mat>& vec_image,
+		std::function<void(const std::vector<BatchResult>&)> callback = nullptr)
+	{
+		ContextPool::Lease context = m_ContextPool->Acquire();
+		prepareInput_dyn(*context, vec_image);
+		if (!enqueueInference_dyn(*context, vec_image.size(), vec_image[0].size()))
+		{
+			//outputs still hold the last batch, fail the future instead of decoding them
+			return AsyncWorker::Failed<std::vector<BatchResult>>(std::move(context), "could not enqueue the inference");
+		}
+		return m_Worker->Decode<std::vector<BatchResult>>(std::move(context), [this, vec_image](InferContext& context)
+		{
+			std::vector<BatchResult> vec_batch_result;
+			decodeOutputs_dyn(context, vec_image, vec_batch_result);
+			return vec_batch_result;
+		}, callback);
+	}
 };
 
 int main()
@@ -495,6 +564,7 @@ int main()
 	//m_config.calibration_image_list_file = "D:\\onnx_tensorrt\\onnx_tensorrt_centernet\\onnx_tensorrt_project\\model\\darknet_onnx_tensorrt_yolo\\image\\";
 	m_config.maxBatchSize = 1;
 	m_config.mode = 0;
+	m_config.warmupIterations = 2;
 	m_Yolov5DynDectector.init(m_config);
 	std::vector<BatchResult> batch_res;
 	std::vector<cv::Mat> batch_img;